@@ -0,0 +1,244 @@
+/*
+ * nf_conntrack_bench: measure the TCP connection setup rate through
+ * connection tracking over a local veth pair.
+ *
+ * A child process moves into a new network namespace and runs a
+ * listener on one end of a veth pair. The parent keeps the other end
+ * and starts one client per CPU, each pinned to its CPU, which connect
+ * and reset connections to the listener as fast as they can. Every
+ * connection creates and destroys a conntrack entry on each side.
+ *
+ * The veth pair is set up with ip(8) and nf_conntrack_ipv4 is loaded
+ * with modprobe(8), so this must run as root.
+ *
+ * Usage: nf_conntrack_bench [-c clients] [-t seconds]
+ *
+ * Prints the connections per second of each client, by the CPU it ran
+ * on, and the total.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifndef CLONE_NEWNET
+#define CLONE_NEWNET	0x40000000
+#endif
+
+#define BENCH_PORT	5001
+#define LOCAL_ADDR	"10.199.0.1"
+#define PEER_ADDR	"10.199.0.2"
+#define LOCAL_DEV	"ctbench0"
+#define PEER_DEV	"ctbench1"
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void run(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+
+static void run(const char *fmt, ...)
+{
+	char cmd[256];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(cmd, sizeof(cmd), fmt, ap);
+	va_end(ap);
+	if (system(cmd) != 0) {
+		fprintf(stderr, "command failed: %s\n", cmd);
+		exit(1);
+	}
+}
+
+static void pin_to_cpu(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		die("sched_setaffinity");
+}
+
+/* Accept and drop connections until killed, one acceptor per CPU */
+static void serve(int nr_cpus)
+{
+	struct sockaddr_in sin;
+	int fd, one = 1, i;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		die("socket");
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(BENCH_PORT);
+	sin.sin_addr.s_addr = inet_addr(PEER_ADDR);
+	if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)))
+		die("bind");
+	if (listen(fd, 4096))
+		die("listen");
+
+	for (i = 1; i < nr_cpus; i++)
+		if (fork() == 0)
+			break;
+	pin_to_cpu(i % nr_cpus);
+
+	for (;;) {
+		int c = accept(fd, NULL, NULL);
+
+		if (c >= 0)
+			close(c);
+	}
+}
+
+/* Open and reset connections for @secs seconds, return how many */
+static unsigned long client(int cpu, int secs)
+{
+	struct linger lg = { .l_onoff = 1, .l_linger = 0 };
+	struct sockaddr_in sin;
+	struct timeval end, now;
+	unsigned long nr = 0;
+
+	pin_to_cpu(cpu);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(BENCH_PORT);
+	sin.sin_addr.s_addr = inet_addr(PEER_ADDR);
+
+	gettimeofday(&end, NULL);
+	end.tv_sec += secs;
+	do {
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+		if (fd < 0)
+			die("socket");
+		/* Reset instead of FIN: no TIME_WAIT, no port exhaustion */
+		setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+		if (connect(fd, (struct sockaddr *)&sin, sizeof(sin)) == 0)
+			nr++;
+		else if (errno != ECONNREFUSED && errno != EADDRNOTAVAIL)
+			die("connect");
+		close(fd);
+		gettimeofday(&now, NULL);
+	} while (timercmp(&now, &end, <));
+
+	return nr;
+}
+
+int main(int argc, char **argv)
+{
+	int nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int clients = nr_cpus, secs = 10;
+	int go[2], ready[2], results[2];
+	unsigned long total = 0;
+	pid_t server;
+	char c;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "c:t:")) != -1) {
+		switch (opt) {
+		case 'c':
+			clients = atoi(optarg);
+			break;
+		case 't':
+			secs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-c clients] [-t seconds]\n",
+				argv[0]);
+			return 2;
+		}
+	}
+	if (clients <= 0 || secs <= 0)
+		return 2;
+
+	/* Conntrack may be built in, or loaded already */
+	if (system("modprobe nf_conntrack_ipv4 2>/dev/null"))
+		fprintf(stderr, "modprobe nf_conntrack_ipv4 failed\n");
+	if (pipe(go) || pipe(ready) || pipe(results))
+		die("pipe");
+
+	server = fork();
+	if (server < 0)
+		die("fork");
+	if (server == 0) {
+		/* Own process group, so that all acceptors go at the end */
+		setpgid(0, 0);
+		if (unshare(CLONE_NEWNET))
+			die("unshare");
+		if (write(ready[1], "n", 1) != 1 || read(go[0], &c, 1) != 1)
+			die("sync");
+		run("ip link set lo up");
+		run("ip addr add " PEER_ADDR "/24 dev " PEER_DEV);
+		run("ip link set " PEER_DEV " up");
+		if (write(ready[1], "s", 1) != 1)
+			die("sync");
+		serve(nr_cpus);
+	}
+
+	setpgid(server, server);
+
+	/* The child has its own namespace once it says so */
+	if (read(ready[0], &c, 1) != 1)
+		die("sync");
+	run("ip link add " LOCAL_DEV " type veth peer name " PEER_DEV);
+	run("ip link set " PEER_DEV " netns %d", (int)server);
+	run("ip addr add " LOCAL_ADDR "/24 dev " LOCAL_DEV);
+	run("ip link set " LOCAL_DEV " up");
+	if (write(go[1], "g", 1) != 1 || read(ready[0], &c, 1) != 1)
+		die("sync");
+	/* Let the link come up */
+	sleep(1);
+
+	for (i = 0; i < clients; i++) {
+		if (fork() == 0) {
+			unsigned long res[2];
+
+			res[0] = i % nr_cpus;
+			res[1] = client(res[0], secs);
+			if (write(results[1], res, sizeof(res)) != sizeof(res))
+				die("write");
+			exit(0);
+		}
+	}
+	for (i = 0; i < clients; i++) {
+		unsigned long res[2];
+
+		if (read(results[0], res, sizeof(res)) != sizeof(res))
+			die("read");
+		total += res[1];
+		printf("cpu %lu: %lu conn/s\n", res[0], res[1] / secs);
+	}
+	for (i = 0; i < clients; i++)
+		wait(NULL);
+
+	printf("%d clients, %d cpus: %lu conn/s\n",
+	       clients, nr_cpus, total / secs);
+
+	kill(-server, SIGKILL);
+	waitpid(server, NULL, 0);
+	run("ip link del " LOCAL_DEV);
+	return 0;
+}
@@ -33,6 +33,10 @@ uasm_i##op(u32 **buf, unsigned int a, unsigned int b, unsigned int c)
 void __uasminit								\
 uasm_i##op(u32 **buf, unsigned int a, unsigned int b, unsigned int c)
 
+#define Ip_u3u2u1(op)							\
+void __uasminit								\
+uasm_i##op(u32 **buf, unsigned int a, unsigned int b, unsigned int c)
+
 #define Ip_u1u2s3(op)							\
 void __uasminit								\
 uasm_i##op(u32 **buf, unsigned int a, unsigned int b, signed int c)
@@ -123,6 +127,16 @@ Ip_u3u1u2(_ldx);
 Ip_u1(_syscall);
 Ip_u1(_zcb);
 Ip_u1(_zcbt);
+Ip_u2s3u1(_lbu);
+Ip_u2s3u1(_lhu);
+Ip_u3u2u1(_sllv);
+Ip_u3u2u1(_srlv);
+Ip_u1u2(_multu);
+Ip_u1u2(_divu);
+Ip_u1(_mflo);
+Ip_u3u1u2(_sltu);
+Ip_u2u1s3(_sltiu);
+Ip_u1(_jalr);
 
 /* Handle labels. */
 struct uasm_label {
@@ -68,7 +68,9 @@ enum opcode {
 	insn_sd, insn_sll, insn_sra, insn_srl, insn_rotr, insn_subu, insn_sw,
 	insn_tlbp, insn_tlbr, insn_tlbwi, insn_tlbwr, insn_xor, insn_xori,
 	insn_dins, insn_dinsm, insn_bbit0, insn_bbit1, insn_lwx, insn_ldx,
-	insn_syscall, insn_zcb, insn_zcbt
+	insn_syscall, insn_zcb, insn_zcbt, insn_lbu, insn_lhu, insn_sllv,
+	insn_srlv, insn_multu, insn_divu, insn_mflo, insn_sltu, insn_sltiu,
+	insn_jalr
 };
 
 struct insn {
@@ -150,6 +152,16 @@ static struct insn insn_table[] __uasminitdata = {
 	{ insn_syscall, M(spec_op, 0, 0, 0, 0, syscall_op), SCIMM},
 	{ insn_zcb,  M(spec2_op, 0, 0, 0, zcb_op, cvm_op),  RS },
 	{ insn_zcbt,  M(spec2_op, 0, 0, 0, zcbt_op, cvm_op),  RS },
+	{ insn_lbu,  M(lbu_op, 0, 0, 0, 0, 0),  RS | RT | SIMM },
+	{ insn_lhu,  M(lhu_op, 0, 0, 0, 0, 0),  RS | RT | SIMM },
+	{ insn_sllv,  M(spec_op, 0, 0, 0, 0, sllv_op),  RS | RT | RD },
+	{ insn_srlv,  M(spec_op, 0, 0, 0, 0, srlv_op),  RS | RT | RD },
+	{ insn_multu,  M(spec_op, 0, 0, 0, 0, multu_op),  RS | RT },
+	{ insn_divu,  M(spec_op, 0, 0, 0, 0, divu_op),  RS | RT },
+	{ insn_mflo,  M(spec_op, 0, 0, 0, 0, mflo_op),  RD },
+	{ insn_sltu,  M(spec_op, 0, 0, 0, 0, sltu_op),  RS | RT | RD },
+	{ insn_sltiu,  M(sltiu_op, 0, 0, 0, 0, 0),  RS | RT | SIMM },
+	{ insn_jalr,  M(spec_op, 0, 0, 31, 0, jalr_op),  RS },
 	{ insn_invalid, 0, 0 }
 };
 
@@ -345,6 +357,13 @@ Ip_u2s3u1(op)						\
 }							\
 UASM_EXPORT_SYMBOL(uasm_i##op);
 
+#define I_u3u2u1(op)					\
+Ip_u3u2u1(op)						\
+{							\
+	build_insn(buf, insn##op, c, b, a);		\
+}							\
+UASM_EXPORT_SYMBOL(uasm_i##op);
+
 #define I_u2u1s3(op)					\
 Ip_u2u1s3(op)						\
 {							\
@@ -457,6 +476,16 @@ I_u3u1u2(_ldx)
 I_u1(_syscall);
 I_u1(_zcb);
 I_u1(_zcbt);
+I_u2s3u1(_lbu)
+I_u2s3u1(_lhu)
+I_u3u2u1(_sllv)
+I_u3u2u1(_srlv)
+I_u1u2(_multu)
+I_u1u2(_divu)
+I_u1(_mflo)
+I_u3u1u2(_sltu)
+I_u2u1s3(_sltiu)
+I_u1(_jalr)
 
 
 void __uasminit uasm_i_pref(u32 **buf, unsigned int a, signed int b, unsigned int c)
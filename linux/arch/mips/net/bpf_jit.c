@@ -0,0 +1,678 @@
+/*
+ * BPF JIT compiler for 64-bit MIPS, built on the micro-assembler.
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License.  See the file "COPYING" in the main directory of this archive
+ * for more details.
+ */
+
+#include <linux/kernel.h>
+#include <linux/moduleloader.h>
+#include <linux/netdevice.h>
+#include <linux/filter.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+
+#include <asm/bugs.h>
+#include <asm/cacheflush.h>
+#include <asm/unaligned.h>
+#include <asm/uasm.h>
+
+/*
+ * Register usage (n64 numbering):
+ *  s0 : BPF A accumulator
+ *  s1 : BPF X accumulator
+ *  s2 : skb
+ *  s3 : skb->data
+ *  s4 : skb->len - skb->data_len (headlen)
+ *  t0..t3, a0..a3 : scratch
+ *
+ * A and X are kept sign-extended, as the 32-bit instructions leave them,
+ * so the 64-bit compares order them like their 32-bit values.
+ *
+ * Stack frame:
+ *  120(sp) ra, 112..80(sp) s0..s4,
+ *  16(sp)..76(sp) BPF_MEMWORDS scratch memory,
+ *  0(sp) result slot of the slow path loads, which A and X are passed in
+ *  for the indirect ones.
+ */
+#define r_zero	0
+#define r_v0	2
+#define r_a0	4
+#define r_a1	5
+#define r_a2	6
+#define r_a3	7
+#define r_t0	12
+#define r_t1	13
+#define r_t2	14
+#define r_t3	15
+#define r_A	16
+#define r_X	17
+#define r_skb	18
+#define r_D	19
+#define r_HL	20
+#define r_t9	25
+#define r_sp	29
+#define r_ra	31
+
+#define FRAME_SIZE	128
+#define MEM_OFF(k)	(16 + 4 * (k))
+#define SLOT_OFF	0
+
+/* No BPF instruction is translated to more than this many words */
+#define JIT_INSN_MAX	48
+
+#define SEEN_DATAREF	1	/* loads from the packet */
+#define SEEN_X		2	/* X is read before it is written */
+
+struct jit_ctx {
+	const struct sk_filter *skf;
+	unsigned int *offsets;	/* word offset of each BPF instruction */
+	u32 *image;		/* NULL while sizing */
+	u32 *p;			/* emit pointer */
+	unsigned int ret0;	/* word offset of the "return 0" exit */
+	unsigned int exit;	/* word offset of the common exit */
+	u8 seen;
+};
+
+/* Slow path of the packet loads, called from the generated code */
+static int jit_load_slow(const struct sk_buff *skb, int k, unsigned int size,
+			 u32 *val)
+{
+	u8 buf[4];
+	const u8 *ptr;
+
+	if (k >= 0) {
+		if (skb_copy_bits(skb, k, buf, size))
+			return -EFAULT;
+		ptr = buf;
+	} else {
+		ptr = bpf_internal_load_pointer_neg_helper(skb, k, size);
+		if (!ptr)
+			return -EFAULT;
+	}
+
+	switch (size) {
+	case 4:
+		*val = get_unaligned_be32(ptr);
+		break;
+	case 2:
+		*val = get_unaligned_be16(ptr);
+		break;
+	default:
+		*val = *ptr;
+	}
+	return 0;
+}
+
+/*
+ * Slow path of the indirect loads: an X + K in the SKF_AD_OFF area reads
+ * ancillary data, as in the interpreter. val[0] and val[1] hold A and X
+ * on entry.
+ */
+static int jit_load_ind_slow(const struct sk_buff *skb, int k,
+			     unsigned int size, u32 *val)
+{
+	if (k >= SKF_AD_OFF && k < 0)
+		return bpf_internal_load_ancillary_helper(skb, k, val[0],
+							  val[1], val);
+	return jit_load_slow(skb, k, size, val);
+}
+
+/* Branch offset from the instruction about to be emitted to word @target */
+static int b_off(struct jit_ctx *ctx, unsigned int target)
+{
+	if (!ctx->image)
+		return 0;
+	return (int)(target - (ctx->p - ctx->image) - 1) * 4;
+}
+
+/* Resolve a branch emitted with a zero offset to the current position */
+static void b_here(struct jit_ctx *ctx, u32 *br)
+{
+	*br |= (ctx->p - br - 1) & 0xffff;
+}
+
+static void emit_load_imm(struct jit_ctx *ctx, unsigned int reg, u32 k)
+{
+	if (k <= 0xffff) {
+		uasm_i_ori(&ctx->p, reg, r_zero, k);
+	} else if ((s32)k < 0 && (s32)k >= -0x8000) {
+		uasm_i_addiu(&ctx->p, reg, r_zero, (s32)k);
+	} else {
+		uasm_i_lui(&ctx->p, reg, (s16)(k >> 16));
+		if (k & 0xffff)
+			uasm_i_ori(&ctx->p, reg, reg, k & 0xffff);
+	}
+}
+
+static void emit_b(struct jit_ctx *ctx, unsigned int target)
+{
+	uasm_i_b(&ctx->p, b_off(ctx, target));
+	uasm_i_nop(&ctx->p);
+}
+
+/* Assemble @size big endian bytes at @off(@base) into @dst */
+static void emit_load_bytes(struct jit_ctx *ctx, unsigned int dst,
+			    unsigned int base, int off, unsigned int size)
+{
+	switch (size) {
+	case 1:
+		uasm_i_lbu(&ctx->p, dst, off, base);
+		break;
+	case 2:
+		uasm_i_lbu(&ctx->p, r_t2, off, base);
+		uasm_i_lbu(&ctx->p, r_t3, off + 1, base);
+		uasm_i_sll(&ctx->p, r_t2, r_t2, 8);
+		uasm_i_or(&ctx->p, dst, r_t2, r_t3);
+		break;
+	case 4:
+		uasm_i_lbu(&ctx->p, r_t2, off, base);
+		uasm_i_lbu(&ctx->p, r_t3, off + 1, base);
+		uasm_i_lbu(&ctx->p, r_a0, off + 2, base);
+		uasm_i_lbu(&ctx->p, r_a1, off + 3, base);
+		uasm_i_sll(&ctx->p, r_t2, r_t2, 24);
+		uasm_i_sll(&ctx->p, r_t3, r_t3, 16);
+		uasm_i_sll(&ctx->p, r_a0, r_a0, 8);
+		uasm_i_or(&ctx->p, r_t2, r_t2, r_t3);
+		uasm_i_or(&ctx->p, r_a0, r_a0, r_a1);
+		uasm_i_or(&ctx->p, dst, r_t2, r_a0);
+		break;
+	}
+}
+
+/* Out of line load of the offset held in a1; returns 0 on error */
+static void emit_load_slow(struct jit_ctx *ctx, unsigned int dst,
+			   unsigned int size, bool ind)
+{
+	if (ind) {
+		uasm_i_sw(&ctx->p, r_A, SLOT_OFF, r_sp);
+		uasm_i_sw(&ctx->p, r_X, SLOT_OFF + 4, r_sp);
+	}
+	uasm_i_move(&ctx->p, r_a0, r_skb);
+	uasm_i_ori(&ctx->p, r_a2, r_zero, size);
+	uasm_i_move(&ctx->p, r_a3, r_sp);
+	UASM_i_LA(&ctx->p, r_t9,
+		  (long)(ind ? jit_load_ind_slow : jit_load_slow));
+	uasm_i_jalr(&ctx->p, r_t9);
+	uasm_i_nop(&ctx->p);
+	uasm_i_bnez(&ctx->p, r_v0, b_off(ctx, ctx->ret0));
+	uasm_i_lw(&ctx->p, dst, SLOT_OFF, r_sp);
+}
+
+/*
+ * Load @size bytes at offset K (ABS) or X + K (IND) into @dst, with an
+ * inline fast path for data in the linear part of the skb.
+ */
+static void emit_load(struct jit_ctx *ctx, unsigned int dst, u32 k,
+		      unsigned int size, bool ind)
+{
+	u32 *to_slow1 = NULL, *to_slow2, *to_done;
+
+	ctx->seen |= SEEN_DATAREF;
+
+	if (ind) {
+		ctx->seen |= SEEN_X;
+		if ((s32)k >= -0x8000 && (s32)k <= 0x7fff) {
+			uasm_i_addiu(&ctx->p, r_a1, r_X, (s32)k);
+		} else {
+			emit_load_imm(ctx, r_t0, k);
+			uasm_i_addu(&ctx->p, r_a1, r_X, r_t0);
+		}
+		/* negative offsets are left to the C helper */
+		to_slow1 = ctx->p;
+		uasm_i_bltz(&ctx->p, r_a1, 0);
+		uasm_i_subu(&ctx->p, r_t0, r_HL, r_a1);
+		uasm_i_addiu(&ctx->p, r_t0, r_t0, -(int)size);
+		to_slow2 = ctx->p;
+		uasm_i_bltz(&ctx->p, r_t0, 0);
+		uasm_i_daddu(&ctx->p, r_t1, r_D, r_a1);
+		emit_load_bytes(ctx, dst, r_t1, 0, size);
+	} else {
+		emit_load_imm(ctx, r_a1, k);
+		if ((s32)k < 0 || k > 0x7fff - 4) {
+			/* out of reach of the fast path */
+			emit_load_slow(ctx, dst, size, false);
+			return;
+		}
+		uasm_i_addiu(&ctx->p, r_t0, r_HL, -(int)(k + size));
+		to_slow2 = ctx->p;
+		uasm_i_bltz(&ctx->p, r_t0, 0);
+		uasm_i_nop(&ctx->p);
+		emit_load_bytes(ctx, dst, r_D, k, size);
+	}
+	to_done = ctx->p;
+	uasm_i_b(&ctx->p, 0);
+	uasm_i_nop(&ctx->p);
+
+	if (to_slow1)
+		b_here(ctx, to_slow1);
+	b_here(ctx, to_slow2);
+	emit_load_slow(ctx, dst, size, ind);
+	b_here(ctx, to_done);
+}
+
+static void emit_ret(struct jit_ctx *ctx, unsigned int reg, bool last)
+{
+	if (last) {
+		uasm_i_move(&ctx->p, r_v0, reg);
+		return;
+	}
+	uasm_i_b(&ctx->p, b_off(ctx, ctx->exit));
+	uasm_i_move(&ctx->p, r_v0, reg);
+}
+
+static void emit_prologue(struct jit_ctx *ctx)
+{
+	uasm_i_daddiu(&ctx->p, r_sp, r_sp, -FRAME_SIZE);
+	uasm_i_sd(&ctx->p, r_ra, 120, r_sp);
+	uasm_i_sd(&ctx->p, r_A, 112, r_sp);
+	uasm_i_sd(&ctx->p, r_X, 104, r_sp);
+	uasm_i_sd(&ctx->p, r_skb, 96, r_sp);
+	uasm_i_sd(&ctx->p, r_D, 88, r_sp);
+	uasm_i_sd(&ctx->p, r_HL, 80, r_sp);
+
+	uasm_i_move(&ctx->p, r_skb, r_a0);
+	if (ctx->seen & SEEN_DATAREF) {
+		uasm_i_ld(&ctx->p, r_D, offsetof(struct sk_buff, data), r_a0);
+		uasm_i_lw(&ctx->p, r_t0, offsetof(struct sk_buff, len), r_a0);
+		uasm_i_lw(&ctx->p, r_t1, offsetof(struct sk_buff, data_len),
+			  r_a0);
+		uasm_i_subu(&ctx->p, r_HL, r_t0, r_t1);
+	}
+	/* make sure we dont leak kernel information to user */
+	uasm_i_move(&ctx->p, r_A, r_zero);
+	if (ctx->seen & SEEN_X)
+		uasm_i_move(&ctx->p, r_X, r_zero);
+}
+
+static void emit_epilogue(struct jit_ctx *ctx)
+{
+	uasm_i_ld(&ctx->p, r_HL, 80, r_sp);
+	uasm_i_ld(&ctx->p, r_D, 88, r_sp);
+	uasm_i_ld(&ctx->p, r_skb, 96, r_sp);
+	uasm_i_ld(&ctx->p, r_X, 104, r_sp);
+	uasm_i_ld(&ctx->p, r_A, 112, r_sp);
+	uasm_i_ld(&ctx->p, r_ra, 120, r_sp);
+	uasm_i_jr(&ctx->p, r_ra);
+	uasm_i_daddiu(&ctx->p, r_sp, r_sp, FRAME_SIZE);
+}
+
+/*
+ * Conditional jump: the condition holds when @reg compares to zero as
+ * @true_if_nez says.
+ */
+static void emit_cond(struct jit_ctx *ctx, int i, unsigned int reg,
+		      bool true_if_nez)
+{
+	const struct sock_filter *f = &ctx->skf->insns[i];
+	unsigned int t = ctx->offsets[i + 1 + f->jt];
+	unsigned int e = ctx->offsets[i + 1 + f->jf];
+
+	if (f->jt) {
+		if (true_if_nez)
+			uasm_i_bnez(&ctx->p, reg, b_off(ctx, t));
+		else
+			uasm_i_beqz(&ctx->p, reg, b_off(ctx, t));
+		uasm_i_nop(&ctx->p);
+		if (f->jf)
+			emit_b(ctx, e);
+	} else {
+		if (true_if_nez)
+			uasm_i_beqz(&ctx->p, reg, b_off(ctx, e));
+		else
+			uasm_i_bnez(&ctx->p, reg, b_off(ctx, e));
+		uasm_i_nop(&ctx->p);
+	}
+}
+
+/* Returns -1 if the instruction is not supported */
+static int build_insn(struct jit_ctx *ctx, int i)
+{
+	const struct sock_filter *f = &ctx->skf->insns[i];
+	bool last = i == ctx->skf->len - 1;
+	u32 k = f->k;
+	unsigned int r;
+
+	switch (f->code) {
+	case BPF_ALU|BPF_ADD|BPF_X:
+		ctx->seen |= SEEN_X;
+		uasm_i_addu(&ctx->p, r_A, r_A, r_X);
+		break;
+	case BPF_ALU|BPF_ADD|BPF_K:
+		if ((s32)k >= -0x8000 && (s32)k <= 0x7fff) {
+			uasm_i_addiu(&ctx->p, r_A, r_A, (s32)k);
+		} else {
+			emit_load_imm(ctx, r_t0, k);
+			uasm_i_addu(&ctx->p, r_A, r_A, r_t0);
+		}
+		break;
+	case BPF_ALU|BPF_SUB|BPF_X:
+		ctx->seen |= SEEN_X;
+		uasm_i_subu(&ctx->p, r_A, r_A, r_X);
+		break;
+	case BPF_ALU|BPF_SUB|BPF_K:
+		if ((s32)k > -0x8000 && (s32)k <= 0x8000) {
+			uasm_i_addiu(&ctx->p, r_A, r_A, -(s32)k);
+		} else {
+			emit_load_imm(ctx, r_t0, k);
+			uasm_i_subu(&ctx->p, r_A, r_A, r_t0);
+		}
+		break;
+	case BPF_ALU|BPF_MUL|BPF_X:
+		ctx->seen |= SEEN_X;
+		uasm_i_multu(&ctx->p, r_A, r_X);
+		uasm_i_mflo(&ctx->p, r_A);
+		break;
+	case BPF_ALU|BPF_MUL|BPF_K:
+		emit_load_imm(ctx, r_t0, k);
+		uasm_i_multu(&ctx->p, r_A, r_t0);
+		uasm_i_mflo(&ctx->p, r_A);
+		break;
+	case BPF_ALU|BPF_DIV|BPF_X:
+		ctx->seen |= SEEN_X;
+		uasm_i_beqz(&ctx->p, r_X, b_off(ctx, ctx->ret0));
+		uasm_i_nop(&ctx->p);
+		uasm_i_divu(&ctx->p, r_A, r_X);
+		uasm_i_mflo(&ctx->p, r_A);
+		break;
+	case BPF_ALU|BPF_DIV|BPF_K:
+		emit_load_imm(ctx, r_t0, k);
+		uasm_i_divu(&ctx->p, r_A, r_t0);
+		uasm_i_mflo(&ctx->p, r_A);
+		break;
+	case BPF_ALU|BPF_AND|BPF_X:
+		ctx->seen |= SEEN_X;
+		uasm_i_and(&ctx->p, r_A, r_A, r_X);
+		break;
+	case BPF_ALU|BPF_AND|BPF_K:
+		if (k <= 0xffff) {
+			uasm_i_andi(&ctx->p, r_A, r_A, k);
+		} else {
+			emit_load_imm(ctx, r_t0, k);
+			uasm_i_and(&ctx->p, r_A, r_A, r_t0);
+		}
+		break;
+	case BPF_ALU|BPF_OR|BPF_X:
+		ctx->seen |= SEEN_X;
+		uasm_i_or(&ctx->p, r_A, r_A, r_X);
+		break;
+	case BPF_ALU|BPF_OR|BPF_K:
+		if (k <= 0xffff) {
+			uasm_i_ori(&ctx->p, r_A, r_A, k);
+		} else {
+			emit_load_imm(ctx, r_t0, k);
+			uasm_i_or(&ctx->p, r_A, r_A, r_t0);
+		}
+		break;
+	case BPF_ALU|BPF_LSH|BPF_X:
+		ctx->seen |= SEEN_X;
+		uasm_i_sllv(&ctx->p, r_A, r_A, r_X);
+		break;
+	case BPF_ALU|BPF_LSH|BPF_K:
+		uasm_i_sll(&ctx->p, r_A, r_A, k & 31);
+		break;
+	case BPF_ALU|BPF_RSH|BPF_X:
+		ctx->seen |= SEEN_X;
+		uasm_i_srlv(&ctx->p, r_A, r_A, r_X);
+		break;
+	case BPF_ALU|BPF_RSH|BPF_K:
+		uasm_i_srl(&ctx->p, r_A, r_A, k & 31);
+		break;
+	case BPF_ALU|BPF_NEG:
+		uasm_i_subu(&ctx->p, r_A, r_zero, r_A);
+		break;
+	case BPF_JMP|BPF_JA:
+		emit_b(ctx, ctx->offsets[i + 1 + k]);
+		break;
+	case BPF_JMP|BPF_JEQ|BPF_K:
+	case BPF_JMP|BPF_JEQ|BPF_X:
+		if (f->jt == f->jf) {
+			emit_b(ctx, ctx->offsets[i + 1 + f->jt]);
+			break;
+		}
+		if (BPF_SRC(f->code) == BPF_X) {
+			ctx->seen |= SEEN_X;
+			uasm_i_xor(&ctx->p, r_t1, r_A, r_X);
+		} else if (k <= 0xffff) {
+			uasm_i_xori(&ctx->p, r_t1, r_A, k);
+		} else {
+			emit_load_imm(ctx, r_t0, k);
+			uasm_i_xor(&ctx->p, r_t1, r_A, r_t0);
+		}
+		emit_cond(ctx, i, r_t1, false);
+		break;
+	case BPF_JMP|BPF_JGT|BPF_K:
+	case BPF_JMP|BPF_JGT|BPF_X:
+		if (f->jt == f->jf) {
+			emit_b(ctx, ctx->offsets[i + 1 + f->jt]);
+			break;
+		}
+		if (BPF_SRC(f->code) == BPF_X) {
+			ctx->seen |= SEEN_X;
+			r = r_X;
+		} else {
+			emit_load_imm(ctx, r_t0, k);
+			r = r_t0;
+		}
+		uasm_i_sltu(&ctx->p, r_t1, r, r_A);	/* K < A */
+		emit_cond(ctx, i, r_t1, true);
+		break;
+	case BPF_JMP|BPF_JGE|BPF_K:
+	case BPF_JMP|BPF_JGE|BPF_X:
+		if (f->jt == f->jf) {
+			emit_b(ctx, ctx->offsets[i + 1 + f->jt]);
+			break;
+		}
+		if (BPF_SRC(f->code) == BPF_X) {
+			ctx->seen |= SEEN_X;
+			uasm_i_sltu(&ctx->p, r_t1, r_A, r_X);
+		} else if (k <= 0x7fff) {
+			uasm_i_sltiu(&ctx->p, r_t1, r_A, k);
+		} else {
+			emit_load_imm(ctx, r_t0, k);
+			uasm_i_sltu(&ctx->p, r_t1, r_A, r_t0);
+		}
+		emit_cond(ctx, i, r_t1, false);	/* !(A < K) */
+		break;
+	case BPF_JMP|BPF_JSET|BPF_K:
+	case BPF_JMP|BPF_JSET|BPF_X:
+		if (f->jt == f->jf) {
+			emit_b(ctx, ctx->offsets[i + 1 + f->jt]);
+			break;
+		}
+		if (BPF_SRC(f->code) == BPF_X) {
+			ctx->seen |= SEEN_X;
+			uasm_i_and(&ctx->p, r_t1, r_A, r_X);
+		} else if (k <= 0xffff) {
+			uasm_i_andi(&ctx->p, r_t1, r_A, k);
+		} else {
+			emit_load_imm(ctx, r_t0, k);
+			uasm_i_and(&ctx->p, r_t1, r_A, r_t0);
+		}
+		emit_cond(ctx, i, r_t1, true);
+		break;
+	case BPF_LD|BPF_W|BPF_ABS:
+	case BPF_LD|BPF_H|BPF_ABS:
+	case BPF_LD|BPF_B|BPF_ABS:
+		if ((s32)k >= SKF_AD_OFF && (s32)k < 0) {
+			switch (k - SKF_AD_OFF) {
+			case SKF_AD_PROTOCOL:
+				/* A = ntohs(skb->protocol) */
+				r = offsetof(struct sk_buff, protocol);
+				uasm_i_lbu(&ctx->p, r_t0, r, r_skb);
+				uasm_i_lbu(&ctx->p, r_t1, r + 1, r_skb);
+				uasm_i_sll(&ctx->p, r_t0, r_t0, 8);
+				uasm_i_or(&ctx->p, r_A, r_t0, r_t1);
+				break;
+			case SKF_AD_IFINDEX:
+				/* A = skb->dev->ifindex, 0 without a device */
+				uasm_i_ld(&ctx->p, r_t0,
+					  offsetof(struct sk_buff, dev), r_skb);
+				uasm_i_beqz(&ctx->p, r_t0, b_off(ctx, ctx->ret0));
+				uasm_i_nop(&ctx->p);
+				uasm_i_lw(&ctx->p, r_A,
+					  offsetof(struct net_device, ifindex),
+					  r_t0);
+				break;
+			default:
+				/* PKTTYPE and the netlink attribute lookups
+				 * stay with the interpreter.
+				 */
+				return -1;
+			}
+			break;
+		}
+		emit_load(ctx, r_A, k, BPF_SIZE(f->code) == BPF_W ? 4 :
+			  BPF_SIZE(f->code) == BPF_H ? 2 : 1, false);
+		break;
+	case BPF_LD|BPF_W|BPF_IND:
+	case BPF_LD|BPF_H|BPF_IND:
+	case BPF_LD|BPF_B|BPF_IND:
+		emit_load(ctx, r_A, k, BPF_SIZE(f->code) == BPF_W ? 4 :
+			  BPF_SIZE(f->code) == BPF_H ? 2 : 1, true);
+		break;
+	case BPF_LDX|BPF_B|BPF_MSH:
+		/* X = 4 * ([k] & 0xf) */
+		emit_load(ctx, r_t0, k, 1, false);
+		uasm_i_andi(&ctx->p, r_t0, r_t0, 0xf);
+		uasm_i_sll(&ctx->p, r_X, r_t0, 2);
+		break;
+	case BPF_LD|BPF_W|BPF_LEN:
+		uasm_i_lw(&ctx->p, r_A, offsetof(struct sk_buff, len), r_skb);
+		break;
+	case BPF_LDX|BPF_W|BPF_LEN:
+		uasm_i_lw(&ctx->p, r_X, offsetof(struct sk_buff, len), r_skb);
+		break;
+	case BPF_LD|BPF_IMM:
+		emit_load_imm(ctx, r_A, k);
+		break;
+	case BPF_LDX|BPF_IMM:
+		emit_load_imm(ctx, r_X, k);
+		break;
+	case BPF_LD|BPF_MEM:
+		uasm_i_lw(&ctx->p, r_A, MEM_OFF(k), r_sp);
+		break;
+	case BPF_LDX|BPF_MEM:
+		uasm_i_lw(&ctx->p, r_X, MEM_OFF(k), r_sp);
+		break;
+	case BPF_ST:
+		uasm_i_sw(&ctx->p, r_A, MEM_OFF(k), r_sp);
+		break;
+	case BPF_STX:
+		ctx->seen |= SEEN_X;
+		uasm_i_sw(&ctx->p, r_X, MEM_OFF(k), r_sp);
+		break;
+	case BPF_MISC|BPF_TAX:
+		uasm_i_move(&ctx->p, r_X, r_A);
+		break;
+	case BPF_MISC|BPF_TXA:
+		ctx->seen |= SEEN_X;
+		uasm_i_move(&ctx->p, r_A, r_X);
+		break;
+	case BPF_RET|BPF_K:
+		emit_load_imm(ctx, r_t0, k);
+		emit_ret(ctx, r_t0, last);
+		break;
+	case BPF_RET|BPF_A:
+		emit_ret(ctx, r_A, last);
+		break;
+	default:
+		return -1;
+	}
+	return 0;
+}
+
+static void jit_free_defer(struct work_struct *arg)
+{
+	module_free(NULL, arg);
+}
+
+void bpf_jit_compile(struct sk_filter *fp)
+{
+	u32 temp[JIT_INSN_MAX];
+	struct jit_ctx ctx;
+	unsigned int words, pro, i;
+	u32 *image;
+
+	if (!bpf_jit_enable || r4k_daddiu_bug())
+		return;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.skf = fp;
+	ctx.offsets = kcalloc(fp->len + 1, sizeof(*ctx.offsets), GFP_KERNEL);
+	if (!ctx.offsets)
+		return;
+
+	/*
+	 * Sizing pass: instruction lengths do not depend on branch
+	 * distances, so one pass gives the final layout.
+	 */
+	words = 0;
+	for (i = 0; i < fp->len; i++) {
+		ctx.offsets[i] = words;
+		ctx.p = temp;
+		if (build_insn(&ctx, i))
+			goto out;
+		words += ctx.p - temp;
+	}
+	ctx.p = temp;
+	emit_prologue(&ctx);
+	pro = ctx.p - temp;
+	for (i = 0; i < fp->len; i++)
+		ctx.offsets[i] += pro;
+	ctx.offsets[fp->len] = ctx.exit = pro + words;
+	ctx.p = temp;
+	emit_epilogue(&ctx);
+	ctx.ret0 = ctx.exit + (ctx.p - temp);
+	words = ctx.ret0 + 2;
+
+	/* all branches must be in reach of a 16-bit displacement */
+	if (words > 0x7fff)
+		goto out;
+
+	image = module_alloc(max_t(unsigned int, words * sizeof(u32),
+				   sizeof(struct work_struct)));
+	if (!image)
+		goto out;
+
+	ctx.image = ctx.p = image;
+	emit_prologue(&ctx);
+	for (i = 0; i < fp->len; i++)
+		build_insn(&ctx, i);
+	emit_epilogue(&ctx);
+	uasm_i_b(&ctx.p, b_off(&ctx, ctx.exit));
+	uasm_i_move(&ctx.p, r_v0, r_zero);
+
+	if (ctx.p - image != words) {
+		pr_err("bpf_jit_compile: %u words emitted, %u expected\n",
+		       (unsigned int)(ctx.p - image), words);
+		module_free(NULL, image);
+		goto out;
+	}
+
+	if (bpf_jit_enable > 1) {
+		pr_err("flen=%u words=%u image=%p\n", fp->len, words, image);
+		print_hex_dump(KERN_ERR, "JIT code: ", DUMP_PREFIX_ADDRESS,
+			       16, 4, image, words * sizeof(u32), false);
+	}
+
+	flush_icache_range((unsigned long)image,
+			   (unsigned long)(image + words));
+	fp->bpf_func = (void *)image;
+out:
+	kfree(ctx.offsets);
+}
+
+/* run from softirq, we must use a work_struct to call
+ * module_free() from process context
+ */
+void bpf_jit_free(struct sk_filter *fp)
+{
+	if (fp->bpf_func) {
+		struct work_struct *work = (struct work_struct *)fp->bpf_func;
+
+		INIT_WORK(work, jit_free_defer);
+		schedule_work(work);
+	}
+}
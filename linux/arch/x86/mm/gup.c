@@ -125,6 +125,19 @@ static noinline int gup_huge_pmd(pmd_t pmd, unsigned long addr,
 	refs = 0;
 	head = pte_page(pte);
 	page = head + ((addr & ~PMD_MASK) >> PAGE_SHIFT);
+	if (!PageCompound(head)) {
+		/*
+		 * A transparent huge page is made of independent small
+		 * pages, each with its own refcount.
+		 */
+		do {
+			get_page(page);
+			pages[*nr] = page;
+			(*nr)++;
+			page++;
+		} while (addr += PAGE_SIZE, addr != end);
+		return 1;
+	}
 	do {
 		VM_BUG_ON(compound_head(page) != head);
 		pages[*nr] = page;
@@ -148,9 +161,14 @@ static int gup_pmd_range(pud_t pud, unsigned long addr, unsigned long end,
 		pmd_t pmd = *pmdp;
 
 		next = pmd_addr_end(addr, end);
+		/*
+		 * A transparent huge pmd being split is not present but
+		 * still has _PAGE_PSE set: gup_huge_pmd() rejects it, it
+		 * must not be mistaken for a page table.
+		 */
 		if (pmd_none(pmd))
 			return 0;
-		if (unlikely(pmd_large(pmd))) {
+		if (unlikely(pmd_flags(pmd) & _PAGE_PSE)) {
 			if (!gup_huge_pmd(pmd, addr, next, write, pages, nr))
 				return 0;
 		} else {
@@ -336,6 +336,68 @@ int ptep_clear_flush_young(struct vm_area_struct *vma,
 	return young;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+int pmdp_set_access_flags(struct vm_area_struct *vma,
+			  unsigned long address, pmd_t *pmdp,
+			  pmd_t entry, int dirty)
+{
+	int changed = !pmd_same(*pmdp, entry);
+
+	VM_BUG_ON(address & ~PMD_MASK);
+
+	if (changed && dirty) {
+		*pmdp = entry;
+		flush_tlb_range(vma, address, address + PMD_SIZE);
+	}
+
+	return changed;
+}
+
+int pmdp_test_and_clear_young(struct vm_area_struct *vma,
+			      unsigned long addr, pmd_t *pmdp)
+{
+	int ret = 0;
+
+	if (pmd_young(*pmdp))
+		ret = test_and_clear_bit(_PAGE_BIT_ACCESSED,
+					 (unsigned long *)pmdp);
+
+	return ret;
+}
+
+int pmdp_clear_flush_young(struct vm_area_struct *vma,
+			   unsigned long address, pmd_t *pmdp)
+{
+	int young;
+
+	VM_BUG_ON(address & ~PMD_MASK);
+
+	young = pmdp_test_and_clear_young(vma, address, pmdp);
+	if (young)
+		flush_tlb_range(vma, address, address + PMD_SIZE);
+
+	return young;
+}
+
+/*
+ * Make a huge pmd non-present while keeping it recognisable as huge, so
+ * that neither the hardware nor the lockless fast gup walk it while its
+ * replacement page table is being filled in. Returns the old value, with
+ * any accessed and dirty bits the hardware set up to this point.
+ */
+pmd_t pmdp_invalidate(struct mm_struct *mm, unsigned long address,
+		      pmd_t *pmdp)
+{
+	pmd_t pmd = *pmdp;
+
+	pmd = native_make_pmd(xchg(&pmdp->pmd,
+				   pmd_val(pmd_mknotpresent(pmd))));
+	flush_tlb_mm(mm);
+
+	return pmd;
+}
+#endif
+
 /**
  * reserve_top_address - reserves a hole in the top of kernel address space
  * @reserve - size of hole to reserve
@@ -291,6 +291,7 @@ static struct virtqueue *lg_find_vq(struct virtio_device *vdev,
 		err = -ENOMEM;
 		goto unmap;
 	}
+	vq->index = index;
 
 	/* Make sure the interrupt is allocated. */
 	lguest_setup_irq(lvq->config.irq);
@@ -232,7 +232,7 @@ static void tlb_deinitialize(struct bonding *bond)
 	_unlock_tx_hashtbl(bond);
 }
 
-/* Caller must hold bond lock for read */
+/* Caller must hold bond lock for read or rcu_read_lock */
 static struct slave *tlb_get_least_loaded_slave(struct bonding *bond)
 {
 	struct slave *slave, *least_loaded;
@@ -240,8 +240,8 @@ static struct slave *tlb_get_least_loaded_slave(struct bonding *bond)
 	int i, found = 0;
 
 	/* Find the first enabled slave */
-	bond_for_each_slave(bond, slave, i) {
-		if (SLAVE_IS_OK(slave)) {
+	bond_for_each_slave_rcu(bond, slave, i) {
+		if (SLAVE_IS_OK(slave) && SLAVE_IS_LINKED(slave)) {
 			found = 1;
 			break;
 		}
@@ -256,8 +256,8 @@ static struct slave *tlb_get_least_loaded_slave(struct bonding *bond)
 			(s64)(SLAVE_TLB_INFO(slave).load << 3); /* Bytes to bits */
 
 	/* Find the slave with the largest gap */
-	bond_for_each_slave_from(bond, slave, i, least_loaded) {
-		if (SLAVE_IS_OK(slave)) {
+	bond_for_each_slave_from_rcu(bond, slave, i, least_loaded) {
+		if (SLAVE_IS_OK(slave) && SLAVE_IS_LINKED(slave)) {
 			s64 gap = (s64)(slave->speed << 20) -
 					(s64)(SLAVE_TLB_INFO(slave).load << 3);
 			if (max_gap < gap) {
@@ -270,7 +270,7 @@ static struct slave *tlb_get_least_loaded_slave(struct bonding *bond)
 	return least_loaded;
 }
 
-/* Caller must hold bond lock for read */
+/* Caller must hold bond lock for read or rcu_read_lock */
 static struct slave *tlb_choose_channel(struct bonding *bond, u32 hash_index, u32 skb_len)
 {
 	struct alb_bond_info *bond_info = &(BOND_ALB_INFO(bond));
@@ -390,23 +390,24 @@ out:
 	return res;
 }
 
-/* Caller must hold bond lock for read */
+/* Caller must hold bond lock for read or rcu_read_lock */
 static struct slave *rlb_next_rx_slave(struct bonding *bond)
 {
 	struct alb_bond_info *bond_info = &(BOND_ALB_INFO(bond));
 	struct slave *rx_slave, *slave, *start_at;
 	int i = 0;
 
-	if (bond_info->next_rx_slave) {
+	if (bond_info->next_rx_slave &&
+	    SLAVE_IS_LINKED(bond_info->next_rx_slave)) {
 		start_at = bond_info->next_rx_slave;
 	} else {
-		start_at = bond->first_slave;
+		start_at = rcu_dereference(bond->first_slave);
 	}
 
 	rx_slave = NULL;
 
-	bond_for_each_slave_from(bond, slave, i, start_at) {
-		if (SLAVE_IS_OK(slave)) {
+	bond_for_each_slave_from_rcu(bond, slave, i, start_at) {
+		if (SLAVE_IS_OK(slave) && SLAVE_IS_LINKED(slave)) {
 			if (!rx_slave) {
 				rx_slave = slave;
 			} else if (slave->speed > rx_slave->speed) {
@@ -634,7 +635,7 @@ static void rlb_req_update_subnet_clients(struct bonding *bond, __be32 src_ip)
 	_unlock_rx_hashtbl(bond);
 }
 
-/* Caller must hold both bond and ptr locks for read */
+/* Caller must hold rcu_read_lock */
 static struct slave *rlb_choose_channel(struct sk_buff *skb, struct bonding *bond)
 {
 	struct alb_bond_info *bond_info = &(BOND_ALB_INFO(bond));
@@ -667,9 +668,10 @@ static struct slave *rlb_choose_channel(struct sk_buff *skb, struct bonding *bon
 			 * move the old client to primary (curr_active_slave) so
 			 * that the new client can be assigned to this entry.
 			 */
-			if (bond->curr_active_slave &&
-			    client_info->slave != bond->curr_active_slave) {
-				client_info->slave = bond->curr_active_slave;
+			struct slave *curr = rcu_dereference(bond->curr_active_slave);
+
+			if (curr && client_info->slave != curr) {
+				client_info->slave = curr;
 				rlb_update_client(client_info);
 			}
 		}
@@ -1289,7 +1291,7 @@ int bond_alb_xmit(struct sk_buff *skb, struct net_device *bond_dev)
 	struct bonding *bond = netdev_priv(bond_dev);
 	struct ethhdr *eth_data;
 	struct alb_bond_info *bond_info = &(BOND_ALB_INFO(bond));
-	struct slave *tx_slave = NULL;
+	struct slave *tx_slave = NULL, *curr;
 	static const __be32 ip_bcast = htonl(0xffffffff);
 	int hash_size = 0;
 	int do_tx_balance = 1;
@@ -1301,12 +1303,9 @@ int bond_alb_xmit(struct sk_buff *skb, struct net_device *bond_dev)
 	skb_reset_mac_header(skb);
 	eth_data = eth_hdr(skb);
 
-	/* make sure that the curr_active_slave and the slaves list do
-	 * not change during tx
+	/* called from bond_start_xmit() under rcu_read_lock, which keeps
+	 * curr_active_slave and any slave found in the hash tables alive
 	 */
-	read_lock(&bond->lock);
-	read_lock(&bond->curr_slave_lock);
-
 	if (!BOND_IS_OK(bond)) {
 		goto out;
 	}
@@ -1390,14 +1389,15 @@ int bond_alb_xmit(struct sk_buff *skb, struct net_device *bond_dev)
 		tx_slave = tlb_choose_channel(bond, hash_index, skb->len);
 	}
 
+	curr = rcu_dereference(bond->curr_active_slave);
 	if (!tx_slave) {
 		/* unbalanced or unassigned, send through primary */
-		tx_slave = bond->curr_active_slave;
+		tx_slave = curr;
 		bond_info->unbalanced_load += skb->len;
 	}
 
 	if (tx_slave && SLAVE_IS_OK(tx_slave)) {
-		if (tx_slave != bond->curr_active_slave) {
+		if (tx_slave != curr) {
 			memcpy(eth_data->h_source,
 			       tx_slave->dev->dev_addr,
 			       ETH_ALEN);
@@ -1415,8 +1415,6 @@ out:
 		/* no suitable interface, frame not sent */
 		dev_kfree_skb(skb);
 	}
-	read_unlock(&bond->curr_slave_lock);
-	read_unlock(&bond->lock);
 	return NETDEV_TX_OK;
 }
 
@@ -1585,7 +1583,10 @@ void bond_alb_deinit_slave(struct bonding *bond, struct slave *slave)
 	tlb_clear_slave(bond, slave, 0);
 
 	if (bond->alb_info.rlb_enabled) {
+		/* transmitters pick rx slaves under the rx hash table lock */
+		_lock_rx_hashtbl(bond);
 		bond->alb_info.next_rx_slave = NULL;
+		_unlock_rx_hashtbl(bond);
 		rlb_clear_slave(bond, slave);
 	}
 }
@@ -1649,7 +1650,7 @@ void bond_alb_handle_active_change(struct bonding *bond, struct slave *new_slave
 	}
 
 	swap_slave = bond->curr_active_slave;
-	bond->curr_active_slave = new_slave;
+	rcu_assign_pointer(bond->curr_active_slave, new_slave);
 
 	if (!new_slave || (bond->slave_cnt == 0)) {
 		return;
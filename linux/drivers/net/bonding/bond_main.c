@@ -86,6 +86,7 @@
 #define BOND_LINK_ARP_INTERV	0
 
 static int max_bonds	= BOND_DEFAULT_MAX_BONDS;
+static int tx_queues	= BOND_DEFAULT_TX_QUEUES;
 static int num_grat_arp = 1;
 static int num_unsol_na = 1;
 static int miimon	= BOND_LINK_MON_INTERV;
@@ -105,6 +106,8 @@ static struct bond_params bonding_defaults;
 
 module_param(max_bonds, int, 0);
 MODULE_PARM_DESC(max_bonds, "Max number of bonded devices");
+module_param(tx_queues, int, 0);
+MODULE_PARM_DESC(tx_queues, "Max number of transmit queues (default = 16)");
 module_param(num_grat_arp, int, 0644);
 MODULE_PARM_DESC(num_grat_arp, "Number of gratuitous ARP packets to send on failover event");
 module_param(num_unsol_na, int, 0644);
@@ -1180,7 +1183,7 @@ void bond_change_active_slave(struct bonding *bond, struct slave *new_active)
 		if (new_active)
 			bond_set_slave_active_flags(new_active);
 	} else {
-		bond->curr_active_slave = new_active;
+		rcu_assign_pointer(bond->curr_active_slave, new_active);
 	}
 
 	if (bond->params.mode == BOND_MODE_ACTIVEBACKUP) {
@@ -1250,6 +1253,8 @@ void bond_select_active_slave(struct bonding *bond)
 
 /*
  * This function attaches the slave to the end of list.
+ * The slave is fully linked before it becomes reachable, so that
+ * lockless readers in the transmit path never see a half-built entry.
  *
  * bond->lock held for writing by caller.
  */
@@ -1258,12 +1263,12 @@ static void bond_attach_slave(struct bonding *bond, struct slave *new_slave)
 	if (bond->first_slave == NULL) { /* attaching the first slave */
 		new_slave->next = new_slave;
 		new_slave->prev = new_slave;
-		bond->first_slave = new_slave;
+		rcu_assign_pointer(bond->first_slave, new_slave);
 	} else {
 		new_slave->next = bond->first_slave;
 		new_slave->prev = bond->first_slave->prev;
 		new_slave->next->prev = new_slave;
-		new_slave->prev->next = new_slave;
+		rcu_assign_pointer(new_slave->prev->next, new_slave);
 	}
 
 	bond->slave_cnt++;
@@ -1277,6 +1282,10 @@ static void bond_attach_slave(struct bonding *bond, struct slave *new_slave)
  * If any slave pointer in bond was pointing to <slave>,
  * it should be changed by the calling function.
  *
+ * slave->next is left alone so that a transmitter still walking the
+ * list through <slave> can carry on; the caller must not free <slave>
+ * before a grace period has elapsed.
+ *
  * bond->lock held for writing by caller.
  */
 static void bond_detach_slave(struct bonding *bond, struct slave *slave)
@@ -1295,7 +1304,6 @@ static void bond_detach_slave(struct bonding *bond, struct slave *slave)
 		}
 	}
 
-	slave->next = NULL;
 	slave->prev = NULL;
 	bond->slave_cnt--;
 }
@@ -1727,7 +1735,7 @@ int bond_enslave(struct net_device *bond_dev, struct net_device *slave_dev)
 		 * so we can change it without calling change_active_interface()
 		 */
 		if (!bond->curr_active_slave)
-			bond->curr_active_slave = new_slave;
+			rcu_assign_pointer(bond->curr_active_slave, new_slave);
 
 		break;
 	} /* switch(bond_mode) */
@@ -1740,7 +1748,7 @@ int bond_enslave(struct net_device *bond_dev, struct net_device *slave_dev)
 
 	res = bond_create_slave_symlinks(bond_dev, slave_dev);
 	if (res)
-		goto err_close;
+		goto err_detach;
 
 	pr_info(DRV_NAME
 	       ": %s: enslaving %s as a%s interface with a%s link.\n",
@@ -1752,6 +1760,29 @@ int bond_enslave(struct net_device *bond_dev, struct net_device *slave_dev)
 	return 0;
 
 /* Undo stages on error */
+err_detach:
+	write_lock_bh(&bond->lock);
+	if (bond->params.mode == BOND_MODE_8023AD)
+		bond_3ad_unbind_slave(new_slave);
+	bond_detach_slave(bond, new_slave);
+	if (bond->primary_slave == new_slave)
+		bond->primary_slave = NULL;
+	if (bond->curr_active_slave == new_slave)
+		bond_change_active_slave(bond, NULL);
+	write_unlock_bh(&bond->lock);
+
+	if (bond_is_lb(bond))
+		bond_alb_deinit_slave(bond, new_slave);
+
+	read_lock(&bond->lock);
+	write_lock_bh(&bond->curr_slave_lock);
+	bond_select_active_slave(bond);
+	write_unlock_bh(&bond->curr_slave_lock);
+	read_unlock(&bond->lock);
+
+	bond_del_vlans_from_slave(bond, slave_dev);
+	bond_compute_features(bond);
+
 err_close:
 	dev_close(slave_dev);
 
@@ -3278,6 +3309,7 @@ static void bond_info_show_slave(struct seq_file *seq,
 		   slave->link_failure_count);
 
 	seq_printf(seq, "Permanent HW addr: %pM\n", slave->perm_hwaddr);
+	seq_printf(seq, "Slave queue ID: %d\n", slave->queue_id);
 
 	if (bond->params.mode == BOND_MODE_8023AD) {
 		const struct aggregator *agg
@@ -4204,31 +4236,36 @@ unwind:
 	return res;
 }
 
+/*
+ * The transmit handlers below run without bond->lock; they are called
+ * from bond_start_xmit() under rcu_read_lock and only see slaves that
+ * are still safe to dereference (see the locking notes in bonding.h).
+ * bond->slave_cnt may change under us, so it is sampled once.
+ */
 static int bond_xmit_roundrobin(struct sk_buff *skb, struct net_device *bond_dev)
 {
 	struct bonding *bond = netdev_priv(bond_dev);
 	struct slave *slave, *start_at;
-	int i, slave_no, res = 1;
-
-	read_lock(&bond->lock);
+	int i, slave_no, slave_cnt, res = 1;
 
-	if (!BOND_IS_OK(bond))
+	slave_cnt = ACCESS_ONCE(bond->slave_cnt);
+	if (!BOND_IS_OK(bond) || !slave_cnt)
 		goto out;
 
 	/*
 	 * Concurrent TX may collide on rr_tx_counter; we accept that
 	 * as being rare enough not to justify using an atomic op here
 	 */
-	slave_no = bond->rr_tx_counter++ % bond->slave_cnt;
+	slave_no = bond->rr_tx_counter++ % slave_cnt;
 
-	bond_for_each_slave(bond, slave, i) {
+	bond_for_each_slave_rcu(bond, slave, i) {
 		slave_no--;
 		if (slave_no < 0)
 			break;
 	}
 
 	start_at = slave;
-	bond_for_each_slave_from(bond, slave, i, start_at) {
+	bond_for_each_slave_from_rcu(bond, slave, i, start_at) {
 		if (IS_UP(slave->dev) &&
 		    (slave->link == BOND_LINK_UP) &&
 		    (slave->state == BOND_STATE_ACTIVE)) {
@@ -4242,7 +4279,6 @@ out:
 		/* no suitable interface, frame not sent */
 		dev_kfree_skb(skb);
 	}
-	read_unlock(&bond->lock);
 	return NETDEV_TX_OK;
 }
 
@@ -4254,26 +4290,23 @@ out:
 static int bond_xmit_activebackup(struct sk_buff *skb, struct net_device *bond_dev)
 {
 	struct bonding *bond = netdev_priv(bond_dev);
+	struct slave *curr;
 	int res = 1;
 
-	read_lock(&bond->lock);
-	read_lock(&bond->curr_slave_lock);
-
 	if (!BOND_IS_OK(bond))
 		goto out;
 
-	if (!bond->curr_active_slave)
+	curr = rcu_dereference(bond->curr_active_slave);
+	if (!curr)
 		goto out;
 
-	res = bond_dev_queue_xmit(bond, skb, bond->curr_active_slave->dev);
+	res = bond_dev_queue_xmit(bond, skb, curr->dev);
 
 out:
 	if (res)
 		/* no suitable interface, frame not sent */
 		dev_kfree_skb(skb);
 
-	read_unlock(&bond->curr_slave_lock);
-	read_unlock(&bond->lock);
 	return NETDEV_TX_OK;
 }
 
@@ -4286,18 +4319,17 @@ static int bond_xmit_xor(struct sk_buff *skb, struct net_device *bond_dev)
 {
 	struct bonding *bond = netdev_priv(bond_dev);
 	struct slave *slave, *start_at;
-	int slave_no;
+	int slave_no, slave_cnt;
 	int i;
 	int res = 1;
 
-	read_lock(&bond->lock);
-
-	if (!BOND_IS_OK(bond))
+	slave_cnt = ACCESS_ONCE(bond->slave_cnt);
+	if (!BOND_IS_OK(bond) || !slave_cnt)
 		goto out;
 
-	slave_no = bond->xmit_hash_policy(skb, bond_dev, bond->slave_cnt);
+	slave_no = bond->xmit_hash_policy(skb, bond_dev, slave_cnt);
 
-	bond_for_each_slave(bond, slave, i) {
+	bond_for_each_slave_rcu(bond, slave, i) {
 		slave_no--;
 		if (slave_no < 0)
 			break;
@@ -4305,7 +4337,7 @@ static int bond_xmit_xor(struct sk_buff *skb, struct net_device *bond_dev)
 
 	start_at = slave;
 
-	bond_for_each_slave_from(bond, slave, i, start_at) {
+	bond_for_each_slave_from_rcu(bond, slave, i, start_at) {
 		if (IS_UP(slave->dev) &&
 		    (slave->link == BOND_LINK_UP) &&
 		    (slave->state == BOND_STATE_ACTIVE)) {
@@ -4319,7 +4351,6 @@ out:
 		/* no suitable interface, frame not sent */
 		dev_kfree_skb(skb);
 	}
-	read_unlock(&bond->lock);
 	return NETDEV_TX_OK;
 }
 
@@ -4334,19 +4365,14 @@ static int bond_xmit_broadcast(struct sk_buff *skb, struct net_device *bond_dev)
 	int i;
 	int res = 1;
 
-	read_lock(&bond->lock);
-
 	if (!BOND_IS_OK(bond))
 		goto out;
 
-	read_lock(&bond->curr_slave_lock);
-	start_at = bond->curr_active_slave;
-	read_unlock(&bond->curr_slave_lock);
-
+	start_at = rcu_dereference(bond->curr_active_slave);
 	if (!start_at)
 		goto out;
 
-	bond_for_each_slave_from(bond, slave, i, start_at) {
+	bond_for_each_slave_from_rcu(bond, slave, i, start_at) {
 		if (IS_UP(slave->dev) &&
 		    (slave->link == BOND_LINK_UP) &&
 		    (slave->state == BOND_STATE_ACTIVE)) {
@@ -4379,10 +4405,47 @@ out:
 		dev_kfree_skb(skb);
 
 	/* frame sent to all suitable interfaces */
-	read_unlock(&bond->lock);
 	return NETDEV_TX_OK;
 }
 
+/*
+ * Send the frame through a usable slave whose queue_id matches the tx
+ * queue picked for it, if there is one, be it active or backup. Returns 0 if the frame was
+ * handed to a slave and 1 if the mode's own policy should pick one
+ * instead.
+ */
+static int bond_slave_override(struct bonding *bond, struct sk_buff *skb)
+{
+	struct slave *slave;
+	int i;
+
+	if (!skb->queue_mapping)
+		return 1;
+
+	bond_for_each_slave_rcu(bond, slave, i) {
+		if (slave->queue_id != skb->queue_mapping ||
+		    !IS_UP(slave->dev) || slave->link != BOND_LINK_UP)
+			continue;
+		return bond_dev_queue_xmit(bond, skb, slave->dev);
+	}
+
+	return 1;
+}
+
+/*
+ * Use the rx queue recorded on forwarded frames instead of hashing, and
+ * queue 0 otherwise; an skbedit action on the bond's qdisc may then
+ * pick the queue, and so the slave, through bond_slave_override().
+ */
+static u16 bond_select_queue(struct net_device *dev, struct sk_buff *skb)
+{
+	u16 txq = skb_rx_queue_recorded(skb) ? skb_get_rx_queue(skb) : 0;
+
+	if (unlikely(txq >= dev->real_num_tx_queues))
+		txq = 0;
+	return txq;
+}
+
 /*------------------------- Device initialization ---------------------------*/
 
 static void bond_set_xmit_hash_policy(struct bonding *bond)
@@ -4403,30 +4466,48 @@ static void bond_set_xmit_hash_policy(struct bonding *bond)
 
 static netdev_tx_t bond_start_xmit(struct sk_buff *skb, struct net_device *dev)
 {
-	const struct bonding *bond = netdev_priv(dev);
+	struct bonding *bond = netdev_priv(dev);
+	netdev_tx_t ret = NETDEV_TX_OK;
+
+	rcu_read_lock();
+
+	if ((bond->params.mode == BOND_MODE_ROUNDROBIN ||
+	     bond->params.mode == BOND_MODE_ACTIVEBACKUP) &&
+	    bond->slave_cnt && !bond_slave_override(bond, skb))
+		goto out;
 
 	switch (bond->params.mode) {
 	case BOND_MODE_ROUNDROBIN:
-		return bond_xmit_roundrobin(skb, dev);
+		ret = bond_xmit_roundrobin(skb, dev);
+		break;
 	case BOND_MODE_ACTIVEBACKUP:
-		return bond_xmit_activebackup(skb, dev);
+		ret = bond_xmit_activebackup(skb, dev);
+		break;
 	case BOND_MODE_XOR:
-		return bond_xmit_xor(skb, dev);
+		ret = bond_xmit_xor(skb, dev);
+		break;
 	case BOND_MODE_BROADCAST:
-		return bond_xmit_broadcast(skb, dev);
+		ret = bond_xmit_broadcast(skb, dev);
+		break;
 	case BOND_MODE_8023AD:
-		return bond_3ad_xmit_xor(skb, dev);
+		ret = bond_3ad_xmit_xor(skb, dev);
+		break;
 	case BOND_MODE_ALB:
 	case BOND_MODE_TLB:
-		return bond_alb_xmit(skb, dev);
+		ret = bond_alb_xmit(skb, dev);
+		break;
 	default:
 		/* Should never happen, mode already checked */
 		pr_err(DRV_NAME ": %s: Error: Unknown bonding mode %d\n",
 		     dev->name, bond->params.mode);
 		WARN_ON_ONCE(1);
 		dev_kfree_skb(skb);
-		return NETDEV_TX_OK;
+		break;
 	}
+
+out:
+	rcu_read_unlock();
+	return ret;
 }
 
 
@@ -4490,6 +4571,7 @@ static const struct net_device_ops bond_netdev_ops = {
 	.ndo_open		= bond_open,
 	.ndo_stop		= bond_close,
 	.ndo_start_xmit		= bond_start_xmit,
+	.ndo_select_queue	= bond_select_queue,
 	.ndo_get_stats		= bond_get_stats,
 	.ndo_do_ioctl		= bond_do_ioctl,
 	.ndo_set_multicast_list	= bond_set_multicast_list,
@@ -4721,6 +4803,14 @@ static int bond_check_params(struct bond_params *params)
 		max_bonds = BOND_DEFAULT_MAX_BONDS;
 	}
 
+	if (tx_queues < 1 || tx_queues > 255) {
+		pr_warning(DRV_NAME
+		       ": Warning: tx_queues (%d) should be between "
+		       "1 and 255, resetting to %d\n",
+		       tx_queues, BOND_DEFAULT_TX_QUEUES);
+		tx_queues = BOND_DEFAULT_TX_QUEUES;
+	}
+
 	if (miimon < 0) {
 		pr_warning(DRV_NAME
 		       ": Warning: miimon module parameter (%d), "
@@ -4977,6 +5067,7 @@ static int bond_check_params(struct bond_params *params)
 	params->lacp_fast = lacp_fast;
 	params->primary[0] = 0;
 	params->fail_over_mac = fail_over_mac_value;
+	params->tx_queues = tx_queues;
 
 	if (primary) {
 		strncpy(params->primary, primary, IFNAMSIZ);
@@ -5049,8 +5140,8 @@ int bond_create(const char *name)
 		goto out_rtnl;
 	}
 
-	bond_dev = alloc_netdev(sizeof(struct bonding), name ? name : "",
-				bond_setup);
+	bond_dev = alloc_netdev_mq(sizeof(struct bonding), name ? name : "",
+				   bond_setup, tx_queues);
 	if (!bond_dev) {
 		pr_err(DRV_NAME ": %s: eek! can't alloc netdev!\n",
 		       name);
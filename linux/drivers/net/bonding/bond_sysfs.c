@@ -1213,6 +1213,92 @@ out:
 static DEVICE_ATTR(primary, S_IRUGO | S_IWUSR,
 		   bonding_show_primary, bonding_store_primary);
 
+/*
+ * Show and set the queue_id of each slave, written as "ifname:queue_id".
+ * Frames the bond is asked to send on a given tx queue go out through the
+ * slave holding that queue_id in the balance-rr and active-backup modes;
+ * queue_id 0 leaves the slave to the mode's normal policy.
+ */
+static ssize_t bonding_show_queue_id(struct device *d,
+				     struct device_attribute *attr,
+				     char *buf)
+{
+	struct slave *slave;
+	int i, res = 0;
+	struct bonding *bond = to_bond(d);
+
+	if (!rtnl_trylock())
+		return restart_syscall();
+
+	read_lock(&bond->lock);
+	bond_for_each_slave(bond, slave, i) {
+		if (res > (PAGE_SIZE - IFNAMSIZ - 6)) {
+			/* not enough space for another ifname:queue_id pair */
+			if ((PAGE_SIZE - res) > 10)
+				res = PAGE_SIZE - 10;
+			res += sprintf(buf + res, "++more++ ");
+			break;
+		}
+		res += sprintf(buf + res, "%s:%d ",
+			       slave->dev->name, slave->queue_id);
+	}
+	read_unlock(&bond->lock);
+	if (res)
+		buf[res-1] = '\n'; /* eat the leftover space */
+	rtnl_unlock();
+
+	return res;
+}
+
+static ssize_t bonding_store_queue_id(struct device *d,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct slave *slave, *update_slave;
+	struct bonding *bond = to_bond(d);
+	char ifname[IFNAMSIZ];
+	unsigned short qid;
+	int i, ret = count;
+
+	if (sscanf(buf, "%15[^:]:%hu", ifname, &qid) != 2 ||
+	    qid >= bond->dev->real_num_tx_queues)
+		goto err_no_cmd;
+
+	if (!rtnl_trylock())
+		return restart_syscall();
+
+	read_lock(&bond->lock);
+
+	/* find the slave and refuse a queue_id already taken by another */
+	update_slave = NULL;
+	bond_for_each_slave(bond, slave, i) {
+		if (!strcmp(slave->dev->name, ifname))
+			update_slave = slave;
+		else if (qid && qid == slave->queue_id)
+			goto err_unlock;
+	}
+
+	if (!update_slave)
+		goto err_unlock;
+
+	update_slave->queue_id = qid;
+
+	read_unlock(&bond->lock);
+	rtnl_unlock();
+
+	return ret;
+
+err_unlock:
+	read_unlock(&bond->lock);
+	rtnl_unlock();
+err_no_cmd:
+	pr_info(DRV_NAME ": %s: invalid queue_id \"%.*s\".\n",
+		bond->dev->name, (int)strcspn(buf, "\n"), buf);
+	return -EINVAL;
+}
+static DEVICE_ATTR(queue_id, S_IRUGO | S_IWUSR,
+		   bonding_show_queue_id, bonding_store_queue_id);
+
 /*
  * Show and set the use_carrier flag.
  */
@@ -1510,6 +1596,7 @@ static struct attribute *per_bond_attrs[] = {
 	&dev_attr_ad_actor_key.attr,
 	&dev_attr_ad_partner_key.attr,
 	&dev_attr_ad_partner_mac.attr,
+	&dev_attr_queue_id.attr,
 	NULL,
 };
 
@@ -20,6 +20,7 @@
 #include <linux/if_bonding.h>
 #include <linux/kobject.h>
 #include <linux/in6.h>
+#include <linux/rcupdate.h>
 #include "bond_3ad.h"
 #include "bond_alb.h"
 
@@ -30,6 +31,8 @@
 
 #define BOND_MAX_ARP_TARGETS	16
 
+#define BOND_DEFAULT_TX_QUEUES	16
+
 extern struct list_head bond_dev_list;
 
 #define IS_UP(dev)					   \
@@ -56,6 +59,13 @@ extern struct list_head bond_dev_list;
 		     ((slave)->link == BOND_LINK_UP) && \
 		     ((slave)->state == BOND_STATE_ACTIVE))
 
+/*
+ * Checks whether slave is still on the slave list. Lockless transmitters
+ * may run into a slave that bond_detach_slave() has already unlinked and
+ * must not hand it out again.
+ */
+#define SLAVE_IS_LINKED(slave)	((slave)->prev != NULL)
+
 
 #define USES_PRIMARY(mode)				\
 		(((mode) == BOND_MODE_ACTIVEBACKUP) ||	\
@@ -115,6 +125,35 @@ extern struct list_head bond_dev_list;
 #define bond_for_each_slave(bond, pos, cnt)	\
 		bond_for_each_slave_from(bond, pos, cnt, (bond)->first_slave)
 
+/**
+ * bond_for_each_slave_from_rcu - iterate the slaves list under RCU
+ * @bond:	the bond holding this list.
+ * @pos:	current slave.
+ * @cnt:	counter for max number of moves
+ * @start:	starting point, may be NULL.
+ *
+ * Caller must hold rcu_read_lock. The list may change under us: a
+ * slave that is being released keeps pointing into the list and is
+ * not freed until a grace period has elapsed, so the walk is safe but
+ * may skip or repeat a slave while a release is in progress.
+ */
+#define bond_for_each_slave_from_rcu(bond, pos, cnt, start)	\
+	for (cnt = 0, pos = start;				\
+	     pos && cnt < (bond)->slave_cnt;			\
+	     cnt++, pos = rcu_dereference((pos)->next))
+
+/**
+ * bond_for_each_slave_rcu - iterate the slaves list from head under RCU
+ * @bond:	the bond holding this list.
+ * @pos:	current slave.
+ * @cnt:	counter for max number of moves
+ *
+ * Caller must hold rcu_read_lock
+ */
+#define bond_for_each_slave_rcu(bond, pos, cnt)			\
+	bond_for_each_slave_from_rcu(bond, pos, cnt,		\
+				     rcu_dereference((bond)->first_slave))
+
 
 struct bond_params {
 	int mode;
@@ -130,6 +169,7 @@ struct bond_params {
 	int downdelay;
 	int lacp_fast;
 	int ad_select;
+	int tx_queues;
 	char primary[IFNAMSIZ];
 	__be32 arp_targets[BOND_MAX_ARP_TARGETS];
 };
@@ -166,6 +206,7 @@ struct slave {
 	u8     perm_hwaddr[ETH_ALEN];
 	u16    speed;
 	u8     duplex;
+	u16    queue_id;
 	struct ad_slave_info ad_info; /* HUGE - better to dynamically alloc */
 	struct tlb_slave_info tlb_info;
 };
@@ -183,6 +224,12 @@ struct slave {
  *    (It is unnecessary when the write-lock is put with bond->lock.)
  * 3) When we lock with bond->curr_slave_lock, we must lock with bond->lock
  *    beforehand.
+ *
+ * The transmit path takes neither lock. It walks the slave list and reads
+ * bond->first_slave and bond->curr_active_slave under rcu_read_lock, so
+ * writers publish those pointers with rcu_assign_pointer() and a released
+ * slave is only freed after netdev_set_master() has waited for a grace
+ * period.
  */
 struct bonding {
 	struct   net_device *dev; /* first - useful for panic debug */
@@ -118,6 +118,13 @@
 /* Maximum number of SKBs to try to free per xmit packet. */
 #define MAX_OUT_QUEUE_DEPTH 1000
 
+/*
+ * The PKO doesn't interrupt on transmit completion, so while byte
+ * queue limits keep a queue stopped we poll for completions at this
+ * interval (in nanoseconds).
+ */
+#define BQL_RESTART_INTERVAL_NS 50000
+
 #define FAU_NUM_PACKET_BUFFERS_TO_FREE (CVMX_FAU_REG_END - sizeof(uint32_t))
 
 #define TOTAL_NUMBER_OF_PORTS       (CVMX_PIP_NUM_INPUT_PORTS+1)
@@ -71,6 +71,61 @@
 
 #endif
 
+#ifdef CONFIG_BQL
+/**
+ * cvm_oct_tx_bql_reclaim - report packets sent by the PKO to BQL
+ * @priv:   Device to reclaim for
+ *
+ * The PKO subtracts the length of every packet it sends from
+ * tx_bql_fau, so the register holds the bytes still queued in
+ * hardware. Everything else reported to BQL as sent has completed.
+ * Must be called with tx_bql_lock held.
+ */
+static void cvm_oct_tx_bql_reclaim(struct octeon_ethernet *priv)
+{
+	int32_t in_hw = cvmx_fau_fetch_and_add32(priv->tx_bql_fau, 0);
+	unsigned int outstanding = priv->tx_bql_queued - priv->tx_bql_completed;
+	unsigned int done;
+
+	if (in_hw < 0)
+		in_hw = 0;
+	if (outstanding <= (unsigned int)in_hw)
+		return;
+
+	done = outstanding - in_hw;
+	priv->tx_bql_completed += done;
+	netdev_completed_queue(priv->netdev, 0, done);
+}
+
+/**
+ * cvm_oct_tx_bql_restart - poll for completions on a stopped queue
+ * @timer:  tx_bql_timer of the device
+ *
+ * Returns HRTIMER_RESTART until BQL restarts the queue or nothing is
+ * left in the hardware.
+ */
+enum hrtimer_restart cvm_oct_tx_bql_restart(struct hrtimer *timer)
+{
+	struct octeon_ethernet *priv =
+		container_of(timer, struct octeon_ethernet, tx_bql_timer);
+	struct netdev_queue *txq = netdev_get_tx_queue(priv->netdev, 0);
+	unsigned long flags;
+	int again;
+
+	spin_lock_irqsave(&priv->tx_bql_lock, flags);
+	cvm_oct_tx_bql_reclaim(priv);
+	again = netif_xmit_stopped(txq) &&
+		priv->tx_bql_queued != priv->tx_bql_completed;
+	spin_unlock_irqrestore(&priv->tx_bql_lock, flags);
+
+	if (!again)
+		return HRTIMER_NORESTART;
+
+	hrtimer_forward_now(timer, ns_to_ktime(BQL_RESTART_INTERVAL_NS));
+	return HRTIMER_RESTART;
+}
+#endif
+
 #ifdef CONFIG_OCTEON_ETHERNET_LOCKLESS_IF_SUPPORTED
 #define CVM_OCT_LOCKLESS 1
 #include "ethernet-xmit.c"
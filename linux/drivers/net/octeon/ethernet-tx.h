@@ -28,4 +28,7 @@
 int cvm_oct_xmit(struct sk_buff *skb, struct net_device *dev);
 int cvm_oct_xmit_lockless(struct sk_buff *skb, struct net_device *dev);
 int cvm_oct_xmit_pow(struct sk_buff *skb, struct net_device *dev);
+#ifdef CONFIG_BQL
+enum hrtimer_restart cvm_oct_tx_bql_restart(struct hrtimer *timer);
+#endif
 
@@ -59,6 +59,9 @@ CVM_OCT_XMIT
 	int32_t buffers_to_free;
 	unsigned long flags;
 	cvmx_wqe_t *work = NULL;
+#ifdef CONFIG_BQL
+	int32_t bql_len = 0;
+#endif
 #if REUSE_SKBUFFS_WITHOUT_FREE
 	unsigned char *fpa_head;
 #endif
@@ -358,6 +361,32 @@ dont_put_skbuff_in_hw:
 		work->packet_ptr.u64 = (unsigned long)skb;
 	}
 
+#ifdef CONFIG_BQL
+	/*
+	 * Have the PKO subtract the packet length from the BQL byte
+	 * counter once it is sent. The lockless transmit paths use a
+	 * PKO queue per core, but all of them feed the one BQL queue
+	 * of the device, so its accounting is done under tx_bql_lock
+	 * on both paths.
+	 */
+	bql_len = pko_command.s.total_bytes;
+	pko_command.s.size1 = CVMX_FAU_OP_SIZE_32;
+	pko_command.s.subone1 = 0;
+	pko_command.s.reg1 = priv->tx_bql_fau;
+
+	spin_lock_irqsave(&priv->tx_bql_lock, flags);
+	cvm_oct_tx_bql_reclaim(priv);
+	cvmx_fau_atomic_add32(priv->tx_bql_fau, bql_len);
+	priv->tx_bql_queued += bql_len;
+	netdev_sent_queue(dev, bql_len);
+	if (netif_xmit_stopped(netdev_get_tx_queue(dev, 0)) &&
+	    !hrtimer_active(&priv->tx_bql_timer))
+		hrtimer_start(&priv->tx_bql_timer,
+			      ns_to_ktime(BQL_RESTART_INTERVAL_NS),
+			      HRTIMER_MODE_REL);
+	spin_unlock_irqrestore(&priv->tx_bql_lock, flags);
+#endif
+
 	local_irq_save(flags);
 
 	cvmx_pko_send_packet_prepare(priv->port, priv->tx_queue[qos].queue, CVM_OCT_PKO_LOCK_TYPE);
@@ -396,6 +425,11 @@ skip_xmit:
 	switch (queue_type) {
 	case QUEUE_DROP:
 		cvmx_fau_atomic_add32(priv->tx_queue[qos].fau, -1);
+#ifdef CONFIG_BQL
+		/* Never reached the PKO: the next reclaim completes it */
+		if (bql_len)
+			cvmx_fau_atomic_add32(priv->tx_bql_fau, -bql_len);
+#endif
 		dev_kfree_skb_any(skb);
 		dev->stats.tx_dropped++;
 		break;
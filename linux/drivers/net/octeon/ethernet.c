@@ -542,6 +542,12 @@ int cvm_oct_common_init(struct net_device *dev)
 	dev->features |= NETIF_F_LLTX;
 	SET_ETHTOOL_OPS(dev, &cvm_oct_ethtool_ops);
 
+#ifdef CONFIG_BQL
+	spin_lock_init(&priv->tx_bql_lock);
+	hrtimer_init(&priv->tx_bql_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	priv->tx_bql_timer.function = cvm_oct_tx_bql_restart;
+#endif
+
 	cvm_oct_phy_setup_device(dev);
 	dev->netdev_ops->ndo_set_mac_address(dev, &sa);
 	dev->netdev_ops->ndo_change_mtu(dev, dev->mtu);
@@ -564,6 +570,9 @@ void cvm_oct_common_uninit(struct net_device *dev)
 {
 	struct octeon_ethernet *priv = netdev_priv(dev);
 
+#ifdef CONFIG_BQL
+	hrtimer_cancel(&priv->tx_bql_timer);
+#endif
 	if (priv->phydev)
 		phy_disconnect(priv->phydev);
 }
@@ -882,6 +891,11 @@ static int __init cvm_oct_init_module(void)
 				priv->tx_queue[qos].fau = fau;
 				cvmx_fau_atomic_write32(priv->tx_queue[qos].fau, 0);
 			}
+#ifdef CONFIG_BQL
+			fau = fau - sizeof(uint32_t);
+			priv->tx_bql_fau = fau;
+			cvmx_fau_atomic_write32(priv->tx_bql_fau, 0);
+#endif
 
 			switch (priv->imode) {
 
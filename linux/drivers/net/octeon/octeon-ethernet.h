@@ -31,6 +31,8 @@
 #ifndef OCTEON_ETHERNET_H
 #define OCTEON_ETHERNET_H
 
+#include <linux/hrtimer.h>
+
 #include <asm/octeon/cvmx-helper.h>
 
 #include <asm/octeon/octeon-ethernet-user.h>
@@ -88,6 +90,17 @@ struct octeon_ethernet {
 	struct work_struct	port_work;	/* may be unused. */
 	u64 last_tx_octets;
 	u32 last_tx_packets;
+#ifdef CONFIG_BQL
+	/* Serializes the byte queue limit accounting below */
+	spinlock_t		tx_bql_lock;
+	/* Hardware fetch and add counting bytes queued to the PKO */
+	int			tx_bql_fau;
+	/* Bytes reported to BQL as sent and as completed */
+	unsigned int		tx_bql_queued;
+	unsigned int		tx_bql_completed;
+	/* Polls for completions while BQL keeps the queue stopped */
+	struct hrtimer		tx_bql_timer;
+#endif
 };
 
 int cvm_oct_free_work(void *work_queue_entry);
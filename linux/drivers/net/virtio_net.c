@@ -25,6 +25,7 @@
 #include <linux/virtio_net.h>
 #include <linux/scatterlist.h>
 #include <linux/if_vlan.h>
+#include <linux/cpu.h>
 
 static int napi_weight = 128;
 module_param(napi_weight, int, 0444);
@@ -39,16 +40,62 @@ module_param(gso, bool, 0444);
 
 #define VIRTNET_SEND_COMMAND_SG_MAX    2
 
+/* Internal representation of a send virtqueue */
+struct send_queue {
+	/* Virtqueue associated with this send_queue */
+	struct virtqueue *vq;
+
+	/* Sent skbs waiting to be reclaimed. */
+	struct sk_buff_head skbs;
+
+	/* Reclaims sent buffers while byte queue limits stop the queue. */
+	struct tasklet_struct tasklet;
+
+	/* Name of the send queue: output.$index */
+	char name[40];
+};
+
+/* Internal representation of a receive virtqueue */
+struct receive_queue {
+	/* Virtqueue associated with this receive_queue */
+	struct virtqueue *vq;
+
+	struct napi_struct napi;
+
+	/* Number of input buffers, and max we've ever had. */
+	unsigned int num, max;
+
+	/* Posted skbs, in the order they were added. */
+	struct sk_buff_head skbs;
+
+	/* Chain pages by the private ptr. */
+	struct page *pages;
+
+	/* Work struct for refilling if we run low on memory. */
+	struct delayed_work refill;
+
+	/* Only touched by this queue's NAPI poll; see virtnet_get_stats. */
+	unsigned long rx_packets;
+	unsigned long rx_bytes;
+
+	/* Name of this receive queue: input.$index */
+	char name[40];
+};
+
 struct virtnet_info
 {
 	struct virtio_device *vdev;
-	struct virtqueue *rvq, *svq, *cvq;
+	struct virtqueue *cvq;
 	struct net_device *dev;
-	struct napi_struct napi;
+	struct send_queue *sq;
+	struct receive_queue *rq;
 	unsigned int status;
 
-	/* Number of input buffers, and max we've ever had. */
-	unsigned int num, max;
+	/* Max # of queue pairs supported by the device */
+	u16 max_queue_pairs;
+
+	/* # of queue pairs currently used by the driver */
+	u16 curr_queue_pairs;
 
 	/* I like... big packets and I cannot lie! */
 	bool big_packets;
@@ -56,15 +103,17 @@ struct virtnet_info
 	/* Host will merge rx buffers for big packets (shake it! shake it!) */
 	bool mergeable_rx_bufs;
 
-	/* Receive & send queues. */
-	struct sk_buff_head recv;
-	struct sk_buff_head send;
+	/* Has control virtqueue */
+	bool has_cvq;
 
-	/* Work struct for refilling if we run low on memory. */
-	struct delayed_work refill;
+	/* Queue pairs are pinned one per cpu, interrupts included. */
+	bool affinity_set;
 
-	/* Chain pages by the private ptr. */
-	struct page *pages;
+	/* Per-cpu transmit queue used when the skb carries no rx queue. */
+	int *vq_index;
+
+	/* Redoes the cpu to queue mapping as cpus come and go. */
+	struct notifier_block nb;
 };
 
 struct skb_vnet_hdr {
@@ -80,48 +129,80 @@ static inline struct skb_vnet_hdr *skb_vnet_hdr(struct sk_buff *skb)
 	return (struct skb_vnet_hdr *)skb->cb;
 }
 
-static void give_a_page(struct virtnet_info *vi, struct page *page)
+/* Converting between virtqueue no. and kernel tx/rx queue no.
+ * 0:rx0 1:tx0 2:rx1 3:tx1 ... 2N:rxN 2N+1:txN 2N+2:cvq
+ */
+static int vq2txq(struct virtqueue *vq)
+{
+	return (vq->index - 1) / 2;
+}
+
+static int txq2vq(int txq)
 {
-	page->private = (unsigned long)vi->pages;
-	vi->pages = page;
+	return txq * 2 + 1;
 }
 
-static void trim_pages(struct virtnet_info *vi, struct sk_buff *skb)
+static int vq2rxq(struct virtqueue *vq)
+{
+	return vq->index / 2;
+}
+
+static int rxq2vq(int rxq)
+{
+	return rxq * 2;
+}
+
+static void give_a_page(struct receive_queue *rq, struct page *page)
+{
+	page->private = (unsigned long)rq->pages;
+	rq->pages = page;
+}
+
+static void trim_pages(struct receive_queue *rq, struct sk_buff *skb)
 {
 	unsigned int i;
 
 	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++)
-		give_a_page(vi, skb_shinfo(skb)->frags[i].page);
+		give_a_page(rq, skb_shinfo(skb)->frags[i].page);
 	skb_shinfo(skb)->nr_frags = 0;
 	skb->data_len = 0;
 }
 
-static struct page *get_a_page(struct virtnet_info *vi, gfp_t gfp_mask)
+static struct page *get_a_page(struct receive_queue *rq, gfp_t gfp_mask)
 {
-	struct page *p = vi->pages;
+	struct page *p = rq->pages;
 
 	if (p)
-		vi->pages = (struct page *)p->private;
+		rq->pages = (struct page *)p->private;
 	else
 		p = alloc_page(gfp_mask);
 	return p;
 }
 
-static void skb_xmit_done(struct virtqueue *svq)
+static void skb_xmit_done(struct virtqueue *vq)
 {
-	struct virtnet_info *vi = svq->vdev->priv;
+	struct virtnet_info *vi = vq->vdev->priv;
+	int qnum = vq2txq(vq);
 
 	/* Suppress further interrupts. */
-	svq->vq_ops->disable_cb(svq);
+	vq->vq_ops->disable_cb(vq);
 
 	/* We were probably waiting for more output buffers. */
-	netif_wake_queue(vi->dev);
+	netif_wake_subqueue(vi->dev, qnum);
+
+	/*
+	 * If the stack stopped the queue instead, nothing will call
+	 * start_xmit to free the sent buffers: do it from the tasklet.
+	 */
+	if (netif_xmit_stopped(netdev_get_tx_queue(vi->dev, qnum)))
+		tasklet_schedule(&vi->sq[qnum].tasklet);
 }
 
-static void receive_skb(struct net_device *dev, struct sk_buff *skb,
+static void receive_skb(struct receive_queue *rq, struct sk_buff *skb,
 			unsigned len)
 {
-	struct virtnet_info *vi = netdev_priv(dev);
+	struct virtnet_info *vi = rq->vq->vdev->priv;
+	struct net_device *dev = vi->dev;
 	struct skb_vnet_hdr *hdr = skb_vnet_hdr(skb);
 	int err;
 	int i;
@@ -152,7 +233,7 @@ static void receive_skb(struct net_device *dev, struct sk_buff *skb,
 		len -= copy;
 
 		if (!len) {
-			give_a_page(vi, skb_shinfo(skb)->frags[0].page);
+			give_a_page(rq, skb_shinfo(skb)->frags[0].page);
 			skb_shinfo(skb)->nr_frags--;
 		} else {
 			skb_shinfo(skb)->frags[0].page_offset +=
@@ -173,7 +254,7 @@ static void receive_skb(struct net_device *dev, struct sk_buff *skb,
 				goto drop;
 			}
 
-			nskb = vi->rvq->vq_ops->get_buf(vi->rvq, &len);
+			nskb = rq->vq->vq_ops->get_buf(rq->vq, &len);
 			if (!nskb) {
 				pr_debug("%s: rx error: %d buffers missing\n",
 					 dev->name, hdr->mhdr.num_buffers);
@@ -181,8 +262,8 @@ static void receive_skb(struct net_device *dev, struct sk_buff *skb,
 				goto drop;
 			}
 
-			__skb_unlink(nskb, &vi->recv);
-			vi->num--;
+			__skb_unlink(nskb, &rq->skbs);
+			rq->num--;
 
 			skb_shinfo(skb)->frags[i] = skb_shinfo(nskb)->frags[0];
 			skb_shinfo(nskb)->nr_frags = 0;
@@ -200,7 +281,7 @@ static void receive_skb(struct net_device *dev, struct sk_buff *skb,
 		len -= sizeof(hdr->hdr);
 
 		if (len <= MAX_PACKET_LEN)
-			trim_pages(vi, skb);
+			trim_pages(rq, skb);
 
 		err = pskb_trim(skb, len);
 		if (err) {
@@ -212,8 +293,8 @@ static void receive_skb(struct net_device *dev, struct sk_buff *skb,
 	}
 
 	skb->truesize += skb->data_len;
-	dev->stats.rx_bytes += skb->len;
-	dev->stats.rx_packets++;
+	rq->rx_bytes += skb->len;
+	rq->rx_packets++;
 
 	if (hdr->hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
 		pr_debug("Needs csum!\n");
@@ -262,6 +343,7 @@ static void receive_skb(struct net_device *dev, struct sk_buff *skb,
 		skb_shinfo(skb)->gso_segs = 0;
 	}
 
+	skb_record_rx_queue(skb, vq2rxq(rq->vq));
 	netif_receive_skb(skb);
 	return;
 
@@ -271,8 +353,9 @@ drop:
 	dev_kfree_skb(skb);
 }
 
-static bool try_fill_recv_maxbufs(struct virtnet_info *vi, gfp_t gfp)
+static bool try_fill_recv_maxbufs(struct receive_queue *rq, gfp_t gfp)
 {
+	struct virtnet_info *vi = rq->vq->vdev->priv;
 	struct sk_buff *skb;
 	struct scatterlist sg[2+MAX_SKB_FRAGS];
 	int num, err, i;
@@ -297,7 +380,7 @@ static bool try_fill_recv_maxbufs(struct virtnet_info *vi, gfp_t gfp)
 		if (vi->big_packets) {
 			for (i = 0; i < MAX_SKB_FRAGS; i++) {
 				skb_frag_t *f = &skb_shinfo(skb)->frags[i];
-				f->page = get_a_page(vi, gfp);
+				f->page = get_a_page(rq, gfp);
 				if (!f->page)
 					break;
 
@@ -312,33 +395,34 @@ static bool try_fill_recv_maxbufs(struct virtnet_info *vi, gfp_t gfp)
 		}
 
 		num = skb_to_sgvec(skb, sg+1, 0, skb->len) + 1;
-		skb_queue_head(&vi->recv, skb);
+		skb_queue_head(&rq->skbs, skb);
 
-		err = vi->rvq->vq_ops->add_buf(vi->rvq, sg, 0, num, skb);
+		err = rq->vq->vq_ops->add_buf(rq->vq, sg, 0, num, skb);
 		if (err < 0) {
-			skb_unlink(skb, &vi->recv);
-			trim_pages(vi, skb);
+			skb_unlink(skb, &rq->skbs);
+			trim_pages(rq, skb);
 			kfree_skb(skb);
 			break;
 		}
-		vi->num++;
+		rq->num++;
 	} while (err >= num);
-	if (unlikely(vi->num > vi->max))
-		vi->max = vi->num;
-	vi->rvq->vq_ops->kick(vi->rvq);
+	if (unlikely(rq->num > rq->max))
+		rq->max = rq->num;
+	rq->vq->vq_ops->kick(rq->vq);
 	return !oom;
 }
 
 /* Returns false if we couldn't fill entirely (OOM). */
-static bool try_fill_recv(struct virtnet_info *vi, gfp_t gfp)
+static bool try_fill_recv(struct receive_queue *rq, gfp_t gfp)
 {
+	struct virtnet_info *vi = rq->vq->vdev->priv;
 	struct sk_buff *skb;
 	struct scatterlist sg[1];
 	int err;
 	bool oom = false;
 
 	if (!vi->mergeable_rx_bufs)
-		return try_fill_recv_maxbufs(vi, gfp);
+		return try_fill_recv_maxbufs(rq, gfp);
 
 	do {
 		skb_frag_t *f;
@@ -352,7 +436,7 @@ static bool try_fill_recv(struct virtnet_info *vi, gfp_t gfp)
 		skb_reserve(skb, NET_IP_ALIGN);
 
 		f = &skb_shinfo(skb)->frags[0];
-		f->page = get_a_page(vi, gfp);
+		f->page = get_a_page(rq, gfp);
 		if (!f->page) {
 			oom = true;
 			kfree_skb(skb);
@@ -365,75 +449,99 @@ static bool try_fill_recv(struct virtnet_info *vi, gfp_t gfp)
 		skb_shinfo(skb)->nr_frags++;
 
 		sg_init_one(sg, page_address(f->page), PAGE_SIZE);
-		skb_queue_head(&vi->recv, skb);
+		skb_queue_head(&rq->skbs, skb);
 
-		err = vi->rvq->vq_ops->add_buf(vi->rvq, sg, 0, 1, skb);
+		err = rq->vq->vq_ops->add_buf(rq->vq, sg, 0, 1, skb);
 		if (err < 0) {
-			skb_unlink(skb, &vi->recv);
+			skb_unlink(skb, &rq->skbs);
 			kfree_skb(skb);
 			break;
 		}
-		vi->num++;
+		rq->num++;
 	} while (err > 0);
-	if (unlikely(vi->num > vi->max))
-		vi->max = vi->num;
-	vi->rvq->vq_ops->kick(vi->rvq);
+	if (unlikely(rq->num > rq->max))
+		rq->max = rq->num;
+	rq->vq->vq_ops->kick(rq->vq);
 	return !oom;
 }
 
 static void skb_recv_done(struct virtqueue *rvq)
 {
 	struct virtnet_info *vi = rvq->vdev->priv;
+	struct receive_queue *rq = &vi->rq[vq2rxq(rvq)];
+
 	/* Schedule NAPI, Suppress further interrupts if successful. */
-	if (napi_schedule_prep(&vi->napi)) {
+	if (napi_schedule_prep(&rq->napi)) {
 		rvq->vq_ops->disable_cb(rvq);
-		__napi_schedule(&vi->napi);
+		__napi_schedule(&rq->napi);
+	}
+}
+
+static void virtnet_napi_enable(struct receive_queue *rq)
+{
+	napi_enable(&rq->napi);
+
+	/* If all buffers were filled by other side before we napi_enabled, we
+	 * won't get another interrupt, so process any outstanding packets
+	 * now.  virtnet_poll wants re-enable the queue, so we disable here.
+	 * We synchronize against interrupts via NAPI_STATE_SCHED */
+	if (napi_schedule_prep(&rq->napi)) {
+		rq->vq->vq_ops->disable_cb(rq->vq);
+		__napi_schedule(&rq->napi);
 	}
 }
 
 static void refill_work(struct work_struct *work)
 {
+	struct receive_queue *rq;
 	struct virtnet_info *vi;
 	bool still_empty;
 
-	vi = container_of(work, struct virtnet_info, refill.work);
-	napi_disable(&vi->napi);
-	try_fill_recv(vi, GFP_KERNEL);
-	still_empty = (vi->num == 0);
-	napi_enable(&vi->napi);
+	rq = container_of(work, struct receive_queue, refill.work);
+	vi = rq->vq->vdev->priv;
+
+	/* virtnet_close() has disabled NAPI, or is about to. */
+	if (!netif_running(vi->dev))
+		return;
+
+	napi_disable(&rq->napi);
+	try_fill_recv(rq, GFP_KERNEL);
+	still_empty = (rq->num == 0);
+	virtnet_napi_enable(rq);
 
 	/* In theory, this can happen: if we don't get any buffers in
 	 * we will *never* try to fill again. */
 	if (still_empty)
-		schedule_delayed_work(&vi->refill, HZ/2);
+		schedule_delayed_work(&rq->refill, HZ/2);
 }
 
 static int virtnet_poll(struct napi_struct *napi, int budget)
 {
-	struct virtnet_info *vi = container_of(napi, struct virtnet_info, napi);
+	struct receive_queue *rq =
+		container_of(napi, struct receive_queue, napi);
 	struct sk_buff *skb = NULL;
 	unsigned int len, received = 0;
 
 again:
 	while (received < budget &&
-	       (skb = vi->rvq->vq_ops->get_buf(vi->rvq, &len)) != NULL) {
-		__skb_unlink(skb, &vi->recv);
-		receive_skb(vi->dev, skb, len);
-		vi->num--;
+	       (skb = rq->vq->vq_ops->get_buf(rq->vq, &len)) != NULL) {
+		__skb_unlink(skb, &rq->skbs);
+		receive_skb(rq, skb, len);
+		rq->num--;
 		received++;
 	}
 
-	if (vi->num < vi->max / 2) {
-		if (!try_fill_recv(vi, GFP_ATOMIC))
-			schedule_delayed_work(&vi->refill, 0);
+	if (rq->num < rq->max / 2) {
+		if (!try_fill_recv(rq, GFP_ATOMIC))
+			schedule_delayed_work(&rq->refill, 0);
 	}
 
 	/* Out of packets? */
 	if (received < budget) {
 		napi_complete(napi);
-		if (unlikely(!vi->rvq->vq_ops->enable_cb(vi->rvq))
+		if (unlikely(!rq->vq->vq_ops->enable_cb(rq->vq))
 		    && napi_schedule_prep(napi)) {
-			vi->rvq->vq_ops->disable_cb(vi->rvq);
+			rq->vq->vq_ops->disable_cb(rq->vq);
 			__napi_schedule(napi);
 			goto again;
 		}
@@ -442,24 +550,47 @@ again:
 	return received;
 }
 
-static unsigned int free_old_xmit_skbs(struct virtnet_info *vi)
+/* Called with the tx lock of the queue held. */
+static unsigned int free_old_xmit_skbs(struct send_queue *sq,
+				       struct netdev_queue *txq)
 {
 	struct sk_buff *skb;
 	unsigned int len, tot_sgs = 0;
+	unsigned int bytes = 0, packets = 0;
 
-	while ((skb = vi->svq->vq_ops->get_buf(vi->svq, &len)) != NULL) {
+	while ((skb = sq->vq->vq_ops->get_buf(sq->vq, &len)) != NULL) {
 		pr_debug("Sent skb %p\n", skb);
-		__skb_unlink(skb, &vi->send);
-		vi->dev->stats.tx_bytes += skb->len;
-		vi->dev->stats.tx_packets++;
+		__skb_unlink(skb, &sq->skbs);
+		bytes += skb->len;
+		packets++;
 		tot_sgs += skb_vnet_hdr(skb)->num_sg;
 		dev_kfree_skb_any(skb);
 	}
+	txq->tx_bytes += bytes;
+	txq->tx_packets += packets;
+	netdev_tx_completed_queue(txq, packets, bytes);
 	return tot_sgs;
 }
 
-static int xmit_skb(struct virtnet_info *vi, struct sk_buff *skb)
+static void xmit_tasklet(unsigned long data)
+{
+	struct send_queue *sq = (struct send_queue *)data;
+	struct virtnet_info *vi = sq->vq->vdev->priv;
+	struct netdev_queue *txq = netdev_get_tx_queue(vi->dev,
+						       vq2txq(sq->vq));
+
+	__netif_tx_lock(txq, smp_processor_id());
+	do {
+		free_old_xmit_skbs(sq, txq);
+		/* Still over the limit: wait for the next completion. */
+	} while (netif_xmit_stopped(txq) &&
+		 unlikely(!sq->vq->vq_ops->enable_cb(sq->vq)));
+	__netif_tx_unlock(txq);
+}
+
+static int xmit_skb(struct send_queue *sq, struct sk_buff *skb)
 {
+	struct virtnet_info *vi = sq->vq->vdev->priv;
 	struct scatterlist sg[2+MAX_SKB_FRAGS];
 	struct skb_vnet_hdr *hdr = skb_vnet_hdr(skb);
 	const unsigned char *dest = ((struct ethhdr *)skb->data)->h_dest;
@@ -504,33 +635,37 @@ static int xmit_skb(struct virtnet_info *vi, struct sk_buff *skb)
 		sg_set_buf(sg, &hdr->hdr, sizeof(hdr->hdr));
 
 	hdr->num_sg = skb_to_sgvec(skb, sg+1, 0, skb->len) + 1;
-	return vi->svq->vq_ops->add_buf(vi->svq, sg, hdr->num_sg, 0, skb);
+	return sq->vq->vq_ops->add_buf(sq->vq, sg, hdr->num_sg, 0, skb);
 }
 
 static netdev_tx_t start_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct virtnet_info *vi = netdev_priv(dev);
+	int qnum = skb_get_queue_mapping(skb);
+	struct send_queue *sq = &vi->sq[qnum];
+	struct netdev_queue *txq = netdev_get_tx_queue(dev, qnum);
 	int capacity;
 
 again:
 	/* Free up any pending old buffers before queueing new ones. */
-	free_old_xmit_skbs(vi);
+	free_old_xmit_skbs(sq, txq);
 
 	/* Try to transmit */
-	capacity = xmit_skb(vi, skb);
+	capacity = xmit_skb(sq, skb);
 
 	/* This can happen with OOM and indirect buffers. */
 	if (unlikely(capacity < 0)) {
-		netif_stop_queue(dev);
+		netif_stop_subqueue(dev, qnum);
 		dev_warn(&dev->dev, "Unexpected full queue\n");
-		if (unlikely(!vi->svq->vq_ops->enable_cb(vi->svq))) {
-			vi->svq->vq_ops->disable_cb(vi->svq);
-			netif_start_queue(dev);
+		if (unlikely(!sq->vq->vq_ops->enable_cb(sq->vq))) {
+			sq->vq->vq_ops->disable_cb(sq->vq);
+			netif_start_subqueue(dev, qnum);
 			goto again;
 		}
 		return NETDEV_TX_BUSY;
 	}
-	vi->svq->vq_ops->kick(vi->svq);
+	netdev_tx_sent_queue(txq, skb->len);
+	sq->vq->vq_ops->kick(sq->vq);
 
 	/*
 	 * Put new one in send queue.  You'd expect we'd need this before
@@ -539,7 +674,7 @@ again:
 	 * another call back here, normal network xmit locking prevents the
 	 * race.
 	 */
-	__skb_queue_head(&vi->send, skb);
+	__skb_queue_head(&sq->skbs, skb);
 
 	/* Don't wait up for transmitted skbs to be freed. */
 	skb_orphan(skb);
@@ -548,20 +683,73 @@ again:
 	/* Apparently nice girls don't return TX_BUSY; stop the queue
 	 * before it gets out of hand.  Naturally, this wastes entries. */
 	if (capacity < 2+MAX_SKB_FRAGS) {
-		netif_stop_queue(dev);
-		if (unlikely(!vi->svq->vq_ops->enable_cb(vi->svq))) {
+		netif_stop_subqueue(dev, qnum);
+		if (unlikely(!sq->vq->vq_ops->enable_cb(sq->vq))) {
 			/* More just got used, free them then recheck. */
-			capacity += free_old_xmit_skbs(vi);
+			capacity += free_old_xmit_skbs(sq, txq);
 			if (capacity >= 2+MAX_SKB_FRAGS) {
-				netif_start_queue(dev);
-				vi->svq->vq_ops->disable_cb(vi->svq);
+				netif_start_subqueue(dev, qnum);
+				sq->vq->vq_ops->disable_cb(sq->vq);
 			}
 		}
 	}
 
+	/*
+	 * Byte queue limits stopped the queue: we must hear about the
+	 * next completion, since no more start_xmit calls will come.
+	 */
+	if (netif_xmit_stopped(txq) &&
+	    unlikely(!sq->vq->vq_ops->enable_cb(sq->vq)))
+		tasklet_schedule(&sq->tasklet);
+
 	return NETDEV_TX_OK;
 }
 
+/*
+ * Forwarded packets leave on the queue pair they came in on; locally
+ * generated ones use the queue of the sending cpu, which is the one
+ * whose interrupts are steered to that cpu, see virtnet_set_affinity.
+ */
+static u16 virtnet_select_queue(struct net_device *dev, struct sk_buff *skb)
+{
+	struct virtnet_info *vi = netdev_priv(dev);
+	int txq;
+
+	if (skb_rx_queue_recorded(skb))
+		txq = skb_get_rx_queue(skb);
+	else
+		txq = *per_cpu_ptr(vi->vq_index, raw_smp_processor_id());
+
+	while (unlikely(txq >= dev->real_num_tx_queues))
+		txq -= dev->real_num_tx_queues;
+
+	return txq;
+}
+
+static struct net_device_stats *virtnet_get_stats(struct net_device *dev)
+{
+	struct virtnet_info *vi = netdev_priv(dev);
+	struct net_device_stats *stats = &dev->stats;
+	unsigned long rx_packets = 0, rx_bytes = 0;
+	unsigned long tx_packets = 0, tx_bytes = 0;
+	int i;
+
+	for (i = 0; i < vi->max_queue_pairs; i++) {
+		struct netdev_queue *txq = netdev_get_tx_queue(dev, i);
+
+		rx_packets += vi->rq[i].rx_packets;
+		rx_bytes += vi->rq[i].rx_bytes;
+		tx_packets += txq->tx_packets;
+		tx_bytes += txq->tx_bytes;
+	}
+
+	stats->rx_packets = rx_packets;
+	stats->rx_bytes = rx_bytes;
+	stats->tx_packets = tx_packets;
+	stats->tx_bytes = tx_bytes;
+	return stats;
+}
+
 static int virtnet_set_mac_address(struct net_device *dev, void *p)
 {
 	struct virtnet_info *vi = netdev_priv(dev);
@@ -583,25 +771,20 @@ static int virtnet_set_mac_address(struct net_device *dev, void *p)
 static void virtnet_netpoll(struct net_device *dev)
 {
 	struct virtnet_info *vi = netdev_priv(dev);
+	int i;
 
-	napi_schedule(&vi->napi);
+	for (i = 0; i < vi->curr_queue_pairs; i++)
+		napi_schedule(&vi->rq[i].napi);
 }
 #endif
 
 static int virtnet_open(struct net_device *dev)
 {
 	struct virtnet_info *vi = netdev_priv(dev);
+	int i;
 
-	napi_enable(&vi->napi);
-
-	/* If all buffers were filled by other side before we napi_enabled, we
-	 * won't get another interrupt, so process any outstanding packets
-	 * now.  virtnet_poll wants re-enable the queue, so we disable here.
-	 * We synchronize against interrupts via NAPI_STATE_SCHED */
-	if (napi_schedule_prep(&vi->napi)) {
-		vi->rvq->vq_ops->disable_cb(vi->rvq);
-		__napi_schedule(&vi->napi);
-	}
+	for (i = 0; i < vi->max_queue_pairs; i++)
+		virtnet_napi_enable(&vi->rq[i]);
 	return 0;
 }
 
@@ -650,11 +833,39 @@ static bool virtnet_send_command(struct virtnet_info *vi, u8 class, u8 cmd,
 	return status == VIRTIO_NET_OK;
 }
 
+static int virtnet_set_queues(struct virtnet_info *vi, u16 queue_pairs)
+{
+	struct scatterlist sg;
+	struct virtio_net_ctrl_mq s;
+	struct net_device *dev = vi->dev;
+
+	if (!vi->has_cvq || !virtio_has_feature(vi->vdev, VIRTIO_NET_F_MQ))
+		return 0;
+
+	s.virtqueue_pairs = queue_pairs;
+	sg_init_one(&sg, &s, sizeof(s));
+
+	if (!virtnet_send_command(vi, VIRTIO_NET_CTRL_MQ,
+				  VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET, &sg, 1, 0)) {
+		dev_warn(&dev->dev, "Failed to set num of queue pairs to %d\n",
+			 queue_pairs);
+		return -EINVAL;
+	}
+
+	vi->curr_queue_pairs = queue_pairs;
+	return 0;
+}
+
 static int virtnet_close(struct net_device *dev)
 {
 	struct virtnet_info *vi = netdev_priv(dev);
+	int i;
 
-	napi_disable(&vi->napi);
+	for (i = 0; i < vi->max_queue_pairs; i++) {
+		/* Refill work finds the device down from now on. */
+		cancel_delayed_work_sync(&vi->rq[i].refill);
+		napi_disable(&vi->rq[i].napi);
+	}
 
 	return 0;
 }
@@ -766,12 +977,115 @@ static void virtnet_vlan_rx_kill_vid(struct net_device *dev, u16 vid)
 		dev_warn(&dev->dev, "Failed to kill VLAN ID %d.\n", vid);
 }
 
+/*
+ * Spread the online cpus over the queue pairs in use.  With exactly one
+ * pair per cpu, each pair is made private to its cpu: transmit uses it
+ * and both its interrupts are steered there.  Called with cpu hotplug
+ * excluded.
+ */
+static void virtnet_set_affinity(struct virtnet_info *vi)
+{
+	bool pin;
+	int i, cpu;
+
+	pin = vi->curr_queue_pairs > 1 &&
+	      vi->curr_queue_pairs == num_online_cpus();
+
+	if (!pin && vi->affinity_set) {
+		for (i = 0; i < vi->max_queue_pairs; i++) {
+			virtqueue_set_affinity(vi->rq[i].vq, -1);
+			virtqueue_set_affinity(vi->sq[i].vq, -1);
+		}
+	}
+
+	i = 0;
+	for_each_online_cpu(cpu) {
+		if (pin) {
+			virtqueue_set_affinity(vi->rq[i].vq, cpu);
+			virtqueue_set_affinity(vi->sq[i].vq, cpu);
+		}
+		*per_cpu_ptr(vi->vq_index, cpu) = i;
+		if (++i == vi->curr_queue_pairs)
+			i = 0;
+	}
+
+	vi->affinity_set = pin;
+}
+
+static int virtnet_cpu_callback(struct notifier_block *nfb,
+				unsigned long action, void *hcpu)
+{
+	struct virtnet_info *vi = container_of(nfb, struct virtnet_info, nb);
+
+	switch (action & ~CPU_TASKS_FROZEN) {
+	case CPU_ONLINE:
+	case CPU_DOWN_FAILED:
+	case CPU_DEAD:
+		virtnet_set_affinity(vi);
+		break;
+	default:
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+static void virtnet_get_channels(struct net_device *dev,
+				 struct ethtool_channels *channels)
+{
+	struct virtnet_info *vi = netdev_priv(dev);
+
+	channels->combined_count = vi->curr_queue_pairs;
+	channels->max_combined = vi->max_queue_pairs;
+	channels->max_other = 0;
+	channels->rx_count = 0;
+	channels->tx_count = 0;
+	channels->other_count = 0;
+}
+
+static int virtnet_set_channels(struct net_device *dev,
+				struct ethtool_channels *channels)
+{
+	struct virtnet_info *vi = netdev_priv(dev);
+	u32 queue_pairs = channels->combined_count;
+	bool running;
+	int err;
+
+	/* We don't support separate rx/tx channels.
+	 * We don't allow setting 'other' channels.
+	 */
+	if (channels->rx_count || channels->tx_count || channels->other_count)
+		return -EINVAL;
+
+	if (queue_pairs > vi->max_queue_pairs || queue_pairs == 0)
+		return -EINVAL;
+
+	get_online_cpus();
+	/* Hold transmitters off while flows move to their new queues, so
+	 * that no packet is sent on an old queue after one on a new queue.
+	 */
+	running = netif_running(dev);
+	if (running)
+		netif_tx_disable(dev);
+	err = virtnet_set_queues(vi, queue_pairs);
+	if (!err) {
+		netif_set_real_num_tx_queues(dev, queue_pairs);
+		virtnet_set_affinity(vi);
+	}
+	if (running)
+		netif_tx_wake_all_queues(dev);
+	put_online_cpus();
+
+	return err;
+}
+
 static const struct ethtool_ops virtnet_ethtool_ops = {
 	.set_tx_csum = virtnet_set_tx_csum,
 	.set_sg = ethtool_op_set_sg,
 	.set_tso = ethtool_op_set_tso,
 	.set_ufo = ethtool_op_set_ufo,
 	.get_link = ethtool_op_get_link,
+	.get_channels = virtnet_get_channels,
+	.set_channels = virtnet_set_channels,
 };
 
 #define MIN_MTU 68
@@ -789,6 +1103,8 @@ static const struct net_device_ops virtnet_netdev = {
 	.ndo_open            = virtnet_open,
 	.ndo_stop   	     = virtnet_close,
 	.ndo_start_xmit      = start_xmit,
+	.ndo_select_queue    = virtnet_select_queue,
+	.ndo_get_stats       = virtnet_get_stats,
 	.ndo_validate_addr   = eth_validate_addr,
 	.ndo_set_mac_address = virtnet_set_mac_address,
 	.ndo_set_rx_mode     = virtnet_set_rx_mode,
@@ -821,10 +1137,10 @@ static void virtnet_update_status(struct virtnet_info *vi)
 
 	if (vi->status & VIRTIO_NET_S_LINK_UP) {
 		netif_carrier_on(vi->dev);
-		netif_wake_queue(vi->dev);
+		netif_tx_wake_all_queues(vi->dev);
 	} else {
 		netif_carrier_off(vi->dev);
-		netif_stop_queue(vi->dev);
+		netif_tx_stop_all_queues(vi->dev);
 	}
 }
 
@@ -835,18 +1151,154 @@ static void virtnet_config_changed(struct virtio_device *vdev)
 	virtnet_update_status(vi);
 }
 
+static int virtnet_alloc_queues(struct virtnet_info *vi)
+{
+	int i;
+
+	vi->sq = kzalloc(sizeof(*vi->sq) * vi->max_queue_pairs, GFP_KERNEL);
+	if (!vi->sq)
+		goto err_sq;
+	vi->rq = kzalloc(sizeof(*vi->rq) * vi->max_queue_pairs, GFP_KERNEL);
+	if (!vi->rq)
+		goto err_rq;
+
+	for (i = 0; i < vi->max_queue_pairs; i++) {
+		netif_napi_add(vi->dev, &vi->rq[i].napi, virtnet_poll,
+			       napi_weight);
+		INIT_DELAYED_WORK(&vi->rq[i].refill, refill_work);
+		skb_queue_head_init(&vi->rq[i].skbs);
+
+		skb_queue_head_init(&vi->sq[i].skbs);
+		tasklet_init(&vi->sq[i].tasklet, xmit_tasklet,
+			     (unsigned long)&vi->sq[i]);
+	}
+
+	return 0;
+
+err_rq:
+	kfree(vi->sq);
+err_sq:
+	return -ENOMEM;
+}
+
+static void virtnet_free_queues(struct virtnet_info *vi)
+{
+	int i;
+
+	for (i = 0; i < vi->max_queue_pairs; i++)
+		netif_napi_del(&vi->rq[i].napi);
+
+	kfree(vi->rq);
+	kfree(vi->sq);
+}
+
+static int virtnet_find_vqs(struct virtnet_info *vi)
+{
+	vq_callback_t **callbacks;
+	struct virtqueue **vqs;
+	const char **names;
+	int ret = -ENOMEM;
+	int i, total_vqs;
+
+	/* We expect 1 RX virtqueue followed by 1 TX virtqueue, followed by
+	 * possible N-1 RX/TX queue pairs used in multiqueue mode, followed by
+	 * possible control vq.
+	 */
+	total_vqs = vi->max_queue_pairs * 2 + vi->has_cvq;
+
+	vqs = kzalloc(total_vqs * sizeof(*vqs), GFP_KERNEL);
+	if (!vqs)
+		goto err_vq;
+	callbacks = kmalloc(total_vqs * sizeof(*callbacks), GFP_KERNEL);
+	if (!callbacks)
+		goto err_callback;
+	names = kmalloc(total_vqs * sizeof(*names), GFP_KERNEL);
+	if (!names)
+		goto err_names;
+
+	/* Parameters for control virtqueue, if any */
+	if (vi->has_cvq) {
+		callbacks[total_vqs - 1] = NULL;
+		names[total_vqs - 1] = "control";
+	}
+
+	/* Allocate/initialize parameters for send/receive virtqueues */
+	for (i = 0; i < vi->max_queue_pairs; i++) {
+		callbacks[rxq2vq(i)] = skb_recv_done;
+		callbacks[txq2vq(i)] = skb_xmit_done;
+		sprintf(vi->rq[i].name, "input.%d", i);
+		sprintf(vi->sq[i].name, "output.%d", i);
+		names[rxq2vq(i)] = vi->rq[i].name;
+		names[txq2vq(i)] = vi->sq[i].name;
+	}
+
+	ret = vi->vdev->config->find_vqs(vi->vdev, total_vqs, vqs, callbacks,
+					 names);
+	if (ret)
+		goto err_find;
+
+	if (vi->has_cvq) {
+		vi->cvq = vqs[total_vqs - 1];
+
+		if (virtio_has_feature(vi->vdev, VIRTIO_NET_F_CTRL_VLAN))
+			vi->dev->features |= NETIF_F_HW_VLAN_FILTER;
+	}
+
+	for (i = 0; i < vi->max_queue_pairs; i++) {
+		vi->rq[i].vq = vqs[rxq2vq(i)];
+		vi->sq[i].vq = vqs[txq2vq(i)];
+	}
+
+err_find:
+	kfree(names);
+err_names:
+	kfree(callbacks);
+err_callback:
+	kfree(vqs);
+err_vq:
+	return ret;
+}
+
+static void free_receive_bufs(struct virtnet_info *vi)
+{
+	struct sk_buff *skb;
+	int i;
+
+	for (i = 0; i < vi->max_queue_pairs; i++) {
+		struct receive_queue *rq = &vi->rq[i];
+
+		while ((skb = __skb_dequeue(&rq->skbs)) != NULL) {
+			kfree_skb(skb);
+			rq->num--;
+		}
+		BUG_ON(rq->num != 0);
+
+		while (rq->pages)
+			__free_pages(get_a_page(rq, GFP_KERNEL), 0);
+	}
+}
+
 static int virtnet_probe(struct virtio_device *vdev)
 {
-	int err;
+	int i, err;
 	struct net_device *dev;
 	struct virtnet_info *vi;
-	struct virtqueue *vqs[3];
-	vq_callback_t *callbacks[] = { skb_recv_done, skb_xmit_done, NULL};
-	const char *names[] = { "input", "output", "control" };
-	int nvqs;
+	u16 max_queue_pairs;
+
+	/* Find if host supports multiqueue virtio_net device */
+	err = virtio_config_val(vdev, VIRTIO_NET_F_MQ,
+				offsetof(struct virtio_net_config,
+					 max_virtqueue_pairs),
+				&max_queue_pairs);
+
+	/* We need at least 2 queue's */
+	if (err || max_queue_pairs < VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MIN ||
+	    max_queue_pairs > VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MAX ||
+	    !virtio_has_feature(vdev, VIRTIO_NET_F_CTRL_VQ))
+		max_queue_pairs = 1;
 
 	/* Allocate ourselves a network device with room for our info */
-	dev = alloc_etherdev(sizeof(struct virtnet_info));
+	dev = alloc_etherdev_mq(sizeof(struct virtnet_info), max_queue_pairs);
 	if (!dev)
 		return -ENOMEM;
 
@@ -885,12 +1337,9 @@ static int virtnet_probe(struct virtio_device *vdev)
 
 	/* Set up our device-specific information */
 	vi = netdev_priv(dev);
-	netif_napi_add(dev, &vi->napi, virtnet_poll, napi_weight);
 	vi->dev = dev;
 	vi->vdev = vdev;
 	vdev->priv = vi;
-	vi->pages = NULL;
-	INIT_DELAYED_WORK(&vi->refill, refill_work);
 
 	/* If we can receive ANY GSO packets, we must allocate large ones. */
 	if (virtio_has_feature(vdev, VIRTIO_NET_F_GUEST_TSO4)
@@ -901,27 +1350,28 @@ static int virtnet_probe(struct virtio_device *vdev)
 	if (virtio_has_feature(vdev, VIRTIO_NET_F_MRG_RXBUF))
 		vi->mergeable_rx_bufs = true;
 
-	/* We expect two virtqueues, receive then send,
-	 * and optionally control. */
-	nvqs = virtio_has_feature(vi->vdev, VIRTIO_NET_F_CTRL_VQ) ? 3 : 2;
+	if (virtio_has_feature(vdev, VIRTIO_NET_F_CTRL_VQ))
+		vi->has_cvq = true;
 
-	err = vdev->config->find_vqs(vdev, nvqs, vqs, callbacks, names);
-	if (err)
-		goto free;
+	/* Use single tx/rx queue pair as default */
+	vi->curr_queue_pairs = 1;
+	vi->max_queue_pairs = max_queue_pairs;
 
-	vi->rvq = vqs[0];
-	vi->svq = vqs[1];
+	vi->vq_index = alloc_percpu(int);
+	if (!vi->vq_index) {
+		err = -ENOMEM;
+		goto free;
+	}
 
-	if (virtio_has_feature(vi->vdev, VIRTIO_NET_F_CTRL_VQ)) {
-		vi->cvq = vqs[2];
+	err = virtnet_alloc_queues(vi);
+	if (err)
+		goto free_index;
 
-		if (virtio_has_feature(vi->vdev, VIRTIO_NET_F_CTRL_VLAN))
-			dev->features |= NETIF_F_HW_VLAN_FILTER;
-	}
+	err = virtnet_find_vqs(vi);
+	if (err)
+		goto free_queues;
 
-	/* Initialize our empty receive and send queues. */
-	skb_queue_head_init(&vi->recv);
-	skb_queue_head_init(&vi->send);
+	netif_set_real_num_tx_queues(dev, vi->curr_queue_pairs);
 
 	err = register_netdev(dev);
 	if (err) {
@@ -930,11 +1380,23 @@ static int virtnet_probe(struct virtio_device *vdev)
 	}
 
 	/* Last of all, set up some receive buffers. */
-	try_fill_recv(vi, GFP_KERNEL);
+	for (i = 0; i < vi->max_queue_pairs; i++) {
+		try_fill_recv(&vi->rq[i], GFP_KERNEL);
 
-	/* If we didn't even get one input buffer, we're useless. */
-	if (vi->num == 0) {
-		err = -ENOMEM;
+		/* If we didn't even get one input buffer, we're useless. */
+		if (vi->rq[i].num == 0) {
+			err = -ENOMEM;
+			goto unregister;
+		}
+	}
+
+	get_online_cpus();
+	virtnet_set_affinity(vi);
+	vi->nb.notifier_call = &virtnet_cpu_callback;
+	err = register_hotcpu_notifier(&vi->nb);
+	put_online_cpus();
+	if (err) {
+		pr_debug("virtio_net: registering cpu notifier failed\n");
 		goto unregister;
 	}
 
@@ -942,14 +1404,20 @@ static int virtnet_probe(struct virtio_device *vdev)
 	virtnet_update_status(vi);
 	netif_carrier_on(dev);
 
-	pr_debug("virtnet: registered device %s\n", dev->name);
+	pr_debug("virtnet: registered device %s with %d RX and TX vq's\n",
+		 dev->name, max_queue_pairs);
 	return 0;
 
 unregister:
 	unregister_netdev(dev);
-	cancel_delayed_work_sync(&vi->refill);
+	vdev->config->reset(vdev);
+	free_receive_bufs(vi);
 free_vqs:
 	vdev->config->del_vqs(vdev);
+free_queues:
+	virtnet_free_queues(vi);
+free_index:
+	free_percpu(vi->vq_index);
 free:
 	free_netdev(dev);
 	return err;
@@ -958,28 +1426,26 @@ free:
 static void __devexit virtnet_remove(struct virtio_device *vdev)
 {
 	struct virtnet_info *vi = vdev->priv;
-	struct sk_buff *skb;
+	int i;
+
+	unregister_hotcpu_notifier(&vi->nb);
 
 	/* Stop all the virtqueues. */
 	vdev->config->reset(vdev);
-
-	/* Free our skbs in send and recv queues, if any. */
-	while ((skb = __skb_dequeue(&vi->recv)) != NULL) {
-		kfree_skb(skb);
-		vi->num--;
-	}
-	__skb_queue_purge(&vi->send);
-
-	BUG_ON(vi->num != 0);
+	for (i = 0; i < vi->max_queue_pairs; i++)
+		tasklet_kill(&vi->sq[i].tasklet);
 
 	unregister_netdev(vi->dev);
-	cancel_delayed_work_sync(&vi->refill);
 
-	vdev->config->del_vqs(vi->vdev);
+	/* Free our skbs in send and recv queues, if any. */
+	for (i = 0; i < vi->max_queue_pairs; i++)
+		__skb_queue_purge(&vi->sq[i].skbs);
+	free_receive_bufs(vi);
 
-	while (vi->pages)
-		__free_pages(get_a_page(vi, GFP_KERNEL), 0);
+	vdev->config->del_vqs(vi->vdev);
 
+	virtnet_free_queues(vi);
+	free_percpu(vi->vq_index);
 	free_netdev(vi->dev);
 }
 
@@ -996,6 +1462,7 @@ static unsigned int features[] = {
 	VIRTIO_NET_F_GUEST_ECN, VIRTIO_NET_F_GUEST_UFO,
 	VIRTIO_NET_F_MRG_RXBUF, VIRTIO_NET_F_STATUS, VIRTIO_NET_F_CTRL_VQ,
 	VIRTIO_NET_F_CTRL_RX, VIRTIO_NET_F_CTRL_VLAN,
+	VIRTIO_NET_F_MQ,
 };
 
 static struct virtio_driver virtio_net_driver = {
@@ -200,6 +200,7 @@ static struct virtqueue *kvm_find_vq(struct virtio_device *vdev,
 		err = -ENOMEM;
 		goto unmap;
 	}
+	vq->index = index;
 
 	/*
 	 * register a callback token
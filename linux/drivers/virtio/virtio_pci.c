@@ -407,6 +407,7 @@ static struct virtqueue *setup_vq(struct virtio_device *vdev, unsigned index,
 		goto out_activate_queue;
 	}
 
+	vq->index = index;
 	vq->priv = info;
 	info->vq = vq;
 
@@ -580,6 +581,32 @@ static int vp_find_vqs(struct virtio_device *vdev, unsigned nvqs,
 				  false, false);
 }
 
+/* Setup the affinity for a virtqueue.  Only a per vq MSI-X vector can
+ * follow it: with a shared vector or INTX the request is ignored. */
+static int vp_set_vq_affinity(struct virtqueue *vq, int cpu)
+{
+	struct virtio_device *vdev = vq->vdev;
+	struct virtio_pci_device *vp_dev = to_vp_device(vdev);
+	struct virtio_pci_vq_info *info = vq->priv;
+	const struct cpumask *mask;
+	unsigned int irq;
+
+	if (!vq->callback)
+		return -EINVAL;
+
+	if (!vp_dev->msix_enabled || !vp_dev->per_vq_vectors ||
+	    info->msix_vector == VIRTIO_MSI_NO_VECTOR)
+		return 0;
+
+	irq = vp_dev->msix_entries[info->msix_vector].vector;
+	if (cpu == -1)
+		mask = cpu_online_mask;
+	else
+		mask = cpumask_of(cpu);
+
+	return irq_set_affinity(irq, mask);
+}
+
 static struct virtio_config_ops virtio_pci_config_ops = {
 	.get		= vp_get,
 	.set		= vp_set,
@@ -590,6 +617,7 @@ static struct virtio_config_ops virtio_pci_config_ops = {
 	.del_vqs	= vp_del_vqs,
 	.get_features	= vp_get_features,
 	.finalize_features = vp_finalize_features,
+	.set_vq_affinity = vp_set_vq_affinity,
 };
 
 static void virtio_pci_release_dev(struct device *_d)
@@ -759,6 +759,7 @@ static long wb_writeback(struct bdi_writeback *wb,
 		.range_cyclic		= args->range_cyclic,
 	};
 	unsigned long oldest_jif;
+	unsigned long wb_start = jiffies;
 	long wrote = 0;
 	struct inode *inode;
 
@@ -794,6 +795,9 @@ static long wb_writeback(struct bdi_writeback *wb,
 		args->nr_pages -= MAX_WRITEBACK_PAGES - wbc.nr_to_write;
 		wrote += MAX_WRITEBACK_PAGES - wbc.nr_to_write;
 
+		/* keep the estimate of bdi write bandwidth current */
+		bdi_update_bandwidth(wb->bdi, 0, 0, 0, 0, 0, wb_start);
+
 		/*
 		 * If we consumed everything, see if we have more
 		 */
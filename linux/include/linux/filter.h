@@ -128,11 +128,16 @@ struct sock_fprog	/* Required for SO_ATTACH_FILTER. */
 #define SKF_LL_OFF    (-0x200000)
 
 #ifdef __KERNEL__
+struct sk_buff;
+struct sock;
+
 struct sk_filter
 {
 	atomic_t		refcnt;
 	unsigned int         	len;	/* Number of filter blocks */
 	struct rcu_head		rcu;
+	unsigned int		(*bpf_func)(const struct sk_buff *skb,
+					    const struct sock_filter *filter);
 	struct sock_filter     	insns[0];
 };
 
@@ -141,15 +146,40 @@ static inline unsigned int sk_filter_len(const struct sk_filter *fp)
 	return fp->len * sizeof(struct sock_filter) + sizeof(*fp);
 }
 
-struct sk_buff;
-struct sock;
-
 extern int sk_filter(struct sock *sk, struct sk_buff *skb);
 extern unsigned int sk_run_filter(struct sk_buff *skb,
 				  struct sock_filter *filter, int flen);
 extern int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk);
 extern int sk_detach_filter(struct sock *sk);
 extern int sk_chk_filter(struct sock_filter *filter, int flen);
+
+#ifdef CONFIG_BPF_JIT
+extern int bpf_jit_enable;
+extern void bpf_jit_compile(struct sk_filter *fp);
+extern void bpf_jit_free(struct sk_filter *fp);
+extern void *bpf_internal_load_pointer_neg_helper(const struct sk_buff *skb,
+						  int k, unsigned int size);
+extern int bpf_internal_load_ancillary_helper(const struct sk_buff *skb,
+					      int k, u32 A, u32 X, u32 *res);
+
+/*
+ * A filter the JIT could not (or was not asked to) translate keeps a
+ * NULL bpf_func and is run by the interpreter.
+ */
+#define SK_RUN_FILTER(FILTER, SKB)					\
+	((FILTER)->bpf_func ?						\
+	 (FILTER)->bpf_func(SKB, (FILTER)->insns) :			\
+	 sk_run_filter(SKB, (FILTER)->insns, (FILTER)->len))
+#else
+static inline void bpf_jit_compile(struct sk_filter *fp)
+{
+}
+static inline void bpf_jit_free(struct sk_filter *fp)
+{
+}
+#define SK_RUN_FILTER(FILTER, SKB)					\
+	sk_run_filter(SKB, (FILTER)->insns, (FILTER)->len)
+#endif
 #endif /* __KERNEL__ */
 
 #endif /* __LINUX_FILTER_H__ */
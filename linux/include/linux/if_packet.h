@@ -48,6 +48,13 @@ struct sockaddr_ll
 #define PACKET_RESERVE			12
 #define PACKET_TX_RING			13
 #define PACKET_LOSS			14
+#define PACKET_FANOUT			18
+
+#define PACKET_FANOUT_HASH		0
+#define PACKET_FANOUT_LB		1
+#define PACKET_FANOUT_CPU		2
+#define PACKET_FANOUT_ROLLOVER		3
+#define PACKET_FANOUT_FLAG_ROLLOVER	0x1000
 
 struct tpacket_stats
 {
@@ -55,6 +62,19 @@ struct tpacket_stats
 	unsigned int	tp_drops;
 };
 
+struct tpacket_stats_v3
+{
+	unsigned int	tp_packets;
+	unsigned int	tp_drops;
+	unsigned int	tp_freeze_q_cnt;
+};
+
+union tpacket_stats_u
+{
+	struct tpacket_stats stats1;
+	struct tpacket_stats_v3 stats3;
+};
+
 struct tpacket_auxdata
 {
 	__u32		tp_status;
@@ -71,6 +91,8 @@ struct tpacket_auxdata
 #define TP_STATUS_COPY		0x2
 #define TP_STATUS_LOSING	0x4
 #define TP_STATUS_CSUMNOTREADY	0x8
+#define TP_STATUS_VLAN_VALID	0x10	/* tp_vlan_tci is valid */
+#define TP_STATUS_BLK_TMO	0x20	/* block retired by timeout */
 
 /* Tx ring - header status */
 #define TP_STATUS_AVAILABLE	0x0
@@ -107,10 +129,82 @@ struct tpacket2_hdr
 
 #define TPACKET2_HDRLEN		(TPACKET_ALIGN(sizeof(struct tpacket2_hdr)) + sizeof(struct sockaddr_ll))
 
+struct tpacket_hdr_variant1
+{
+	__u32		tp_rxhash;
+	__u32		tp_vlan_tci;
+};
+
+struct tpacket3_hdr
+{
+	__u32		tp_next_offset;	/* offset of the next packet in the
+					 * block, 0 for the last one
+					 */
+	__u32		tp_sec;
+	__u32		tp_nsec;
+	__u32		tp_snaplen;
+	__u32		tp_len;
+	__u32		tp_status;
+	__u16		tp_mac;
+	__u16		tp_net;
+	/* pkt_hdr variants */
+	union {
+		struct tpacket_hdr_variant1 hv1;
+	};
+};
+
+#define TPACKET3_HDRLEN		(TPACKET_ALIGN(sizeof(struct tpacket3_hdr)) + sizeof(struct sockaddr_ll))
+
+struct tpacket_bd_ts
+{
+	unsigned int	ts_sec;
+	union {
+		unsigned int	ts_usec;
+		unsigned int	ts_nsec;
+	};
+};
+
+struct tpacket_hdr_v1
+{
+	__u32		block_status;
+	__u32		num_pkts;
+	__u32		offset_to_first_pkt;
+
+	/* Number of valid bytes in the block, including the block
+	 * descriptor and the private area.
+	 */
+	__u32		blk_len;
+
+	/* Sequence number of the block, incremented each time a block
+	 * is handed to the kernel. Readers can use it to detect that
+	 * they have missed blocks.
+	 */
+	__aligned_u64	seq_num;
+
+	/* ts_first_pkt is the time the block was opened and
+	 * ts_last_pkt the time of the last packet it holds, or the
+	 * time the block was retired by the timer if it is empty.
+	 */
+	struct tpacket_bd_ts	ts_first_pkt, ts_last_pkt;
+};
+
+union tpacket_bd_header_u
+{
+	struct tpacket_hdr_v1 bh1;
+};
+
+struct tpacket_block_desc
+{
+	__u32		version;
+	__u32		offset_to_priv;
+	union tpacket_bd_header_u hdr;
+};
+
 enum tpacket_versions
 {
 	TPACKET_V1,
 	TPACKET_V2,
+	TPACKET_V3,
 };
 
 /*
@@ -124,6 +218,18 @@ enum tpacket_versions
    - Start+tp_mac: [ Optional MAC header ]
    - Start+tp_net: Packet data, aligned to TPACKET_ALIGNMENT=16.
    - Pad to align to TPACKET_ALIGNMENT=16
+
+   TPACKET_V3 receive rings are made of blocks instead of frames:
+
+   - Start. struct tpacket_block_desc
+   - Optional private area of tp_sizeof_priv bytes at offset_to_priv
+   - offset_to_first_pkt: first struct tpacket3_hdr, followed by its
+     struct sockaddr_ll and packet data laid out as for V1/V2 frames.
+     Each packet starts 8 byte aligned; tp_next_offset of a packet
+     gives the offset of the next one, and is 0 for the last one.
+
+   The whole block belongs to user space once block_status has
+   TP_STATUS_USER set, and is given back by writing TP_STATUS_KERNEL.
  */
 
 struct tpacket_req
@@ -134,6 +240,26 @@ struct tpacket_req
 	unsigned int	tp_frame_nr;	/* Total number of frames */
 };
 
+/* Rx ring - feature request bits */
+#define TP_FT_REQ_FILL_RXHASH	0x1
+
+struct tpacket_req3
+{
+	unsigned int	tp_block_size;	/* Minimal size of contiguous block */
+	unsigned int	tp_block_nr;	/* Number of blocks */
+	unsigned int	tp_frame_size;	/* Size of frame */
+	unsigned int	tp_frame_nr;	/* Total number of frames */
+	unsigned int	tp_retire_blk_tov; /* timeout in msecs */
+	unsigned int	tp_sizeof_priv; /* offset to private data area */
+	unsigned int	tp_feature_req_word;
+};
+
+union tpacket_req_u
+{
+	struct tpacket_req	req;
+	struct tpacket_req3	req3;
+};
+
 struct packet_mreq
 {
 	int		mr_ifindex;
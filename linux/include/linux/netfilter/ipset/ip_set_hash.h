@@ -0,0 +1,84 @@
+#ifndef __IP_SET_HASH_H
+#define __IP_SET_HASH_H
+
+/* Hash type specific error codes */
+enum {
+	/* Hash is full */
+	IPSET_ERR_HASH_FULL = IPSET_ERR_TYPE_SPECIFIC,
+	/* Null-valued element */
+	IPSET_ERR_HASH_ELEM,
+	/* Invalid protocol */
+	IPSET_ERR_INVALID_PROTO,
+	/* Protocol missing but must be specified */
+	IPSET_ERR_MISSING_PROTO,
+};
+
+#ifdef __KERNEL__
+
+#include <linux/list.h>
+#include <linux/rcupdate.h>
+#include <linux/spinlock.h>
+
+#define IPSET_DEFAULT_HASHSIZE		1024
+#define IPSET_MIMINAL_HASHSIZE		64
+#define IPSET_DEFAULT_MAXELEM		65536
+
+/* Largest table the sets are allowed to grow to */
+#define IPSET_HASH_MAX_BITS		24
+
+/*
+ * Each element carries two list nodes. Lookups walk the table the
+ * reader found in ip_set_hash::table through node[table->idx]; a
+ * resize relinks every element into the new table through the other
+ * node, publishes the new table and frees the old bucket array after
+ * a grace period. Readers therefore never see an element vanish from
+ * a chain they are walking, and never take a lock.
+ */
+struct ip_set_hash_elem {
+	struct hlist_node	node[2];
+	struct rcu_head		rcu;
+	u32			key[0];
+};
+
+struct ip_set_hash_table {
+	u8			htable_bits;	/* size of table is 2^htable_bits */
+	u8			idx;		/* node[] slot used by this table */
+	struct hlist_head	bucket[0];
+};
+
+/* Generic hash part, embedded first in the type specific set data */
+struct ip_set_hash {
+	struct ip_set_hash_table *table; /* RCU protected */
+	spinlock_t		lock;	/* serializes writers */
+	u32			initval;
+	u32			maxelem;
+	u32			elements;
+	u8			keylen;	/* key length in bytes, multiple of 4 */
+};
+
+#define ip_set_hash_size(bits)	((u32)1 << (bits))
+
+extern int ip_set_hash_init(struct ip_set_hash *h, u32 hashsize,
+			    u32 maxelem, size_t keylen);
+extern void ip_set_hash_destroy(struct ip_set_hash *h);
+extern void ip_set_hash_flush(struct ip_set_hash *h);
+extern int ip_set_hash_resize(struct ip_set_hash *h);
+
+/* Caller must hold rcu_read_lock() */
+extern bool ip_set_hash_test(const struct ip_set_hash *h, const void *key);
+extern int ip_set_hash_add(struct ip_set_hash *h, const void *key);
+extern int ip_set_hash_del(struct ip_set_hash *h, const void *key);
+
+/* Same as above, for types which keep more state under h->lock */
+extern void __ip_set_hash_flush(struct ip_set_hash *h);
+extern int __ip_set_hash_add(struct ip_set_hash *h, const void *key);
+extern int __ip_set_hash_del(struct ip_set_hash *h, const void *key);
+
+extern int ip_set_hash_head(const struct ip_set_hash *h, struct sk_buff *skb);
+extern int ip_set_hash_list(const struct ip_set_hash *h, struct sk_buff *skb,
+			    struct netlink_callback *cb,
+			    int (*fill)(struct sk_buff *skb, const void *key));
+
+#endif /* __KERNEL__ */
+
+#endif /* __IP_SET_HASH_H */
@@ -518,4 +518,132 @@ struct tc_drr_stats
 	__u32	deficit;
 };
 
+/* CODEL */
+
+enum
+{
+	TCA_CODEL_UNSPEC,
+	TCA_CODEL_TARGET,
+	TCA_CODEL_LIMIT,
+	TCA_CODEL_INTERVAL,
+	TCA_CODEL_ECN,
+	__TCA_CODEL_MAX
+};
+
+#define TCA_CODEL_MAX	(__TCA_CODEL_MAX - 1)
+
+struct tc_codel_xstats
+{
+	__u32	maxpacket;	/* largest packet we've seen so far */
+	__u32	count;		/* how many drops we've done since the last
+				 * time we entered dropping state
+				 */
+	__u32	lastcount;	/* count at entry to dropping state */
+	__u32	ldelay;		/* in-queue delay seen by most recently
+				 * dequeued packet
+				 */
+	__s32	drop_next;	/* time to drop next packet */
+	__u32	drop_overlimit;	/* number of times max qdisc packet limit
+				 * was hit
+				 */
+	__u32	ecn_mark;	/* number of packets we ECN marked instead
+				 * of dropped
+				 */
+	__u32	dropping;	/* are we in dropping state ? */
+};
+
+/* FQ_CODEL */
+
+enum
+{
+	TCA_FQ_CODEL_UNSPEC,
+	TCA_FQ_CODEL_TARGET,
+	TCA_FQ_CODEL_LIMIT,
+	TCA_FQ_CODEL_INTERVAL,
+	TCA_FQ_CODEL_ECN,
+	TCA_FQ_CODEL_FLOWS,
+	TCA_FQ_CODEL_QUANTUM,
+	__TCA_FQ_CODEL_MAX
+};
+
+#define TCA_FQ_CODEL_MAX	(__TCA_FQ_CODEL_MAX - 1)
+
+enum
+{
+	TCA_FQ_CODEL_XSTATS_QDISC,
+	TCA_FQ_CODEL_XSTATS_CLASS,
+};
+
+struct tc_fq_codel_qd_stats
+{
+	__u32	maxpacket;	/* largest packet we've seen so far */
+	__u32	drop_overlimit;	/* number of times max qdisc packet limit
+				 * was hit
+				 */
+	__u32	ecn_mark;	/* number of packets we ECN marked instead
+				 * of dropped
+				 */
+	__u32	new_flow_count;	/* number of times packets created a
+				 * 'new flow'
+				 */
+	__u32	new_flows_len;	/* count of flows in new list */
+	__u32	old_flows_len;	/* count of flows in old list */
+};
+
+struct tc_fq_codel_cl_stats
+{
+	__s32	deficit;
+	__u32	ldelay;		/* in-queue delay seen by most recently
+				 * dequeued packet
+				 */
+	__u32	count;
+	__u32	lastcount;
+	__u32	dropping;
+	__s32	drop_next;
+};
+
+struct tc_fq_codel_xstats
+{
+	__u32	type;
+	union {
+		struct tc_fq_codel_qd_stats qdisc_stats;
+		struct tc_fq_codel_cl_stats class_stats;
+	};
+};
+
+/* FQ */
+
+enum
+{
+	TCA_FQ_UNSPEC,
+	TCA_FQ_PLIMIT,		/* limit of total number of packets in queue */
+	TCA_FQ_FLOW_PLIMIT,	/* limit of packets per flow */
+	TCA_FQ_QUANTUM,		/* RR quantum */
+	TCA_FQ_INITIAL_QUANTUM,	/* RR quantum for new flow */
+	TCA_FQ_RATE_ENABLE,	/* enable/disable rate limiting */
+	TCA_FQ_FLOW_DEFAULT_RATE,/* rate of flows without a socket */
+	TCA_FQ_FLOW_MAX_RATE,	/* per flow max rate */
+	TCA_FQ_BUCKETS_LOG,	/* log2(number of buckets) */
+	TCA_FQ_FLOW_REFILL_DELAY,/* flow credit refill delay in usec */
+	__TCA_FQ_MAX
+};
+
+#define TCA_FQ_MAX	(__TCA_FQ_MAX - 1)
+
+struct tc_fq_qd_stats
+{
+	__u64	gc_flows;
+	__u64	highprio_packets;
+	__u64	tcp_retrans;
+	__u64	throttled;
+	__u64	flows_plimit;
+	__u64	pkts_too_long;
+	__u64	allocation_errors;
+	__s64	time_next_delayed_flow;
+	__u32	flows;
+	__u32	inactive_flows;
+	__u32	throttled_flows;
+	__u32	pad;
+};
+
 #endif
@@ -94,6 +94,7 @@
 struct net_device;
 struct scatterlist;
 struct pipe_inode_info;
+struct splice_pipe_desc;
 
 #if defined(CONFIG_NF_CONNTRACK) || defined(CONFIG_NF_CONNTRACK_MODULE)
 struct nf_conntrack {
@@ -243,6 +244,13 @@ enum {
 	SKB_GSO_TCPV6 = 1 << 4,
 
 	SKB_GSO_FCOE = 1 << 5,
+
+	/* These indicate the segments are carried in a GRE or IP-in-IP
+	 * tunnel, whose outer headers are in front of the inner packet.
+	 */
+	SKB_GSO_GRE = 1 << 6,
+
+	SKB_GSO_IPIP = 1 << 7,
 };
 
 #if BITS_PER_LONG > 32
@@ -302,10 +310,12 @@ typedef unsigned char *sk_buff_data_t;
  *	@nfct_reasm: netfilter conntrack re-assembly pointer
  *	@nf_bridge: Saved data about a bridged frame - see br_netfilter.c
  *	@iif: ifindex of device we arrived on
+ *	@rxhash: the packet hash computed on receive
  *	@queue_mapping: Queue mapping for multiqueue devices
  *	@tc_index: Traffic control index
  *	@tc_verd: traffic control verdict
  *	@ndisc_nodetype: router type (from link layer)
+ *	@ooo_okay: allow the mapping of a socket to a queue to be changed
  *	@dma_cookie: a cookie to one of several possible DMA operations
  *		done by skb DMA functions
  *	@secmark: security marking
@@ -356,7 +366,7 @@ struct sk_buff {
 				ipvs_property:1,
 				peeked:1,
 				nf_trace:1;
-	__be16			protocol:16;
+	__be16			protocol;
 	kmemcheck_bitfield_end(flags1);
 
 	void			(*destructor)(struct sk_buff *skb);
@@ -369,6 +379,7 @@ struct sk_buff {
 #endif
 
 	int			iif;
+	__u32			rxhash;
 #ifdef CONFIG_NET_SCHED
 	__u16			tc_index;	/* traffic control index */
 #ifdef CONFIG_NET_CLS_ACT
@@ -385,9 +396,10 @@ struct sk_buff {
 	__u8			proto_data_valid:1,
 				proto_csum_blank:1;
 #endif
+	__u8			ooo_okay:1;
 	kmemcheck_bitfield_end(flags2);
 
-	/* 0/9...15 bit hole */
+	/* 1/10...15 bit hole */
 
 #ifdef CONFIG_NET_DMA
 	dma_cookie_t		dma_cookie;
@@ -1776,11 +1788,18 @@ extern int	       skb_store_bits(struct sk_buff *skb, int offset,
 extern __wsum	       skb_copy_and_csum_bits(const struct sk_buff *skb,
 					      int offset, u8 *to, int len,
 					      __wsum csum);
+extern ssize_t	       skb_socket_splice(struct sock *sk,
+					 struct pipe_inode_info *pipe,
+					 struct splice_pipe_desc *spd);
 extern int             skb_splice_bits(struct sk_buff *skb,
-						unsigned int offset,
-						struct pipe_inode_info *pipe,
-						unsigned int len,
-						unsigned int flags);
+				       struct sock *sk,
+				       unsigned int offset,
+				       struct pipe_inode_info *pipe,
+				       unsigned int len,
+				       unsigned int flags,
+				       ssize_t (*splice_cb)(struct sock *,
+						struct pipe_inode_info *,
+						struct splice_pipe_desc *));
 extern void	       skb_copy_and_csum_dev(const struct sk_buff *skb, u8 *to);
 extern void	       skb_split(struct sk_buff *skb,
 				 struct sk_buff *skb1, const u32 len);
@@ -2029,6 +2048,21 @@ static inline void skb_copy_queue_mapping(struct sk_buff *to, const struct sk_bu
 	to->queue_mapping = from->queue_mapping;
 }
 
+extern __u32 __skb_get_rxhash(struct sk_buff *skb);
+
+/*
+ * skb_get_rxhash - return the flow hash of a packet, computing it from
+ * the IP addresses and ports on first use.  The network header must be
+ * set.  Returns 0 if no hash could be computed.
+ */
+static inline __u32 skb_get_rxhash(struct sk_buff *skb)
+{
+	if (!skb->rxhash)
+		skb->rxhash = __skb_get_rxhash(skb);
+
+	return skb->rxhash;
+}
+
 static inline void skb_record_rx_queue(struct sk_buff *skb, u16 rx_queue)
 {
 	skb->queue_mapping = rx_queue + 1;
@@ -143,8 +143,8 @@ enum {
 	SWP_USED	= (1 << 0),	/* is slot in swap_info[] used? */
 	SWP_WRITEOK	= (1 << 1),	/* ok to write to this swap?	*/
 	SWP_DISCARDABLE = (1 << 2),	/* blkdev supports discard */
-	SWP_DISCARDING	= (1 << 3),	/* now discarding a free cluster */
 	SWP_SOLIDSTATE	= (1 << 4),	/* blkdev seeks are cheap */
+	SWP_BLKDEV	= (1 << 5),	/* its a block device */
 					/* add others here before... */
 	SWP_SCANNING	= (1 << 8),	/* refcount in scan_swap_map */
 };
@@ -155,6 +155,29 @@ enum {
 #define SWAP_MAP_BAD	0x7fff
 #define SWAP_HAS_CACHE  0x8000		/* There is a swap cache of entry. */
 #define SWAP_COUNT_MASK (~SWAP_HAS_CACHE)
+
+/*
+ * Swap space is handed out in clusters of SWAPFILE_CLUSTER slots,
+ * naturally aligned on the device. On solid state devices each CPU
+ * fills a cluster of its own, taken from the list of free clusters,
+ * so that concurrent swapouts still write sequentially.
+ */
+#define SWAPFILE_CLUSTER	256
+
+/* Maximum number of slots get_swap_pages() allocates at once */
+#define SWAP_BATCH		64
+
+struct swap_cluster_info {
+	struct list_head list;		/* on free_clusters while unused */
+	unsigned int count:31;		/* slots in use or bad */
+	unsigned int need_discard:1;	/* freed since swapon's discard */
+};
+
+struct percpu_cluster {
+	struct swap_cluster_info *info;	/* cluster being filled, or NULL */
+	unsigned int next;		/* likely next allocation offset */
+};
+
 /*
  * The in-memory structure used to track swap areas.
  */
@@ -167,16 +190,24 @@ struct swap_info_struct {
 	struct list_head extent_list;
 	struct swap_extent *curr_swap_extent;
 	unsigned short *swap_map;
+	struct swap_cluster_info *cluster_info; /* solid state devices only */
+	struct list_head free_clusters;	/* clusters with no slots in use */
+	struct percpu_cluster *percpu_cluster; /* per cpu's swap location */
 	unsigned int lowest_bit;
 	unsigned int highest_bit;
-	unsigned int lowest_alloc;	/* while preparing discard cluster */
-	unsigned int highest_alloc;	/* while preparing discard cluster */
 	unsigned int cluster_next;
 	unsigned int cluster_nr;
 	unsigned int pages;
 	unsigned int max;
 	unsigned int inuse_pages;
 	unsigned int old_block_size;
+	spinlock_t lock;		/*
+					 * protect map scan related fields like
+					 * swap_map, lowest_bit, highest_bit,
+					 * inuse_pages, cluster_next,
+					 * cluster_nr, the cluster lists and
+					 * flags; swap_lock nests outside it
+					 */
 };
 
 struct swap_list_t {
@@ -185,7 +216,7 @@ struct swap_list_t {
 };
 
 /* Swap 50% full? Release swapcache more aggressively.. */
-#define vm_swap_full() (nr_swap_pages*2 < total_swap_pages)
+#define vm_swap_full() (get_nr_swap_pages()*2 < total_swap_pages)
 
 /* linux/mm/page_alloc.c */
 extern unsigned long totalram_pages;
@@ -244,6 +275,12 @@ extern unsigned long mem_cgroup_shrink_node_zone(struct mem_cgroup *mem,
 						unsigned int swappiness,
 						struct zone *zone,
 						int nid);
+
+/* LRU Isolation modes. */
+#define ISOLATE_INACTIVE 0	/* Isolate inactive pages. */
+#define ISOLATE_ACTIVE 1	/* Isolate active pages. */
+#define ISOLATE_BOTH 2		/* Isolate both active and inactive pages. */
+
 extern int __isolate_lru_page(struct page *page, int mode, int file);
 extern unsigned long shrink_all_memory(unsigned long nr_pages);
 extern int vm_swappiness;
@@ -304,11 +341,20 @@ extern struct page *swapin_readahead(swp_entry_t, gfp_t,
 			struct vm_area_struct *vma, unsigned long addr);
 
 /* linux/mm/swapfile.c */
-extern long nr_swap_pages;
+extern atomic_long_t nr_swap_pages;
 extern long total_swap_pages;
+
+static inline long get_nr_swap_pages(void)
+{
+	return atomic_long_read(&nr_swap_pages);
+}
+
 extern void si_swapinfo(struct sysinfo *);
 extern swp_entry_t get_swap_page(void);
+extern int get_swap_pages(int n, swp_entry_t swp_entries[]);
 extern swp_entry_t get_swap_page_of_type(int);
+extern void swapcache_free_entries(swp_entry_t *entries, int n);
+extern bool has_usable_swap(void);
 extern void swap_duplicate(swp_entry_t);
 extern int swapcache_prepare(swp_entry_t);
 extern int valid_swaphandles(swp_entry_t, unsigned long *);
@@ -364,7 +410,7 @@ static inline void mem_cgroup_uncharge_swap(swp_entry_t ent)
 
 #else /* CONFIG_SWAP */
 
-#define nr_swap_pages				0L
+#define get_nr_swap_pages()			0L
 #define total_swap_pages			0L
 #define total_swapcache_pages			0UL
 
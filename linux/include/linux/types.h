@@ -175,6 +175,13 @@ typedef __u64 __bitwise __be64;
 typedef __u16 __bitwise __sum16;
 typedef __u32 __bitwise __wsum;
 
+/*
+ * __aligned_u64 is the userspace-visible variant of aligned_u64, for use
+ * in kernel<->userspace ABIs: it gives 64-bit fields the same 8-byte
+ * alignment on 32-bit and 64-bit architectures.
+ */
+#define __aligned_u64 __u64 __attribute__((aligned(8)))
+
 #ifdef __KERNEL__
 typedef unsigned __bitwise__ gfp_t;
 typedef unsigned __bitwise__ fmode_t;
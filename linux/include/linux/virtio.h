@@ -15,6 +15,7 @@
  * @name: the name of this virtqueue (mainly for debugging)
  * @vdev: the virtio device this queue was created for.
  * @vq_ops: the operations for this virtqueue (see below).
+ * @index: the zero-based ordinal number of this queue in the device.
  * @priv: a pointer for the virtqueue implementation to use.
  */
 struct virtqueue {
@@ -23,6 +24,7 @@ struct virtqueue {
 	const char *name;
 	struct virtio_device *vdev;
 	struct virtqueue_ops *vq_ops;
+	unsigned int index;
 	void *priv;
 };
 
@@ -77,6 +77,10 @@
  *	vdev: the virtio_device
  *	This gives the final feature bits for the device: it can change
  *	the dev->feature bits if it wants.
+ * @set_vq_affinity: set the affinity for a virtqueue (optional).
+ *	vq: the virtqueue
+ *	cpu: the cpu whose interrupts should handle the virtqueue,
+ *	     or -1 to clear the affinity
  */
 typedef void vq_callback_t(struct virtqueue *);
 struct virtio_config_ops {
@@ -94,6 +98,7 @@ struct virtio_config_ops {
 	void (*del_vqs)(struct virtio_device *);
 	u32 (*get_features)(struct virtio_device *vdev);
 	void (*finalize_features)(struct virtio_device *vdev);
+	int (*set_vq_affinity)(struct virtqueue *vq, int cpu);
 };
 
 /* If driver didn't advertise the feature, it will never appear. */
@@ -117,6 +122,23 @@ static inline bool virtio_has_feature(const struct virtio_device *vdev,
 	return test_bit(fbit, vdev->features);
 }
 
+/**
+ * virtqueue_set_affinity - steer the interrupt of a virtqueue to a cpu.
+ * @vq: the virtqueue
+ * @cpu: the cpu number, or -1 to let the interrupt go anywhere
+ *
+ * This is only a hint: transports which cannot do it, e.g. because
+ * the virtqueue shares its interrupt with others, ignore it.
+ */
+static inline int virtqueue_set_affinity(struct virtqueue *vq, int cpu)
+{
+	struct virtio_device *vdev = vq->vdev;
+
+	if (vdev->config->set_vq_affinity)
+		return vdev->config->set_vq_affinity(vq, cpu);
+	return 0;
+}
+
 /**
  * virtio_config_val - look for a feature and get a virtio config entry.
  * @vdev: the virtio device
@@ -32,9 +32,9 @@ extern struct request_sock *inet6_csk_search_req(const struct sock *sk,
 						 const struct in6_addr *laddr,
 						 const int iif);
 
-extern void inet6_csk_reqsk_queue_hash_add(struct sock *sk,
-					   struct request_sock *req,
-					   const unsigned long timeout);
+extern int inet6_csk_reqsk_queue_hash_add(struct sock *sk,
+					  struct request_sock *req,
+					  const unsigned long timeout);
 
 extern void inet6_csk_addr2sockaddr(struct sock *sk, struct sockaddr *uaddr);
 
@@ -2,6 +2,7 @@
 #define __NET_IPIP_H 1
 
 #include <linux/if_tunnel.h>
+#include <linux/netdevice.h>
 #include <net/ip.h>
 
 /* Keep error state on tunnel for 30 sec */
@@ -34,12 +35,45 @@ struct ip_tunnel_prl_entry
 	u16				flags;
 };
 
+/*
+ * Prepare a packet for encapsulation. A GSO packet is tagged with the
+ * tunnel's @gso_type and is segmented after the outer headers are added,
+ * by the device if it can, otherwise when it is handed to the device.
+ * The pending checksum of any other packet is completed now, as nothing
+ * below the tunnel can find the inner transport header.
+ */
+static inline int iptunnel_handle_offloads(struct sk_buff *skb, int gso_type)
+{
+	if (skb_is_gso(skb)) {
+		/* The shared info may be shared with a clone, e.g. the
+		 * copy TCP keeps for retransmission.
+		 */
+		if (skb_cloned(skb)) {
+			int err = pskb_expand_head(skb, 0, 0, GFP_ATOMIC);
+
+			if (err)
+				return err;
+		}
+		skb_shinfo(skb)->gso_type |= gso_type;
+		return 0;
+	}
+
+	if (skb->ip_summed == CHECKSUM_PARTIAL)
+		return skb_checksum_help(skb);
+	return 0;
+}
+
 #define IPTUNNEL_XMIT() do {						\
 	int err;							\
 	int pkt_len = skb->len - skb_transport_offset(skb);		\
 									\
-	skb->ip_summed = CHECKSUM_NONE;					\
-	ip_select_ident(iph, &rt->u.dst, NULL);				\
+	if (skb_is_gso(skb)) {						\
+		ip_select_ident_more(iph, &rt->u.dst, NULL,		\
+				     (skb_shinfo(skb)->gso_segs ?: 1) - 1); \
+	} else {							\
+		skb->ip_summed = CHECKSUM_NONE;				\
+		ip_select_ident(iph, &rt->u.dst, NULL);			\
+	}								\
 									\
 	err = ip_local_out(skb);					\
 	if (net_xmit_eval(err) == 0) {					\
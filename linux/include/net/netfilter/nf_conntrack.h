@@ -94,6 +94,8 @@ struct nf_conn {
 	struct nf_conntrack ct_general;
 
 	spinlock_t lock;
+	/* cpu whose unconfirmed/dying list we are on */
+	u16 cpu;
 
 	/* XXX should I move this to the tail ? - Y.K */
 	/* These are my tuples; original and reply */
@@ -200,7 +202,21 @@ extern void nf_ct_free_hashtable(void *hash, int vmalloced, unsigned int size);
 extern struct nf_conntrack_tuple_hash *
 __nf_conntrack_find(struct net *net, const struct nf_conntrack_tuple *tuple);
 
-extern void nf_conntrack_hash_insert(struct nf_conn *ct);
+/* Snapshot the hash table and its size, which change together on resize */
+static inline void nf_conntrack_get_ht(struct net *net,
+				       struct hlist_nulls_head **hash,
+				       unsigned int *hsize)
+{
+	unsigned int seq;
+
+	do {
+		seq = read_seqcount_begin(&net->ct.generation);
+		*hash = net->ct.hash;
+		*hsize = net->ct.htable_size;
+	} while (read_seqcount_retry(&net->ct.generation, seq));
+}
+
+extern int nf_conntrack_hash_check_insert(struct nf_conn *ct);
 extern void nf_ct_delete_from_lists(struct nf_conn *ct);
 extern void nf_ct_insert_dying_list(struct nf_conn *ct);
 
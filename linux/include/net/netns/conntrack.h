@@ -3,20 +3,29 @@
 
 #include <linux/list.h>
 #include <linux/list_nulls.h>
+#include <linux/seqlock.h>
+#include <linux/spinlock.h>
 #include <asm/atomic.h>
 
 struct ctl_table_header;
 struct nf_conntrack_ecache;
 
+/* Per-cpu lists of conntracks that are not in the hash table */
+struct ct_pcpu {
+	spinlock_t		lock;
+	struct hlist_nulls_head	unconfirmed;
+	struct hlist_nulls_head	dying;
+};
+
 struct netns_ct {
 	atomic_t		count;
 	unsigned int		expect_count;
 	unsigned int		htable_size;
+	seqcount_t		generation;	/* bumped on hash resize */
 	struct kmem_cache	*nf_conntrack_cachep;
 	struct hlist_nulls_head	*hash;
 	struct hlist_head	*expect_hash;
-	struct hlist_nulls_head	unconfirmed;
-	struct hlist_nulls_head	dying;
+	struct ct_pcpu		*pcpu_lists;
 	struct ip_conntrack_stat *stat;
 	int			sysctl_events;
 	unsigned int		sysctl_events_retry_timeout;
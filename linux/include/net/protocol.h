@@ -41,7 +41,8 @@ struct net_protocol {
 					       int features);
 	struct sk_buff	      **(*gro_receive)(struct sk_buff **head,
 					       struct sk_buff *skb);
-	int			(*gro_complete)(struct sk_buff *skb);
+	int			(*gro_complete)(struct sk_buff *skb,
+						int thoff);
 	unsigned int		no_policy:1,
 				netns_ok:1;
 };
@@ -61,7 +62,7 @@ struct inet6_protocol
 				       int features);
 	struct sk_buff **(*gro_receive)(struct sk_buff **head,
 					struct sk_buff *skb);
-	int	(*gro_complete)(struct sk_buff *skb);
+	int	(*gro_complete)(struct sk_buff *skb, int thoff);
 
 	unsigned int	flags;	/* INET6_PROTO_xxx */
 };
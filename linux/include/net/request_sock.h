@@ -19,6 +19,7 @@
 #include <linux/spinlock.h>
 #include <linux/types.h>
 #include <linux/bug.h>
+#include <linux/rcupdate.h>
 
 #include <net/sock.h>
 
@@ -89,8 +90,8 @@ extern int sysctl_max_syn_backlog;
 struct listen_sock {
 	u8			max_qlen_log;
 	/* 3 bytes hole, try to use */
-	int			qlen;
-	int			qlen_young;
+	atomic_t		qlen;
+	atomic_t		qlen_young;
 	int			clock_hand;
 	u32			hash_rnd;
 	u32			nr_table_entries;
@@ -104,22 +105,43 @@ struct listen_sock {
  * @rskq_defer_accept - User waits for some data after accept()
  * @syn_wait_lock - serializer
  *
- * %syn_wait_lock is necessary only to avoid proc interface having to grab the main
- * lock sock while browsing the listening hash (otherwise it's deadlock prone).
+ * SYNs that do not match a pending request are hashed into the SYN table
+ * without the listener lock, so %syn_wait_lock serializes every change to
+ * the SYN table and to @listen_opt, and is taken by whoever walks the
+ * chains without the listener lock (lookups, proc, inet_diag). Requests
+ * are only ever unlinked and freed with the listener lock held, so a
+ * caller holding it may keep using a request found by a lookup after the
+ * lock is dropped.
  *
- * This lock is acquired in read mode only from listening_get_next() seq_file
- * op and it's acquired in write mode _only_ from code that is actively
- * changing rskq_accept_head. All readers that are holding the master sock lock
- * don't need to grab this lock in read mode too as rskq_accept_head. writes
- * are always protected from the main sock lock.
+ * @listen_opt is freed only after an RCU grace period, letting the
+ * lockless SYN path read the queue lengths without any lock at all.
+ * The accept queue itself stays under the listener lock.
  */
+/*
+ * For a TCP Fast Open listener -
+ *	lock - protects the access to all the reqsk, which is co-owned by
+ *		the listener and the child socket.
+ *	qlen - pending TFO requests (still in TCP_SYN_RECV).
+ *	max_qlen - max TFO reqs allowed before TFO is disabled.
+ */
+struct fastopen_queue {
+	spinlock_t	lock;
+	int		qlen;		/* # of pending (TCP_SYN_RECV) reqs */
+	int		max_qlen;	/* != 0 iff TFO is currently enabled */
+};
+
 struct request_sock_queue {
 	struct request_sock	*rskq_accept_head;
 	struct request_sock	*rskq_accept_tail;
-	rwlock_t		syn_wait_lock;
+	spinlock_t		syn_wait_lock;
 	u8			rskq_defer_accept;
 	/* 3 bytes hole, try to pack */
 	struct listen_sock	*listen_opt;
+	struct fastopen_queue	*fastopenq; /* This is non-NULL iff TFO has been
+					     * enabled on this listener. Check
+					     * max_qlen != 0 to determine
+					     * if TFO is enabled right now.
+					     */
 };
 
 extern int reqsk_queue_alloc(struct request_sock_queue *queue,
@@ -127,6 +149,8 @@ extern int reqsk_queue_alloc(struct request_sock_queue *queue,
 
 extern void __reqsk_queue_destroy(struct request_sock_queue *queue);
 extern void reqsk_queue_destroy(struct request_sock_queue *queue);
+extern void reqsk_fastopen_remove(struct sock *sk,
+				  struct request_sock *req);
 
 static inline struct request_sock *
 	reqsk_queue_yank_acceptq(struct request_sock_queue *queue)
@@ -146,9 +170,15 @@ static inline void reqsk_queue_unlink(struct request_sock_queue *queue,
 				      struct request_sock *req,
 				      struct request_sock **prev_req)
 {
-	write_lock(&queue->syn_wait_lock);
+	spin_lock(&queue->syn_wait_lock);
+	/* New requests are added at the head of the chain without the
+	 * listener lock, so @prev_req may no longer point at @req if it
+	 * was the chain head when it was looked up.
+	 */
+	while (*prev_req != req)
+		prev_req = &(*prev_req)->dl_next;
 	*prev_req = req->dl_next;
-	write_unlock(&queue->syn_wait_lock);
+	spin_unlock(&queue->syn_wait_lock);
 }
 
 static inline void reqsk_queue_add(struct request_sock_queue *queue,
@@ -200,50 +230,63 @@ static inline int reqsk_queue_removed(struct request_sock_queue *queue,
 	struct listen_sock *lopt = queue->listen_opt;
 
 	if (req->retrans == 0)
-		--lopt->qlen_young;
+		atomic_dec(&lopt->qlen_young);
 
-	return --lopt->qlen;
-}
-
-static inline int reqsk_queue_added(struct request_sock_queue *queue)
-{
-	struct listen_sock *lopt = queue->listen_opt;
-	const int prev_qlen = lopt->qlen;
-
-	lopt->qlen_young++;
-	lopt->qlen++;
-	return prev_qlen;
+	return atomic_dec_return(&lopt->qlen);
 }
 
 static inline int reqsk_queue_len(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt != NULL ? queue->listen_opt->qlen : 0;
+	struct listen_sock *lopt = rcu_dereference(queue->listen_opt);
+
+	return lopt != NULL ? atomic_read(&lopt->qlen) : 0;
 }
 
 static inline int reqsk_queue_len_young(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt->qlen_young;
+	struct listen_sock *lopt = rcu_dereference(queue->listen_opt);
+
+	return lopt != NULL ? atomic_read(&lopt->qlen_young) : 0;
 }
 
+/* A listener going away is reported as full. */
 static inline int reqsk_queue_is_full(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt->qlen >> queue->listen_opt->max_qlen_log;
+	struct listen_sock *lopt = rcu_dereference(queue->listen_opt);
+
+	return lopt == NULL ||
+	       atomic_read(&lopt->qlen) >> lopt->max_qlen_log;
 }
 
-static inline void reqsk_queue_hash_req(struct request_sock_queue *queue,
-					u32 hash, struct request_sock *req,
-					unsigned long timeout)
+/*
+ * Add @req to the SYN table. May be called without the listener lock.
+ * Returns the number of requests queued before @req, or -1 when the
+ * listener stopped listening and @req was not queued.
+ */
+static inline int reqsk_queue_hash_req(struct request_sock_queue *queue,
+				       u32 hash, struct request_sock *req,
+				       unsigned long timeout)
 {
-	struct listen_sock *lopt = queue->listen_opt;
+	struct listen_sock *lopt;
+	int qlen = -1;
 
 	req->expires = jiffies + timeout;
 	req->retrans = 0;
 	req->sk = NULL;
-	req->dl_next = lopt->syn_table[hash];
 
-	write_lock(&queue->syn_wait_lock);
-	lopt->syn_table[hash] = req;
-	write_unlock(&queue->syn_wait_lock);
+	spin_lock(&queue->syn_wait_lock);
+	lopt = queue->listen_opt;
+	if (likely(lopt != NULL)) {
+		req->dl_next = lopt->syn_table[hash];
+		/* The SYN-ACK timer walks the chains without this lock. */
+		smp_wmb();
+		lopt->syn_table[hash] = req;
+		atomic_inc(&lopt->qlen_young);
+		qlen = atomic_inc_return(&lopt->qlen) - 1;
+	}
+	spin_unlock(&queue->syn_wait_lock);
+
+	return qlen;
 }
 
 #endif /* _REQUEST_SOCK_H */
@@ -259,6 +259,7 @@ static inline void sch_tree_unlock(struct Qdisc *q)
 extern struct Qdisc noop_qdisc;
 extern struct Qdisc_ops noop_qdisc_ops;
 extern struct Qdisc_ops pfifo_fast_ops;
+extern struct Qdisc_ops *default_qdisc_ops;
 extern struct Qdisc_ops mq_qdisc_ops;
 
 struct Qdisc_class_common
@@ -330,6 +331,23 @@ static inline void qdisc_reset_all_tx(struct net_device *dev)
 		qdisc_reset(netdev_get_tx_queue(dev, i)->qdisc);
 }
 
+/* Reset the TX qdiscs of a device from queue index i onwards.  */
+static inline void qdisc_reset_all_tx_gt(struct net_device *dev, unsigned int i)
+{
+	struct Qdisc *qdisc;
+
+	for (; i < dev->num_tx_queues; i++) {
+		qdisc = netdev_get_tx_queue(dev, i)->qdisc;
+		if (qdisc) {
+			spinlock_t *root_lock = qdisc_lock(qdisc);
+
+			spin_lock_bh(root_lock);
+			qdisc_reset(qdisc);
+			spin_unlock_bh(root_lock);
+		}
+	}
+}
+
 /* Are all TX queues of the device empty?  */
 static inline bool qdisc_all_tx_empty(const struct net_device *dev)
 {
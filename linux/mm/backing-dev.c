@@ -87,24 +87,32 @@ static int bdi_debug_stats_show(struct seq_file *m, void *v)
 
 #define K(x) ((x) << (PAGE_SHIFT - 10))
 	seq_printf(m,
-		   "BdiWriteback:     %8lu kB\n"
-		   "BdiReclaimable:   %8lu kB\n"
-		   "BdiDirtyThresh:   %8lu kB\n"
-		   "DirtyThresh:      %8lu kB\n"
-		   "BackgroundThresh: %8lu kB\n"
-		   "WritebackThreads: %8lu\n"
-		   "b_dirty:          %8lu\n"
-		   "b_io:             %8lu\n"
-		   "b_more_io:        %8lu\n"
-		   "bdi_list:         %8u\n"
-		   "state:            %8lx\n"
-		   "wb_mask:          %8lx\n"
-		   "wb_list:          %8u\n"
-		   "wb_cnt:           %8u\n",
+		   "BdiWriteback:       %8lu kB\n"
+		   "BdiReclaimable:     %8lu kB\n"
+		   "BdiDirtyThresh:     %8lu kB\n"
+		   "DirtyThresh:        %8lu kB\n"
+		   "BackgroundThresh:   %8lu kB\n"
+		   "BdiDirtied:         %8lu kB\n"
+		   "BdiWritten:         %8lu kB\n"
+		   "BdiWriteBandwidth:  %8lu kBps\n"
+		   "BdiDirtyRatelimit:  %8lu kBps\n"
+		   "WritebackThreads:   %8lu\n"
+		   "b_dirty:            %8lu\n"
+		   "b_io:               %8lu\n"
+		   "b_more_io:          %8lu\n"
+		   "bdi_list:           %8u\n"
+		   "state:              %8lx\n"
+		   "wb_mask:            %8lx\n"
+		   "wb_list:            %8u\n"
+		   "wb_cnt:             %8u\n",
 		   (unsigned long) K(bdi_stat(bdi, BDI_WRITEBACK)),
 		   (unsigned long) K(bdi_stat(bdi, BDI_RECLAIMABLE)),
-		   K(bdi_thresh), K(dirty_thresh),
-		   K(background_thresh), nr_wb, nr_dirty, nr_io, nr_more_io,
+		   K(bdi_thresh), K(dirty_thresh), K(background_thresh),
+		   (unsigned long) K(bdi_stat(bdi, BDI_DIRTIED)),
+		   (unsigned long) K(bdi_stat(bdi, BDI_WRITTEN)),
+		   (unsigned long) K(bdi->write_bandwidth),
+		   (unsigned long) K(bdi->dirty_ratelimit),
+		   nr_wb, nr_dirty, nr_io, nr_more_io,
 		   !list_empty(&bdi->bdi_list), bdi->state, bdi->wb_mask,
 		   !list_empty(&bdi->wb_list), bdi->wb_cnt);
 #undef K
@@ -643,6 +651,11 @@ void bdi_unregister(struct backing_dev_info *bdi)
 }
 EXPORT_SYMBOL(bdi_unregister);
 
+/*
+ * Initial write bandwidth: 100 MB/s
+ */
+#define INIT_BW		(100 << (20 - PAGE_SHIFT))
+
 int bdi_init(struct backing_dev_info *bdi)
 {
 	int i, err;
@@ -673,6 +686,16 @@ int bdi_init(struct backing_dev_info *bdi)
 	}
 
 	bdi->dirty_exceeded = 0;
+
+	spin_lock_init(&bdi->bw_lock);
+	bdi->bw_time_stamp = jiffies;
+	bdi->written_stamp = 0;
+	bdi->dirtied_stamp = 0;
+	bdi->write_bandwidth = INIT_BW;
+	bdi->avg_write_bandwidth = INIT_BW;
+	bdi->dirty_ratelimit = INIT_BW;
+	bdi->balanced_dirty_ratelimit = INIT_BW;
+
 	err = prop_local_init_percpu(&bdi->completions);
 
 	if (err) {
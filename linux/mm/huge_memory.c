@@ -0,0 +1,1570 @@
+/*
+ * Transparent huge pages for anonymous memory.
+ *
+ * Anonymous vmas that are large enough get their memory faulted in one
+ * pmd at a time: a naturally aligned block of HPAGE_PMD_NR small pages
+ * is allocated with a single high order allocation and mapped by a huge
+ * pmd. The small pages are split out of the allocation right away, so
+ * the rmap, LRU, memcg and swap code keeps dealing with ordinary small
+ * pages; only the page tables know about the huge mapping.
+ *
+ * Any path that needs to look at the individual ptes (partial munmap or
+ * mprotect, swapout, migration, ...) splits the huge pmd back into a
+ * regular page table, which is always possible without allocating since
+ * one page table is deposited in the mm for every huge pmd it maps.
+ *
+ * khugepaged goes the other way, collapsing runs of small pages back
+ * into huge pmds in the background.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/highmem.h>
+#include <linux/hugetlb.h>
+#include <linux/mmu_notifier.h>
+#include <linux/rmap.h>
+#include <linux/swap.h>
+#include <linux/mman.h>
+#include <linux/pagemap.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/memcontrol.h>
+#include <linux/ksm.h>
+#include <linux/khugepaged.h>
+#include <asm/tlb.h>
+#include <asm/pgalloc.h>
+#include "internal.h"
+
+/*
+ * By default transparent hugepage support is enabled for all mappings
+ * or only for madvise(MADV_HUGEPAGE) regions, depending on the config.
+ * Defrag is only invoked by khugepaged and for MADV_HUGEPAGE regions,
+ * to avoid the risk of slowing down short lived allocations.
+ */
+unsigned long transparent_hugepage_flags __read_mostly =
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE_ALWAYS
+	(1 << TRANSPARENT_HUGEPAGE_FLAG) |
+#endif
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE_MADVISE
+	(1 << TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG) |
+#endif
+	(1 << TRANSPARENT_HUGEPAGE_DEFRAG_REQ_MADV_FLAG) |
+	(1 << TRANSPARENT_HUGEPAGE_DEFRAG_KHUGEPAGED_FLAG);
+
+/* default scan 8*512 pte (or vmas) every 10 seconds */
+static unsigned int khugepaged_pages_to_scan __read_mostly = HPAGE_PMD_NR * 8;
+static unsigned int khugepaged_pages_collapsed;
+static unsigned int khugepaged_full_scans;
+static unsigned int khugepaged_scan_sleep_millisecs __read_mostly = 10000;
+/* during fragmentation poll the hugepage allocator once every minute */
+static unsigned int khugepaged_alloc_sleep_millisecs __read_mostly = 60000;
+/*
+ * default collapse hugepages if there is at least one pte mapped like
+ * it would have happened if the vma was large enough during page
+ * fault.
+ */
+static unsigned int khugepaged_max_ptes_none __read_mostly = HPAGE_PMD_NR - 1;
+
+static struct task_struct *khugepaged_thread __read_mostly;
+static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
+static DEFINE_SPINLOCK(khugepaged_mm_lock);
+
+/**
+ * struct mm_slot - hash lookup from mm to mm_slot
+ * @hash: hash collision list
+ * @mm_node: khugepaged scan list headed in khugepaged_scan.mm_head
+ * @mm: the mm that this information is valid for
+ */
+struct mm_slot {
+	struct hlist_node hash;
+	struct list_head mm_node;
+	struct mm_struct *mm;
+};
+
+/**
+ * struct khugepaged_scan - cursor for scanning
+ * @mm_head: the head of the mm list to scan
+ * @mm_slot: the current mm_slot we are scanning
+ * @address: the next address inside that to be scanned
+ *
+ * There is only the one khugepaged_scan instance of this cursor structure.
+ */
+struct khugepaged_scan {
+	struct list_head mm_head;
+	struct mm_slot *mm_slot;
+	unsigned long address;
+};
+
+static struct khugepaged_scan khugepaged_scan = {
+	.mm_head = LIST_HEAD_INIT(khugepaged_scan.mm_head),
+};
+
+#define MM_SLOTS_HASH_HEADS 1024
+static struct hlist_head *mm_slots_hash __read_mostly;
+static struct kmem_cache *mm_slot_cache __read_mostly;
+
+static inline int khugepaged_test_exit(struct mm_struct *mm)
+{
+	return atomic_read(&mm->mm_users) == 0;
+}
+
+static inline int khugepaged_should_run(void)
+{
+	return khugepaged_enabled() &&
+		!list_empty(&khugepaged_scan.mm_head);
+}
+
+static inline gfp_t alloc_hugepage_gfpmask(int defrag)
+{
+	return GFP_TRANSHUGE & ~(defrag ? 0 : __GFP_WAIT);
+}
+
+static inline struct page *alloc_hugepage_vma(int defrag,
+					      struct vm_area_struct *vma,
+					      unsigned long haddr)
+{
+	return alloc_pages_vma(alloc_hugepage_gfpmask(defrag),
+			       HPAGE_PMD_ORDER, vma, haddr);
+}
+
+/*
+ * Break a freshly allocated huge page up into its small pages and
+ * charge each of them to the memory cgroup of @mm. On failure the
+ * pages are freed.
+ */
+static int prepare_huge_page(struct page *page, struct mm_struct *mm)
+{
+	int i;
+
+	split_page(page, HPAGE_PMD_ORDER);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (unlikely(mem_cgroup_newpage_charge(page + i, mm,
+						       GFP_KERNEL))) {
+			while (--i >= 0)
+				mem_cgroup_uncharge_page(page + i);
+			for (i = 0; i < HPAGE_PMD_NR; i++)
+				put_page(page + i);
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+/* Undo prepare_huge_page() for a huge page that never got mapped */
+static void release_huge_page(struct page *page)
+{
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		mem_cgroup_uncharge_page(page + i);
+		put_page(page + i);
+	}
+}
+
+static void clear_huge_page(struct page *page, unsigned long haddr)
+{
+	int i;
+
+	might_sleep();
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		cond_resched();
+		clear_user_highpage(page + i, haddr + i * PAGE_SIZE);
+		__SetPageUptodate(page + i);
+	}
+}
+
+static void copy_huge_page(struct page *dst, struct page *src,
+			   unsigned long haddr, struct vm_area_struct *vma)
+{
+	int i;
+
+	might_sleep();
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		cond_resched();
+		copy_user_highpage(dst + i, src + i, haddr + i * PAGE_SIZE,
+				   vma);
+		__SetPageUptodate(dst + i);
+	}
+}
+
+static inline pmd_t maybe_pmd_mkwrite(pmd_t pmd, struct vm_area_struct *vma)
+{
+	if (likely(vma->vm_flags & VM_WRITE))
+		pmd = pmd_mkwrite(pmd);
+	return pmd;
+}
+
+/*
+ * The deposited page tables are chained through page->lru, which is
+ * unused for page table pages. Called with page_table_lock held.
+ */
+static void prepare_pmd_huge_pte(pgtable_t pgtable, struct mm_struct *mm)
+{
+	assert_spin_locked(&mm->page_table_lock);
+
+	if (!mm->pmd_huge_pte)
+		INIT_LIST_HEAD(&pgtable->lru);
+	else
+		list_add(&pgtable->lru, &mm->pmd_huge_pte->lru);
+	mm->pmd_huge_pte = pgtable;
+}
+
+static pgtable_t get_pmd_huge_pte(struct mm_struct *mm)
+{
+	pgtable_t pgtable;
+
+	assert_spin_locked(&mm->page_table_lock);
+
+	pgtable = mm->pmd_huge_pte;
+	VM_BUG_ON(!pgtable);
+	if (list_empty(&pgtable->lru))
+		mm->pmd_huge_pte = NULL;
+	else {
+		mm->pmd_huge_pte = list_entry(pgtable->lru.next,
+					      struct page, lru);
+		list_del(&pgtable->lru);
+	}
+	return pgtable;
+}
+
+/*
+ * Map the prepared huge page @page at @haddr. Called with
+ * page_table_lock held and @pmd known to be none.
+ */
+static void __map_huge_page(struct mm_struct *mm, struct page *page,
+			    struct vm_area_struct *vma, unsigned long haddr,
+			    pmd_t *pmd)
+{
+	pmd_t entry;
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		page_add_new_anon_rmap(page + i, vma, haddr + i * PAGE_SIZE);
+
+	entry = mk_pmd(page, vma->vm_page_prot);
+	entry = maybe_pmd_mkwrite(pmd_mkdirty(entry), vma);
+	entry = pmd_mkhuge(entry);
+	set_pmd_at(mm, haddr, pmd, entry);
+
+	add_mm_counter(mm, anon_rss, HPAGE_PMD_NR);
+	inc_zone_page_state(page, NR_ANON_TRANSPARENT_HUGEPAGES);
+}
+
+int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
+			       unsigned long address, pmd_t *pmd,
+			       unsigned int flags)
+{
+	struct page *page;
+	pgtable_t pgtable;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+
+	if (unlikely(khugepaged_enter(vma)))
+		return VM_FAULT_OOM;
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+		return VM_FAULT_FALLBACK;
+	if (unlikely(anon_vma_prepare(vma)))
+		return VM_FAULT_OOM;
+
+	page = alloc_hugepage_vma(transparent_hugepage_defrag(vma), vma, haddr);
+	if (unlikely(!page)) {
+		count_vm_event(THP_FAULT_FALLBACK);
+		return VM_FAULT_FALLBACK;
+	}
+	count_vm_event(THP_FAULT_ALLOC);
+	if (unlikely(prepare_huge_page(page, mm)))
+		return VM_FAULT_FALLBACK;
+	clear_huge_page(page, haddr);
+
+	pgtable = pte_alloc_one(mm, haddr);
+	if (unlikely(!pgtable)) {
+		release_huge_page(page);
+		return VM_FAULT_OOM;
+	}
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_none(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		release_huge_page(page);
+		pte_free(mm, pgtable);
+		return 0;
+	}
+	__map_huge_page(mm, page, vma, haddr, pmd);
+	prepare_pmd_huge_pte(pgtable, mm);
+	mm->nr_ptes++;
+	spin_unlock(&mm->page_table_lock);
+
+	return 0;
+}
+
+int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+		  pmd_t *dst_pmd, pmd_t *src_pmd, unsigned long addr,
+		  struct vm_area_struct *vma)
+{
+	struct page *page;
+	pgtable_t pgtable;
+	pmd_t pmd;
+	int i;
+
+	pgtable = pte_alloc_one(dst_mm, addr);
+	if (unlikely(!pgtable))
+		return -ENOMEM;
+
+	spin_lock(&dst_mm->page_table_lock);
+	spin_lock_nested(&src_mm->page_table_lock, SINGLE_DEPTH_NESTING);
+
+	pmd = *src_pmd;
+	if (unlikely(!pmd_trans_huge(pmd))) {
+		/* split by the rmap code since the caller looked */
+		spin_unlock(&src_mm->page_table_lock);
+		spin_unlock(&dst_mm->page_table_lock);
+		pte_free(dst_mm, pgtable);
+		return -EAGAIN;
+	}
+
+	page = pmd_page(pmd);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		get_page(page + i);
+		page_dup_rmap(page + i);
+	}
+	pmdp_set_wrprotect(src_mm, addr, src_pmd);
+	pmd = pmd_mkold(pmd_wrprotect(pmd));
+	set_pmd_at(dst_mm, addr, dst_pmd, pmd);
+	prepare_pmd_huge_pte(pgtable, dst_mm);
+	dst_mm->nr_ptes++;
+	add_mm_counter(dst_mm, anon_rss, HPAGE_PMD_NR);
+	inc_zone_page_state(page, NR_ANON_TRANSPARENT_HUGEPAGES);
+
+	spin_unlock(&src_mm->page_table_lock);
+	spin_unlock(&dst_mm->page_table_lock);
+
+	return 0;
+}
+
+void huge_pmd_set_accessed(struct mm_struct *mm, struct vm_area_struct *vma,
+			   unsigned long address, pmd_t *pmd, pmd_t orig_pmd,
+			   int dirty)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	pmd_t entry;
+
+	spin_lock(&mm->page_table_lock);
+	if (likely(pmd_same(*pmd, orig_pmd))) {
+		entry = pmd_mkyoung(orig_pmd);
+		if (dirty)
+			entry = pmd_mkdirty(entry);
+		pmdp_set_access_flags(vma, haddr, pmd, entry, dirty);
+	}
+	spin_unlock(&mm->page_table_lock);
+}
+
+/*
+ * The huge page can be written in place only if none of its small
+ * pages is shared with another mapping or sitting in the swap cache.
+ */
+static int huge_page_exclusive(struct page *page)
+{
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++, page++)
+		if (page_mapcount(page) != 1 || PageSwapCache(page) ||
+		    PageKsm(page))
+			return 0;
+	return 1;
+}
+
+int do_huge_pmd_wp_page(struct mm_struct *mm, struct vm_area_struct *vma,
+			unsigned long address, pmd_t *pmd, pmd_t orig_pmd)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *page, *new_page;
+	pmd_t entry;
+	int i, ret = 0;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_same(*pmd, orig_pmd)))
+		goto out_unlock;
+
+	page = pmd_page(orig_pmd);
+	if (huge_page_exclusive(page)) {
+		entry = pmd_mkyoung(orig_pmd);
+		entry = maybe_pmd_mkwrite(pmd_mkdirty(entry), vma);
+		pmdp_set_access_flags(vma, haddr, pmd, entry, 1);
+		ret |= VM_FAULT_WRITE;
+		goto out_unlock;
+	}
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		get_page(page + i);
+	spin_unlock(&mm->page_table_lock);
+
+	if (transparent_hugepage_enabled(vma))
+		new_page = alloc_hugepage_vma(transparent_hugepage_defrag(vma),
+					      vma, haddr);
+	else
+		new_page = NULL;
+
+	if (unlikely(!new_page)) {
+		count_vm_event(THP_FAULT_FALLBACK);
+		goto out_fallback;
+	}
+	count_vm_event(THP_FAULT_ALLOC);
+	if (unlikely(prepare_huge_page(new_page, mm)))
+		goto out_fallback;
+
+	copy_huge_page(new_page, page, haddr, vma);
+
+	mmu_notifier_invalidate_range_start(mm, haddr, haddr + HPAGE_PMD_SIZE);
+
+	spin_lock(&mm->page_table_lock);
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		put_page(page + i);
+	if (unlikely(!pmd_same(*pmd, orig_pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		release_huge_page(new_page);
+		goto out_mn;
+	}
+
+	pmdp_get_and_clear(mm, haddr, pmd);
+	flush_tlb_range(vma, haddr, haddr + HPAGE_PMD_SIZE);
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		page_add_new_anon_rmap(new_page + i, vma,
+				       haddr + i * PAGE_SIZE);
+	entry = mk_pmd(new_page, vma->vm_page_prot);
+	entry = maybe_pmd_mkwrite(pmd_mkdirty(entry), vma);
+	entry = pmd_mkhuge(entry);
+	set_pmd_at(mm, haddr, pmd, entry);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		page_remove_rmap(page + i);
+		put_page(page + i);
+	}
+	ret |= VM_FAULT_WRITE;
+	spin_unlock(&mm->page_table_lock);
+out_mn:
+	mmu_notifier_invalidate_range_end(mm, haddr, haddr + HPAGE_PMD_SIZE);
+	return ret;
+
+out_unlock:
+	spin_unlock(&mm->page_table_lock);
+	return ret;
+
+out_fallback:
+	/* let the caller COW the small pages one at a time */
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		put_page(page + i);
+	split_huge_page_pmd(mm, haddr, pmd);
+	return VM_FAULT_FALLBACK;
+}
+
+/*
+ * Called with page_table_lock held by follow_page(), after it found
+ * @pmd to be huge. A huge pmd cannot be in the middle of a split here,
+ * so it maps its pages even when not present (PROT_NONE).
+ */
+struct page *follow_trans_huge_pmd(struct mm_struct *mm, unsigned long addr,
+				   pmd_t *pmd, unsigned int flags)
+{
+	struct page *page;
+
+	assert_spin_locked(&mm->page_table_lock);
+
+	if ((flags & FOLL_WRITE) && !pmd_write(*pmd))
+		return NULL;
+
+	page = pmd_page(*pmd) + ((addr & ~HPAGE_PMD_MASK) >> PAGE_SHIFT);
+	if (flags & FOLL_GET)
+		get_page(page);
+	if (flags & FOLL_TOUCH) {
+		if ((flags & FOLL_WRITE) && !PageDirty(page))
+			set_page_dirty(page);
+		mark_page_accessed(page);
+	}
+	return page;
+}
+
+int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
+		 pmd_t *pmd, unsigned long addr)
+{
+	struct mm_struct *mm = tlb->mm;
+	pgtable_t pgtable;
+	struct page *page;
+	pmd_t orig_pmd;
+	int i;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_trans_huge(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		return 0;
+	}
+
+	orig_pmd = pmdp_get_and_clear(mm, addr, pmd);
+	pgtable = get_pmd_huge_pte(mm);
+	page = pmd_page(orig_pmd);
+	dec_zone_page_state(page, NR_ANON_TRANSPARENT_HUGEPAGES);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		page_remove_rmap(page + i);
+		tlb_remove_page(tlb, page + i);
+	}
+	add_mm_counter(mm, anon_rss, -HPAGE_PMD_NR);
+	mm->nr_ptes--;
+	spin_unlock(&mm->page_table_lock);
+
+	pte_free(mm, pgtable);
+	return 1;
+}
+
+int mincore_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
+		     unsigned long addr, unsigned long end,
+		     unsigned char *vec)
+{
+	int ret = 0;
+
+	spin_lock(&vma->vm_mm->page_table_lock);
+	if (likely(pmd_trans_huge(*pmd))) {
+		memset(vec, 1, (end - addr) >> PAGE_SHIFT);
+		ret = 1;
+	}
+	spin_unlock(&vma->vm_mm->page_table_lock);
+
+	return ret;
+}
+
+int change_huge_pmd(struct mm_struct *mm, pmd_t *pmd, unsigned long addr,
+		    pgprot_t newprot)
+{
+	pmd_t entry;
+	int ret = 0;
+
+	spin_lock(&mm->page_table_lock);
+	if (likely(pmd_trans_huge(*pmd))) {
+		entry = pmdp_get_and_clear(mm, addr, pmd);
+		entry = pmd_modify(entry, newprot);
+		set_pmd_at(mm, addr, pmd, entry);
+		ret = 1;
+	}
+	spin_unlock(&mm->page_table_lock);
+
+	return ret;
+}
+
+/*
+ * page_referenced() on a small page mapped by a huge pmd. There is only
+ * one accessed bit for all of them, so it is reported for each small
+ * page but only cleared once the last one of the block has been looked
+ * at: the LRU lists keep the small pages of a huge page in order.
+ * Returns -EAGAIN if @pmd does not map @page as a huge pmd any longer.
+ */
+int page_referenced_huge_pmd(struct page *page, struct vm_area_struct *vma,
+			     unsigned long address, pmd_t *pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	unsigned long index = (address - haddr) >> PAGE_SHIFT;
+	int ret = -EAGAIN;
+
+	spin_lock(&mm->page_table_lock);
+	if (pmd_trans_huge(*pmd) &&
+	    pmd_pfn(*pmd) + index == page_to_pfn(page)) {
+		if (index == HPAGE_PMD_NR - 1)
+			ret = pmdp_clear_flush_young(vma, haddr, pmd);
+		else
+			ret = !!pmd_young(*pmd);
+	}
+	spin_unlock(&mm->page_table_lock);
+
+	return ret;
+}
+
+/*
+ * Replace the huge pmd at @address with a page table mapping the same
+ * small pages. The pmd is made non-present and the TLB flushed before
+ * the ptes become visible, so that no CPU ever sees both the huge and
+ * the small translations of the same address.
+ */
+void __split_huge_page_pmd(struct mm_struct *mm, unsigned long address,
+			   pmd_t *pmd)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	pgtable_t pgtable;
+	pmd_t orig_pmd, _pmd;
+	pgprot_t prot;
+	unsigned long pfn;
+	pte_t *pte;
+	int i;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_trans_huge(*pmd)))
+		goto out;
+
+	pgtable = get_pmd_huge_pte(mm);
+	orig_pmd = pmdp_invalidate(mm, haddr, pmd);
+	pfn = pmd_pfn(orig_pmd);
+	prot = pmd_pgprot(orig_pmd);
+
+	pmd_populate(mm, &_pmd, pgtable);
+	pte = pte_offset_map(&_pmd, haddr);
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		set_pte_at(mm, haddr + i * PAGE_SIZE, pte + i,
+			   pfn_pte(pfn + i, prot));
+	pte_unmap(pte);
+
+	smp_wmb(); /* make ptes visible before pmd */
+	pmd_populate(mm, pmd, pgtable);
+
+	dec_zone_page_state(pfn_to_page(pfn), NR_ANON_TRANSPARENT_HUGEPAGES);
+	count_vm_event(THP_SPLIT);
+out:
+	spin_unlock(&mm->page_table_lock);
+}
+
+static void split_huge_page_address(struct mm_struct *mm,
+				    unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	VM_BUG_ON(!(address & ~HPAGE_PMD_MASK));
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return;
+
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return;
+
+	pmd = pmd_offset(pud, address);
+	split_huge_page_pmd(mm, address, pmd);
+}
+
+static inline int huge_pmd_straddles(unsigned long address,
+				     struct vm_area_struct *vma)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+
+	return (address & ~HPAGE_PMD_MASK) && haddr >= vma->vm_start &&
+		haddr + HPAGE_PMD_SIZE <= vma->vm_end;
+}
+
+void __vma_adjust_trans_huge(struct vm_area_struct *vma,
+			     unsigned long start,
+			     unsigned long end,
+			     long adjust_next)
+{
+	/*
+	 * If the new start or end address isn't hpage aligned and the
+	 * range could previously contain a huge pmd, split it.
+	 */
+	if (huge_pmd_straddles(start, vma))
+		split_huge_page_address(vma->vm_mm, start);
+	if (huge_pmd_straddles(end, vma))
+		split_huge_page_address(vma->vm_mm, end);
+
+	if (adjust_next > 0) {
+		struct vm_area_struct *next = vma->vm_next;
+		unsigned long nstart = next->vm_start;
+
+		nstart += adjust_next << PAGE_SHIFT;
+		if (huge_pmd_straddles(nstart, next))
+			split_huge_page_address(next->vm_mm, nstart);
+	}
+}
+
+#define VM_NO_THP (VM_SHARED | VM_MAYSHARE | VM_PFNMAP | VM_IO |	\
+		   VM_DONTEXPAND | VM_RESERVED | VM_HUGETLB |		\
+		   VM_INSERTPAGE | VM_MIXEDMAP | VM_SAO)
+
+int hugepage_madvise(struct vm_area_struct *vma,
+		     unsigned long *vm_flags, int advice)
+{
+	switch (advice) {
+	case MADV_HUGEPAGE:
+		/*
+		 * Be somewhat over-protective like KSM for now!
+		 */
+		if (*vm_flags & (VM_HUGEPAGE | VM_NO_THP))
+			return -EINVAL;
+		*vm_flags &= ~VM_NOHUGEPAGE;
+		*vm_flags |= VM_HUGEPAGE;
+		/*
+		 * Register the mm with khugepaged right away, without
+		 * waiting for a page fault that may not come soon.
+		 */
+		if (!test_bit(MMF_VM_HUGEPAGE, &vma->vm_mm->flags) &&
+		    __khugepaged_enter(vma->vm_mm))
+			return -ENOMEM;
+		break;
+	case MADV_NOHUGEPAGE:
+		if (*vm_flags & (VM_NOHUGEPAGE | VM_NO_THP))
+			return -EINVAL;
+		*vm_flags &= ~VM_HUGEPAGE;
+		*vm_flags |= VM_NOHUGEPAGE;
+		break;
+	}
+
+	return 0;
+}
+
+static int __init khugepaged_slab_init(void)
+{
+	mm_slot_cache = kmem_cache_create("khugepaged_mm_slot",
+					  sizeof(struct mm_slot),
+					  __alignof__(struct mm_slot), 0, NULL);
+	if (!mm_slot_cache)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static inline struct mm_slot *alloc_mm_slot(void)
+{
+	if (!mm_slot_cache)	/* initialization failed */
+		return NULL;
+	return kmem_cache_zalloc(mm_slot_cache, GFP_KERNEL);
+}
+
+static inline void free_mm_slot(struct mm_slot *mm_slot)
+{
+	kmem_cache_free(mm_slot_cache, mm_slot);
+}
+
+static int __init mm_slots_hash_init(void)
+{
+	mm_slots_hash = kzalloc(MM_SLOTS_HASH_HEADS * sizeof(struct hlist_head),
+				GFP_KERNEL);
+	if (!mm_slots_hash)
+		return -ENOMEM;
+	return 0;
+}
+
+static struct mm_slot *get_mm_slot(struct mm_struct *mm)
+{
+	struct mm_slot *mm_slot;
+	struct hlist_head *bucket;
+	struct hlist_node *node;
+
+	bucket = &mm_slots_hash[((unsigned long)mm / sizeof(struct mm_struct))
+				% MM_SLOTS_HASH_HEADS];
+	hlist_for_each_entry(mm_slot, node, bucket, hash) {
+		if (mm == mm_slot->mm)
+			return mm_slot;
+	}
+	return NULL;
+}
+
+static void insert_to_mm_slots_hash(struct mm_struct *mm,
+				    struct mm_slot *mm_slot)
+{
+	struct hlist_head *bucket;
+
+	bucket = &mm_slots_hash[((unsigned long)mm / sizeof(struct mm_struct))
+				% MM_SLOTS_HASH_HEADS];
+	mm_slot->mm = mm;
+	hlist_add_head(&mm_slot->hash, bucket);
+}
+
+int __khugepaged_enter(struct mm_struct *mm)
+{
+	struct mm_slot *mm_slot;
+	int wakeup;
+
+	mm_slot = alloc_mm_slot();
+	if (!mm_slot)
+		return -ENOMEM;
+
+	/* __khugepaged_exit() must not run from under us */
+	VM_BUG_ON(khugepaged_test_exit(mm));
+	if (unlikely(test_and_set_bit(MMF_VM_HUGEPAGE, &mm->flags))) {
+		free_mm_slot(mm_slot);
+		return 0;
+	}
+
+	spin_lock(&khugepaged_mm_lock);
+	insert_to_mm_slots_hash(mm, mm_slot);
+	/*
+	 * Insert just behind the scanning cursor, to let the area settle
+	 * down a little.
+	 */
+	wakeup = list_empty(&khugepaged_scan.mm_head);
+	list_add_tail(&mm_slot->mm_node, &khugepaged_scan.mm_head);
+	spin_unlock(&khugepaged_mm_lock);
+
+	atomic_inc(&mm->mm_count);
+	if (wakeup)
+		wake_up_interruptible(&khugepaged_wait);
+
+	return 0;
+}
+
+void __khugepaged_exit(struct mm_struct *mm)
+{
+	struct mm_slot *mm_slot;
+	int free = 0;
+
+	spin_lock(&khugepaged_mm_lock);
+	mm_slot = get_mm_slot(mm);
+	if (mm_slot && khugepaged_scan.mm_slot != mm_slot) {
+		hlist_del(&mm_slot->hash);
+		list_del(&mm_slot->mm_node);
+		free = 1;
+	}
+	spin_unlock(&khugepaged_mm_lock);
+
+	if (free) {
+		clear_bit(MMF_VM_HUGEPAGE, &mm->flags);
+		free_mm_slot(mm_slot);
+		mmdrop(mm);
+	} else if (mm_slot) {
+		/*
+		 * khugepaged is looking at this mm: wait for it to drop
+		 * mmap_sem before the page tables go away. It notices
+		 * mm_users is zero and frees the mm_slot itself.
+		 */
+		down_write(&mm->mmap_sem);
+		up_write(&mm->mmap_sem);
+	}
+}
+
+static int khugepaged_vma_eligible(struct vm_area_struct *vma)
+{
+	if ((!(vma->vm_flags & VM_HUGEPAGE) && !khugepaged_always()) ||
+	    (vma->vm_flags & VM_NOHUGEPAGE))
+		return 0;
+	/* only private anonymous memory that already faulted in */
+	if (!vma->anon_vma || vma->vm_ops || (vma->vm_flags & VM_NO_THP))
+		return 0;
+	return 1;
+}
+
+static pmd_t *khugepaged_find_pmd(struct mm_struct *mm, unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return NULL;
+
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return NULL;
+
+	pmd = pmd_offset(pud, address);
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
+		return NULL;
+
+	return pmd;
+}
+
+static void release_pte_page(struct page *page)
+{
+	/* 0 stands for page_is_file_cache(page) == false */
+	dec_zone_page_state(page, NR_ISOLATED_ANON + 0);
+	unlock_page(page);
+	putback_lru_page(page);
+}
+
+static void release_pte_pages(pte_t *pte, pte_t *_pte)
+{
+	while (--_pte >= pte) {
+		pte_t pteval = *_pte;
+
+		if (!pte_none(pteval))
+			release_pte_page(pte_page(pteval));
+	}
+}
+
+/*
+ * Lock and isolate the pages mapped by @pte, so that nothing else can
+ * get at them while they are copied. Called with the pte lock held.
+ */
+static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
+					unsigned long address,
+					pte_t *pte)
+{
+	struct page *page;
+	pte_t *_pte;
+	int none = 0;
+
+	for (_pte = pte; _pte < pte + HPAGE_PMD_NR;
+	     _pte++, address += PAGE_SIZE) {
+		pte_t pteval = *_pte;
+
+		if (pte_none(pteval)) {
+			if (++none <= khugepaged_max_ptes_none)
+				continue;
+			goto out;
+		}
+		if (!pte_present(pteval) || !pte_write(pteval))
+			goto out;
+		page = vm_normal_page(vma, address, pteval);
+		if (unlikely(!page) || !PageAnon(page) || PageKsm(page))
+			goto out;
+		/* cannot use mapcount: can't collapse if there's a gup pin */
+		if (page_count(page) != 1)
+			goto out;
+		/*
+		 * We can do it before isolate_lru_page because the page
+		 * can't be freed from under us: we hold mmap_sem for
+		 * writing and the pte lock.
+		 */
+		if (!trylock_page(page))
+			goto out;
+		if (isolate_lru_page(page)) {
+			unlock_page(page);
+			goto out;
+		}
+		/* 0 stands for page_is_file_cache(page) == false */
+		inc_zone_page_state(page, NR_ISOLATED_ANON + 0);
+	}
+	return 1;
+
+out:
+	release_pte_pages(pte, _pte);
+	return 0;
+}
+
+static void __collapse_huge_page_copy(pte_t *pte, struct page *page,
+				      struct vm_area_struct *vma,
+				      unsigned long address,
+				      spinlock_t *ptl)
+{
+	pte_t *_pte;
+
+	for (_pte = pte; _pte < pte + HPAGE_PMD_NR; _pte++) {
+		pte_t pteval = *_pte;
+		struct page *src_page;
+
+		if (pte_none(pteval)) {
+			clear_user_highpage(page, address);
+		} else {
+			src_page = pte_page(pteval);
+			copy_user_highpage(page, src_page, address, vma);
+			VM_BUG_ON(page_mapcount(src_page) != 1);
+			release_pte_page(src_page);
+			/*
+			 * ptl mostly unnecessary, but the mm counters and
+			 * the per-cpu stats in page_remove_rmap() need it.
+			 */
+			spin_lock(ptl);
+			pte_clear(vma->vm_mm, address, _pte);
+			page_remove_rmap(src_page);
+			add_mm_counter(vma->vm_mm, anon_rss, -1);
+			spin_unlock(ptl);
+			free_page_and_swap_cache(src_page);
+		}
+		__SetPageUptodate(page);
+
+		address += PAGE_SIZE;
+		page++;
+	}
+}
+
+/*
+ * Called with mmap_sem held for reading, which is released before
+ * returning.
+ */
+static void collapse_huge_page(struct mm_struct *mm, unsigned long address,
+			       struct vm_area_struct *vma, int *alloc_failed)
+{
+	struct page *new_page;
+	pgtable_t pgtable;
+	pmd_t *pmd, _pmd;
+	pte_t *pte;
+	spinlock_t *ptl;
+	int isolated;
+
+	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
+
+	/*
+	 * Allocate the page while the vma is still valid and under
+	 * mmap_sem read mode, so that there is no memory allocation
+	 * later when mmap_sem is taken for writing.
+	 */
+	new_page = alloc_hugepage_vma(khugepaged_defrag(), vma, address);
+	if (unlikely(!new_page)) {
+		count_vm_event(THP_COLLAPSE_ALLOC_FAILED);
+		*alloc_failed = 1;
+		up_read(&mm->mmap_sem);
+		return;
+	}
+	count_vm_event(THP_COLLAPSE_ALLOC);
+	if (unlikely(prepare_huge_page(new_page, mm))) {
+		up_read(&mm->mmap_sem);
+		return;
+	}
+	up_read(&mm->mmap_sem);
+
+	/*
+	 * Prevent all access to the page tables, with the exception of
+	 * the fast gup walk and the rmap walks, the latter excluded below
+	 * by the anon_vma lock.
+	 */
+	down_write(&mm->mmap_sem);
+	if (unlikely(khugepaged_test_exit(mm)))
+		goto out;
+
+	vma = find_vma(mm, address);
+	if (!vma || address < vma->vm_start ||
+	    address + HPAGE_PMD_SIZE > vma->vm_end)
+		goto out;
+	if (!khugepaged_vma_eligible(vma))
+		goto out;
+
+	pmd = khugepaged_find_pmd(mm, address);
+	if (!pmd)
+		goto out;
+
+	mmu_notifier_invalidate_range_start(mm, address,
+					    address + HPAGE_PMD_SIZE);
+	spin_lock(&vma->anon_vma->lock);
+
+	pte = pte_offset_map(pmd, address);
+	ptl = pte_lockptr(mm, pmd);
+
+	spin_lock(&mm->page_table_lock); /* probably unnecessary */
+	/*
+	 * After this the fast gup walk can't find the small pages any
+	 * longer, and only then their refcounts can be trusted.
+	 */
+	_pmd = pmdp_get_and_clear(mm, address, pmd);
+	spin_unlock(&mm->page_table_lock);
+	flush_tlb_range(vma, address, address + HPAGE_PMD_SIZE);
+
+	spin_lock(ptl);
+	isolated = __collapse_huge_page_isolate(vma, address, pte);
+	spin_unlock(ptl);
+
+	if (unlikely(!isolated)) {
+		pte_unmap(pte);
+		spin_lock(&mm->page_table_lock);
+		BUG_ON(!pmd_none(*pmd));
+		set_pmd_at(mm, address, pmd, _pmd);
+		spin_unlock(&mm->page_table_lock);
+		spin_unlock(&vma->anon_vma->lock);
+		mmu_notifier_invalidate_range_end(mm, address,
+						  address + HPAGE_PMD_SIZE);
+		goto out;
+	}
+
+	/*
+	 * All the pages are isolated and locked so anon_vma rmap
+	 * can't run anymore.
+	 */
+	spin_unlock(&vma->anon_vma->lock);
+
+	__collapse_huge_page_copy(pte, new_page, vma, address, ptl);
+	pte_unmap(pte);
+
+	/* the old page table, now empty, is deposited for a later split */
+	pgtable = pmd_pgtable(_pmd);
+
+	spin_lock(&mm->page_table_lock);
+	BUG_ON(!pmd_none(*pmd));
+	__map_huge_page(mm, new_page, vma, address, pmd);
+	prepare_pmd_huge_pte(pgtable, mm);
+	spin_unlock(&mm->page_table_lock);
+
+	mmu_notifier_invalidate_range_end(mm, address,
+					  address + HPAGE_PMD_SIZE);
+
+	khugepaged_pages_collapsed++;
+	up_write(&mm->mmap_sem);
+	return;
+
+out:
+	up_write(&mm->mmap_sem);
+	release_huge_page(new_page);
+}
+
+/*
+ * Returns 1 if mmap_sem was released by collapsing the range.
+ */
+static int khugepaged_scan_pmd(struct mm_struct *mm,
+			       struct vm_area_struct *vma,
+			       unsigned long address, int *alloc_failed)
+{
+	pmd_t *pmd;
+	pte_t *pte, *_pte;
+	int ret = 0, referenced = 0, none = 0;
+	struct page *page;
+	unsigned long _address;
+	spinlock_t *ptl;
+
+	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
+
+	pmd = khugepaged_find_pmd(mm, address);
+	if (!pmd)
+		goto out;
+
+	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
+	for (_address = address, _pte = pte; _pte < pte + HPAGE_PMD_NR;
+	     _pte++, _address += PAGE_SIZE) {
+		pte_t pteval = *_pte;
+
+		if (pte_none(pteval)) {
+			if (++none <= khugepaged_max_ptes_none)
+				continue;
+			goto out_unmap;
+		}
+		if (!pte_present(pteval) || !pte_write(pteval))
+			goto out_unmap;
+		page = vm_normal_page(vma, _address, pteval);
+		if (unlikely(!page) || !PageAnon(page) || PageKsm(page))
+			goto out_unmap;
+		if (!PageLRU(page) || PageLocked(page))
+			goto out_unmap;
+		/* cannot use mapcount: can't collapse if there's a gup pin */
+		if (page_count(page) != 1)
+			goto out_unmap;
+		if (pte_young(pteval) || PageReferenced(page))
+			referenced = 1;
+	}
+	if (referenced)
+		ret = 1;
+out_unmap:
+	pte_unmap_unlock(pte, ptl);
+	if (ret)
+		/* collapse_huge_page will return with the mmap_sem released */
+		collapse_huge_page(mm, address, vma, alloc_failed);
+out:
+	return ret;
+}
+
+/* Called with khugepaged_mm_lock held */
+static void collect_mm_slot(struct mm_slot *mm_slot)
+{
+	struct mm_struct *mm = mm_slot->mm;
+
+	assert_spin_locked(&khugepaged_mm_lock);
+
+	if (khugepaged_test_exit(mm)) {
+		/* free mm_slot */
+		hlist_del(&mm_slot->hash);
+		list_del(&mm_slot->mm_node);
+		free_mm_slot(mm_slot);
+		mmdrop(mm);
+	}
+}
+
+static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
+					    int *alloc_failed)
+{
+	struct mm_slot *mm_slot;
+	struct mm_struct *mm;
+	struct vm_area_struct *vma;
+	unsigned int progress = 0;
+
+	spin_lock(&khugepaged_mm_lock);
+	if (khugepaged_scan.mm_slot)
+		mm_slot = khugepaged_scan.mm_slot;
+	else {
+		mm_slot = list_entry(khugepaged_scan.mm_head.next,
+				     struct mm_slot, mm_node);
+		khugepaged_scan.address = 0;
+		khugepaged_scan.mm_slot = mm_slot;
+	}
+	spin_unlock(&khugepaged_mm_lock);
+
+	mm = mm_slot->mm;
+	down_read(&mm->mmap_sem);
+	if (unlikely(khugepaged_test_exit(mm)))
+		vma = NULL;
+	else
+		vma = find_vma(mm, khugepaged_scan.address);
+
+	progress++;
+	for (; vma; vma = vma->vm_next) {
+		unsigned long hstart, hend;
+
+		cond_resched();
+		if (unlikely(khugepaged_test_exit(mm))) {
+			progress++;
+			break;
+		}
+
+		if (!khugepaged_vma_eligible(vma)) {
+			progress++;
+			continue;
+		}
+		hstart = (vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
+		hend = vma->vm_end & HPAGE_PMD_MASK;
+		if (hstart >= hend) {
+			progress++;
+			continue;
+		}
+		if (khugepaged_scan.address < hstart)
+			khugepaged_scan.address = hstart;
+		if (khugepaged_scan.address > hend) {
+			progress++;
+			continue;
+		}
+
+		while (khugepaged_scan.address < hend) {
+			int ret;
+
+			cond_resched();
+			if (unlikely(khugepaged_test_exit(mm)))
+				goto breakouterloop;
+
+			ret = khugepaged_scan_pmd(mm, vma,
+						  khugepaged_scan.address,
+						  alloc_failed);
+			/* move to next address */
+			khugepaged_scan.address += HPAGE_PMD_SIZE;
+			progress += HPAGE_PMD_NR;
+			if (ret)
+				/* we released mmap_sem so break loop */
+				goto breakouterloop_mmap_sem;
+			if (progress >= pages)
+				goto breakouterloop;
+		}
+	}
+breakouterloop:
+	up_read(&mm->mmap_sem); /* exit_mmap will destroy ptes after this */
+breakouterloop_mmap_sem:
+
+	spin_lock(&khugepaged_mm_lock);
+	VM_BUG_ON(khugepaged_scan.mm_slot != mm_slot);
+	/*
+	 * Release the current mm_slot if this mm is about to die, or
+	 * if we scanned all vmas of this mm.
+	 */
+	if (khugepaged_test_exit(mm) || !vma) {
+		/*
+		 * Make sure that if mm_users is reaching zero while
+		 * khugepaged runs here, __khugepaged_exit() will find
+		 * mm_slot not pointing to the exiting mm.
+		 */
+		if (mm_slot->mm_node.next != &khugepaged_scan.mm_head) {
+			khugepaged_scan.mm_slot = list_entry(
+				mm_slot->mm_node.next,
+				struct mm_slot, mm_node);
+			khugepaged_scan.address = 0;
+		} else {
+			khugepaged_scan.mm_slot = NULL;
+			khugepaged_full_scans++;
+		}
+
+		collect_mm_slot(mm_slot);
+	}
+	spin_unlock(&khugepaged_mm_lock);
+
+	return progress;
+}
+
+static void khugepaged_do_scan(int *alloc_failed)
+{
+	unsigned int progress = 0, pass_through_head = 0;
+	unsigned int pages = khugepaged_pages_to_scan;
+
+	/* only pages off the per-cpu pagevecs can be isolated */
+	lru_add_drain();
+
+	while (progress < pages) {
+		cond_resched();
+
+		if (unlikely(kthread_should_stop() || freezing(current)))
+			break;
+
+		spin_lock(&khugepaged_mm_lock);
+		if (!khugepaged_scan.mm_slot)
+			pass_through_head++;
+		if (list_empty(&khugepaged_scan.mm_head) ||
+		    pass_through_head >= 2) {
+			spin_unlock(&khugepaged_mm_lock);
+			break;
+		}
+		spin_unlock(&khugepaged_mm_lock);
+
+		progress += khugepaged_scan_mm_slot(pages - progress,
+						    alloc_failed);
+		if (*alloc_failed)
+			break;
+	}
+}
+
+static int khugepaged(void *none)
+{
+	set_freezable();
+	set_user_nice(current, 19);
+
+	while (!kthread_should_stop()) {
+		int alloc_failed = 0;
+
+		if (khugepaged_should_run())
+			khugepaged_do_scan(&alloc_failed);
+
+		try_to_freeze();
+		if (alloc_failed)
+			wait_event_freezable_timeout(khugepaged_wait,
+				kthread_should_stop(),
+				msecs_to_jiffies(
+					khugepaged_alloc_sleep_millisecs));
+		else if (khugepaged_should_run())
+			wait_event_freezable_timeout(khugepaged_wait,
+				kthread_should_stop(),
+				msecs_to_jiffies(
+					khugepaged_scan_sleep_millisecs));
+		else
+			wait_event_freezable(khugepaged_wait,
+				khugepaged_should_run() ||
+				kthread_should_stop());
+	}
+	return 0;
+}
+
+#ifdef CONFIG_SYSFS
+#define HUGEPAGE_ATTR_RO(_name) \
+	static struct kobj_attribute _name##_attr = __ATTR_RO(_name)
+#define HUGEPAGE_ATTR(_name) \
+	static struct kobj_attribute _name##_attr = \
+		__ATTR(_name, 0644, _name##_show, _name##_store)
+
+static ssize_t double_flag_show(char *buf,
+				enum transparent_hugepage_flag enabled,
+				enum transparent_hugepage_flag req_madv)
+{
+	if (test_bit(enabled, &transparent_hugepage_flags)) {
+		VM_BUG_ON(test_bit(req_madv, &transparent_hugepage_flags));
+		return sprintf(buf, "[always] madvise never\n");
+	} else if (test_bit(req_madv, &transparent_hugepage_flags))
+		return sprintf(buf, "always [madvise] never\n");
+	else
+		return sprintf(buf, "always madvise [never]\n");
+}
+
+static ssize_t double_flag_store(const char *buf, size_t count,
+				 enum transparent_hugepage_flag enabled,
+				 enum transparent_hugepage_flag req_madv)
+{
+	if (!memcmp("always", buf, min(sizeof("always")-1, count))) {
+		set_bit(enabled, &transparent_hugepage_flags);
+		clear_bit(req_madv, &transparent_hugepage_flags);
+	} else if (!memcmp("madvise", buf, min(sizeof("madvise")-1, count))) {
+		clear_bit(enabled, &transparent_hugepage_flags);
+		set_bit(req_madv, &transparent_hugepage_flags);
+	} else if (!memcmp("never", buf, min(sizeof("never")-1, count))) {
+		clear_bit(enabled, &transparent_hugepage_flags);
+		clear_bit(req_madv, &transparent_hugepage_flags);
+	} else
+		return -EINVAL;
+
+	return count;
+}
+
+static ssize_t enabled_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	return double_flag_show(buf, TRANSPARENT_HUGEPAGE_FLAG,
+				TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG);
+}
+
+static ssize_t enabled_store(struct kobject *kobj,
+			     struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	ssize_t ret;
+
+	ret = double_flag_store(buf, count, TRANSPARENT_HUGEPAGE_FLAG,
+				TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG);
+	if (ret > 0 && khugepaged_should_run())
+		wake_up_interruptible(&khugepaged_wait);
+
+	return ret;
+}
+HUGEPAGE_ATTR(enabled);
+
+static ssize_t defrag_show(struct kobject *kobj,
+			   struct kobj_attribute *attr, char *buf)
+{
+	return double_flag_show(buf, TRANSPARENT_HUGEPAGE_DEFRAG_FLAG,
+				TRANSPARENT_HUGEPAGE_DEFRAG_REQ_MADV_FLAG);
+}
+
+static ssize_t defrag_store(struct kobject *kobj,
+			    struct kobj_attribute *attr,
+			    const char *buf, size_t count)
+{
+	return double_flag_store(buf, count,
+				 TRANSPARENT_HUGEPAGE_DEFRAG_FLAG,
+				 TRANSPARENT_HUGEPAGE_DEFRAG_REQ_MADV_FLAG);
+}
+HUGEPAGE_ATTR(defrag);
+
+static struct attribute *hugepage_attrs[] = {
+	&enabled_attr.attr,
+	&defrag_attr.attr,
+	NULL,
+};
+
+static struct attribute_group hugepage_attr_group = {
+	.attrs = hugepage_attrs,
+};
+
+static ssize_t khugepaged_defrag_show(struct kobject *kobj,
+				      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", !!test_bit(
+			TRANSPARENT_HUGEPAGE_DEFRAG_KHUGEPAGED_FLAG,
+			&transparent_hugepage_flags));
+}
+
+static ssize_t khugepaged_defrag_store(struct kobject *kobj,
+				       struct kobj_attribute *attr,
+				       const char *buf, size_t count)
+{
+	unsigned long value;
+	int err;
+
+	err = strict_strtoul(buf, 10, &value);
+	if (err || value > 1)
+		return -EINVAL;
+
+	if (value)
+		set_bit(TRANSPARENT_HUGEPAGE_DEFRAG_KHUGEPAGED_FLAG,
+			&transparent_hugepage_flags);
+	else
+		clear_bit(TRANSPARENT_HUGEPAGE_DEFRAG_KHUGEPAGED_FLAG,
+			  &transparent_hugepage_flags);
+
+	return count;
+}
+static struct kobj_attribute khugepaged_defrag_attr =
+	__ATTR(defrag, 0644, khugepaged_defrag_show,
+	       khugepaged_defrag_store);
+
+/* The remaining khugepaged knobs are all plain unsigned ints */
+#define KHUGEPAGED_UINT_ATTR(_name, _var, _min, _max)			\
+static ssize_t _name##_show(struct kobject *kobj,			\
+			    struct kobj_attribute *attr, char *buf)	\
+{									\
+	return sprintf(buf, "%u\n", _var);				\
+}									\
+static ssize_t _name##_store(struct kobject *kobj,			\
+			     struct kobj_attribute *attr,		\
+			     const char *buf, size_t count)		\
+{									\
+	unsigned long value;						\
+	int err;							\
+									\
+	err = strict_strtoul(buf, 10, &value);				\
+	if (err || value < (_min) || value > (_max))			\
+		return -EINVAL;						\
+									\
+	_var = value;							\
+	wake_up_interruptible(&khugepaged_wait);			\
+	return count;							\
+}									\
+HUGEPAGE_ATTR(_name)
+
+KHUGEPAGED_UINT_ATTR(pages_to_scan, khugepaged_pages_to_scan,
+		     1, UINT_MAX);
+KHUGEPAGED_UINT_ATTR(scan_sleep_millisecs, khugepaged_scan_sleep_millisecs,
+		     0, UINT_MAX);
+KHUGEPAGED_UINT_ATTR(alloc_sleep_millisecs, khugepaged_alloc_sleep_millisecs,
+		     0, UINT_MAX);
+KHUGEPAGED_UINT_ATTR(max_ptes_none, khugepaged_max_ptes_none,
+		     0, HPAGE_PMD_NR - 1);
+
+static ssize_t pages_collapsed_show(struct kobject *kobj,
+				    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_pages_collapsed);
+}
+HUGEPAGE_ATTR_RO(pages_collapsed);
+
+static ssize_t full_scans_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_full_scans);
+}
+HUGEPAGE_ATTR_RO(full_scans);
+
+static struct attribute *khugepaged_attrs[] = {
+	&khugepaged_defrag_attr.attr,
+	&pages_to_scan_attr.attr,
+	&pages_collapsed_attr.attr,
+	&full_scans_attr.attr,
+	&scan_sleep_millisecs_attr.attr,
+	&alloc_sleep_millisecs_attr.attr,
+	&max_ptes_none_attr.attr,
+	NULL,
+};
+
+static struct attribute_group khugepaged_attr_group = {
+	.attrs = khugepaged_attrs,
+	.name = "khugepaged",
+};
+#endif /* CONFIG_SYSFS */
+
+static int __init hugepage_init(void)
+{
+	int err;
+#ifdef CONFIG_SYSFS
+	static struct kobject *hugepage_kobj;
+#endif
+
+	err = khugepaged_slab_init();
+	if (err)
+		goto out;
+
+	err = mm_slots_hash_init();
+	if (err)
+		goto out_free1;
+
+	khugepaged_thread = kthread_run(khugepaged, NULL, "khugepaged");
+	if (IS_ERR(khugepaged_thread)) {
+		printk(KERN_ERR "hugepage: creating kthread failed\n");
+		err = PTR_ERR(khugepaged_thread);
+		khugepaged_thread = NULL;
+		goto out_free2;
+	}
+
+#ifdef CONFIG_SYSFS
+	err = -ENOMEM;
+	hugepage_kobj = kobject_create_and_add("transparent_hugepage",
+					       mm_kobj);
+	if (unlikely(!hugepage_kobj)) {
+		printk(KERN_ERR "hugepage: failed kobject create\n");
+		goto out_stop;
+	}
+
+	err = sysfs_create_group(hugepage_kobj, &hugepage_attr_group);
+	if (err) {
+		printk(KERN_ERR "hugepage: failed register hugepage group\n");
+		goto out_put;
+	}
+
+	err = sysfs_create_group(hugepage_kobj, &khugepaged_attr_group);
+	if (err) {
+		printk(KERN_ERR "hugepage: failed register khugepaged group\n");
+		goto out_remove;
+	}
+#endif
+
+	return 0;
+
+#ifdef CONFIG_SYSFS
+out_remove:
+	sysfs_remove_group(hugepage_kobj, &hugepage_attr_group);
+out_put:
+	kobject_put(hugepage_kobj);
+out_stop:
+	kthread_stop(khugepaged_thread);
+	khugepaged_thread = NULL;
+#endif
+out_free2:
+	kfree(mm_slots_hash);
+	mm_slots_hash = NULL;
+out_free1:
+	kmem_cache_destroy(mm_slot_cache);
+	mm_slot_cache = NULL;
+out:
+	/* huge pages are only set up when everything above worked */
+	transparent_hugepage_flags = 0;
+	return err;
+}
+module_init(hugepage_init)
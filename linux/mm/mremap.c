@@ -42,6 +42,7 @@ static pmd_t *get_old_pmd(struct mm_struct *mm, unsigned long addr)
 		return NULL;
 
 	pmd = pmd_offset(pud, addr);
+	split_huge_page_pmd(mm, addr, pmd);
 	if (pmd_none_or_clear_bad(pmd))
 		return NULL;
 
@@ -34,7 +34,13 @@ static int walk_pmd_range(pud_t *pud, unsigned long addr, unsigned long end,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		if (pmd_none_or_clear_bad(pmd)) {
+		/*
+		 * The callbacks all expect a page table: walkers may hold
+		 * mmap_sem only for reading, so a huge pmd faulted in after
+		 * the split is reported as a hole.
+		 */
+		split_huge_page_pmd(walk->mm, addr, pmd);
+		if (pmd_none_or_trans_huge_or_clear_bad(pmd)) {
 			if (walk->pte_hole)
 				err = walk->pte_hole(addr, next, walk);
 			if (err)
@@ -260,6 +260,26 @@ unsigned long page_address_in_vma(struct page *page, struct vm_area_struct *vma)
 	return vma_address(page, vma);
 }
 
+/*
+ * Returns the pmd mapping @address in @mm, or NULL if the upper levels
+ * are not populated. The pmd itself may be none or huge.
+ */
+static pmd_t *mm_find_pmd(struct mm_struct *mm, unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return NULL;
+
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return NULL;
+
+	return pmd_offset(pud, address);
+}
+
 /*
  * Check that @page is mapped at @address into @mm.
  *
@@ -272,22 +292,20 @@ unsigned long page_address_in_vma(struct page *page, struct vm_area_struct *vma)
 pte_t *page_check_address(struct page *page, struct mm_struct *mm,
 			  unsigned long address, spinlock_t **ptlp, int sync)
 {
-	pgd_t *pgd;
-	pud_t *pud;
 	pmd_t *pmd;
+	pmd_t pmde;
 	pte_t *pte;
 	spinlock_t *ptl;
 
-	pgd = pgd_offset(mm, address);
-	if (!pgd_present(*pgd))
+	pmd = mm_find_pmd(mm, address);
+	if (!pmd)
 		return NULL;
 
-	pud = pud_offset(pgd, address);
-	if (!pud_present(*pud))
-		return NULL;
-
-	pmd = pmd_offset(pud, address);
-	if (!pmd_present(*pmd))
+	/* the caller wants the pte: break up a transparent huge pmd */
+	split_huge_page_pmd(mm, address, pmd);
+	pmde = *pmd;
+	barrier();
+	if (!pmd_present(pmde) || pmd_trans_huge(pmde))
 		return NULL;
 
 	pte = pte_offset_map(pmd, address);
@@ -344,14 +362,36 @@ static int page_referenced_one(struct page *page,
 {
 	struct mm_struct *mm = vma->vm_mm;
 	unsigned long address;
-	pte_t *pte;
+	pte_t *pte = NULL;
 	spinlock_t *ptl;
+	pmd_t *pmd;
 	int referenced = 0;
+	int young;
 
 	address = vma_address(page, vma);
 	if (address == -EFAULT)
 		goto out;
 
+	/*
+	 * A page mapped by a transparent huge pmd is aged through the pmd,
+	 * so that reclaim scanning does not split huge pages it then
+	 * decides to keep.
+	 */
+	pmd = mm_find_pmd(mm, address);
+	if (PageAnon(page) && pmd && pmd_trans_huge(*pmd)) {
+		young = page_referenced_huge_pmd(page, vma, address, pmd);
+		if (young >= 0) {
+			if (vma->vm_flags & VM_LOCKED) {
+				*mapcount = 1;	/* break early from loop */
+				*vm_flags |= VM_LOCKED;
+				goto out_unmap;
+			}
+			if (young && likely(!VM_SequentialReadHint(vma)))
+				referenced++;
+			goto swap_token;
+		}
+	}
+
 	pte = page_check_address(page, mm, address, &ptl, 0);
 	if (!pte)
 		goto out;
@@ -379,6 +419,7 @@ static int page_referenced_one(struct page *page,
 			referenced++;
 	}
 
+swap_token:
 	/* Pretend the page is referenced if the task has the
 	   swap token and is in the middle of a page fault. */
 	if (mm != current->mm && has_swap_token(mm) &&
@@ -387,7 +428,8 @@ static int page_referenced_one(struct page *page,
 
 out_unmap:
 	(*mapcount)--;
-	pte_unmap_unlock(pte, ptl);
+	if (pte)
+		pte_unmap_unlock(pte, ptl);
 out:
 	if (referenced)
 		*vm_flags |= vma->vm_flags;
@@ -0,0 +1,273 @@
+/*
+ * linux/mm/swap_slots.c
+ *
+ * Per-cpu caches of swap slots.
+ *
+ * Allocating a swap slot takes swap_lock and the lock of the swap device,
+ * and so does freeing one: with many CPUs swapping at once, these locks
+ * become the bottleneck. So each CPU keeps a cache of slots preallocated
+ * with get_swap_pages(), which get_swap_page() hands out without taking
+ * any global lock, and a cache of slots being freed, which are returned
+ * to their devices in a batch by swapcache_free_entries() once it fills.
+ *
+ * Slots sitting in either cache are still marked SWAP_HAS_CACHE in their
+ * swap_map, so they can be neither allocated nor freed by anyone else.
+ *
+ * The caches are only used while there is plenty of free swap: when it
+ * runs low, the slots spread over the per-cpu caches are all returned so
+ * that they can be found by whoever needs them. They are also drained,
+ * and disabled, for the duration of a swapoff.
+ */
+
+#include <linux/swap_slots.h>
+#include <linux/cpumask.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/module.h>
+
+static DEFINE_PER_CPU(struct swap_slots_cache, swp_slots);
+static bool	swap_slot_cache_active;
+bool	swap_slot_cache_enabled;
+static bool	swap_slot_cache_initialized;
+/* Serialize swap slots cache enable/disable operations */
+static DEFINE_MUTEX(swap_slots_cache_enable_mutex);
+/* Serialize activation and deactivation of the caches */
+static DEFINE_MUTEX(swap_slots_cache_mutex);
+
+#define use_swap_slot_cache (swap_slot_cache_active && \
+		swap_slot_cache_enabled && swap_slot_cache_initialized)
+#define SLOTS_CACHE 0x1
+#define SLOTS_CACHE_RET 0x2
+
+static void drain_slots_cache_cpu(unsigned int cpu, unsigned int type)
+{
+	struct swap_slots_cache *cache;
+
+	cache = &per_cpu(swp_slots, cpu);
+	if ((type & SLOTS_CACHE) && cache->slots) {
+		mutex_lock(&cache->alloc_lock);
+		swapcache_free_entries(cache->slots + cache->cur, cache->nr);
+		cache->cur = 0;
+		cache->nr = 0;
+		mutex_unlock(&cache->alloc_lock);
+	}
+	if ((type & SLOTS_CACHE_RET) && cache->slots_ret) {
+		spin_lock(&cache->free_lock);
+		swapcache_free_entries(cache->slots_ret, cache->n_ret);
+		cache->n_ret = 0;
+		spin_unlock(&cache->free_lock);
+	}
+}
+
+/*
+ * The caches of all possible CPUs are allocated up front, so there is no
+ * need to serialize against CPU hotplug: a cache left behind by an
+ * offlined CPU just gets drained along with the others.
+ */
+static void __drain_swap_slots_cache(unsigned int type)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu)
+		drain_slots_cache_cpu(cpu, type);
+}
+
+static void deactivate_swap_slots_cache(void)
+{
+	mutex_lock(&swap_slots_cache_mutex);
+	swap_slot_cache_active = false;
+	__drain_swap_slots_cache(SLOTS_CACHE|SLOTS_CACHE_RET);
+	mutex_unlock(&swap_slots_cache_mutex);
+}
+
+static void reactivate_swap_slots_cache(void)
+{
+	mutex_lock(&swap_slots_cache_mutex);
+	swap_slot_cache_active = true;
+	mutex_unlock(&swap_slots_cache_mutex);
+}
+
+/* Must not be called with cpu hot plug lock */
+void disable_swap_slots_cache_lock(void)
+{
+	mutex_lock(&swap_slots_cache_enable_mutex);
+	swap_slot_cache_enabled = false;
+	if (swap_slot_cache_initialized)
+		__drain_swap_slots_cache(SLOTS_CACHE|SLOTS_CACHE_RET);
+}
+
+static void __reenable_swap_slots_cache(void)
+{
+	swap_slot_cache_enabled = has_usable_swap();
+}
+
+void reenable_swap_slots_cache_unlock(void)
+{
+	__reenable_swap_slots_cache();
+	mutex_unlock(&swap_slots_cache_enable_mutex);
+}
+
+static bool check_cache_active(void)
+{
+	long pages;
+
+	if (!swap_slot_cache_enabled || !swap_slot_cache_initialized)
+		return false;
+
+	pages = get_nr_swap_pages();
+	if (!swap_slot_cache_active) {
+		if (pages > num_online_cpus() *
+		    THRESHOLD_ACTIVATE_SWAP_SLOTS_CACHE)
+			reactivate_swap_slots_cache();
+		goto out;
+	}
+
+	/* if global pool of slot caches too low, deactivate cache */
+	if (pages < num_online_cpus() * THRESHOLD_DEACTIVATE_SWAP_SLOTS_CACHE)
+		deactivate_swap_slots_cache();
+out:
+	return swap_slot_cache_active;
+}
+
+static int alloc_swap_slot_cache(unsigned int cpu)
+{
+	struct swap_slots_cache *cache;
+	swp_entry_t *slots, *slots_ret;
+
+	slots = kzalloc(sizeof(swp_entry_t) * SWAP_SLOTS_CACHE_SIZE,
+			GFP_KERNEL);
+	if (!slots)
+		return -ENOMEM;
+
+	slots_ret = kzalloc(sizeof(swp_entry_t) * SWAP_SLOTS_CACHE_SIZE,
+			    GFP_KERNEL);
+	if (!slots_ret) {
+		kfree(slots);
+		return -ENOMEM;
+	}
+
+	cache = &per_cpu(swp_slots, cpu);
+	mutex_init(&cache->alloc_lock);
+	spin_lock_init(&cache->free_lock);
+	cache->nr = 0;
+	cache->cur = 0;
+	cache->n_ret = 0;
+	cache->slots = slots;
+	cache->slots_ret = slots_ret;
+	return 0;
+}
+
+/* Called from swapon, once there is swap space to cache */
+void enable_swap_slots_cache(void)
+{
+	unsigned int cpu;
+
+	mutex_lock(&swap_slots_cache_enable_mutex);
+	if (!swap_slot_cache_initialized) {
+		for_each_possible_cpu(cpu) {
+			if (per_cpu(swp_slots, cpu).slots)
+				continue;
+			if (alloc_swap_slot_cache(cpu)) {
+				/* carry on without the caches */
+				printk(KERN_WARNING "Failed to allocate swap "
+				       "slots cache for cpu %u\n", cpu);
+				goto out_unlock;
+			}
+		}
+		swap_slot_cache_initialized = true;
+	}
+
+	__reenable_swap_slots_cache();
+out_unlock:
+	mutex_unlock(&swap_slots_cache_enable_mutex);
+}
+
+/* called with swap slot cache's alloc lock held */
+static int refill_swap_slots_cache(struct swap_slots_cache *cache)
+{
+	if (!use_swap_slot_cache || cache->nr)
+		return 0;
+
+	cache->cur = 0;
+	if (swap_slot_cache_active)
+		cache->nr = get_swap_pages(SWAP_SLOTS_CACHE_SIZE, cache->slots);
+
+	return cache->nr;
+}
+
+/*
+ * Return a slot whose last reference went away. It is kept in this
+ * CPU's cache, and only released to its swap device, along with the
+ * other cached slots, once the cache is full.
+ */
+void free_swap_slot(swp_entry_t entry)
+{
+	struct swap_slots_cache *cache;
+
+	cache = &__raw_get_cpu_var(swp_slots);
+	if (use_swap_slot_cache && cache->slots_ret) {
+		spin_lock(&cache->free_lock);
+		/* Swap slots cache may be deactivated before acquiring lock */
+		if (!use_swap_slot_cache) {
+			spin_unlock(&cache->free_lock);
+			goto direct_free;
+		}
+		if (cache->n_ret >= SWAP_SLOTS_CACHE_SIZE) {
+			/*
+			 * Return slots to global pool.
+			 * The current swap_map value is SWAP_HAS_CACHE.
+			 * Set it to 0 to indicate it is available for
+			 * allocation in global pool
+			 */
+			swapcache_free_entries(cache->slots_ret, cache->n_ret);
+			cache->n_ret = 0;
+		}
+		cache->slots_ret[cache->n_ret++] = entry;
+		spin_unlock(&cache->free_lock);
+	} else {
+direct_free:
+		swapcache_free_entries(&entry, 1);
+	}
+}
+
+swp_entry_t get_swap_page(void)
+{
+	swp_entry_t entry, *pentry;
+	struct swap_slots_cache *cache;
+
+	/*
+	 * Preemption is allowed here, because we may sleep
+	 * in refill_swap_slots_cache().  But it is safe, because
+	 * accesses to the per-CPU data structure are protected by the
+	 * mutex cache->alloc_lock.
+	 *
+	 * The alloc path here does not touch cache->slots_ret
+	 * so cache->free_lock is not taken.
+	 */
+	cache = &__raw_get_cpu_var(swp_slots);
+
+	entry.val = 0;
+	if (check_cache_active()) {
+		mutex_lock(&cache->alloc_lock);
+		if (cache->slots) {
+repeat:
+			if (cache->nr) {
+				pentry = &cache->slots[cache->cur++];
+				entry = *pentry;
+				pentry->val = 0;
+				cache->nr--;
+			} else {
+				if (refill_swap_slots_cache(cache))
+					goto repeat;
+			}
+		}
+		mutex_unlock(&cache->alloc_lock);
+		if (entry.val)
+			return entry;
+	}
+
+	get_swap_pages(1, &entry);
+
+	return entry;
+}
@@ -11,6 +11,7 @@
 #include <linux/slab.h>
 #include <linux/kernel_stat.h>
 #include <linux/swap.h>
+#include <linux/swap_slots.h>
 #include <linux/vmalloc.h>
 #include <linux/pagemap.h>
 #include <linux/namei.h>
@@ -29,6 +30,7 @@
 #include <linux/capability.h>
 #include <linux/syscalls.h>
 #include <linux/memcontrol.h>
+#include <linux/sort.h>
 
 #include <asm/pgtable.h>
 #include <asm/tlbflush.h>
@@ -37,7 +39,7 @@
 
 static DEFINE_SPINLOCK(swap_lock);
 static unsigned int nr_swapfiles;
-long nr_swap_pages;
+atomic_long_t nr_swap_pages;
 long total_swap_pages;
 static int swap_overflow;
 static int least_priority;
@@ -51,6 +53,15 @@ static struct swap_list_t swap_list = {-1, -1};
 
 static struct swap_info_struct swap_info[MAX_SWAPFILES];
 
+/*
+ * Slots are freed under the device lock alone, so swap_entry_free()
+ * cannot update swap_list.next: instead it records here the highest
+ * priority device it freed a slot on, for get_swap_pages() to pick up
+ * under swap_lock.  The hint is only advisory, it may name a device
+ * that has been swapped off since.
+ */
+static atomic_t highest_priority_index = ATOMIC_INIT(-1);
+
 static DEFINE_MUTEX(swapon_mutex);
 
 /* For reference count accounting in swap_map */
@@ -213,23 +224,137 @@ static void discard_swap_cluster(struct swap_info_struct *si,
 	}
 }
 
-static int wait_for_discard(void *word)
+/*
+ * Swap slots are accounted to the cluster of SWAPFILE_CLUSTER slots they
+ * belong to, on solid state devices: a cluster whose count drops to zero
+ * goes back on the free_clusters list, from which each CPU takes one to
+ * allocate from sequentially. Bad slots and the header page are counted
+ * too, so that their clusters never look free.
+ */
+static inline unsigned int cluster_index(struct swap_info_struct *si,
+					 struct swap_cluster_info *ci)
 {
-	schedule();
-	return 0;
+	return ci - si->cluster_info;
+}
+
+static void inc_cluster_info_page(struct swap_info_struct *si,
+				  unsigned long page_nr)
+{
+	struct swap_cluster_info *ci;
+
+	if (!si->cluster_info)
+		return;
+
+	ci = si->cluster_info + page_nr / SWAPFILE_CLUSTER;
+	/* the linear scan may allocate from a free cluster */
+	if (!list_empty(&ci->list))
+		list_del_init(&ci->list);
+	ci->count++;
+	VM_BUG_ON(ci->count > SWAPFILE_CLUSTER);
+}
+
+static void dec_cluster_info_page(struct swap_info_struct *si,
+				  unsigned long page_nr)
+{
+	struct swap_cluster_info *ci;
+
+	if (!si->cluster_info)
+		return;
+
+	ci = si->cluster_info + page_nr / SWAPFILE_CLUSTER;
+	VM_BUG_ON(ci->count == 0);
+	if (!--ci->count) {
+		ci->need_discard = 1;
+		list_add_tail(&ci->list, &si->free_clusters);
+	}
+}
+
+/*
+ * Discard the old contents of a free cluster, before it is taken into
+ * use. Its slots are marked bad meanwhile, so that neither the linear
+ * scan nor another CPU allocates from it while si->lock is dropped.
+ */
+static void swap_discard_cluster(struct swap_info_struct *si,
+				 struct swap_cluster_info *ci)
+{
+	unsigned long idx = cluster_index(si, ci) * SWAPFILE_CLUSTER;
+	unsigned long nr = min_t(unsigned long, SWAPFILE_CLUSTER, si->max - idx);
+	unsigned long i;
+
+	for (i = 0; i < nr; i++)
+		si->swap_map[idx + i] = SWAP_MAP_BAD;
+
+	spin_unlock(&si->lock);
+	discard_swap_cluster(si, idx, nr);
+	spin_lock(&si->lock);
+
+	memset(si->swap_map + idx, 0, nr * sizeof(*si->swap_map));
+}
+
+/*
+ * On a solid state device each CPU allocates sequentially from a cluster
+ * of its own, so that concurrent swapouts don't interleave their slots.
+ * Returns false when there is no free cluster left to take, and the
+ * caller has to fall back to scanning the whole map.
+ */
+static bool scan_swap_map_try_ssd_cluster(struct swap_info_struct *si,
+					  unsigned long *offset,
+					  unsigned long *scan_base)
+{
+	struct percpu_cluster *cluster;
+	struct swap_cluster_info *ci;
+	unsigned long tmp, max;
+
+new_cluster:
+	cluster = per_cpu_ptr(si->percpu_cluster, smp_processor_id());
+	if (!cluster->info) {
+		if (list_empty(&si->free_clusters))
+			return false;
+		ci = list_first_entry(&si->free_clusters,
+				      struct swap_cluster_info, list);
+		list_del_init(&ci->list);
+		if ((si->flags & SWP_DISCARDABLE) && ci->need_discard) {
+			ci->need_discard = 0;
+			swap_discard_cluster(si, ci);
+			/* we may have slept, and moved to another CPU */
+			cluster = per_cpu_ptr(si->percpu_cluster,
+					      smp_processor_id());
+			if (cluster->info) {
+				if (!ci->count)
+					list_add_tail(&ci->list,
+						      &si->free_clusters);
+				goto new_cluster;
+			}
+		}
+		cluster->info = ci;
+		cluster->next = cluster_index(si, ci) * SWAPFILE_CLUSTER;
+	}
+
+	ci = cluster->info;
+	tmp = cluster->next;
+	max = min_t(unsigned long, si->max,
+		    (cluster_index(si, ci) + 1) * SWAPFILE_CLUSTER);
+	while (tmp < max && si->swap_map[tmp])
+		tmp++;
+	if (tmp >= max) {
+		/* this cluster is full, move on to another */
+		cluster->info = NULL;
+		goto new_cluster;
+	}
+	cluster->next = tmp + 1;
+	*offset = tmp;
+	*scan_base = tmp;
+	return true;
 }
 
-#define SWAPFILE_CLUSTER	256
 #define LATENCY_LIMIT		256
 
-static inline unsigned long scan_swap_map(struct swap_info_struct *si,
-					  int cache)
+static unsigned long scan_swap_map(struct swap_info_struct *si, int cache)
 {
 	unsigned long offset;
 	unsigned long scan_base;
 	unsigned long last_in_cluster = 0;
 	int latency_ration = LATENCY_LIMIT;
-	int found_free_cluster = 0;
 
 	/*
 	 * We try to cluster swap pages by allocating them sequentially
@@ -239,42 +364,32 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 	 * all over the entire swap partition, so that we reduce
 	 * overall disk seek times between swap pages.  -- sct
 	 * But we do now try to find an empty cluster.  -Andrea
-	 * And we let swap pages go all over an SSD partition.  Hugh
+	 * And on an SSD each CPU fills a free cluster of its own,
+	 * taken from anywhere on the partition.
 	 */
 
 	si->flags += SWP_SCANNING;
 	scan_base = offset = si->cluster_next;
 
+	if (si->cluster_info) {
+		if (scan_swap_map_try_ssd_cluster(si, &offset, &scan_base))
+			goto checks;
+		goto scan;
+	}
+
 	if (unlikely(!si->cluster_nr--)) {
 		if (si->pages - si->inuse_pages < SWAPFILE_CLUSTER) {
 			si->cluster_nr = SWAPFILE_CLUSTER - 1;
 			goto checks;
 		}
-		if (si->flags & SWP_DISCARDABLE) {
-			/*
-			 * Start range check on racing allocations, in case
-			 * they overlap the cluster we eventually decide on
-			 * (we scan without swap_lock to allow preemption).
-			 * It's hardly conceivable that cluster_nr could be
-			 * wrapped during our scan, but don't depend on it.
-			 */
-			if (si->lowest_alloc)
-				goto checks;
-			si->lowest_alloc = si->max;
-			si->highest_alloc = 0;
-		}
-		spin_unlock(&swap_lock);
+		spin_unlock(&si->lock);
 
 		/*
-		 * If seek is expensive, start searching for new cluster from
-		 * start of partition, to minimize the span of allocated swap.
-		 * But if seek is cheap, search from our current position, so
-		 * that swap is allocated from all over the partition: if the
-		 * Flash Translation Layer only remaps within limited zones,
-		 * we don't want to wear out the first zone too quickly.
+		 * Seek is expensive here, so start searching for a new
+		 * cluster from the start of the partition, to minimize
+		 * the span of allocated swap.
 		 */
-		if (!(si->flags & SWP_SOLIDSTATE))
-			scan_base = offset = si->lowest_bit;
+		scan_base = offset = si->lowest_bit;
 		last_in_cluster = offset + SWAPFILE_CLUSTER - 1;
 
 		/* Locate the first empty (unaligned) cluster */
@@ -282,32 +397,10 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 			if (si->swap_map[offset])
 				last_in_cluster = offset + SWAPFILE_CLUSTER;
 			else if (offset == last_in_cluster) {
-				spin_lock(&swap_lock);
+				spin_lock(&si->lock);
 				offset -= SWAPFILE_CLUSTER - 1;
 				si->cluster_next = offset;
 				si->cluster_nr = SWAPFILE_CLUSTER - 1;
-				found_free_cluster = 1;
-				goto checks;
-			}
-			if (unlikely(--latency_ration < 0)) {
-				cond_resched();
-				latency_ration = LATENCY_LIMIT;
-			}
-		}
-
-		offset = si->lowest_bit;
-		last_in_cluster = offset + SWAPFILE_CLUSTER - 1;
-
-		/* Locate the first empty (unaligned) cluster */
-		for (; last_in_cluster < scan_base; offset++) {
-			if (si->swap_map[offset])
-				last_in_cluster = offset + SWAPFILE_CLUSTER;
-			else if (offset == last_in_cluster) {
-				spin_lock(&swap_lock);
-				offset -= SWAPFILE_CLUSTER - 1;
-				si->cluster_next = offset;
-				si->cluster_nr = SWAPFILE_CLUSTER - 1;
-				found_free_cluster = 1;
 				goto checks;
 			}
 			if (unlikely(--latency_ration < 0)) {
@@ -317,9 +410,8 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 		}
 
 		offset = scan_base;
-		spin_lock(&swap_lock);
+		spin_lock(&si->lock);
 		si->cluster_nr = SWAPFILE_CLUSTER - 1;
-		si->lowest_alloc = 0;
 	}
 
 checks:
@@ -333,9 +425,9 @@ checks:
 	/* reuse swap entry of cache-only swap if not busy. */
 	if (vm_swap_full() && si->swap_map[offset] == SWAP_HAS_CACHE) {
 		int swap_was_freed;
-		spin_unlock(&swap_lock);
+		spin_unlock(&si->lock);
 		swap_was_freed = __try_to_reclaim_swap(si, offset);
-		spin_lock(&swap_lock);
+		spin_lock(&si->lock);
 		/* entry was freed successfully, try to use this again */
 		if (swap_was_freed)
 			goto checks;
@@ -358,73 +450,20 @@ checks:
 		si->swap_map[offset] = encode_swapmap(0, true);
 	else /* at suspend */
 		si->swap_map[offset] = encode_swapmap(1, false);
+	inc_cluster_info_page(si, offset);
 	si->cluster_next = offset + 1;
 	si->flags -= SWP_SCANNING;
-
-	if (si->lowest_alloc) {
-		/*
-		 * Only set when SWP_DISCARDABLE, and there's a scan
-		 * for a free cluster in progress or just completed.
-		 */
-		if (found_free_cluster) {
-			/*
-			 * To optimize wear-levelling, discard the
-			 * old data of the cluster, taking care not to
-			 * discard any of its pages that have already
-			 * been allocated by racing tasks (offset has
-			 * already stepped over any at the beginning).
-			 */
-			if (offset < si->highest_alloc &&
-			    si->lowest_alloc <= last_in_cluster)
-				last_in_cluster = si->lowest_alloc - 1;
-			si->flags |= SWP_DISCARDING;
-			spin_unlock(&swap_lock);
-
-			if (offset < last_in_cluster)
-				discard_swap_cluster(si, offset,
-					last_in_cluster - offset + 1);
-
-			spin_lock(&swap_lock);
-			si->lowest_alloc = 0;
-			si->flags &= ~SWP_DISCARDING;
-
-			smp_mb();	/* wake_up_bit advises this */
-			wake_up_bit(&si->flags, ilog2(SWP_DISCARDING));
-
-		} else if (si->flags & SWP_DISCARDING) {
-			/*
-			 * Delay using pages allocated by racing tasks
-			 * until the whole discard has been issued. We
-			 * could defer that delay until swap_writepage,
-			 * but it's easier to keep this self-contained.
-			 */
-			spin_unlock(&swap_lock);
-			wait_on_bit(&si->flags, ilog2(SWP_DISCARDING),
-				wait_for_discard, TASK_UNINTERRUPTIBLE);
-			spin_lock(&swap_lock);
-		} else {
-			/*
-			 * Note pages allocated by racing tasks while
-			 * scan for a free cluster is in progress, so
-			 * that its final discard can exclude them.
-			 */
-			if (offset < si->lowest_alloc)
-				si->lowest_alloc = offset;
-			if (offset > si->highest_alloc)
-				si->highest_alloc = offset;
-		}
-	}
 	return offset;
 
 scan:
-	spin_unlock(&swap_lock);
+	spin_unlock(&si->lock);
 	while (++offset <= si->highest_bit) {
 		if (!si->swap_map[offset]) {
-			spin_lock(&swap_lock);
+			spin_lock(&si->lock);
 			goto checks;
 		}
 		if (vm_swap_full() && si->swap_map[offset] == SWAP_HAS_CACHE) {
-			spin_lock(&swap_lock);
+			spin_lock(&si->lock);
 			goto checks;
 		}
 		if (unlikely(--latency_ration < 0)) {
@@ -435,11 +474,11 @@ scan:
 	offset = si->lowest_bit;
 	while (++offset < scan_base) {
 		if (!si->swap_map[offset]) {
-			spin_lock(&swap_lock);
+			spin_lock(&si->lock);
 			goto checks;
 		}
 		if (vm_swap_full() && si->swap_map[offset] == SWAP_HAS_CACHE) {
-			spin_lock(&swap_lock);
+			spin_lock(&si->lock);
 			goto checks;
 		}
 		if (unlikely(--latency_ration < 0)) {
@@ -447,24 +486,61 @@ scan:
 			latency_ration = LATENCY_LIMIT;
 		}
 	}
-	spin_lock(&swap_lock);
+	spin_lock(&si->lock);
 
 no_page:
 	si->flags -= SWP_SCANNING;
 	return 0;
 }
 
-swp_entry_t get_swap_page(void)
+/* Allocate up to @nr slots for swap cache from @si, whose lock is held */
+static int scan_swap_map_slots(struct swap_info_struct *si, int cache,
+			       int nr, swp_entry_t slots[])
+{
+	int type = si - swap_info;
+	unsigned long offset;
+	int n_ret = 0;
+
+	while (n_ret < nr) {
+		offset = scan_swap_map(si, cache);
+		if (!offset)
+			break;
+		slots[n_ret++] = swp_entry(type, offset);
+	}
+	return n_ret;
+}
+
+/*
+ * Allocate up to @n_goal (at most SWAP_BATCH) swap slots for swap cache,
+ * all from the same device. Returns the number of slots allocated.
+ */
+int get_swap_pages(int n_goal, swp_entry_t swp_entries[])
 {
 	struct swap_info_struct *si;
-	pgoff_t offset;
-	int type, next;
+	long avail_pgs;
+	int n_ret = 0;
+	int type, next, hp_index;
 	int wrapped = 0;
 
+	avail_pgs = get_nr_swap_pages();
+	if (avail_pgs <= 0)
+		return 0;
+
+	if (n_goal > SWAP_BATCH)
+		n_goal = SWAP_BATCH;
+	if (n_goal > avail_pgs)
+		n_goal = avail_pgs;
+
+	atomic_long_sub(n_goal, &nr_swap_pages);
+
 	spin_lock(&swap_lock);
-	if (nr_swap_pages <= 0)
-		goto noswap;
-	nr_swap_pages--;
+
+	hp_index = atomic_xchg(&highest_priority_index, -1);
+	if (hp_index != -1 && hp_index != swap_list.next) {
+		si = swap_info + hp_index;
+		if (si->highest_bit && (si->flags & SWP_WRITEOK))
+			swap_list.next = hp_index;
+	}
 
 	for (type = swap_list.next; type >= 0 && wrapped < 2; type = next) {
 		si = swap_info + type;
@@ -475,25 +551,28 @@ swp_entry_t get_swap_page(void)
 			wrapped++;
 		}
 
-		if (!si->highest_bit)
-			continue;
-		if (!(si->flags & SWP_WRITEOK))
+		spin_lock(&si->lock);
+		if (!si->highest_bit || !(si->flags & SWP_WRITEOK)) {
+			spin_unlock(&si->lock);
 			continue;
+		}
 
 		swap_list.next = next;
+		spin_unlock(&swap_lock);
 		/* This is called for allocating swap entry for cache */
-		offset = scan_swap_map(si, SWAP_CACHE);
-		if (offset) {
-			spin_unlock(&swap_lock);
-			return swp_entry(type, offset);
-		}
+		n_ret = scan_swap_map_slots(si, SWAP_CACHE, n_goal, swp_entries);
+		spin_unlock(&si->lock);
+		if (n_ret)
+			goto out;
+		spin_lock(&swap_lock);
 		next = swap_list.next;
 	}
 
-	nr_swap_pages++;
-noswap:
 	spin_unlock(&swap_lock);
-	return (swp_entry_t) {0};
+out:
+	if (n_ret < n_goal)
+		atomic_long_add(n_goal - n_ret, &nr_swap_pages);
+	return n_ret;
 }
 
 /* The only caller of this function is now susupend routine */
@@ -502,23 +581,23 @@ swp_entry_t get_swap_page_of_type(int type)
 	struct swap_info_struct *si;
 	pgoff_t offset;
 
-	spin_lock(&swap_lock);
 	si = swap_info + type;
+	spin_lock(&si->lock);
 	if (si->flags & SWP_WRITEOK) {
-		nr_swap_pages--;
+		atomic_long_dec(&nr_swap_pages);
 		/* This is called for allocating swap entry, not cache */
 		offset = scan_swap_map(si, SWAP_MAP);
 		if (offset) {
-			spin_unlock(&swap_lock);
+			spin_unlock(&si->lock);
 			return swp_entry(type, offset);
 		}
-		nr_swap_pages++;
+		atomic_long_inc(&nr_swap_pages);
 	}
-	spin_unlock(&swap_lock);
+	spin_unlock(&si->lock);
 	return (swp_entry_t) {0};
 }
 
-static struct swap_info_struct * swap_info_get(swp_entry_t entry)
+static struct swap_info_struct *__swap_info_get(swp_entry_t entry)
 {
 	struct swap_info_struct * p;
 	unsigned long offset, type;
@@ -536,7 +615,6 @@ static struct swap_info_struct * swap_info_get(swp_entry_t entry)
 		goto bad_offset;
 	if (!p->swap_map[offset])
 		goto bad_free;
-	spin_lock(&swap_lock);
 	return p;
 
 bad_free:
@@ -554,8 +632,55 @@ out:
 	return NULL;
 }
 
-static int swap_entry_free(struct swap_info_struct *p,
-			   swp_entry_t ent, int cache)
+/* Returns with the lock of the entry's swap device held */
+static struct swap_info_struct * swap_info_get(swp_entry_t entry)
+{
+	struct swap_info_struct *p;
+
+	p = __swap_info_get(entry);
+	if (p)
+		spin_lock(&p->lock);
+	return p;
+}
+
+/* Like swap_info_get(), but keeps holding @q's lock if entry is on @q */
+static struct swap_info_struct *swap_info_get_cont(swp_entry_t entry,
+						   struct swap_info_struct *q)
+{
+	struct swap_info_struct *p;
+
+	p = __swap_info_get(entry);
+	if (p != q) {
+		if (q)
+			spin_unlock(&q->lock);
+		if (p)
+			spin_lock(&p->lock);
+	}
+	return p;
+}
+
+static void set_highest_priority_index(int type)
+{
+	int old_hp_index, new_hp_index;
+
+	do {
+		old_hp_index = atomic_read(&highest_priority_index);
+		if (old_hp_index != -1 &&
+		    swap_info[old_hp_index].prio >= swap_info[type].prio)
+			break;
+		new_hp_index = type;
+	} while (atomic_cmpxchg(&highest_priority_index,
+				old_hp_index, new_hp_index) != old_hp_index);
+}
+
+/*
+ * Drop a reference to a swap entry. When the last one goes, the slot
+ * is left marked SWAP_HAS_CACHE, so that nobody can allocate or
+ * duplicate it, and 0 is returned: the caller then hands the slot to
+ * free_swap_slot(), once it has dropped the device lock.
+ */
+static int swap_entry_put(struct swap_info_struct *p,
+			  swp_entry_t ent, int cache)
 {
 	unsigned long offset = swp_offset(ent);
 	int count = swap_count(p->swap_map[offset]);
@@ -575,22 +700,44 @@ static int swap_entry_free(struct swap_info_struct *p,
 	}
 	/* return code. */
 	count = p->swap_map[offset];
-	/* free if no reference */
-	if (!count) {
-		if (offset < p->lowest_bit)
-			p->lowest_bit = offset;
-		if (offset > p->highest_bit)
-			p->highest_bit = offset;
-		if (p->prio > swap_info[swap_list.next].prio)
-			swap_list.next = p - swap_info;
-		nr_swap_pages++;
-		p->inuse_pages--;
-	}
 	if (!swap_count(count))
 		mem_cgroup_uncharge_swap(ent);
+	/* free if no reference */
+	if (!count)
+		p->swap_map[offset] = SWAP_HAS_CACHE;
 	return count;
 }
 
+/*
+ * Really release a slot left by swap_entry_put(), with the device lock
+ * held: this is done in batches, from swapcache_free_entries().
+ */
+static void swap_entry_free(struct swap_info_struct *p, swp_entry_t ent)
+{
+	unsigned long offset = swp_offset(ent);
+	int type = p - swap_info;
+	int next;
+
+	VM_BUG_ON(p->swap_map[offset] != SWAP_HAS_CACHE);
+	p->swap_map[offset] = 0;
+	dec_cluster_info_page(p, offset);
+
+	if (offset < p->lowest_bit)
+		p->lowest_bit = offset;
+	if (offset > p->highest_bit)
+		p->highest_bit = offset;
+	next = swap_list.next;
+	if (next < 0 || p->prio > swap_info[next].prio)
+		set_highest_priority_index(type);
+	atomic_long_inc(&nr_swap_pages);
+	p->inuse_pages--;
+	if (p->flags & SWP_BLKDEV) {
+		struct gendisk *disk = p->bdev->bd_disk;
+		if (disk->fops->swap_slot_free_notify)
+			disk->fops->swap_slot_free_notify(p->bdev, offset);
+	}
+}
+
 /*
  * Caller has made sure that the swapdevice corresponding to entry
  * is still around or has not been recycled.
@@ -598,11 +745,14 @@ static int swap_entry_free(struct swap_info_struct *p,
 void swap_free(swp_entry_t entry)
 {
 	struct swap_info_struct * p;
+	int count;
 
 	p = swap_info_get(entry);
 	if (p) {
-		swap_entry_free(p, entry, SWAP_MAP);
-		spin_unlock(&swap_lock);
+		count = swap_entry_put(p, entry, SWAP_MAP);
+		spin_unlock(&p->lock);
+		if (!count)
+			free_swap_slot(entry);
 	}
 }
 
@@ -616,7 +766,7 @@ void swapcache_free(swp_entry_t entry, struct page *page)
 
 	p = swap_info_get(entry);
 	if (p) {
-		ret = swap_entry_free(p, entry, SWAP_CACHE);
+		ret = swap_entry_put(p, entry, SWAP_CACHE);
 		if (page) {
 			bool swapout;
 			if (ret)
@@ -625,11 +775,47 @@ void swapcache_free(swp_entry_t entry, struct page *page)
 				swapout = false; /* no more swap users! */
 			mem_cgroup_uncharge_swapcache(page, entry, swapout);
 		}
-		spin_unlock(&swap_lock);
+		spin_unlock(&p->lock);
+		if (!ret)
+			free_swap_slot(entry);
 	}
 	return;
 }
 
+static int swp_entry_cmp(const void *ent1, const void *ent2)
+{
+	const swp_entry_t *e1 = ent1, *e2 = ent2;
+
+	return (int)swp_type(*e1) - (int)swp_type(*e2);
+}
+
+/*
+ * Release a batch of slots which have lost their last reference. They
+ * are sorted by device first, so that each device lock is taken once.
+ */
+void swapcache_free_entries(swp_entry_t *entries, int n)
+{
+	struct swap_info_struct *p, *prev;
+	int i;
+
+	if (n <= 0)
+		return;
+
+	prev = NULL;
+	p = NULL;
+
+	if (nr_swapfiles > 1)
+		sort(entries, n, sizeof(entries[0]), swp_entry_cmp, NULL);
+	for (i = 0; i < n; ++i) {
+		p = swap_info_get_cont(entries[i], prev);
+		if (p)
+			swap_entry_free(p, entries[i]);
+		prev = p;
+	}
+	if (p)
+		spin_unlock(&p->lock);
+}
+
 /*
  * How many references to page are currently swapped out?
  */
@@ -643,7 +829,7 @@ static inline int page_swapcount(struct page *page)
 	p = swap_info_get(entry);
 	if (p) {
 		count = swap_count(p->swap_map[swp_offset(entry)]);
-		spin_unlock(&swap_lock);
+		spin_unlock(&p->lock);
 	}
 	return count;
 }
@@ -698,20 +884,24 @@ int free_swap_and_cache(swp_entry_t entry)
 {
 	struct swap_info_struct *p;
 	struct page *page = NULL;
+	int count;
 
 	if (non_swap_entry(entry))
 		return 1;
 
 	p = swap_info_get(entry);
 	if (p) {
-		if (swap_entry_free(p, entry, SWAP_MAP) == SWAP_HAS_CACHE) {
+		count = swap_entry_put(p, entry, SWAP_MAP);
+		if (count == SWAP_HAS_CACHE) {
 			page = find_get_page(&swapper_space, entry.val);
 			if (page && !trylock_page(page)) {
 				page_cache_release(page);
 				page = NULL;
 			}
 		}
-		spin_unlock(&swap_lock);
+		spin_unlock(&p->lock);
+		if (!count)
+			free_swap_slot(entry);
 	}
 	if (page) {
 		/*
@@ -793,13 +983,15 @@ unsigned int count_swap_pages(int type, int free)
 	unsigned int n = 0;
 
 	if (type < nr_swapfiles) {
-		spin_lock(&swap_lock);
-		if (swap_info[type].flags & SWP_WRITEOK) {
-			n = swap_info[type].pages;
+		struct swap_info_struct *sis = swap_info + type;
+
+		spin_lock(&sis->lock);
+		if (sis->flags & SWP_WRITEOK) {
+			n = sis->pages;
 			if (free)
-				n -= swap_info[type].inuse_pages;
+				n -= sis->inuse_pages;
 		}
-		spin_unlock(&swap_lock);
+		spin_unlock(&sis->lock);
 	}
 	return n;
 }
@@ -896,7 +1088,8 @@ static inline int unuse_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		if (pmd_none_or_clear_bad(pmd))
+		/* a huge pmd never maps swap entries */
+		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
 			continue;
 		ret = unuse_pte_range(vma, pmd, addr, next, entry, page);
 		if (ret)
@@ -1195,9 +1388,9 @@ static int try_to_unuse(unsigned int type)
 			goto retry;
 
 		if (swap_count(*swap_map) == SWAP_MAP_MAX) {
-			spin_lock(&swap_lock);
+			spin_lock(&si->lock);
 			*swap_map = encode_swapmap(0, true);
-			spin_unlock(&swap_lock);
+			spin_unlock(&si->lock);
 			reset_overflow = 1;
 		}
 
@@ -1511,6 +1704,8 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 {
 	struct swap_info_struct * p = NULL;
 	unsigned short *swap_map;
+	struct swap_cluster_info *cluster_info;
+	struct percpu_cluster *percpu_cluster;
 	struct file *swap_file, *victim;
 	struct address_space *mapping;
 	struct inode *inode;
@@ -1569,15 +1764,22 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 			swap_info[i].prio = p->prio--;
 		least_priority++;
 	}
-	nr_swap_pages -= p->pages;
+	atomic_long_sub(p->pages, &nr_swap_pages);
 	total_swap_pages -= p->pages;
+	spin_lock(&p->lock);
 	p->flags &= ~SWP_WRITEOK;
+	spin_unlock(&p->lock);
 	spin_unlock(&swap_lock);
 
+	/* hand back the slots of this device held in the per-cpu caches */
+	disable_swap_slots_cache_lock();
+
 	current->flags |= PF_OOM_ORIGIN;
 	err = try_to_unuse(type);
 	current->flags &= ~PF_OOM_ORIGIN;
 
+	reenable_swap_slots_cache_unlock();
+
 	if (err) {
 		/* re-insert swap space back into swap_list */
 		spin_lock(&swap_lock);
@@ -1594,9 +1796,11 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 			swap_list.head = swap_list.next = p - swap_info;
 		else
 			swap_info[prev].next = p - swap_info;
-		nr_swap_pages += p->pages;
+		atomic_long_add(p->pages, &nr_swap_pages);
 		total_swap_pages += p->pages;
+		spin_lock(&p->lock);
 		p->flags |= SWP_WRITEOK;
+		spin_unlock(&p->lock);
 		spin_unlock(&swap_lock);
 		goto out_dput;
 	}
@@ -1609,13 +1813,16 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	mutex_lock(&swapon_mutex);
 	spin_lock(&swap_lock);
 	drain_mmlist();
+	spin_lock(&p->lock);
 
 	/* wait for anyone still in scan_swap_map */
 	p->highest_bit = 0;		/* cuts scans short */
 	while (p->flags >= SWP_SCANNING) {
+		spin_unlock(&p->lock);
 		spin_unlock(&swap_lock);
 		schedule_timeout_uninterruptible(1);
 		spin_lock(&swap_lock);
+		spin_lock(&p->lock);
 	}
 
 	swap_file = p->swap_file;
@@ -1623,10 +1830,17 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	p->max = 0;
 	swap_map = p->swap_map;
 	p->swap_map = NULL;
+	cluster_info = p->cluster_info;
+	p->cluster_info = NULL;
+	percpu_cluster = p->percpu_cluster;
+	p->percpu_cluster = NULL;
 	p->flags = 0;
+	spin_unlock(&p->lock);
 	spin_unlock(&swap_lock);
 	mutex_unlock(&swapon_mutex);
 	vfree(swap_map);
+	vfree(cluster_info);
+	free_percpu(percpu_cluster);
 	/* Destroy swap account informatin */
 	swap_cgroup_swapoff(type);
 
@@ -1763,6 +1977,45 @@ late_initcall(max_swapfiles_check);
  *
  * The swapon system call
  */
+/*
+ * Set up the cluster accounting of a solid state swap device, before
+ * its swap_map is installed. The header page, bad pages and the slots
+ * past the end of the area count as in use, so that only clusters
+ * which are entirely usable go on the free list.
+ */
+static int setup_swap_cluster_info(struct swap_info_struct *p,
+				   unsigned short *swap_map)
+{
+	unsigned long nr_clusters = DIV_ROUND_UP(p->max, SWAPFILE_CLUSTER);
+	struct swap_cluster_info *cluster_info;
+	unsigned long i;
+
+	cluster_info = vmalloc(nr_clusters * sizeof(*cluster_info));
+	if (!cluster_info)
+		return -ENOMEM;
+	p->percpu_cluster = alloc_percpu(struct percpu_cluster);
+	if (!p->percpu_cluster) {
+		vfree(cluster_info);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < nr_clusters; i++) {
+		INIT_LIST_HEAD(&cluster_info[i].list);
+		cluster_info[i].count = 0;
+		cluster_info[i].need_discard = 0;
+	}
+	for (i = 0; i < nr_clusters * SWAPFILE_CLUSTER; i++)
+		if (i >= p->max || swap_map[i])
+			cluster_info[i / SWAPFILE_CLUSTER].count++;
+	for (i = 0; i < nr_clusters; i++)
+		if (!cluster_info[i].count)
+			list_add_tail(&cluster_info[i].list,
+				      &p->free_clusters);
+
+	p->cluster_info = cluster_info;
+	return 0;
+}
+
 SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 {
 	struct swap_info_struct * p;
@@ -1799,7 +2052,9 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	if (type >= nr_swapfiles)
 		nr_swapfiles = type+1;
 	memset(p, 0, sizeof(*p));
+	spin_lock_init(&p->lock);
 	INIT_LIST_HEAD(&p->extent_list);
+	INIT_LIST_HEAD(&p->free_clusters);
 	p->flags = SWP_USED;
 	p->next = -1;
 	spin_unlock(&swap_lock);
@@ -1844,6 +2099,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		if (error < 0)
 			goto bad_swap;
 		p->bdev = bdev;
+		p->flags |= SWP_BLKDEV;
 	} else if (S_ISREG(inode->i_mode)) {
 		p->bdev = inode->i_sb->s_bdev;
 		mutex_lock(&inode->i_mutex);
@@ -1982,6 +2238,12 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 			p->flags |= SWP_DISCARDABLE;
 	}
 
+	if (p->flags & SWP_SOLIDSTATE) {
+		error = setup_swap_cluster_info(p, swap_map);
+		if (error)
+			goto bad_swap;
+	}
+
 	mutex_lock(&swapon_mutex);
 	spin_lock(&swap_lock);
 	if (swap_flags & SWAP_FLAG_PREFER)
@@ -1989,9 +2251,11 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		  (swap_flags & SWAP_FLAG_PRIO_MASK) >> SWAP_FLAG_PRIO_SHIFT;
 	else
 		p->prio = --least_priority;
+	spin_lock(&p->lock);
 	p->swap_map = swap_map;
 	p->flags |= SWP_WRITEOK;
-	nr_swap_pages += nr_good_pages;
+	spin_unlock(&p->lock);
+	atomic_long_add(nr_good_pages, &nr_swap_pages);
 	total_swap_pages += nr_good_pages;
 
 	printk(KERN_INFO "Adding %uk swap on %s.  "
@@ -2017,6 +2281,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	}
 	spin_unlock(&swap_lock);
 	mutex_unlock(&swapon_mutex);
+	enable_swap_slots_cache();
 	error = 0;
 	goto out;
 bad_swap:
@@ -2032,6 +2297,10 @@ bad_swap_2:
 	p->flags = 0;
 	spin_unlock(&swap_lock);
 	vfree(swap_map);
+	vfree(p->cluster_info);
+	p->cluster_info = NULL;
+	free_percpu(p->percpu_cluster);
+	p->percpu_cluster = NULL;
 	if (swap_file)
 		filp_close(swap_file, NULL);
 out:
@@ -2049,6 +2318,17 @@ out:
 	return error;
 }
 
+/* Is there a swap device to allocate slots from? */
+bool has_usable_swap(void)
+{
+	bool ret;
+
+	spin_lock(&swap_lock);
+	ret = swap_list.head >= 0;
+	spin_unlock(&swap_lock);
+	return ret;
+}
+
 void si_swapinfo(struct sysinfo *val)
 {
 	unsigned int i;
@@ -2061,7 +2341,7 @@ void si_swapinfo(struct sysinfo *val)
 			continue;
 		nr_to_be_unused += swap_info[i].inuse_pages;
 	}
-	val->freeswap = nr_swap_pages + nr_to_be_unused;
+	val->freeswap = get_nr_swap_pages() + nr_to_be_unused;
 	val->totalswap = total_swap_pages + nr_to_be_unused;
 	spin_unlock(&swap_lock);
 }
@@ -2095,7 +2375,7 @@ static int __swap_duplicate(swp_entry_t entry, bool cache)
 	p = type + swap_info;
 	offset = swp_offset(entry);
 
-	spin_lock(&swap_lock);
+	spin_lock(&p->lock);
 
 	if (unlikely(offset >= p->max))
 		goto unlock_out;
@@ -2109,10 +2389,10 @@ static int __swap_duplicate(swp_entry_t entry, bool cache)
 		if (!has_cache && count) {
 			p->swap_map[offset] = encode_swapmap(count, true);
 			result = 0;
-		} else if (has_cache) /* someone added cache */
-			result = -EEXIST;
-		else if (!count) /* no users */
+		} else if (!count) /* no users, maybe waiting to be freed */
 			result = -ENOENT;
+		else /* someone added cache */
+			result = -EEXIST;
 
 	} else if (count || has_cache) {
 		if (count < SWAP_MAP_MAX - 1) {
@@ -2130,7 +2410,7 @@ static int __swap_duplicate(swp_entry_t entry, bool cache)
 	} else
 		result = -ENOENT; /* unused swap entry */
 unlock_out:
-	spin_unlock(&swap_lock);
+	spin_unlock(&p->lock);
 out:
 	return result;
 
@@ -2167,7 +2447,7 @@ get_swap_info_struct(unsigned type)
 }
 
 /*
- * swap_lock prevents swap_map being freed. Don't grab an extra
+ * si->lock prevents swap_map being freed. Don't grab an extra
  * reference on the swaphandle, it doesn't matter if it becomes unused.
  */
 int valid_swaphandles(swp_entry_t entry, unsigned long *offset)
@@ -2188,7 +2468,7 @@ int valid_swaphandles(swp_entry_t entry, unsigned long *offset)
 	if (!base)		/* first page is swap header */
 		base++;
 
-	spin_lock(&swap_lock);
+	spin_lock(&si->lock);
 	if (end > si->max)	/* don't go beyond end of map */
 		end = si->max;
 
@@ -2208,7 +2488,7 @@ int valid_swaphandles(swp_entry_t entry, unsigned long *offset)
 		if (swap_count(si->swap_map[toff]) == SWAP_MAP_BAD)
 			break;
 	}
-	spin_unlock(&swap_lock);
+	spin_unlock(&si->lock);
 
 	/*
 	 * Indicate starting offset, and return number of pages to get:
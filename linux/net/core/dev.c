@@ -1456,6 +1456,31 @@ void dev_kfree_skb_any(struct sk_buff *skb)
 }
 EXPORT_SYMBOL(dev_kfree_skb_any);
 
+/**
+ * netif_set_real_num_tx_queues - set the number of TX queues in use
+ * @dev: network device
+ * @txq: number of queues, between 1 and dev->num_tx_queues
+ *
+ * Packets already queued on the qdiscs of queues that go out of use
+ * are flushed, so no stale skb is mapped to a queue past the new
+ * limit. Must be called with RTNL held once the device is registered.
+ */
+int netif_set_real_num_tx_queues(struct net_device *dev, unsigned int txq)
+{
+	if (txq < 1 || txq > dev->num_tx_queues)
+		return -EINVAL;
+
+	if (dev->reg_state == NETREG_REGISTERED) {
+		ASSERT_RTNL();
+
+		if (txq < dev->real_num_tx_queues)
+			qdisc_reset_all_tx_gt(dev, txq);
+	}
+
+	dev->real_num_tx_queues = txq;
+	return 0;
+}
+EXPORT_SYMBOL(netif_set_real_num_tx_queues);
 
 /**
  * netif_device_detach - mark device as removed
@@ -1616,6 +1641,91 @@ struct sk_buff *skb_gso_segment(struct sk_buff *skb, int features)
 }
 EXPORT_SYMBOL(skb_gso_segment);
 
+/**
+ *	skb_tunnel_gso_segment - Perform segmentation on a tunnelled skb.
+ *	@skb: buffer to segment, data pointing at the tunnel header
+ *	@features: features for the output path (see dev->features)
+ *	@hlen: length of the tunnel header
+ *	@protocol: protocol of the encapsulated packet
+ *	@mac_len: length of the link layer header of the encapsulated packet
+ *
+ *	This is called from the gso_segment handler of a tunnel protocol,
+ *	with the outer MAC and network headers already parsed. It segments
+ *	the encapsulated packet and puts a copy of the outer headers, up to
+ *	and including the tunnel header, in front of every segment. The
+ *	outer network header of each segment is left for the caller's caller
+ *	to fix up, as with any other transport protocol.
+ */
+struct sk_buff *skb_tunnel_gso_segment(struct sk_buff *skb, int features,
+				       unsigned int hlen, __be16 protocol,
+				       unsigned int mac_len)
+{
+	struct sk_buff *segs;
+	__be16 outer_protocol = skb->protocol;
+	unsigned int outer_mac_len = skb->mac_len;
+	unsigned int thoff;
+	unsigned int tnl_len;
+
+	if (unlikely(!pskb_may_pull(skb, hlen + mac_len)))
+		return ERR_PTR(-EINVAL);
+
+	thoff = skb->data - skb_mac_header(skb);
+	tnl_len = thoff + hlen;
+
+	__skb_pull(skb, hlen);
+	skb->protocol = protocol;
+	skb_reset_mac_header(skb);
+	skb_set_network_header(skb, mac_len);
+
+	/* Only a device that checksums at any offset can complete the
+	 * checksums of the encapsulated packet. Otherwise they are
+	 * finished here, before any outer checksum is computed over them.
+	 */
+	if (!(features & NETIF_F_GEN_CSUM))
+		features &= ~NETIF_F_ALL_CSUM;
+
+	segs = skb_gso_segment(skb, features);
+
+	if (segs && !IS_ERR(segs)) {
+		struct sk_buff *nskb;
+
+		for (nskb = segs; nskb; nskb = nskb->next) {
+			int err = 0;
+
+			if (!(features & NETIF_F_GEN_CSUM) &&
+			    nskb->ip_summed == CHECKSUM_PARTIAL)
+				err = skb_checksum_help(nskb);
+			if (unlikely(err)) {
+				while (segs) {
+					nskb = segs->next;
+					kfree_skb(segs);
+					segs = nskb;
+				}
+				segs = ERR_PTR(err);
+				break;
+			}
+			__skb_push(nskb, tnl_len);
+			skb_copy_from_linear_data_offset(skb, -tnl_len,
+							 nskb->data, tnl_len);
+			skb_reset_mac_header(nskb);
+			skb_set_network_header(nskb, outer_mac_len);
+			skb_set_transport_header(nskb, thoff);
+			nskb->mac_len = outer_mac_len;
+			nskb->protocol = outer_protocol;
+		}
+	}
+
+	__skb_push(skb, hlen);
+	skb->protocol = outer_protocol;
+	skb->mac_len = outer_mac_len;
+	skb_reset_transport_header(skb);
+	skb_set_mac_header(skb, -thoff);
+	skb_set_network_header(skb, outer_mac_len - thoff);
+
+	return segs;
+}
+EXPORT_SYMBOL(skb_tunnel_gso_segment);
+
 /* Take action when hardware reception checksum errors are detected. */
 #ifdef CONFIG_BUG
 void netdev_rx_csum_fault(struct net_device *dev)
@@ -1760,7 +1870,7 @@ gso:
 			return rc;
 		}
 		txq_trans_update(txq);
-		if (unlikely(netif_tx_queue_stopped(txq) && skb->next))
+		if (unlikely(netif_xmit_stopped(txq) && skb->next))
 			return NETDEV_TX_BUSY;
 	} while (skb->next);
 
@@ -1795,16 +1905,97 @@ u16 skb_tx_hash(const struct net_device *dev, const struct sk_buff *skb)
 }
 EXPORT_SYMBOL(skb_tx_hash);
 
+static inline u16 dev_cap_txqueue(struct net_device *dev, u16 queue_index)
+{
+	if (unlikely(queue_index >= dev->real_num_tx_queues)) {
+		if (net_ratelimit()) {
+			pr_warning("%s selects TX queue %d, but "
+				"real number of TX queues is %d\n",
+				dev->name, queue_index, dev->real_num_tx_queues);
+		}
+		return 0;
+	}
+	return queue_index;
+}
+
+/*
+ * get_xps_queue returns the tx queue mapped to the sending CPU, or -1
+ * if no XPS map covers that CPU.
+ */
+static inline int get_xps_queue(struct net_device *dev, struct sk_buff *skb)
+{
+#ifdef CONFIG_XPS
+	struct xps_dev_maps *dev_maps;
+	struct xps_map *map;
+	int queue_index = -1;
+
+	rcu_read_lock();
+	dev_maps = rcu_dereference(dev->xps_maps);
+	if (dev_maps) {
+		map = rcu_dereference(
+		    dev_maps->cpu_map[raw_smp_processor_id()]);
+		if (map) {
+			if (map->len == 1)
+				queue_index = map->queues[0];
+			else {
+				u32 hash;
+				if (skb->sk && skb->sk->sk_hash)
+					hash = skb->sk->sk_hash;
+				else
+					hash = (__force u16) skb->protocol ^
+					    skb->rxhash;
+				hash = jhash_1word(hash, skb_tx_hashrnd);
+				queue_index = map->queues[
+				    ((u64)hash * map->len) >> 32];
+			}
+			if (unlikely(queue_index >= dev->real_num_tx_queues))
+				queue_index = -1;
+		}
+	}
+	rcu_read_unlock();
+
+	return queue_index;
+#else
+	return -1;
+#endif
+}
+
 static struct netdev_queue *dev_pick_tx(struct net_device *dev,
 					struct sk_buff *skb)
 {
 	const struct net_device_ops *ops = dev->netdev_ops;
-	u16 queue_index = 0;
+	int queue_index;
 
-	if (ops->ndo_select_queue)
+	if (ops->ndo_select_queue) {
 		queue_index = ops->ndo_select_queue(dev, skb);
-	else if (dev->real_num_tx_queues > 1)
-		queue_index = skb_tx_hash(dev, skb);
+		queue_index = dev_cap_txqueue(dev, queue_index);
+	} else if (dev->real_num_tx_queues == 1)
+		queue_index = 0;
+	else {
+		struct sock *sk = skb->sk;
+
+		/*
+		 * Stick to the queue cached on the socket so a flow is not
+		 * reordered, unless the transport says it has nothing in
+		 * flight (ooo_okay) and the queue may follow the sending CPU.
+		 */
+		queue_index = sk_tx_queue_get(sk);
+		if (queue_index < 0 || skb->ooo_okay ||
+		    queue_index >= dev->real_num_tx_queues) {
+			int old_index = queue_index;
+
+			queue_index = get_xps_queue(dev, skb);
+			if (queue_index < 0)
+				queue_index = skb_tx_hash(dev, skb);
+
+			if (queue_index != old_index && sk) {
+				struct dst_entry *dst = sk->sk_dst_cache;
+
+				if (dst && skb_dst(skb) == dst)
+					sk_tx_queue_set(sk, queue_index);
+			}
+		}
+	}
 
 	skb_set_queue_mapping(skb, queue_index);
 	return netdev_get_tx_queue(dev, queue_index);
@@ -1998,7 +2189,7 @@ gso:
 
 			HARD_TX_LOCK(dev, txq, cpu);
 
-			if (!netif_tx_queue_stopped(txq)) {
+			if (!netif_xmit_stopped(txq)) {
 				rc = NET_XMIT_SUCCESS;
 				if (!dev_hard_start_xmit(skb, dev, txq)) {
 					HARD_TX_UNLOCK(dev, txq);
@@ -2042,6 +2233,210 @@ int weight_p __read_mostly = 64;            /* old backlog weight */
 DEFINE_PER_CPU(struct netif_rx_stats, netdev_rx_stat) = { 0, };
 
 
+/* Seed for the flow hash */
+static u32 hashrnd __read_mostly;
+
+/*
+ * __skb_get_rxhash: calculate a flow hash based on src/dst addresses
+ * and src/dst port numbers of an IPv4 or IPv6 packet. The network
+ * header must be set. Returns a non-zero hash on success and 0 on
+ * failure.
+ */
+__u32 __skb_get_rxhash(struct sk_buff *skb)
+{
+	struct ipv6hdr *ip6;
+	struct iphdr *ip;
+	int nhoff = skb_network_offset(skb);
+	u32 addr1, addr2, ports, ihl, hash;
+	u8 ip_proto;
+
+	switch (skb->protocol) {
+	case __constant_htons(ETH_P_IP):
+		if (!pskb_may_pull(skb, sizeof(*ip) + nhoff))
+			return 0;
+
+		ip = (struct iphdr *) (skb->data + nhoff);
+		ip_proto = ip->protocol;
+		if (ip->frag_off & htons(IP_MF | IP_OFFSET))
+			ip_proto = 0;
+		addr1 = (__force u32) ip->saddr;
+		addr2 = (__force u32) ip->daddr;
+		ihl = ip->ihl;
+		break;
+	case __constant_htons(ETH_P_IPV6):
+		if (!pskb_may_pull(skb, sizeof(*ip6) + nhoff))
+			return 0;
+
+		ip6 = (struct ipv6hdr *) (skb->data + nhoff);
+		ip_proto = ip6->nexthdr;
+		addr1 = (__force u32) ip6->saddr.s6_addr32[3];
+		addr2 = (__force u32) ip6->daddr.s6_addr32[3];
+		ihl = (40 >> 2);
+		break;
+	default:
+		return 0;
+	}
+	ports = 0;
+	switch (ip_proto) {
+	case IPPROTO_TCP:
+	case IPPROTO_UDP:
+	case IPPROTO_DCCP:
+	case IPPROTO_ESP:
+	case IPPROTO_AH:
+	case IPPROTO_SCTP:
+	case IPPROTO_UDPLITE:
+		if (pskb_may_pull(skb, nhoff + (ihl * 4) + 4))
+			ports = *((u32 *) (skb->data + nhoff + (ihl * 4)));
+		break;
+
+	default:
+		break;
+	}
+
+	hash = jhash_3words(addr1, addr2, ports, hashrnd);
+	if (!hash)
+		hash = 1;
+
+	return hash;
+}
+EXPORT_SYMBOL(__skb_get_rxhash);
+
+#ifdef CONFIG_RPS
+
+/*
+ * get_rps_cpu is called from netif_receive_skb and returns the target
+ * CPU from the RPS map of the receiving queue for a given skb.
+ * rcu_read_lock must be held on entry.
+ */
+static int get_rps_cpu(struct net_device *dev, struct sk_buff *skb)
+{
+	struct netdev_rx_queue *rxqueue;
+	struct rps_map *map;
+	int cpu = -1;
+	u16 tcpu;
+
+	if (skb_rx_queue_recorded(skb)) {
+		u16 index = skb_get_rx_queue(skb);
+		if (unlikely(index >= dev->num_rx_queues)) {
+			if (net_ratelimit()) {
+				pr_warning("%s received packet on queue "
+					"%u, but number of RX queues is %u\n",
+					dev->name, index, dev->num_rx_queues);
+			}
+			goto done;
+		}
+		rxqueue = dev->_rx + index;
+	} else
+		rxqueue = dev->_rx;
+
+	map = rcu_dereference(rxqueue->rps_map);
+	if (!map)
+		goto done;
+
+	/* The packet data starts at the network header on receive */
+	skb_reset_network_header(skb);
+	if (!skb_get_rxhash(skb))
+		goto done;
+
+	tcpu = map->cpus[((u64) skb->rxhash * map->len) >> 32];
+	if (cpu_online(tcpu))
+		cpu = tcpu;
+
+done:
+	return cpu;
+}
+
+/* Called from hardirq (IPI) context */
+static void rps_trigger_softirq(void *data)
+{
+	struct softnet_data *queue = data;
+
+	__napi_schedule(&queue->backlog);
+	__get_cpu_var(netdev_rx_stat).received_rps++;
+}
+
+#endif /* CONFIG_RPS */
+
+/*
+ * The input_pkt_queue of a CPU may be filled by other CPUs when RPS is
+ * enabled, so its list lock protects it.  Without RPS only the local
+ * CPU touches it with interrupts disabled and the lock can be skipped.
+ */
+static inline void rps_lock(struct softnet_data *queue)
+{
+#ifdef CONFIG_RPS
+	spin_lock(&queue->input_pkt_queue.lock);
+#endif
+}
+
+static inline void rps_unlock(struct softnet_data *queue)
+{
+#ifdef CONFIG_RPS
+	spin_unlock(&queue->input_pkt_queue.lock);
+#endif
+}
+
+/*
+ * enqueue_to_backlog is called to queue an skb to a per CPU backlog
+ * queue (may be a remote CPU queue).
+ */
+static int enqueue_to_backlog(struct sk_buff *skb, int cpu)
+{
+	struct softnet_data *queue;
+	unsigned long flags;
+
+	queue = &per_cpu(softnet_data, cpu);
+
+	local_irq_save(flags);
+	__get_cpu_var(netdev_rx_stat).total++;
+
+	rps_lock(queue);
+	if (queue->input_pkt_queue.qlen <= netdev_max_backlog) {
+		if (queue->input_pkt_queue.qlen) {
+enqueue:
+			__skb_queue_tail(&queue->input_pkt_queue, skb);
+#ifdef CONFIG_RPS
+			if (cpu != smp_processor_id())
+				__get_cpu_var(netdev_rx_stat).steered_rps++;
+#endif
+			rps_unlock(queue);
+			local_irq_restore(flags);
+			return NET_RX_SUCCESS;
+		}
+
+		/* Schedule NAPI for backlog device */
+		if (napi_schedule_prep(&queue->backlog)) {
+#ifdef CONFIG_RPS
+			if (cpu != smp_processor_id()) {
+				struct softnet_data *myqueue;
+
+				/*
+				 * Defer the IPI to the end of our own
+				 * net_rx_action so that one IPI covers a
+				 * whole batch of packets for that CPU.
+				 */
+				myqueue = &__get_cpu_var(softnet_data);
+				queue->rps_ipi_next = myqueue->rps_ipi_list;
+				myqueue->rps_ipi_list = queue;
+
+				__raise_softirq_irqoff(NET_RX_SOFTIRQ);
+				goto enqueue;
+			}
+#endif
+			__napi_schedule(&queue->backlog);
+		}
+		goto enqueue;
+	}
+
+	rps_unlock(queue);
+
+	__get_cpu_var(netdev_rx_stat).dropped++;
+	local_irq_restore(flags);
+
+	kfree_skb(skb);
+	return NET_RX_DROP;
+}
+
 /**
  *	netif_rx	-	post buffer to the network code
  *	@skb: buffer to post
@@ -2059,8 +2454,7 @@ DEFINE_PER_CPU(struct netif_rx_stats, netdev_rx_stat) = { 0, };
 
 int netif_rx(struct sk_buff *skb)
 {
-	struct softnet_data *queue;
-	unsigned long flags;
+	int ret;
 
 	/* if netpoll wants it, pretend we never saw it */
 	if (netpoll_rx(skb))
@@ -2069,31 +2463,22 @@ int netif_rx(struct sk_buff *skb)
 	if (!skb->tstamp.tv64)
 		net_timestamp(skb);
 
-	/*
-	 * The code is rearranged so that the path is the most
-	 * short when CPU is congested, but is still operating.
-	 */
-	local_irq_save(flags);
-	queue = &__get_cpu_var(softnet_data);
-
-	__get_cpu_var(netdev_rx_stat).total++;
-	if (queue->input_pkt_queue.qlen <= netdev_max_backlog) {
-		if (queue->input_pkt_queue.qlen) {
-enqueue:
-			__skb_queue_tail(&queue->input_pkt_queue, skb);
-			local_irq_restore(flags);
-			return NET_RX_SUCCESS;
-		}
+#ifdef CONFIG_RPS
+	{
+		int cpu;
 
-		napi_schedule(&queue->backlog);
-		goto enqueue;
+		rcu_read_lock();
+		cpu = get_rps_cpu(skb->dev, skb);
+		if (cpu < 0)
+			cpu = smp_processor_id();
+		ret = enqueue_to_backlog(skb, cpu);
+		rcu_read_unlock();
 	}
-
-	__get_cpu_var(netdev_rx_stat).dropped++;
-	local_irq_restore(flags);
-
-	kfree_skb(skb);
-	return NET_RX_DROP;
+#else
+	ret = enqueue_to_backlog(skb, get_cpu());
+	put_cpu();
+#endif
+	return ret;
 }
 EXPORT_SYMBOL(netif_rx);
 
@@ -2330,22 +2715,7 @@ void netif_nit_deliver(struct sk_buff *skb)
 	rcu_read_unlock();
 }
 
-/**
- *	netif_receive_skb - process receive buffer from network
- *	@skb: buffer to process
- *
- *	netif_receive_skb() is the main receive data processing function.
- *	It always succeeds. The buffer may be dropped during processing
- *	for congestion control or by the protocol layers.
- *
- *	This function may only be called from softirq context and interrupts
- *	should be enabled.
- *
- *	Return values (usually ignored):
- *	NET_RX_SUCCESS: no congestion
- *	NET_RX_DROP: packet was dropped
- */
-int netif_receive_skb(struct sk_buff *skb)
+static int __netif_receive_skb(struct sk_buff *skb)
 {
 	struct packet_type *ptype, *pt_prev;
 	struct net_device *orig_dev;
@@ -2454,6 +2824,41 @@ out:
 	rcu_read_unlock();
 	return ret;
 }
+
+/**
+ *	netif_receive_skb - process receive buffer from network
+ *	@skb: buffer to process
+ *
+ *	netif_receive_skb() is the main receive data processing function.
+ *	It always succeeds. The buffer may be dropped during processing
+ *	for congestion control or by the protocol layers.
+ *
+ *	This function may only be called from softirq context and interrupts
+ *	should be enabled.
+ *
+ *	Return values (usually ignored):
+ *	NET_RX_SUCCESS: no congestion
+ *	NET_RX_DROP: packet was dropped
+ */
+int netif_receive_skb(struct sk_buff *skb)
+{
+#ifdef CONFIG_RPS
+	int cpu, ret;
+
+	if (!skb->tstamp.tv64)
+		net_timestamp(skb);
+
+	rcu_read_lock();
+	cpu = get_rps_cpu(skb->dev, skb);
+	if (cpu >= 0) {
+		ret = enqueue_to_backlog(skb, cpu);
+		rcu_read_unlock();
+		return ret;
+	}
+	rcu_read_unlock();
+#endif
+	return __netif_receive_skb(skb);
+}
 EXPORT_SYMBOL(netif_receive_skb);
 
 /* Network device is going away, flush any packets still pending  */
@@ -2463,12 +2868,55 @@ static void flush_backlog(void *arg)
 	struct softnet_data *queue = &__get_cpu_var(softnet_data);
 	struct sk_buff *skb, *tmp;
 
+	rps_lock(queue);
 	skb_queue_walk_safe(&queue->input_pkt_queue, skb, tmp)
 		if (skb->dev == dev) {
 			__skb_unlink(skb, &queue->input_pkt_queue);
 			kfree_skb(skb);
 		}
+	rps_unlock(queue);
+}
+
+/**
+ *	gro_find_receive_by_type - find the GRO handler of a protocol
+ *	@type: protocol, in network byte order
+ *
+ *	Used by tunnel protocols to hand the encapsulated packet to the
+ *	next layer. Must be called under rcu_read_lock().
+ */
+struct packet_type *gro_find_receive_by_type(__be16 type)
+{
+	struct list_head *head = &ptype_base[ntohs(type) & PTYPE_HASH_MASK];
+	struct packet_type *ptype;
+
+	list_for_each_entry_rcu(ptype, head, list) {
+		if (ptype->type != type || ptype->dev || !ptype->gro_receive)
+			continue;
+		return ptype;
+	}
+	return NULL;
 }
+EXPORT_SYMBOL(gro_find_receive_by_type);
+
+/**
+ *	gro_find_complete_by_type - find the GRO completion of a protocol
+ *	@type: protocol, in network byte order
+ *
+ *	Must be called under rcu_read_lock().
+ */
+struct packet_type *gro_find_complete_by_type(__be16 type)
+{
+	struct list_head *head = &ptype_base[ntohs(type) & PTYPE_HASH_MASK];
+	struct packet_type *ptype;
+
+	list_for_each_entry_rcu(ptype, head, list) {
+		if (ptype->type != type || ptype->dev || !ptype->gro_complete)
+			continue;
+		return ptype;
+	}
+	return NULL;
+}
+EXPORT_SYMBOL(gro_find_complete_by_type);
 
 static int napi_gro_complete(struct sk_buff *skb)
 {
@@ -2487,7 +2935,7 @@ static int napi_gro_complete(struct sk_buff *skb)
 		if (ptype->type != type || ptype->dev || !ptype->gro_complete)
 			continue;
 
-		err = ptype->gro_complete(skb);
+		err = ptype->gro_complete(skb, 0);
 		break;
 	}
 	rcu_read_unlock();
@@ -2544,6 +2992,7 @@ int dev_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 		NAPI_GRO_CB(skb)->same_flow = 0;
 		NAPI_GRO_CB(skb)->flush = 0;
 		NAPI_GRO_CB(skb)->free = 0;
+		NAPI_GRO_CB(skb)->encap_mark = 0;
 
 		pp = ptype->gro_receive(&napi->gro_list, skb);
 		break;
@@ -2787,15 +3236,18 @@ static int process_backlog(struct napi_struct *napi, int quota)
 		struct sk_buff *skb;
 
 		local_irq_disable();
+		rps_lock(queue);
 		skb = __skb_dequeue(&queue->input_pkt_queue);
 		if (!skb) {
 			__napi_complete(napi);
+			rps_unlock(queue);
 			local_irq_enable();
 			break;
 		}
+		rps_unlock(queue);
 		local_irq_enable();
 
-		netif_receive_skb(skb);
+		__netif_receive_skb(skb);
 	} while (++work < quota && jiffies == start_time);
 
 	return work;
@@ -2885,9 +3337,38 @@ void netif_napi_del(struct napi_struct *napi)
 EXPORT_SYMBOL(netif_napi_del);
 
 
+/*
+ * net_rps_action_and_irq_enable sends any pending IPI's for rps.
+ * Note: called with local irq disabled, but exits with local irq enabled.
+ */
+static void net_rps_action_and_irq_enable(struct softnet_data *queue)
+{
+#ifdef CONFIG_RPS
+	struct softnet_data *remqueue = queue->rps_ipi_list;
+
+	if (remqueue) {
+		queue->rps_ipi_list = NULL;
+
+		local_irq_enable();
+
+		/* Send pending IPI's to kick RPS processing on remote cpus. */
+		while (remqueue) {
+			struct softnet_data *next = remqueue->rps_ipi_next;
+
+			if (cpu_online(remqueue->cpu))
+				__smp_call_function_single(remqueue->cpu,
+							   &remqueue->csd, 0);
+			remqueue = next;
+		}
+	} else
+#endif
+		local_irq_enable();
+}
+
 static void net_rx_action(struct softirq_action *h)
 {
-	struct list_head *list = &__get_cpu_var(softnet_data).poll_list;
+	struct softnet_data *queue = &__get_cpu_var(softnet_data);
+	struct list_head *list = &queue->poll_list;
 	unsigned long time_limit = jiffies + 2;
 	int budget = netdev_budget;
 	void *have;
@@ -2953,7 +3434,7 @@ static void net_rx_action(struct softirq_action *h)
 		netpoll_poll_unlock(have);
 	}
 out:
-	local_irq_enable();
+	net_rps_action_and_irq_enable(queue);
 
 #ifdef CONFIG_NET_DMA
 	/*
@@ -3197,10 +3678,11 @@ static int softnet_seq_show(struct seq_file *seq, void *v)
 {
 	struct netif_rx_stats *s = v;
 
-	seq_printf(seq, "%08x %08x %08x %08x %08x %08x %08x %08x %08x\n",
+	seq_printf(seq,
+		   "%08x %08x %08x %08x %08x %08x %08x %08x %08x %08x %08x\n",
 		   s->total, s->dropped, s->time_squeeze, 0,
 		   0, 0, 0, 0, /* was fastroute */
-		   s->cpu_collision);
+		   s->cpu_collision, s->received_rps, s->steered_rps);
 	return 0;
 }
 
@@ -5185,6 +5667,9 @@ static void netdev_init_one_queue(struct net_device *dev,
 				  void *_unused)
 {
 	queue->dev = dev;
+#ifdef CONFIG_BQL
+	dql_init(&queue->dql, HZ);
+#endif
 }
 
 static void netdev_init_queues(struct net_device *dev)
@@ -5212,6 +5697,9 @@ struct net_device *alloc_netdev_mq(int sizeof_priv, const char *name,
 	struct net_device *dev;
 	size_t alloc_size;
 	struct net_device *p;
+#ifdef CONFIG_RPS
+	struct netdev_rx_queue *rx;
+#endif
 
 	BUG_ON(strlen(name) >= sizeof(dev->name));
 
@@ -5237,11 +5725,20 @@ struct net_device *alloc_netdev_mq(int sizeof_priv, const char *name,
 		goto free_p;
 	}
 
+#ifdef CONFIG_RPS
+	rx = kcalloc(queue_count, sizeof(struct netdev_rx_queue), GFP_KERNEL);
+	if (!rx) {
+		printk(KERN_ERR "alloc_netdev: Unable to allocate "
+		       "rx queues.\n");
+		goto free_tx;
+	}
+#endif
+
 	dev = PTR_ALIGN(p, NETDEV_ALIGN);
 	dev->padded = (char *)dev - (char *)p;
 
 	if (dev_addr_init(dev))
-		goto free_tx;
+		goto free_rx;
 
 	dev_unicast_init(dev);
 
@@ -5251,6 +5748,11 @@ struct net_device *alloc_netdev_mq(int sizeof_priv, const char *name,
 	dev->num_tx_queues = queue_count;
 	dev->real_num_tx_queues = queue_count;
 
+#ifdef CONFIG_RPS
+	dev->_rx = rx;
+	dev->num_rx_queues = queue_count;
+#endif
+
 	dev->gso_max_size = GSO_MAX_SIZE;
 
 	netdev_init_queues(dev);
@@ -5261,7 +5763,11 @@ struct net_device *alloc_netdev_mq(int sizeof_priv, const char *name,
 	strcpy(dev->name, name);
 	return dev;
 
+free_rx:
+#ifdef CONFIG_RPS
+	kfree(rx);
 free_tx:
+#endif
 	kfree(tx);
 
 free_p:
@@ -5284,6 +5790,17 @@ void free_netdev(struct net_device *dev)
 
 	release_net(dev_net(dev));
 
+#ifdef CONFIG_XPS
+	/* The device is unregistered, no transmitter can see the maps */
+	if (dev->xps_maps) {
+		int cpu;
+
+		for_each_possible_cpu(cpu)
+			kfree(dev->xps_maps->cpu_map[cpu]);
+		kfree(dev->xps_maps);
+	}
+#endif
+
 	kfree(dev->_tx);
 
 	/* Flush device addresses */
@@ -5294,6 +5811,10 @@ void free_netdev(struct net_device *dev)
 
 	/*  Compatibility with error handling in drivers */
 	if (dev->reg_state == NETREG_UNINITIALIZED) {
+#ifdef CONFIG_RPS
+		/* otherwise the rx queues go away in netdev_release() */
+		kfree(dev->_rx);
+#endif
 		kfree((char *)dev - dev->padded);
 		return;
 	}
@@ -5527,11 +6048,28 @@ static int dev_cpu_callback(struct notifier_block *nfb,
 	*list_net = oldsd->output_queue;
 	oldsd->output_queue = NULL;
 
+	/*
+	 * Append NAPI poll list from offline CPU.  Its backlog is drained
+	 * below from this CPU, so just make it schedulable again.
+	 */
+	while (!list_empty(&oldsd->poll_list)) {
+		struct napi_struct *napi;
+
+		napi = list_first_entry(&oldsd->poll_list, struct napi_struct,
+					poll_list);
+		if (napi == &oldsd->backlog)
+			list_del_init(&napi->poll_list);
+		else
+			list_move_tail(&napi->poll_list, &sd->poll_list);
+	}
+	clear_bit(NAPI_STATE_SCHED, &oldsd->backlog.state);
+
 	raise_softirq_irqoff(NET_TX_SOFTIRQ);
+	raise_softirq_irqoff(NET_RX_SOFTIRQ);
 	local_irq_enable();
 
 	/* Process offline CPU's input_pkt_queue */
-	while ((skb = __skb_dequeue(&oldsd->input_pkt_queue)))
+	while ((skb = skb_dequeue(&oldsd->input_pkt_queue)))
 		netif_rx(skb);
 
 	return NOTIFY_OK;
@@ -5734,6 +6272,13 @@ static int __init net_dev_init(void)
 		queue->completion_queue = NULL;
 		INIT_LIST_HEAD(&queue->poll_list);
 
+#ifdef CONFIG_RPS
+		queue->csd.func = rps_trigger_softirq;
+		queue->csd.info = queue;
+		queue->csd.flags = 0;
+		queue->cpu = i;
+#endif
+
 		queue->backlog.poll = process_backlog;
 		queue->backlog.weight = weight_p;
 		queue->backlog.gro_list = NULL;
@@ -5773,6 +6318,7 @@ subsys_initcall(net_dev_init);
 static int __init initialize_hashrnd(void)
 {
 	get_random_bytes(&skb_tx_hashrnd, sizeof(skb_tx_hashrnd));
+	get_random_bytes(&hashrnd, sizeof(hashrnd));
 	return 0;
 }
 
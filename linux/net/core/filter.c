@@ -64,6 +64,100 @@ static inline void *load_pointer(struct sk_buff *skb, int k,
 	}
 }
 
+/*
+ * Ancillary data, which are impossible (or very difficult) to get
+ * parsing packet contents. @k is the offset of a load that found no
+ * packet data. Returns 0 with the value in @res, or -EINVAL if the
+ * filter must return 0.
+ */
+static inline int load_ancillary(const struct sk_buff *skb, int k, u32 A,
+				 u32 X, u32 *res)
+{
+	switch (k-SKF_AD_OFF) {
+	case SKF_AD_PROTOCOL:
+		*res = ntohs(skb->protocol);
+		return 0;
+	case SKF_AD_PKTTYPE:
+		*res = skb->pkt_type;
+		return 0;
+	case SKF_AD_IFINDEX:
+		*res = skb->dev->ifindex;
+		return 0;
+	case SKF_AD_NLATTR: {
+		struct nlattr *nla;
+
+		if (skb_is_nonlinear(skb))
+			return -EINVAL;
+		if (A > skb->len - sizeof(struct nlattr))
+			return -EINVAL;
+
+		nla = nla_find((struct nlattr *)&skb->data[A],
+			       skb->len - A, X);
+		*res = nla ? (void *)nla - (void *)skb->data : 0;
+		return 0;
+	}
+	case SKF_AD_NLATTR_NEST: {
+		struct nlattr *nla;
+
+		if (skb_is_nonlinear(skb))
+			return -EINVAL;
+		if (A > skb->len - sizeof(struct nlattr))
+			return -EINVAL;
+
+		nla = (struct nlattr *)&skb->data[A];
+		if (nla->nla_len > A - skb->len)
+			return -EINVAL;
+
+		nla = nla_find_nested(nla, X);
+		*res = nla ? (void *)nla - (void *)skb->data : 0;
+		return 0;
+	}
+	default:
+		return -EINVAL;
+	}
+}
+
+#ifdef CONFIG_BPF_JIT
+/*
+ * 0: filters are interpreted, 1: filters are compiled at attach time,
+ * 2: as 1, and the generated code is dumped to the kernel log.
+ */
+int bpf_jit_enable __read_mostly;
+
+/*
+ * Out of line part of the JIT packet loads: resolve a negative
+ * (SKF_NET_OFF or SKF_LL_OFF relative) offset the way the interpreter
+ * does. Returns NULL if the load must make the filter return 0.
+ */
+void *bpf_internal_load_pointer_neg_helper(const struct sk_buff *skb,
+					   int k, unsigned int size)
+{
+	u8 *ptr = NULL;
+
+	if (k >= SKF_AD_OFF)
+		return NULL;
+	if (k >= SKF_NET_OFF)
+		ptr = skb_network_header(skb) + k - SKF_NET_OFF;
+	else if (k >= SKF_LL_OFF)
+		ptr = skb_mac_header(skb) + k - SKF_LL_OFF;
+
+	if (ptr >= skb->head && ptr + size <= skb_tail_pointer(skb))
+		return ptr;
+	return NULL;
+}
+
+/*
+ * Indirect JIT loads can only tell at run time that X + K falls in the
+ * SKF_AD_OFF area, where the interpreter reads ancillary data. Same
+ * return convention as load_ancillary().
+ */
+int bpf_internal_load_ancillary_helper(const struct sk_buff *skb, int k,
+				       u32 A, u32 X, u32 *res)
+{
+	return load_ancillary(skb, k, A, X, res);
+}
+#endif
+
 /**
  *	sk_filter - run a packet through a socket filter
  *	@sk: sock associated with &sk_buff
@@ -88,8 +182,7 @@ int sk_filter(struct sock *sk, struct sk_buff *skb)
 	rcu_read_lock_bh();
 	filter = rcu_dereference(sk->sk_filter);
 	if (filter) {
-		unsigned int pkt_len = sk_run_filter(skb, filter->insns,
-				filter->len);
+		unsigned int pkt_len = SK_RUN_FILTER(filter, skb);
 		err = pkt_len ? pskb_trim(skb, pkt_len) : -EPERM;
 	}
 	rcu_read_unlock_bh();
@@ -289,58 +382,10 @@ load_b:
 			return 0;
 		}
 
-		/*
-		 * Handle ancillary data, which are impossible
-		 * (or very difficult) to get parsing packet contents.
-		 */
-		switch (k-SKF_AD_OFF) {
-		case SKF_AD_PROTOCOL:
-			A = ntohs(skb->protocol);
-			continue;
-		case SKF_AD_PKTTYPE:
-			A = skb->pkt_type;
-			continue;
-		case SKF_AD_IFINDEX:
-			A = skb->dev->ifindex;
-			continue;
-		case SKF_AD_NLATTR: {
-			struct nlattr *nla;
-
-			if (skb_is_nonlinear(skb))
-				return 0;
-			if (A > skb->len - sizeof(struct nlattr))
-				return 0;
-
-			nla = nla_find((struct nlattr *)&skb->data[A],
-				       skb->len - A, X);
-			if (nla)
-				A = (void *)nla - (void *)skb->data;
-			else
-				A = 0;
-			continue;
-		}
-		case SKF_AD_NLATTR_NEST: {
-			struct nlattr *nla;
-
-			if (skb_is_nonlinear(skb))
-				return 0;
-			if (A > skb->len - sizeof(struct nlattr))
-				return 0;
-
-			nla = (struct nlattr *)&skb->data[A];
-			if (nla->nla_len > A - skb->len)
-				return 0;
-
-			nla = nla_find_nested(nla, X);
-			if (nla)
-				A = (void *)nla - (void *)skb->data;
-			else
-				A = 0;
+		/* No packet data at k, which may be an ancillary load. */
+		if (load_ancillary(skb, k, A, X, &A) == 0)
 			continue;
-		}
-		default:
-			return 0;
-		}
+		return 0;
 	}
 
 	return 0;
@@ -507,6 +552,7 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 
 	atomic_set(&fp->refcnt, 1);
 	fp->len = fprog->len;
+	fp->bpf_func = NULL;
 
 	err = sk_chk_filter(fp->insns, fp->len);
 	if (err) {
@@ -514,6 +560,8 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 		return err;
 	}
 
+	bpf_jit_compile(fp);
+
 	rcu_read_lock_bh();
 	old_fp = rcu_dereference(sk->sk_filter);
 	rcu_assign_pointer(sk->sk_filter, fp);
@@ -18,6 +18,7 @@
 #include <linux/vmalloc.h>
 
 #include <net/request_sock.h>
+#include <net/tcp.h>
 
 /*
  * Maximum number of SYN_RECV sockets in queue per LISTEN socket.
@@ -58,13 +59,13 @@ int reqsk_queue_alloc(struct request_sock_queue *queue,
 	     lopt->max_qlen_log++);
 
 	get_random_bytes(&lopt->hash_rnd, sizeof(lopt->hash_rnd));
-	rwlock_init(&queue->syn_wait_lock);
+	spin_lock_init(&queue->syn_wait_lock);
 	queue->rskq_accept_head = NULL;
 	lopt->nr_table_entries = nr_table_entries;
 
-	write_lock_bh(&queue->syn_wait_lock);
-	queue->listen_opt = lopt;
-	write_unlock_bh(&queue->syn_wait_lock);
+	spin_lock_bh(&queue->syn_wait_lock);
+	rcu_assign_pointer(queue->listen_opt, lopt);
+	spin_unlock_bh(&queue->syn_wait_lock);
 
 	return 0;
 }
@@ -94,10 +95,10 @@ static inline struct listen_sock *reqsk_queue_yank_listen_sk(
 {
 	struct listen_sock *lopt;
 
-	write_lock_bh(&queue->syn_wait_lock);
+	spin_lock_bh(&queue->syn_wait_lock);
 	lopt = queue->listen_opt;
-	queue->listen_opt = NULL;
-	write_unlock_bh(&queue->syn_wait_lock);
+	rcu_assign_pointer(queue->listen_opt, NULL);
+	spin_unlock_bh(&queue->syn_wait_lock);
 
 	return lopt;
 }
@@ -109,7 +110,12 @@ void reqsk_queue_destroy(struct request_sock_queue *queue)
 	size_t lopt_size = sizeof(struct listen_sock) +
 		lopt->nr_table_entries * sizeof(struct request_sock *);
 
-	if (lopt->qlen != 0) {
+	/* Wait for SYNs still looking at the queue without the listener
+	 * lock; none can add requests once listen_opt is gone.
+	 */
+	synchronize_rcu();
+
+	if (atomic_read(&lopt->qlen) != 0) {
 		unsigned int i;
 
 		for (i = 0; i < lopt->nr_table_entries; i++) {
@@ -117,16 +123,44 @@ void reqsk_queue_destroy(struct request_sock_queue *queue)
 
 			while ((req = lopt->syn_table[i]) != NULL) {
 				lopt->syn_table[i] = req->dl_next;
-				lopt->qlen--;
+				atomic_dec(&lopt->qlen);
 				reqsk_free(req);
 			}
 		}
 	}
 
-	WARN_ON(lopt->qlen != 0);
+	WARN_ON(atomic_read(&lopt->qlen) != 0);
 	if (lopt_size > PAGE_SIZE)
 		vfree(lopt);
 	else
 		kfree(lopt);
 }
 
+/*
+ * A Fast Open child is created before the three way handshake completes,
+ * so it keeps a pointer to its request_sock (tp->fastopen_rsk) for SYN-ACK
+ * retransmission until the handshake is completed or aborted. The same req
+ * also sits on the listener's accept queue until the child is accepted,
+ * which sets req->sk to NULL. The req is freed by whichever of the two
+ * owners lets go of it last; fastopenq->lock serializes the decision.
+ *
+ * Called from the child's context, with its socket lock held, once it no
+ * longer needs the req.
+ */
+void reqsk_fastopen_remove(struct sock *sk, struct request_sock *req)
+{
+	struct sock *lsk = tcp_rsk(req)->listener;
+	struct fastopen_queue *fastopenq =
+	    inet_csk(lsk)->icsk_accept_queue.fastopenq;
+
+	tcp_sk(sk)->fastopen_rsk = NULL;
+	spin_lock_bh(&fastopenq->lock);
+	fastopenq->qlen--;
+	tcp_rsk(req)->listener = NULL;
+	if (req->sk)	/* the child socket hasn't been accepted yet */
+		req = NULL;
+	spin_unlock_bh(&fastopenq->lock);
+	sock_put(lsk);
+	if (req)
+		reqsk_free(req);
+}
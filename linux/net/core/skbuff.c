@@ -547,6 +547,7 @@ static void __copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 	new->protocol		= old->protocol;
 	new->mark		= old->mark;
 	new->iif		= old->iif;
+	new->rxhash		= old->rxhash;
 	__nf_copy(new, old);
 #if defined(CONFIG_NETFILTER_XT_TARGET_TRACE) || \
     defined(CONFIG_NETFILTER_XT_TARGET_TRACE_MODULE)
@@ -1526,15 +1527,47 @@ static int __skb_splice_bits(struct sk_buff *skb, unsigned int *offset,
 	return 0;
 }
 
+/*
+ * Hand the pages mapped by skb_splice_bits() to the pipe on behalf of a
+ * socket whose lock is held by the caller.
+ */
+ssize_t skb_socket_splice(struct sock *sk, struct pipe_inode_info *pipe,
+			  struct splice_pipe_desc *spd)
+{
+	ssize_t ret;
+
+	/*
+	 * Drop the socket lock, otherwise we have reverse
+	 * locking dependencies between sk_lock and i_mutex
+	 * here as compared to sendfile(). We enter here
+	 * with the socket lock held, and splice_to_pipe() will
+	 * grab the pipe inode lock. For sendfile() emulation,
+	 * we call into ->sendpage() with the i_mutex lock held
+	 * and networking will grab the socket lock.
+	 */
+	release_sock(sk);
+	ret = splice_to_pipe(pipe, spd);
+	lock_sock(sk);
+
+	return ret;
+}
+
 /*
  * Map data from the skb to a pipe. Should handle both the linear part,
  * the fragments, and the frag list. It does NOT handle frag lists within
  * the frag list, if such a thing exists. We'd probably need to recurse to
  * handle that cleanly.
+ *
+ * @sk is the receiving socket; linear data is copied into its page cache.
+ * @splice_cb moves the mapped pages into the pipe, dropping whatever
+ * socket lock the caller holds around splice_to_pipe() if need be.
  */
-int skb_splice_bits(struct sk_buff *skb, unsigned int offset,
+int skb_splice_bits(struct sk_buff *skb, struct sock *sk, unsigned int offset,
 		    struct pipe_inode_info *pipe, unsigned int tlen,
-		    unsigned int flags)
+		    unsigned int flags,
+		    ssize_t (*splice_cb)(struct sock *,
+					 struct pipe_inode_info *,
+					 struct splice_pipe_desc *))
 {
 	struct partial_page partial[PIPE_BUFFERS];
 	struct page *pages[PIPE_BUFFERS];
@@ -1546,7 +1579,6 @@ int skb_splice_bits(struct sk_buff *skb, unsigned int offset,
 		.spd_release = sock_spd_release,
 	};
 	struct sk_buff *frag_iter;
-	struct sock *sk = skb->sk;
 
 	/*
 	 * __skb_splice_bits() only fails if the output has no room left,
@@ -1568,26 +1600,12 @@ int skb_splice_bits(struct sk_buff *skb, unsigned int offset,
 	}
 
 done:
-	if (spd.nr_pages) {
-		int ret;
-
-		/*
-		 * Drop the socket lock, otherwise we have reverse
-		 * locking dependencies between sk_lock and i_mutex
-		 * here as compared to sendfile(). We enter here
-		 * with the socket lock held, and splice_to_pipe() will
-		 * grab the pipe inode lock. For sendfile() emulation,
-		 * we call into ->sendpage() with the i_mutex lock held
-		 * and networking will grab the socket lock.
-		 */
-		release_sock(sk);
-		ret = splice_to_pipe(pipe, &spd);
-		lock_sock(sk);
-		return ret;
-	}
+	if (spd.nr_pages)
+		return splice_cb(sk, pipe, &spd);
 
 	return 0;
 }
+EXPORT_SYMBOL_GPL(skb_splice_bits);
 
 /**
  *	skb_store_bits - store bits from kernel buffer to skb
@@ -22,6 +22,7 @@
 #include <net/ip.h>
 #include <net/route.h>
 #include <net/tcp_states.h>
+#include <net/tcp.h>
 #include <net/xfrm.h>
 
 #ifdef INET_CSK_DEBUG
@@ -56,6 +57,8 @@ int inet_csk_bind_conflict(const struct sock *sk,
 	struct sock *sk2;
 	struct hlist_node *node;
 	int reuse = sk->sk_reuse;
+	int reuseport = sk->sk_reuseport;
+	uid_t uid = sock_i_uid((struct sock *)sk);
 
 	/*
 	 * Unlike other sk lookup places we do not check
@@ -70,8 +73,11 @@ int inet_csk_bind_conflict(const struct sock *sk,
 		    (!sk->sk_bound_dev_if ||
 		     !sk2->sk_bound_dev_if ||
 		     sk->sk_bound_dev_if == sk2->sk_bound_dev_if)) {
-			if (!reuse || !sk2->sk_reuse ||
-			    sk2->sk_state == TCP_LISTEN) {
+			if ((!reuse || !sk2->sk_reuse ||
+			    sk2->sk_state == TCP_LISTEN) &&
+			    (!reuseport || !sk2->sk_reuseport ||
+			    (sk2->sk_state != TCP_TIME_WAIT &&
+			     uid != sock_i_uid(sk2)))) {
 				const __be32 sk2_rcv_saddr = inet_rcv_saddr(sk2);
 				if (!sk2_rcv_saddr || !sk_rcv_saddr ||
 				    sk2_rcv_saddr == sk_rcv_saddr)
@@ -96,6 +102,7 @@ int inet_csk_get_port(struct sock *sk, unsigned short snum)
 	int ret, attempts = 5;
 	struct net *net = sock_net(sk);
 	int smallest_size = -1, smallest_rover;
+	uid_t uid = sock_i_uid(sk);
 
 	local_bh_disable();
 	if (!snum) {
@@ -113,9 +120,12 @@ again:
 			spin_lock(&head->lock);
 			inet_bind_bucket_for_each(tb, node, &head->chain)
 				if (ib_net(tb) == net && tb->port == rover) {
-					if (tb->fastreuse > 0 &&
-					    sk->sk_reuse &&
-					    sk->sk_state != TCP_LISTEN &&
+					if (((tb->fastreuse > 0 &&
+					      sk->sk_reuse &&
+					      sk->sk_state != TCP_LISTEN) ||
+					     (tb->fastreuseport > 0 &&
+					      sk->sk_reuseport &&
+					      tb->fastuid == uid)) &&
 					    (tb->num_owners < smallest_size || smallest_size == -1)) {
 						smallest_size = tb->num_owners;
 						smallest_rover = rover;
@@ -165,14 +175,18 @@ have_snum:
 	goto tb_not_found;
 tb_found:
 	if (!hlist_empty(&tb->owners)) {
-		if (tb->fastreuse > 0 &&
-		    sk->sk_reuse && sk->sk_state != TCP_LISTEN &&
+		if (((tb->fastreuse > 0 &&
+		      sk->sk_reuse && sk->sk_state != TCP_LISTEN) ||
+		     (tb->fastreuseport > 0 &&
+		      sk->sk_reuseport && tb->fastuid == uid)) &&
 		    smallest_size == -1) {
 			goto success;
 		} else {
 			ret = 1;
 			if (inet_csk(sk)->icsk_af_ops->bind_conflict(sk, tb)) {
-				if (sk->sk_reuse && sk->sk_state != TCP_LISTEN &&
+				if (((sk->sk_reuse && sk->sk_state != TCP_LISTEN) ||
+				     (tb->fastreuseport > 0 &&
+				      sk->sk_reuseport && tb->fastuid == uid)) &&
 				    smallest_size != -1 && --attempts >= 0) {
 					spin_unlock(&head->lock);
 					goto again;
@@ -191,9 +205,19 @@ tb_not_found:
 			tb->fastreuse = 1;
 		else
 			tb->fastreuse = 0;
-	} else if (tb->fastreuse &&
-		   (!sk->sk_reuse || sk->sk_state == TCP_LISTEN))
-		tb->fastreuse = 0;
+		if (sk->sk_reuseport) {
+			tb->fastreuseport = 1;
+			tb->fastuid = uid;
+		} else
+			tb->fastreuseport = 0;
+	} else {
+		if (tb->fastreuse &&
+		    (!sk->sk_reuse || sk->sk_state == TCP_LISTEN))
+			tb->fastreuse = 0;
+		if (tb->fastreuseport &&
+		    (!sk->sk_reuseport || tb->fastuid != uid))
+			tb->fastreuseport = 0;
+	}
 success:
 	if (!inet_csk(sk)->icsk_bind_hash)
 		inet_bind_hash(sk, tb, snum);
@@ -263,6 +287,8 @@ static int inet_csk_wait_for_connect(struct sock *sk, long timeo)
 struct sock *inet_csk_accept(struct sock *sk, int flags, int *err)
 {
 	struct inet_connection_sock *icsk = inet_csk(sk);
+	struct request_sock_queue *queue = &icsk->icsk_accept_queue;
+	struct request_sock *req;
 	struct sock *newsk;
 	int error;
 
@@ -289,8 +315,29 @@ struct sock *inet_csk_accept(struct sock *sk, int flags, int *err)
 			goto out_err;
 	}
 
-	newsk = reqsk_queue_get_child(&icsk->icsk_accept_queue, sk);
-	WARN_ON(newsk->sk_state == TCP_SYN_RECV);
+	req = reqsk_queue_remove(queue);
+	newsk = req->sk;
+	WARN_ON(newsk == NULL);
+
+	sk_acceptq_removed(sk);
+	if (sk->sk_protocol == IPPROTO_TCP && queue->fastopenq != NULL) {
+		spin_lock_bh(&queue->fastopenq->lock);
+		if (tcp_rsk(req)->listener) {
+			/* We are still waiting for the final ACK from 3WHS
+			 * so can't free req now. Instead, we set req->sk to
+			 * NULL to signify that the child socket is taken
+			 * so reqsk_fastopen_remove() will free the req
+			 * when 3WHS finishes (or is aborted).
+			 */
+			req->sk = NULL;
+			req = NULL;
+		}
+		spin_unlock_bh(&queue->fastopenq->lock);
+	}
+	if (req) {
+		WARN_ON(newsk->sk_state == TCP_SYN_RECV);
+		__reqsk_free(req);
+	}
 out:
 	release_sock(sk);
 	return newsk;
@@ -404,10 +451,14 @@ struct request_sock *inet_csk_search_req(const struct sock *sk,
 					 const __be16 rport, const __be32 raddr,
 					 const __be32 laddr)
 {
-	const struct inet_connection_sock *icsk = inet_csk(sk);
-	struct listen_sock *lopt = icsk->icsk_accept_queue.listen_opt;
-	struct request_sock *req, **prev;
-
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+	struct listen_sock *lopt;
+	struct request_sock *req = NULL, **prev;
+
+	spin_lock(&queue->syn_wait_lock);
+	lopt = queue->listen_opt;
+	if (lopt == NULL)
+		goto out;
 	for (prev = &lopt->syn_table[inet_synq_hash(raddr, rport, lopt->hash_rnd,
 						    lopt->nr_table_entries)];
 	     (req = *prev) != NULL;
@@ -423,29 +474,49 @@ struct request_sock *inet_csk_search_req(const struct sock *sk,
 			break;
 		}
 	}
-
+out:
+	spin_unlock(&queue->syn_wait_lock);
 	return req;
 }
 
 EXPORT_SYMBOL_GPL(inet_csk_search_req);
 
-void inet_csk_reqsk_queue_hash_add(struct sock *sk, struct request_sock *req,
-				   unsigned long timeout)
+/*
+ * Hash a new request into the SYN table of @sk. This does not need the
+ * listener lock; it fails if @sk stopped listening in the meantime.
+ */
+int inet_csk_reqsk_queue_hash_add(struct sock *sk, struct request_sock *req,
+				  unsigned long timeout)
 {
 	struct inet_connection_sock *icsk = inet_csk(sk);
-	struct listen_sock *lopt = icsk->icsk_accept_queue.listen_opt;
-	const u32 h = inet_synq_hash(inet_rsk(req)->rmt_addr, inet_rsk(req)->rmt_port,
-				     lopt->hash_rnd, lopt->nr_table_entries);
+	struct listen_sock *lopt;
+	int qlen = -1;
+
+	rcu_read_lock();
+	lopt = rcu_dereference(icsk->icsk_accept_queue.listen_opt);
+	if (lopt != NULL) {
+		const u32 h = inet_synq_hash(inet_rsk(req)->rmt_addr,
+					     inet_rsk(req)->rmt_port,
+					     lopt->hash_rnd,
+					     lopt->nr_table_entries);
+
+		qlen = reqsk_queue_hash_req(&icsk->icsk_accept_queue, h,
+					    req, timeout);
+	}
+	rcu_read_unlock();
 
-	reqsk_queue_hash_req(&icsk->icsk_accept_queue, h, req, timeout);
-	inet_csk_reqsk_queue_added(sk, timeout);
+	if (qlen < 0)
+		return -ENOENT;
+	if (qlen == 0)
+		inet_csk_reset_keepalive_timer(sk, timeout);
+	return 0;
 }
 
+EXPORT_SYMBOL_GPL(inet_csk_reqsk_queue_hash_add);
+
 /* Only thing we need from tcp.h */
 extern int sysctl_tcp_synack_retries;
 
-EXPORT_SYMBOL_GPL(inet_csk_reqsk_queue_hash_add);
-
 /* Decide when to expire the request and when to resend SYN-ACK */
 static inline void syn_ack_recalc(struct request_sock *req, const int thresh,
 				  const int max_retries,
@@ -482,7 +553,7 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 	struct request_sock **reqp, *req;
 	int i, budget;
 
-	if (lopt == NULL || lopt->qlen == 0)
+	if (lopt == NULL || atomic_read(&lopt->qlen) == 0)
 		return;
 
 	/* Normally all the openreqs are young and become mature
@@ -502,11 +573,11 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 	 * embrions; and abort old ones without pity, if old
 	 * ones are about to clog our table.
 	 */
-	if (lopt->qlen>>(lopt->max_qlen_log-1)) {
-		int young = (lopt->qlen_young<<1);
+	if (atomic_read(&lopt->qlen) >> (lopt->max_qlen_log - 1)) {
+		int young = atomic_read(&lopt->qlen_young) << 1;
 
 		while (thresh > 2) {
-			if (lopt->qlen < young)
+			if (atomic_read(&lopt->qlen) < young)
 				break;
 			thresh--;
 			young <<= 1;
@@ -535,7 +606,7 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 					unsigned long timeo;
 
 					if (req->retrans++ == 0)
-						lopt->qlen_young--;
+						atomic_dec(&lopt->qlen_young);
 					timeo = min((timeout << req->retrans), max_rto);
 					req->expires = now + timeo;
 					reqp = &req->dl_next;
@@ -557,7 +628,7 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 
 	lopt->clock_hand = i;
 
-	if (lopt->qlen)
+	if (atomic_read(&lopt->qlen))
 		inet_csk_reset_keepalive_timer(parent, interval);
 }
 
@@ -694,6 +765,22 @@ void inet_csk_listen_stop(struct sock *sk)
 		WARN_ON(sock_owned_by_user(child));
 		sock_hold(child);
 
+		if (sk->sk_protocol == IPPROTO_TCP &&
+		    tcp_rsk(req)->listener) {
+			struct fastopen_queue *fastopenq =
+				icsk->icsk_accept_queue.fastopenq;
+
+			/* A Fast Open child still in its handshake; the
+			 * req goes away below with the accept queue.
+			 */
+			WARN_ON(tcp_sk(child)->fastopen_rsk != req);
+			tcp_sk(child)->fastopen_rsk = NULL;
+			spin_lock(&fastopenq->lock);
+			fastopenq->qlen--;
+			tcp_rsk(req)->listener = NULL;
+			spin_unlock(&fastopenq->lock);
+			sock_put(sk);
+		}
 		sk->sk_prot->disconnect(child, O_NONBLOCK);
 
 		sock_orphan(child);
@@ -116,6 +116,10 @@
    Alexey Kuznetsov.
  */
 
+/* Features of GRE devices; packets are segmented below the tunnel. */
+#define GRE_FEATURES	(NETIF_F_SG | NETIF_F_FRAGLIST | NETIF_F_HIGHDMA | \
+			 NETIF_F_HW_CSUM | NETIF_F_GSO_SOFTWARE)
+
 static struct rtnl_link_ops ipgre_link_ops __read_mostly;
 static int ipgre_tunnel_init(struct net_device *dev);
 static void ipgre_tunnel_setup(struct net_device *dev);
@@ -637,6 +641,10 @@ static int ipgre_rcv(struct sk_buff *skb)
 			skb_postpull_rcsum(skb, eth_hdr(skb), ETH_HLEN);
 		}
 
+		/* An aggregated packet is now a plain inner one */
+		if (skb_is_gso(skb))
+			skb_shinfo(skb)->gso_type &= ~SKB_GSO_GRE;
+
 		stats->rx_packets++;
 		stats->rx_bytes += len;
 		skb->dev = tunnel->dev;
@@ -765,7 +773,7 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 	if (skb->protocol == htons(ETH_P_IP)) {
 		df |= (old_iph->frag_off&htons(IP_DF));
 
-		if ((old_iph->frag_off&htons(IP_DF)) &&
+		if ((old_iph->frag_off&htons(IP_DF)) && !skb_is_gso(skb) &&
 		    mtu < ntohs(old_iph->tot_len)) {
 			icmp_send(skb, ICMP_DEST_UNREACH, ICMP_FRAG_NEEDED, htonl(mtu));
 			ip_rt_put(rt);
@@ -785,7 +793,8 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 			}
 		}
 
-		if (mtu >= IPV6_MIN_MTU && mtu < skb->len - tunnel->hlen + gre_hlen) {
+		if (mtu >= IPV6_MIN_MTU && !skb_is_gso(skb) &&
+		    mtu < skb->len - tunnel->hlen + gre_hlen) {
 			icmpv6_send(skb, ICMPV6_PKT_TOOBIG, 0, mtu, dev);
 			ip_rt_put(rt);
 			goto tx_error;
@@ -818,9 +827,16 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 			skb_set_owner_w(new_skb, skb->sk);
 		dev_kfree_skb(skb);
 		skb = new_skb;
-		old_iph = ip_hdr(skb);
 	}
 
+	if (iptunnel_handle_offloads(skb, SKB_GSO_GRE)) {
+		ip_rt_put(rt);
+		goto tx_error;
+	}
+	old_iph = ip_hdr(skb);
+	if (!gre_hlen)
+		tiph = (struct iphdr *)skb->data;
+
 	skb_reset_transport_header(skb);
 	skb_push(skb, gre_hlen);
 	skb_reset_network_header(skb);
@@ -870,9 +886,13 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 			*ptr = tunnel->parms.o_key;
 			ptr--;
 		}
-		if (tunnel->parms.o_flags&GRE_CSUM) {
+		/* Segments of a GSO packet get theirs in ipgre_gso_segment() */
+		if (tunnel->parms.o_flags&GRE_CSUM && !skb_is_gso(skb)) {
 			*ptr = 0;
-			*(__sum16*)ptr = ip_compute_csum((void*)(iph+1), skb->len - sizeof(struct iphdr));
+			*(__sum16*)ptr = csum_fold(skb_checksum(skb,
+						sizeof(struct iphdr),
+						skb->len - sizeof(struct iphdr),
+						0));
 		}
 	}
 
@@ -947,6 +967,18 @@ static int ipgre_tunnel_bind_dev(struct net_device *dev)
 
 	tunnel->hlen = addend;
 
+	/* Segments of a GSO packet would all carry the same sequence
+	 * number, so have the core segment those before encapsulation.
+	 */
+	if (tunnel->parms.o_flags&GRE_SEQ)
+		dev->features &= ~NETIF_F_GSO_SOFTWARE;
+	else
+		dev->features |= NETIF_F_GSO_SOFTWARE;
+
+	/* Keep the outer IP length of a GSO packet within 16 bits */
+	netif_set_gso_max_size(dev, GSO_MAX_SIZE - addend -
+			       (dev->type == ARPHRD_ETHER ? ETH_HLEN : 0));
+
 	return mtu;
 }
 
@@ -1225,7 +1257,7 @@ static void ipgre_tunnel_setup(struct net_device *dev)
 	dev->flags		= IFF_NOARP;
 	dev->iflink		= 0;
 	dev->addr_len		= 4;
-	dev->features		|= NETIF_F_NETNS_LOCAL;
+	dev->features		|= NETIF_F_NETNS_LOCAL | GRE_FEATURES;
 	dev->priv_flags		&= ~IFF_XMIT_DST_RELEASE;
 }
 
@@ -1277,9 +1309,165 @@ static void ipgre_fb_tunnel_init(struct net_device *dev)
 }
 
 
+static struct sk_buff *ipgre_gso_segment(struct sk_buff *skb, int features)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	struct sk_buff *nskb;
+	unsigned int grehlen = 4;
+	unsigned int mac_len = 0;
+	__be16 flags;
+	__be16 gre_proto;
+
+	if (unlikely(skb_shinfo(skb)->gso_type &
+		     ~(SKB_GSO_TCPV4 |
+		       SKB_GSO_DODGY |
+		       SKB_GSO_TCP_ECN |
+		       SKB_GSO_TCPV6 |
+		       SKB_GSO_GRE |
+		       0)))
+		goto out;
+
+	if (unlikely(!pskb_may_pull(skb, 4)))
+		goto out;
+
+	flags = ((__be16 *)skb->data)[0];
+	gre_proto = ((__be16 *)skb->data)[1];
+
+	/* Every segment would carry the same sequence number */
+	if (flags&(GRE_SEQ|GRE_ROUTING|GRE_VERSION))
+		goto out;
+	if (flags&GRE_CSUM) {
+		grehlen += 4;
+		/* The GRE checksum covers the inner checksums, which
+		 * skb_tunnel_gso_segment() then completes in software.
+		 */
+		features &= ~NETIF_F_ALL_CSUM;
+	}
+	if (flags&GRE_KEY)
+		grehlen += 4;
+
+	if (gre_proto == htons(ETH_P_TEB)) {
+		if (unlikely(!pskb_may_pull(skb, grehlen + ETH_HLEN)))
+			goto out;
+		gre_proto = ((struct ethhdr *)(skb->data + grehlen))->h_proto;
+		mac_len = ETH_HLEN;
+	}
+
+	segs = skb_tunnel_gso_segment(skb, features, grehlen, gre_proto,
+				      mac_len);
+	if (!segs || IS_ERR(segs) || !(flags&GRE_CSUM))
+		goto out;
+
+	for (nskb = segs; nskb; nskb = nskb->next) {
+		int off = skb_transport_offset(nskb);
+		__be32 *ptr = (__be32 *)(skb_transport_header(nskb) + 4);
+
+		*ptr = 0;
+		*(__sum16 *)ptr = csum_fold(skb_checksum(nskb, off,
+							 nskb->len - off, 0));
+	}
+
+out:
+	return segs;
+}
+
+static struct sk_buff **ipgre_gro_receive(struct sk_buff **head,
+					  struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	struct packet_type *ptype;
+	struct sk_buff *p;
+	unsigned int grehlen;
+	unsigned int hlen;
+	unsigned int off;
+	__be16 *h;
+	int flush = 1;
+	__wsum csum;
+
+	if (NAPI_GRO_CB(skb)->encap_mark)
+		goto out;
+	NAPI_GRO_CB(skb)->encap_mark = 1;
+
+	off = skb_gro_offset(skb);
+	hlen = off + 4;
+	h = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		h = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!h))
+			goto out;
+	}
+
+	/* Only plain and keyed GRE is aggregated, checksums and sequence
+	 * numbers have to be verified packet by packet.
+	 */
+	if (h[0] & ~GRE_KEY)
+		goto out;
+	grehlen = h[0] & GRE_KEY ? 8 : 4;
+
+	hlen = off + grehlen;
+	if (skb_gro_header_hard(skb, hlen)) {
+		h = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!h))
+			goto out;
+	}
+
+	rcu_read_lock();
+	ptype = gro_find_receive_by_type(h[1]);
+	if (!ptype)
+		goto out_unlock;
+
+	flush = 0;
+
+	for (p = *head; p; p = p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		/* The key, if any, must match too. */
+		if (memcmp(h, skb_gro_held_header(p, skb, off), grehlen))
+			NAPI_GRO_CB(p)->same_flow = 0;
+	}
+
+	skb_gro_pull(skb, grehlen);
+
+	csum = skb->csum;
+	skb_postpull_rcsum(skb, h, grehlen);
+
+	pp = ptype->gro_receive(head, skb);
+
+	skb->csum = csum;
+
+out_unlock:
+	rcu_read_unlock();
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+
+static int ipgre_gro_complete(struct sk_buff *skb, int nhoff)
+{
+	__be16 *h = (__be16 *)(skb->data + nhoff);
+	struct packet_type *ptype;
+	int err = -ENOENT;
+
+	skb_shinfo(skb)->gso_type |= SKB_GSO_GRE;
+
+	rcu_read_lock();
+	ptype = gro_find_complete_by_type(h[1]);
+	if (ptype)
+		err = ptype->gro_complete(skb,
+					  nhoff + (h[0] & GRE_KEY ? 8 : 4));
+	rcu_read_unlock();
+
+	return err;
+}
+
 static const struct net_protocol ipgre_protocol = {
 	.handler	=	ipgre_rcv,
 	.err_handler	=	ipgre_err,
+	.gso_segment	=	ipgre_gso_segment,
+	.gro_receive	=	ipgre_gro_receive,
+	.gro_complete	=	ipgre_gro_complete,
 	.netns_ok	=	1,
 };
 
@@ -1468,7 +1656,7 @@ static void ipgre_tap_setup(struct net_device *dev)
 	dev->destructor 	= free_netdev;
 
 	dev->iflink		= 0;
-	dev->features		|= NETIF_F_NETNS_LOCAL;
+	dev->features		|= NETIF_F_NETNS_LOCAL | GRE_FEATURES;
 }
 
 static int ipgre_newlink(struct net_device *dev, struct nlattr *tb[],
@@ -134,6 +134,10 @@ static void ipip_fb_tunnel_init(struct net_device *dev);
 static void ipip_tunnel_init(struct net_device *dev);
 static void ipip_tunnel_setup(struct net_device *dev);
 
+/* Features of IPIP devices; packets are segmented below the tunnel. */
+#define IPIP_FEATURES	(NETIF_F_SG | NETIF_F_FRAGLIST | NETIF_F_HIGHDMA | \
+			 NETIF_F_HW_CSUM | NETIF_F_TSO | NETIF_F_TSO_ECN)
+
 static DEFINE_RWLOCK(ipip_lock);
 
 static struct ip_tunnel * ipip_tunnel_lookup(struct net *net,
@@ -367,6 +371,10 @@ static int ipip_rcv(struct sk_buff *skb)
 		skb->protocol = htons(ETH_P_IP);
 		skb->pkt_type = PACKET_HOST;
 
+		/* An aggregated packet is now a plain inner one */
+		if (skb_is_gso(skb))
+			skb_shinfo(skb)->gso_type &= ~SKB_GSO_IPIP;
+
 		tunnel->dev->stats.rx_packets++;
 		tunnel->dev->stats.rx_bytes += skb->len;
 		skb->dev = tunnel->dev;
@@ -452,7 +460,7 @@ static netdev_tx_t ipip_tunnel_xmit(struct sk_buff *skb, struct net_device *dev)
 		if (skb_dst(skb))
 			skb_dst(skb)->ops->update_pmtu(skb_dst(skb), mtu);
 
-		if ((old_iph->frag_off & htons(IP_DF)) &&
+		if ((old_iph->frag_off & htons(IP_DF)) && !skb_is_gso(skb) &&
 		    mtu < ntohs(old_iph->tot_len)) {
 			icmp_send(skb, ICMP_DEST_UNREACH, ICMP_FRAG_NEEDED,
 				  htonl(mtu));
@@ -488,9 +496,14 @@ static netdev_tx_t ipip_tunnel_xmit(struct sk_buff *skb, struct net_device *dev)
 			skb_set_owner_w(new_skb, skb->sk);
 		dev_kfree_skb(skb);
 		skb = new_skb;
-		old_iph = ip_hdr(skb);
 	}
 
+	if (iptunnel_handle_offloads(skb, SKB_GSO_IPIP)) {
+		ip_rt_put(rt);
+		goto tx_error;
+	}
+	old_iph = ip_hdr(skb);
+
 	skb->transport_header = skb->network_header;
 	skb_push(skb, sizeof(struct iphdr));
 	skb_reset_network_header(skb);
@@ -705,8 +718,11 @@ static void ipip_tunnel_setup(struct net_device *dev)
 	dev->flags		= IFF_NOARP;
 	dev->iflink		= 0;
 	dev->addr_len		= 4;
-	dev->features		|= NETIF_F_NETNS_LOCAL;
+	dev->features		|= NETIF_F_NETNS_LOCAL | IPIP_FEATURES;
 	dev->priv_flags		&= ~IFF_XMIT_DST_RELEASE;
+
+	/* Keep the outer IP length of a GSO packet within 16 bits */
+	netif_set_gso_max_size(dev, GSO_MAX_SIZE - sizeof(struct iphdr));
 }
 
 static void ipip_tunnel_init(struct net_device *dev)
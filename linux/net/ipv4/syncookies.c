@@ -205,6 +205,26 @@ static inline int cookie_check(struct sk_buff *skb, __u32 cookie)
 	return mssind < NUM_MSS ? msstab[mssind] + 1 : 0;
 }
 
+/*
+ * Check the cookie carried by an ACK that matches no pending request,
+ * without building a request sock. This runs before the listener lock is
+ * taken, so that ACKs with bad cookies are answered cheaply; failures are
+ * accounted as cookie_v4_check() would.
+ */
+int cookie_v4_ack_valid(struct sock *sk, struct sk_buff *skb)
+{
+	__u32 cookie = ntohl(tcp_hdr(skb)->ack_seq) - 1;
+
+	if (!sysctl_tcp_syncookies)
+		return 0;
+
+	if (tcp_synq_no_recent_overflow(sk) || cookie_check(skb, cookie) == 0) {
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_SYNCOOKIESFAILED);
+		return 0;
+	}
+	return 1;
+}
+
 static inline struct sock *get_cookie_sock(struct sock *sk, struct sk_buff *skb,
 					   struct request_sock *req,
 					   struct dst_entry *dst)
@@ -278,7 +298,7 @@ struct sock *cookie_v4_check(struct sock *sk, struct sk_buff *skb,
 
 	/* check for timestamp cookie support */
 	memset(&tcp_opt, 0, sizeof(tcp_opt));
-	tcp_parse_options(skb, &tcp_opt, 0);
+	tcp_parse_options(skb, &tcp_opt, 0, NULL);
 
 	if (tcp_opt.saw_tstamp)
 		cookie_check_timestamp(&tcp_opt);
@@ -291,7 +311,9 @@ struct sock *cookie_v4_check(struct sock *sk, struct sk_buff *skb,
 	ireq = inet_rsk(req);
 	treq = tcp_rsk(req);
 	treq->rcv_isn		= ntohl(th->seq) - 1;
+	treq->rcv_nxt		= treq->rcv_isn + 1;
 	treq->snt_isn		= cookie;
+	treq->listener		= NULL;
 	req->mss		= mss;
 	ireq->loc_port		= th->dest;
 	ireq->rmt_port		= th->source;
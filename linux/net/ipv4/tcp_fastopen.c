@@ -0,0 +1,242 @@
+/*
+ * TCP Fast Open: cookie generation for passive opens and the
+ * per-destination cookie cache used by active opens.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/random.h>
+#include <linux/jhash.h>
+#include <linux/cryptohash.h>
+#include <linux/spinlock.h>
+#include <net/net_namespace.h>
+#include <net/ipv6.h>
+#include <net/tcp.h>
+
+int sysctl_tcp_fastopen __read_mostly = TFO_CLIENT_ENABLE;
+
+/*
+ * Cookies are the first bytes of a SHA-1 over the connection's addresses
+ * and a boot time secret, computed the same way as syncookies. The tail of
+ * the secret also seeds the digest.
+ */
+static u32 tcp_fastopen_secret[16 - 2 + SHA_DIGEST_WORDS] __read_mostly;
+
+static DEFINE_PER_CPU(__u32 [16 + 5 + SHA_WORKSPACE_WORDS],
+		      tcp_fastopen_scratch);
+
+void tcp_fastopen_cookie_gen(__be32 saddr, __be32 daddr,
+			     struct tcp_fastopen_cookie *foc)
+{
+	__u32 *tmp = __get_cpu_var(tcp_fastopen_scratch);
+
+	memcpy(tmp + 2, tcp_fastopen_secret, sizeof(tcp_fastopen_secret));
+	tmp[0] = (__force u32)saddr;
+	tmp[1] = (__force u32)daddr;
+	sha_transform(tmp + 16, (__u8 *)tmp, tmp + 16 + 5);
+
+	memcpy(foc->val, tmp + 16, TCP_FASTOPEN_COOKIE_SIZE);
+	foc->len = TCP_FASTOPEN_COOKIE_SIZE;
+}
+
+/*
+ * Client side cookie cache. Entries are keyed by destination address and
+ * remember the cookie and MSS the server last gave us, along with recent
+ * SYN-data losses so that broken paths fall back to a regular handshake.
+ * Each chain is kept short; the least recently used entry is recycled.
+ */
+#define TCP_FASTOPEN_HASH_BITS	8
+#define TCP_FASTOPEN_HASH_SIZE	(1 << TCP_FASTOPEN_HASH_BITS)
+#define TCP_FASTOPEN_HASH_DEPTH	5
+
+struct tcp_fastopen_entry {
+	struct hlist_node		node;
+	struct net			*net;
+	unsigned short			family;
+	union {
+		__be32			a4;
+		struct in6_addr		a6;
+	} daddr;
+	unsigned long			stamp;		/* last use */
+	unsigned long			last_syn_loss;	/* last SYN-data loss */
+	u16				mss;
+	u16				syn_loss;	/* recurring SYN losses */
+	struct tcp_fastopen_cookie	cookie;
+};
+
+static struct hlist_head tcp_fastopen_hash[TCP_FASTOPEN_HASH_SIZE];
+static DEFINE_SPINLOCK(tcp_fastopen_lock);
+static u32 tcp_fastopen_hash_rnd __read_mostly;
+
+static unsigned int tcp_fastopen_key(struct sock *sk,
+				     struct tcp_fastopen_entry *key)
+{
+	u32 hash;
+
+	key->net = sock_net(sk);
+	key->family = sk->sk_family;
+	switch (sk->sk_family) {
+#if defined(CONFIG_IPV6) || defined(CONFIG_IPV6_MODULE)
+	case AF_INET6:
+		ipv6_addr_copy(&key->daddr.a6, &inet6_sk(sk)->daddr);
+		hash = jhash2(key->daddr.a6.s6_addr32, 4,
+			      tcp_fastopen_hash_rnd);
+		break;
+#endif
+	default:
+		key->daddr.a4 = inet_sk(sk)->daddr;
+		hash = jhash_1word((__force u32)key->daddr.a4,
+				   tcp_fastopen_hash_rnd);
+		break;
+	}
+	return hash & (TCP_FASTOPEN_HASH_SIZE - 1);
+}
+
+static int tcp_fastopen_match(const struct tcp_fastopen_entry *e,
+			      const struct tcp_fastopen_entry *key)
+{
+	if (e->net != key->net || e->family != key->family)
+		return 0;
+#if defined(CONFIG_IPV6) || defined(CONFIG_IPV6_MODULE)
+	if (e->family == AF_INET6)
+		return ipv6_addr_equal(&e->daddr.a6, &key->daddr.a6);
+#endif
+	return e->daddr.a4 == key->daddr.a4;
+}
+
+static struct tcp_fastopen_entry *
+__tcp_fastopen_lookup(const struct tcp_fastopen_entry *key, unsigned int hash)
+{
+	struct tcp_fastopen_entry *e;
+	struct hlist_node *node;
+
+	hlist_for_each_entry(e, node, &tcp_fastopen_hash[hash], node)
+		if (tcp_fastopen_match(e, key))
+			return e;
+	return NULL;
+}
+
+void tcp_fastopen_cache_get(struct sock *sk, u16 *mss,
+			    struct tcp_fastopen_cookie *cookie,
+			    int *syn_loss, unsigned long *last_syn_loss)
+{
+	struct tcp_fastopen_entry key, *e;
+	unsigned int hash = tcp_fastopen_key(sk, &key);
+
+	spin_lock_bh(&tcp_fastopen_lock);
+	e = __tcp_fastopen_lookup(&key, hash);
+	if (e != NULL) {
+		if (e->mss)
+			*mss = e->mss;
+		*cookie = e->cookie;
+		*syn_loss = e->syn_loss;
+		*last_syn_loss = e->syn_loss ? e->last_syn_loss : 0;
+		e->stamp = jiffies;
+	}
+	spin_unlock_bh(&tcp_fastopen_lock);
+}
+
+void tcp_fastopen_cache_set(struct sock *sk, u16 mss,
+			    struct tcp_fastopen_cookie *cookie, int syn_lost)
+{
+	struct tcp_fastopen_entry key, *e;
+	unsigned int hash = tcp_fastopen_key(sk, &key);
+
+	spin_lock_bh(&tcp_fastopen_lock);
+	e = __tcp_fastopen_lookup(&key, hash);
+	if (e == NULL) {
+		struct tcp_fastopen_entry *oldest = NULL;
+		struct hlist_node *node;
+		int depth = 0;
+
+		hlist_for_each_entry(e, node, &tcp_fastopen_hash[hash], node) {
+			if (!oldest || time_before(e->stamp, oldest->stamp))
+				oldest = e;
+			depth++;
+		}
+		if (depth >= TCP_FASTOPEN_HASH_DEPTH) {
+			e = oldest;
+			hlist_del(&e->node);
+		} else {
+			e = kmalloc(sizeof(*e), GFP_ATOMIC);
+			if (e == NULL)
+				goto out;
+		}
+		memcpy(e, &key, sizeof(*e));
+		e->mss = 0;
+		e->syn_loss = 0;
+		e->cookie.len = 0;
+		hlist_add_head(&e->node, &tcp_fastopen_hash[hash]);
+	}
+
+	if (mss)
+		e->mss = mss;
+	if (cookie && cookie->len > 0)
+		e->cookie = *cookie;
+	if (syn_lost) {
+		e->syn_loss++;
+		e->last_syn_loss = jiffies;
+	} else
+		e->syn_loss = 0;
+	e->stamp = jiffies;
+out:
+	spin_unlock_bh(&tcp_fastopen_lock);
+}
+
+static void __net_exit tcp_fastopen_net_exit(struct net *net)
+{
+	unsigned int i;
+
+	spin_lock_bh(&tcp_fastopen_lock);
+	for (i = 0; i < TCP_FASTOPEN_HASH_SIZE; i++) {
+		struct tcp_fastopen_entry *e;
+		struct hlist_node *node, *tmp;
+
+		hlist_for_each_entry_safe(e, node, tmp, &tcp_fastopen_hash[i],
+					  node) {
+			if (e->net != net)
+				continue;
+			hlist_del(&e->node);
+			kfree(e);
+		}
+	}
+	spin_unlock_bh(&tcp_fastopen_lock);
+}
+
+static struct pernet_operations tcp_fastopen_net_ops = {
+	.exit	= tcp_fastopen_net_exit,
+};
+
+/* Allow Fast Open on a listener, queueing at most @backlog TFO children
+ * that have not completed their handshake yet. Called with the socket
+ * locked.
+ */
+int tcp_fastopen_init_queue(struct sock *sk, int backlog)
+{
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+
+	if (queue->fastopenq == NULL) {
+		queue->fastopenq = kzalloc(sizeof(struct fastopen_queue),
+					   sk->sk_allocation);
+		if (queue->fastopenq == NULL)
+			return -ENOMEM;
+		spin_lock_init(&queue->fastopenq->lock);
+	}
+	queue->fastopenq->max_qlen = backlog;
+	return 0;
+}
+
+void __init tcp_fastopen_init(void)
+{
+	get_random_bytes(tcp_fastopen_secret, sizeof(tcp_fastopen_secret));
+	get_random_bytes(&tcp_fastopen_hash_rnd, sizeof(tcp_fastopen_hash_rnd));
+	if (register_pernet_subsys(&tcp_fastopen_net_ops))
+		panic("Failed to register TCP Fast Open pernet ops\n");
+}
@@ -742,7 +742,8 @@ static void tcp_v4_reqsk_send_ack(struct sock *sk, struct sk_buff *skb,
  *	socket.
  */
 static int __tcp_v4_send_synack(struct sock *sk, struct request_sock *req,
-				struct dst_entry *dst)
+				struct dst_entry *dst,
+				struct tcp_fastopen_cookie *foc)
 {
 	const struct inet_request_sock *ireq = inet_rsk(req);
 	int err = -1;
@@ -752,7 +753,7 @@ static int __tcp_v4_send_synack(struct sock *sk, struct request_sock *req,
 	if (!dst && (dst = inet_csk_route_req(sk, req)) == NULL)
 		return -1;
 
-	skb = tcp_make_synack(sk, dst, req);
+	skb = tcp_make_synack(sk, dst, req, foc);
 
 	if (skb) {
 		struct tcphdr *th = tcp_hdr(skb);
@@ -775,7 +776,7 @@ static int __tcp_v4_send_synack(struct sock *sk, struct request_sock *req,
 
 static int tcp_v4_send_synack(struct sock *sk, struct request_sock *req)
 {
-	return __tcp_v4_send_synack(sk, req, NULL);
+	return __tcp_v4_send_synack(sk, req, NULL, NULL);
 }
 
 /*
@@ -1208,8 +1209,146 @@ static struct timewait_sock_ops tcp_timewait_sock_ops = {
 	.twsk_destructor= tcp_twsk_destructor,
 };
 
+/* Decide whether a SYN may use Fast Open. @valid_foc is filled in with
+ * the cookie to return in the SYN-ACK when the client asked for one or
+ * presented a stale one.
+ */
+static int tcp_fastopen_check(struct sock *sk, struct sk_buff *skb,
+			      struct request_sock *req,
+			      struct tcp_fastopen_cookie *foc,
+			      struct tcp_fastopen_cookie *valid_foc)
+{
+	struct fastopen_queue *fastopenq;
+
+	if (likely(foc->len < 0))
+		return 0;
+
+	NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVE);
+
+	/* Check the listener before validating the cookie, so that
+	 * clients cannot burn CPU cycles on a server that would refuse
+	 * them anyway.
+	 */
+	fastopenq = inet_csk(sk)->icsk_accept_queue.fastopenq;
+	if (!(sysctl_tcp_fastopen & TFO_SERVER_ENABLE) ||
+	    fastopenq == NULL || fastopenq->max_qlen == 0)
+		return 0;
+
+	if (fastopenq->qlen >= fastopenq->max_qlen) {
+		NET_INC_STATS_BH(sock_net(sk),
+				 LINUX_MIB_TCPFASTOPENLISTENOVERFLOW);
+		foc->len = -1;
+		return 0;
+	}
+
+	tcp_fastopen_cookie_gen(ip_hdr(skb)->saddr, ip_hdr(skb)->daddr,
+				valid_foc);
+
+	if (foc->len == 0) {
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENCOOKIEREQD);
+		return 0;
+	}
+
+	if (foc->len != TCP_FASTOPEN_COOKIE_SIZE ||
+	    memcmp(foc->val, valid_foc->val, TCP_FASTOPEN_COOKIE_SIZE))
+		return 0;
+
+	/* The cookie is good; there is no need to echo it. A SYN that
+	 * also carries a FIN takes the regular path.
+	 */
+	valid_foc->len = -1;
+	if (tcp_hdr(skb)->fin)
+		return 0;
+
+	/* Acknowledge the data received from the peer. */
+	tcp_rsk(req)->rcv_nxt = TCP_SKB_CB(skb)->end_seq;
+	return 1;
+}
+
+/* Create the child socket for a Fast Open SYN straight away and put it
+ * on the accept queue, so that the data in the SYN reaches the
+ * application before the handshake completes. The request sock stays
+ * attached to the child until the SYN-ACK is acknowledged and is used
+ * to retransmit it.
+ */
+static int tcp_v4_conn_req_fastopen(struct sock *sk, struct sk_buff *skb,
+				    struct request_sock *req,
+				    struct dst_entry *dst)
+{
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+	struct tcp_sock *tp;
+	struct sock *child;
+
+	req->retrans = 0;
+	req->sk = NULL;
+
+	child = inet_csk(sk)->icsk_af_ops->syn_recv_sock(sk, skb, req, dst);
+	if (child == NULL) {
+		NET_INC_STATS_BH(sock_net(sk),
+				 LINUX_MIB_TCPFASTOPENPASSIVEFAIL);
+		return -1;
+	}
+
+	/* The child is already on its way; a lost SYN-ACK is recovered
+	 * by the child's retransmit timer.
+	 */
+	__tcp_v4_send_synack(sk, req, NULL, NULL);
+
+	spin_lock(&queue->fastopenq->lock);
+	queue->fastopenq->qlen++;
+	spin_unlock(&queue->fastopenq->lock);
+
+	tp = tcp_sk(child);
+	tp->fastopen_rsk = req;
+	/* The child may outlive the listener after accept(); hold it so
+	 * that the fastopen queue lock remains valid.
+	 */
+	sock_hold(sk);
+	tcp_rsk(req)->listener = sk;
+
+	/* RFC1323: The window in SYN & SYN/ACK segments is never scaled. */
+	tp->snd_wnd = ntohs(tcp_hdr(skb)->window);
+
+	/* The request sock is not in the SYN table, so the child's
+	 * retransmit timer takes care of the SYN-ACK.
+	 */
+	inet_csk_reset_xmit_timer(child, ICSK_TIME_RETRANS,
+				  TCP_TIMEOUT_INIT, TCP_RTO_MAX);
+
+	inet_csk_reqsk_queue_add(sk, req, child);
+
+	/* Finish what the third ACK would otherwise set up. */
+	inet_csk(child)->icsk_af_ops->rebuild_header(child);
+	tcp_init_metrics(child);
+	tcp_init_congestion_control(child);
+	tcp_mtup_init(child);
+	tcp_init_buffer_space(child);
+
+	/* Queue the data carried in the SYN. The caller frees its own
+	 * reference to the skb.
+	 */
+	if (TCP_SKB_CB(skb)->end_seq != TCP_SKB_CB(skb)->seq + 1) {
+		skb = skb_get(skb);
+		skb_dst_drop(skb);
+		__skb_pull(skb, tcp_hdr(skb)->doff * 4);
+		skb_set_owner_r(skb, child);
+		__skb_queue_tail(&child->sk_receive_queue, skb);
+		tp->rcv_nxt = TCP_SKB_CB(skb)->end_seq;
+		tp->syn_data_acked = 1;
+	}
+	tcp_rsk(req)->rcv_nxt = tp->rcv_nxt;
+
+	sk->sk_data_ready(sk, 0);
+	bh_unlock_sock(child);
+	sock_put(child);
+	WARN_ON(req->sk == NULL);
+	return 0;
+}
+
 int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 {
+	struct tcp_fastopen_cookie foc = { .len = -1 };
+	struct tcp_fastopen_cookie valid_foc = { .len = -1 };
 	struct inet_request_sock *ireq;
 	struct tcp_options_received tmp_opt;
 	struct request_sock *req;
@@ -1260,7 +1399,7 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	tmp_opt.mss_clamp = 536;
 	tmp_opt.user_mss  = tcp_sk(sk)->rx_opt.user_mss;
 
-	tcp_parse_options(skb, &tmp_opt, 0);
+	tcp_parse_options(skb, &tmp_opt, 0, want_cookie ? NULL : &foc);
 
 	if (want_cookie && !tmp_opt.saw_tstamp)
 		tcp_clear_options(&tmp_opt);
@@ -1333,10 +1472,22 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	}
 	tcp_rsk(req)->snt_isn = isn;
 
-	if (__tcp_v4_send_synack(sk, req, dst) || want_cookie)
+	if (tcp_fastopen_check(sk, skb, req, &foc, &valid_foc)) {
+		if (tcp_v4_conn_req_fastopen(sk, skb, req, dst))
+			goto drop_and_free;
+		return 0;
+	}
+
+	if (__tcp_v4_send_synack(sk, req, dst,
+				 valid_foc.len >= 0 ? &valid_foc : NULL) ||
+	    want_cookie)
 		goto drop_and_free;
 
-	inet_csk_reqsk_queue_hash_add(sk, req, TCP_TIMEOUT_INIT);
+	if (inet_csk_reqsk_queue_hash_add(sk, req, TCP_TIMEOUT_INIT))
+		goto drop_and_free;
+	if (foc.len > 0)
+		NET_INC_STATS_BH(sock_net(sk),
+				 LINUX_MIB_TCPFASTOPENPASSIVEFAIL);
 	return 0;
 
 drop_and_release:
@@ -1462,6 +1613,69 @@ static struct sock *tcp_v4_hnd_req(struct sock *sk, struct sk_buff *skb)
 	return sk;
 }
 
+/*
+ * Segments to a listener that match no pending request leave the
+ * listener itself alone: a SYN adds a request to the SYN table, which has
+ * its own lock, or is answered with a syncookie, and a bare ACK either
+ * carries a valid cookie or is reset. Handle those without the listener
+ * lock so that connection setup scales with the number of cpus taking
+ * packets. Only a valid cookie, which creates a child, needs the lock.
+ * MD5 keys and Fast Open state are only stable under the listener lock,
+ * so such listeners always take the regular path.
+ *
+ * Returns 0 if @skb still has to be processed with the lock held.
+ */
+static int tcp_v4_rcv_listen(struct sock *sk, struct sk_buff *skb)
+{
+	const struct tcphdr *th = tcp_hdr(skb);
+	const struct iphdr *iph = ip_hdr(skb);
+	struct request_sock **prev;
+	struct sock *nsk;
+
+	if (th->rst || th->syn == th->ack ||
+	    inet_csk(sk)->icsk_accept_queue.fastopenq != NULL)
+		return 0;
+#ifdef CONFIG_TCP_MD5SIG
+	if (tcp_sk(sk)->md5sig_info != NULL)
+		return 0;
+	if (tcp_v4_inbound_md5_hash(sk, skb))
+		goto discard;
+#endif
+	if (skb->len < tcp_hdrlen(skb) || tcp_checksum_complete(skb))
+		return 0;
+
+	if (inet_csk_search_req(sk, &prev, th->source, iph->saddr, iph->daddr))
+		return 0;
+
+	if (th->syn) {
+		if (inet_csk(sk)->icsk_af_ops->conn_request(sk, skb) < 0)
+			goto reset;
+		goto discard;
+	}
+
+	/* The handshake may have just completed on another cpu. */
+	nsk = inet_lookup_established(sock_net(sk), &tcp_hashinfo, iph->saddr,
+				      th->source, iph->daddr, th->dest,
+				      inet_iif(skb));
+	if (nsk) {
+		if (nsk->sk_state == TCP_TIME_WAIT)
+			inet_twsk_put(inet_twsk(nsk));
+		else
+			sock_put(nsk);
+		return 0;
+	}
+
+#ifdef CONFIG_SYN_COOKIES
+	if (cookie_v4_ack_valid(sk, skb))
+		return 0;
+#endif
+reset:
+	tcp_v4_send_reset(sk, skb);
+discard:
+	kfree_skb(skb);
+	return 1;
+}
+
 static __sum16 tcp_v4_checksum_init(struct sk_buff *skb)
 {
 	const struct iphdr *iph = ip_hdr(skb);
@@ -1619,8 +1833,13 @@ process:
 
 	skb->dev = NULL;
 
-	bh_lock_sock_nested(sk);
 	ret = 0;
+	if (sk->sk_state == TCP_LISTEN && tcp_v4_rcv_listen(sk, skb)) {
+		sock_put(sk);
+		return ret;
+	}
+
+	bh_lock_sock_nested(sk);
 	if (!sock_owned_by_user(sk)) {
 #ifdef CONFIG_NET_DMA
 		struct tcp_sock *tp = tcp_sk(sk);
@@ -1677,6 +1896,7 @@ do_time_wait:
 	case TCP_TW_SYN: {
 		struct sock *sk2 = inet_lookup_listener(dev_net(skb->dev),
 							&tcp_hashinfo,
+							iph->saddr, th->source,
 							iph->daddr, th->dest,
 							inet_iif(skb));
 		if (sk2) {
@@ -1792,6 +2012,7 @@ static int tcp_v4_init_sock(struct sock *sk)
 	struct tcp_sock *tp = tcp_sk(sk);
 
 	skb_queue_head_init(&tp->out_of_order_queue);
+	INIT_LIST_HEAD(&tp->tsq_node);
 	tcp_init_xmit_timers(sk);
 	tcp_prequeue_init(tp);
 
@@ -1938,13 +2159,13 @@ get_req:
 		}
 		sk	  = sk_next(st->syn_wait_sk);
 		st->state = TCP_SEQ_STATE_LISTENING;
-		read_unlock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
+		spin_unlock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
 	} else {
 		icsk = inet_csk(sk);
-		read_lock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
+		spin_lock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
 		if (reqsk_queue_len(&icsk->icsk_accept_queue))
 			goto start_req;
-		read_unlock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
+		spin_unlock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
 		sk = sk_next(sk);
 	}
 get_sk:
@@ -1954,7 +2175,7 @@ get_sk:
 			goto out;
 		}
 		icsk = inet_csk(sk);
-		read_lock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
+		spin_lock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
 		if (reqsk_queue_len(&icsk->icsk_accept_queue)) {
 start_req:
 			st->uid		= sock_i_uid(sk);
@@ -1963,7 +2184,7 @@ start_req:
 			st->sbucket	= 0;
 			goto get_req;
 		}
-		read_unlock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
+		spin_unlock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
 	}
 	spin_unlock_bh(&ilb->lock);
 	if (++st->bucket < INET_LHTABLE_SIZE) {
@@ -2159,7 +2380,7 @@ static void tcp_seq_stop(struct seq_file *seq, void *v)
 	case TCP_SEQ_STATE_OPENREQ:
 		if (v) {
 			struct inet_connection_sock *icsk = inet_csk(st->syn_wait_sk);
-			read_unlock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
+			spin_unlock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
 		}
 	case TCP_SEQ_STATE_LISTENING:
 		if (v != SEQ_START_TOKEN)
@@ -2402,14 +2623,14 @@ struct sk_buff **tcp4_gro_receive(struct sk_buff **head, struct sk_buff *skb)
 }
 EXPORT_SYMBOL(tcp4_gro_receive);
 
-int tcp4_gro_complete(struct sk_buff *skb)
+int tcp4_gro_complete(struct sk_buff *skb, int thoff)
 {
 	struct iphdr *iph = ip_hdr(skb);
 	struct tcphdr *th = tcp_hdr(skb);
 
-	th->check = ~tcp_v4_check(skb->len - skb_transport_offset(skb),
+	th->check = ~tcp_v4_check(skb->len - thoff,
 				  iph->saddr, iph->daddr, 0);
-	skb_shinfo(skb)->gso_type = SKB_GSO_TCPV4;
+	skb_shinfo(skb)->gso_type |= SKB_GSO_TCPV4;
 
 	return tcp_gro_complete(skb);
 }
@@ -2430,6 +2651,7 @@ struct proto tcp_prot = {
 	.getsockopt		= tcp_getsockopt,
 	.recvmsg		= tcp_recvmsg,
 	.backlog_rcv		= tcp_v4_do_rcv,
+	.release_cb		= tcp_release_cb,
 	.hash			= inet_hash,
 	.unhash			= inet_unhash,
 	.get_port		= inet_csk_get_port,
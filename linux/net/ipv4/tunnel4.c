@@ -132,9 +132,62 @@ static void tunnel64_err(struct sk_buff *skb, u32 info)
 }
 #endif
 
+static struct sk_buff *tunnel4_gso_segment(struct sk_buff *skb, int features)
+{
+	if (unlikely(skb_shinfo(skb)->gso_type &
+		     ~(SKB_GSO_TCPV4 |
+		       SKB_GSO_DODGY |
+		       SKB_GSO_TCP_ECN |
+		       SKB_GSO_IPIP |
+		       0)))
+		return ERR_PTR(-EINVAL);
+
+	return skb_tunnel_gso_segment(skb, features, 0, htons(ETH_P_IP), 0);
+}
+
+static struct sk_buff **tunnel4_gro_receive(struct sk_buff **head,
+					    struct sk_buff *skb)
+{
+	struct packet_type *ptype;
+
+	if (NAPI_GRO_CB(skb)->encap_mark)
+		goto flush;
+	NAPI_GRO_CB(skb)->encap_mark = 1;
+
+	/* Called from inet_gro_receive() under rcu_read_lock() */
+	ptype = gro_find_receive_by_type(htons(ETH_P_IP));
+	if (!ptype)
+		goto flush;
+
+	return ptype->gro_receive(head, skb);
+
+flush:
+	NAPI_GRO_CB(skb)->flush = 1;
+	return NULL;
+}
+
+static int tunnel4_gro_complete(struct sk_buff *skb, int nhoff)
+{
+	struct packet_type *ptype;
+	int err = -ENOENT;
+
+	skb_shinfo(skb)->gso_type |= SKB_GSO_IPIP;
+
+	rcu_read_lock();
+	ptype = gro_find_complete_by_type(htons(ETH_P_IP));
+	if (ptype)
+		err = ptype->gro_complete(skb, nhoff);
+	rcu_read_unlock();
+
+	return err;
+}
+
 static const struct net_protocol tunnel4_protocol = {
 	.handler	=	tunnel4_rcv,
 	.err_handler	=	tunnel4_err,
+	.gso_segment	=	tunnel4_gso_segment,
+	.gro_receive	=	tunnel4_gro_receive,
+	.gro_complete	=	tunnel4_gro_complete,
 	.no_policy	=	1,
 	.netns_ok	=	1,
 };
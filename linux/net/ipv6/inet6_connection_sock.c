@@ -31,6 +31,9 @@ int inet6_csk_bind_conflict(const struct sock *sk,
 {
 	const struct sock *sk2;
 	const struct hlist_node *node;
+	int reuse = sk->sk_reuse;
+	int reuseport = sk->sk_reuseport;
+	uid_t uid = sock_i_uid((struct sock *)sk);
 
 	/* We must walk the whole port owner list in this case. -DaveM */
 	/*
@@ -42,8 +45,11 @@ int inet6_csk_bind_conflict(const struct sock *sk,
 		    (!sk->sk_bound_dev_if ||
 		     !sk2->sk_bound_dev_if ||
 		     sk->sk_bound_dev_if == sk2->sk_bound_dev_if) &&
-		    (!sk->sk_reuse || !sk2->sk_reuse ||
+		    (!reuse || !sk2->sk_reuse ||
 		     sk2->sk_state == TCP_LISTEN) &&
+		    (!reuseport || !sk2->sk_reuseport ||
+		     (sk2->sk_state != TCP_TIME_WAIT &&
+		      uid != sock_i_uid((struct sock *)sk2))) &&
 		     ipv6_rcv_saddr_equal(sk, sk2))
 			break;
 	}
@@ -82,10 +88,14 @@ struct request_sock *inet6_csk_search_req(const struct sock *sk,
 					  const struct in6_addr *laddr,
 					  const int iif)
 {
-	const struct inet_connection_sock *icsk = inet_csk(sk);
-	struct listen_sock *lopt = icsk->icsk_accept_queue.listen_opt;
-	struct request_sock *req, **prev;
-
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+	struct listen_sock *lopt;
+	struct request_sock *req = NULL, **prev;
+
+	spin_lock(&queue->syn_wait_lock);
+	lopt = queue->listen_opt;
+	if (lopt == NULL)
+		goto out;
 	for (prev = &lopt->syn_table[inet6_synq_hash(raddr, rport,
 						     lopt->hash_rnd,
 						     lopt->nr_table_entries)];
@@ -100,27 +110,42 @@ struct request_sock *inet6_csk_search_req(const struct sock *sk,
 		    (!treq->iif || treq->iif == iif)) {
 			WARN_ON(req->sk != NULL);
 			*prevp = prev;
-			return req;
+			break;
 		}
 	}
-
-	return NULL;
+out:
+	spin_unlock(&queue->syn_wait_lock);
+	return req;
 }
 
 EXPORT_SYMBOL_GPL(inet6_csk_search_req);
 
-void inet6_csk_reqsk_queue_hash_add(struct sock *sk,
-				    struct request_sock *req,
-				    const unsigned long timeout)
+int inet6_csk_reqsk_queue_hash_add(struct sock *sk,
+				   struct request_sock *req,
+				   const unsigned long timeout)
 {
 	struct inet_connection_sock *icsk = inet_csk(sk);
-	struct listen_sock *lopt = icsk->icsk_accept_queue.listen_opt;
-	const u32 h = inet6_synq_hash(&inet6_rsk(req)->rmt_addr,
-				      inet_rsk(req)->rmt_port,
-				      lopt->hash_rnd, lopt->nr_table_entries);
+	struct listen_sock *lopt;
+	int qlen = -1;
+
+	rcu_read_lock();
+	lopt = rcu_dereference(icsk->icsk_accept_queue.listen_opt);
+	if (lopt != NULL) {
+		const u32 h = inet6_synq_hash(&inet6_rsk(req)->rmt_addr,
+					      inet_rsk(req)->rmt_port,
+					      lopt->hash_rnd,
+					      lopt->nr_table_entries);
+
+		qlen = reqsk_queue_hash_req(&icsk->icsk_accept_queue, h,
+					    req, timeout);
+	}
+	rcu_read_unlock();
 
-	reqsk_queue_hash_req(&icsk->icsk_accept_queue, h, req, timeout);
-	inet_csk_reqsk_queue_added(sk, timeout);
+	if (qlen < 0)
+		return -ENOENT;
+	if (qlen == 0)
+		inet_csk_reset_keepalive_timer(sk, timeout);
+	return 0;
 }
 
 EXPORT_SYMBOL_GPL(inet6_csk_reqsk_queue_hash_add);
@@ -168,6 +193,7 @@ struct dst_entry *__inet6_csk_dst_check(struct sock *sk, u32 cookie)
 	if (dst) {
 		struct rt6_info *rt = (struct rt6_info *)dst;
 		if (rt->rt6i_flow_cache_genid != atomic_read(&flow_cache_genid)) {
+			sk_tx_queue_clear(sk);
 			sk->sk_dst_cache = NULL;
 			dst_release(dst);
 			dst = NULL;
@@ -112,6 +112,12 @@ struct ipv6_txoptions *ipv6_update_options(struct sock *sk,
 			icsk->icsk_sync_mss(sk, icsk->icsk_pmtu_cookie);
 		}
 		opt = xchg(&inet6_sk(sk)->opt, opt);
+		/*
+		 * tcp_v6_rcv_listen() may still be looking at the old
+		 * options from softirq context without the socket lock.
+		 */
+		if (opt && sk->sk_state == TCP_LISTEN)
+			synchronize_net();
 	} else {
 		write_lock(&sk->sk_dst_lock);
 		opt = xchg(&inet6_sk(sk)->opt, opt);
@@ -157,6 +157,20 @@ static inline int cookie_check(struct sk_buff *skb, __u32 cookie)
 	return mssind < NUM_MSS ? msstab[mssind] + 1 : 0;
 }
 
+int cookie_v6_ack_valid(struct sock *sk, struct sk_buff *skb)
+{
+	__u32 cookie = ntohl(tcp_hdr(skb)->ack_seq) - 1;
+
+	if (!sysctl_tcp_syncookies)
+		return 0;
+
+	if (tcp_synq_no_recent_overflow(sk) || cookie_check(skb, cookie) == 0) {
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_SYNCOOKIESFAILED);
+		return 0;
+	}
+	return 1;
+}
+
 struct sock *cookie_v6_check(struct sock *sk, struct sk_buff *skb)
 {
 	struct inet_request_sock *ireq;
@@ -186,7 +200,7 @@ struct sock *cookie_v6_check(struct sock *sk, struct sk_buff *skb)
 
 	/* check for timestamp cookie support */
 	memset(&tcp_opt, 0, sizeof(tcp_opt));
-	tcp_parse_options(skb, &tcp_opt, 0);
+	tcp_parse_options(skb, &tcp_opt, 0, NULL);
 
 	if (tcp_opt.saw_tstamp)
 		cookie_check_timestamp(&tcp_opt);
@@ -231,7 +245,9 @@ struct sock *cookie_v6_check(struct sock *sk, struct sk_buff *skb)
 	ireq->tstamp_ok		= tcp_opt.saw_tstamp;
 	req->ts_recent		= tcp_opt.saw_tstamp ? tcp_opt.rcv_tsval : 0;
 	treq->rcv_isn = ntohl(th->seq) - 1;
+	treq->rcv_nxt = treq->rcv_isn + 1;
 	treq->snt_isn = cookie;
+	treq->listener = NULL;
 
 	/*
 	 * We need to lookup the dst_entry to get the correct window size.
@@ -497,7 +497,7 @@ static int tcp_v6_send_synack(struct sock *sk, struct request_sock *req)
 	if ((err = xfrm_lookup(sock_net(sk), &dst, &fl, sk, 0)) < 0)
 		goto done;
 
-	skb = tcp_make_synack(sk, dst, req);
+	skb = tcp_make_synack(sk, dst, req, NULL);
 	if (skb) {
 		struct tcphdr *th = tcp_hdr(skb);
 
@@ -964,14 +964,14 @@ static struct sk_buff **tcp6_gro_receive(struct sk_buff **head,
 	return tcp_gro_receive(head, skb);
 }
 
-static int tcp6_gro_complete(struct sk_buff *skb)
+static int tcp6_gro_complete(struct sk_buff *skb, int thoff)
 {
 	struct ipv6hdr *iph = ipv6_hdr(skb);
 	struct tcphdr *th = tcp_hdr(skb);
 
-	th->check = ~tcp_v6_check(skb->len - skb_transport_offset(skb),
+	th->check = ~tcp_v6_check(skb->len - thoff,
 				  &iph->saddr, &iph->daddr, 0);
-	skb_shinfo(skb)->gso_type = SKB_GSO_TCPV6;
+	skb_shinfo(skb)->gso_type |= SKB_GSO_TCPV6;
 
 	return tcp_gro_complete(skb);
 }
@@ -1203,7 +1203,7 @@ static int tcp_v6_conn_request(struct sock *sk, struct sk_buff *skb)
 	tmp_opt.mss_clamp = IPV6_MIN_MTU - sizeof(struct tcphdr) - sizeof(struct ipv6hdr);
 	tmp_opt.user_mss = tp->rx_opt.user_mss;
 
-	tcp_parse_options(skb, &tmp_opt, 0);
+	tcp_parse_options(skb, &tmp_opt, 0, NULL);
 
 	if (want_cookie && !tmp_opt.saw_tstamp)
 		tcp_clear_options(&tmp_opt);
@@ -1244,10 +1244,9 @@ static int tcp_v6_conn_request(struct sock *sk, struct sk_buff *skb)
 	if (tcp_v6_send_synack(sk, req))
 		goto drop;
 
-	if (!want_cookie) {
-		inet6_csk_reqsk_queue_hash_add(sk, req, TCP_TIMEOUT_INIT);
+	if (!want_cookie &&
+	    !inet6_csk_reqsk_queue_hash_add(sk, req, TCP_TIMEOUT_INIT))
 		return 0;
-	}
 
 drop:
 	if (req)
@@ -1483,6 +1482,70 @@ static __sum16 tcp_v6_checksum_init(struct sk_buff *skb)
 	return 0;
 }
 
+/*
+ * Lockless handling of SYNs and cookie ACKs to a listener; see
+ * tcp_v4_rcv_listen(). Returns 0 if @skb still has to be processed with
+ * the listener lock held.
+ */
+static int tcp_v6_rcv_listen(struct sock *sk, struct sk_buff *skb)
+{
+	const struct tcphdr *th = tcp_hdr(skb);
+	const struct ipv6hdr *hdr = ipv6_hdr(skb);
+	struct request_sock **prev;
+	struct sock *nsk;
+
+	if (th->rst || th->syn == th->ack ||
+	    inet_csk(sk)->icsk_accept_queue.fastopenq != NULL)
+		return 0;
+	/*
+	 * Listeners with tx options stay on the locked path; a racing
+	 * ipv6_setsockopt() waits for us before freeing the old options.
+	 */
+	if (inet6_sk(sk)->opt != NULL)
+		return 0;
+#ifdef CONFIG_TCP_MD5SIG
+	if (tcp_sk(sk)->md5sig_info != NULL)
+		return 0;
+	if (tcp_v6_inbound_md5_hash(sk, skb))
+		goto discard;
+#endif
+	if (skb->len < tcp_hdrlen(skb) || tcp_checksum_complete(skb))
+		return 0;
+
+	if (inet6_csk_search_req(sk, &prev, th->source, &hdr->saddr,
+				 &hdr->daddr, inet6_iif(skb)))
+		return 0;
+
+	if (th->syn) {
+		if (tcp_v6_conn_request(sk, skb) < 0)
+			goto reset;
+		goto discard;
+	}
+
+	/* The handshake may have just completed on another cpu. */
+	nsk = __inet6_lookup_established(sock_net(sk), &tcp_hashinfo,
+					 &hdr->saddr, th->source,
+					 &hdr->daddr, ntohs(th->dest),
+					 inet6_iif(skb));
+	if (nsk) {
+		if (nsk->sk_state == TCP_TIME_WAIT)
+			inet_twsk_put(inet_twsk(nsk));
+		else
+			sock_put(nsk);
+		return 0;
+	}
+
+#ifdef CONFIG_SYN_COOKIES
+	if (cookie_v6_ack_valid(sk, skb))
+		return 0;
+#endif
+reset:
+	tcp_v6_send_reset(sk, skb);
+discard:
+	kfree_skb(skb);
+	return 1;
+}
+
 /* The socket must have it's spinlock held when we get
  * here.
  *
@@ -1670,8 +1733,13 @@ process:
 
 	skb->dev = NULL;
 
-	bh_lock_sock_nested(sk);
 	ret = 0;
+	if (sk->sk_state == TCP_LISTEN && tcp_v6_rcv_listen(sk, skb)) {
+		sock_put(sk);
+		return ret;
+	}
+
+	bh_lock_sock_nested(sk);
 	if (!sock_owned_by_user(sk)) {
 #ifdef CONFIG_NET_DMA
 		struct tcp_sock *tp = tcp_sk(sk);
@@ -1734,6 +1802,7 @@ do_time_wait:
 		struct sock *sk2;
 
 		sk2 = inet6_lookup_listener(dev_net(skb->dev), &tcp_hashinfo,
+					    &ipv6_hdr(skb)->saddr, th->source,
 					    &ipv6_hdr(skb)->daddr,
 					    ntohs(th->dest), inet6_iif(skb));
 		if (sk2 != NULL) {
@@ -1830,6 +1899,7 @@ static int tcp_v6_init_sock(struct sock *sk)
 	struct tcp_sock *tp = tcp_sk(sk);
 
 	skb_queue_head_init(&tp->out_of_order_queue);
+	INIT_LIST_HEAD(&tp->tsq_node);
 	tcp_init_xmit_timers(sk);
 	tcp_prequeue_init(tp);
 
@@ -2071,6 +2141,7 @@ struct proto tcpv6_prot = {
 	.getsockopt		= tcp_getsockopt,
 	.recvmsg		= tcp_recvmsg,
 	.backlog_rcv		= tcp_v6_do_rcv,
+	.release_cb		= tcp_release_cb,
 	.hash			= tcp_v6_hash,
 	.unhash			= inet_unhash,
 	.get_port		= inet_csk_get_port,
@@ -0,0 +1,342 @@
+/* Copyright (C) 2003-2011 Jozsef Kadlecsik <kadlec@blackhole.kfki.hu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* Generic hash table shared by the hash:* set types.
+ *
+ * Elements are fixed size keys compared with memcmp. Readers walk the
+ * chains under rcu_read_lock() only; writers serialize on the per set
+ * spinlock and release elements through call_rcu(). The table is grown
+ * by ip_set_hash_resize(), see the comment at struct ip_set_hash_elem.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/rculist.h>
+#include <linux/skbuff.h>
+#include <linux/netlink.h>
+#include <net/netlink.h>
+
+#include <linux/netfilter/ipset/ip_set.h>
+#include <linux/netfilter/ipset/ip_set_hash.h>
+
+/* The node[] slot in use differs per table, so the usual hlist entry
+ * helpers which need a constant member cannot be used.
+ */
+#define hash_elem(n, idx)						\
+	((struct ip_set_hash_elem *)					\
+	 ((char *)((n) - (idx)) - offsetof(struct ip_set_hash_elem, node)))
+
+#define hash_for_each_rcu(pos, head)					\
+	for (pos = rcu_dereference((head)->first); pos;			\
+	     pos = rcu_dereference(pos->next))
+
+static inline u32
+hash_key(const struct ip_set_hash *h, const struct ip_set_hash_table *t,
+	 const void *key)
+{
+	return jhash2(key, h->keylen / sizeof(u32), h->initval)
+	       & (ip_set_hash_size(t->htable_bits) - 1);
+}
+
+static struct ip_set_hash_table *
+hash_table_alloc(u8 bits, u8 idx)
+{
+	struct ip_set_hash_table *t;
+	u32 i, size = ip_set_hash_size(bits);
+
+	t = ip_set_alloc(sizeof(*t) + size * sizeof(struct hlist_head));
+	if (!t)
+		return NULL;
+	t->htable_bits = bits;
+	t->idx = idx;
+	for (i = 0; i < size; i++)
+		INIT_HLIST_HEAD(&t->bucket[i]);
+	return t;
+}
+
+static void
+hash_elem_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct ip_set_hash_elem, rcu));
+}
+
+int
+ip_set_hash_init(struct ip_set_hash *h, u32 hashsize, u32 maxelem,
+		 size_t keylen)
+{
+	u8 bits;
+
+	BUG_ON(keylen % sizeof(u32));
+
+	if (hashsize < IPSET_MIMINAL_HASHSIZE)
+		hashsize = IPSET_MIMINAL_HASHSIZE;
+	bits = min_t(u8, fls(hashsize - 1), IPSET_HASH_MAX_BITS);
+
+	h->table = hash_table_alloc(bits, 0);
+	if (!h->table)
+		return -ENOMEM;
+	spin_lock_init(&h->lock);
+	get_random_bytes(&h->initval, sizeof(h->initval));
+	h->maxelem = maxelem;
+	h->elements = 0;
+	h->keylen = keylen;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(ip_set_hash_init);
+
+/* The set is not referenced anymore: no readers are left */
+void
+ip_set_hash_destroy(struct ip_set_hash *h)
+{
+	struct ip_set_hash_table *t = h->table;
+	struct hlist_node *n, *tmp;
+	u32 i;
+
+	for (i = 0; i < ip_set_hash_size(t->htable_bits); i++)
+		hlist_for_each_safe(n, tmp, &t->bucket[i])
+			kfree(hash_elem(n, t->idx));
+	ip_set_free(t);
+	h->table = NULL;
+}
+EXPORT_SYMBOL_GPL(ip_set_hash_destroy);
+
+/* Caller holds h->lock */
+void
+__ip_set_hash_flush(struct ip_set_hash *h)
+{
+	struct ip_set_hash_table *t = h->table;
+	struct ip_set_hash_elem *e;
+	struct hlist_node *n, *tmp;
+	u32 i;
+
+	for (i = 0; i < ip_set_hash_size(t->htable_bits); i++) {
+		hlist_for_each_safe(n, tmp, &t->bucket[i]) {
+			e = hash_elem(n, t->idx);
+			hlist_del_rcu(n);
+			call_rcu(&e->rcu, hash_elem_free_rcu);
+		}
+	}
+	h->elements = 0;
+}
+EXPORT_SYMBOL_GPL(__ip_set_hash_flush);
+
+void
+ip_set_hash_flush(struct ip_set_hash *h)
+{
+	spin_lock_bh(&h->lock);
+	__ip_set_hash_flush(h);
+	spin_unlock_bh(&h->lock);
+}
+EXPORT_SYMBOL_GPL(ip_set_hash_flush);
+
+static struct ip_set_hash_elem *
+hash_lookup(const struct ip_set_hash *h, const struct ip_set_hash_table *t,
+	    const void *key)
+{
+	struct ip_set_hash_elem *e;
+	struct hlist_node *n;
+
+	hash_for_each_rcu(n, &t->bucket[hash_key(h, t, key)]) {
+		e = hash_elem(n, t->idx);
+		if (!memcmp(e->key, key, h->keylen))
+			return e;
+	}
+	return NULL;
+}
+
+bool
+ip_set_hash_test(const struct ip_set_hash *h, const void *key)
+{
+	return hash_lookup(h, rcu_dereference(h->table), key) != NULL;
+}
+EXPORT_SYMBOL_GPL(ip_set_hash_test);
+
+/* Called from packet path (SET target) as well, so cannot sleep.
+ * Caller holds h->lock.
+ */
+int
+__ip_set_hash_add(struct ip_set_hash *h, const void *key)
+{
+	struct ip_set_hash_table *t = h->table;
+	struct ip_set_hash_elem *e;
+
+	if (hash_lookup(h, t, key))
+		return -IPSET_ERR_EXIST;
+	if (h->elements >= h->maxelem)
+		return -IPSET_ERR_HASH_FULL;
+	e = kmalloc(sizeof(*e) + h->keylen, GFP_ATOMIC);
+	if (!e)
+		return -ENOMEM;
+	memcpy(e->key, key, h->keylen);
+	hlist_add_head_rcu(&e->node[t->idx], &t->bucket[hash_key(h, t, key)]);
+	h->elements++;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(__ip_set_hash_add);
+
+int
+ip_set_hash_add(struct ip_set_hash *h, const void *key)
+{
+	int ret;
+
+	spin_lock_bh(&h->lock);
+	ret = __ip_set_hash_add(h, key);
+	spin_unlock_bh(&h->lock);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ip_set_hash_add);
+
+/* Caller holds h->lock */
+int
+__ip_set_hash_del(struct ip_set_hash *h, const void *key)
+{
+	struct ip_set_hash_table *t = h->table;
+	struct ip_set_hash_elem *e;
+
+	e = hash_lookup(h, t, key);
+	if (!e)
+		return -IPSET_ERR_EXIST;
+	hlist_del_rcu(&e->node[t->idx]);
+	h->elements--;
+	call_rcu(&e->rcu, hash_elem_free_rcu);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(__ip_set_hash_del);
+
+int
+ip_set_hash_del(struct ip_set_hash *h, const void *key)
+{
+	int ret;
+
+	spin_lock_bh(&h->lock);
+	ret = __ip_set_hash_del(h, key);
+	spin_unlock_bh(&h->lock);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ip_set_hash_del);
+
+/* Double the table while it holds more elements than buckets. Runs
+ * from process context under the nfnl mutex, which serializes resizes
+ * against each other; adds and deletes from the packet path are held
+ * off by the set lock only while the elements are relinked.
+ */
+int
+ip_set_hash_resize(struct ip_set_hash *h)
+{
+	struct ip_set_hash_table *t, *orig = h->table;
+	struct hlist_node *n;
+	u8 bits = orig->htable_bits;
+	u32 i;
+
+	while (bits < IPSET_HASH_MAX_BITS &&
+	       h->elements > ip_set_hash_size(bits))
+		bits++;
+	if (bits == orig->htable_bits)
+		return 0;
+
+	t = hash_table_alloc(bits, !orig->idx);
+	if (!t)
+		/* Longer chains only, not an error for the caller */
+		return -ENOMEM;
+
+	spin_lock_bh(&h->lock);
+	/* Packet path adds went to orig as well, nothing got lost */
+	for (i = 0; i < ip_set_hash_size(orig->htable_bits); i++) {
+		hlist_for_each(n, &orig->bucket[i]) {
+			struct ip_set_hash_elem *e = hash_elem(n, orig->idx);
+
+			hlist_add_head(&e->node[t->idx],
+				       &t->bucket[hash_key(h, t, e->key)]);
+		}
+	}
+	rcu_assign_pointer(h->table, t);
+	spin_unlock_bh(&h->lock);
+
+	pr_debug("ipset: hash resized from %u to %u buckets\n",
+		 ip_set_hash_size(orig->htable_bits), ip_set_hash_size(bits));
+
+	/* Readers may still walk node[orig->idx] of the old chains */
+	synchronize_rcu();
+	ip_set_free(orig);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(ip_set_hash_resize);
+
+/* Called under rcu_read_lock() */
+int
+ip_set_hash_head(const struct ip_set_hash *h, struct sk_buff *skb)
+{
+	const struct ip_set_hash_table *t = rcu_dereference(h->table);
+	size_t memsize = sizeof(*h) + sizeof(*t) +
+			 ip_set_hash_size(t->htable_bits) *
+			 sizeof(struct hlist_head) +
+			 h->elements * (sizeof(struct ip_set_hash_elem) +
+					h->keylen);
+
+	NLA_PUT_NET32(skb, IPSET_ATTR_HASHSIZE,
+		      htonl(ip_set_hash_size(t->htable_bits)));
+	NLA_PUT_NET32(skb, IPSET_ATTR_MAXELEM, htonl(h->maxelem));
+	NLA_PUT_NET32(skb, IPSET_ATTR_ELEMENTS, htonl(h->elements));
+	NLA_PUT_NET32(skb, IPSET_ATTR_MEMSIZE, htonl(memsize));
+	return 0;
+
+nla_put_failure:
+	return -EMSGSIZE;
+}
+EXPORT_SYMBOL_GPL(ip_set_hash_head);
+
+/* Dump the elements bucket by bucket, cb->args[2] is the bucket to
+ * continue with. A bucket which does not fit into the message is
+ * trimmed as a whole and retried with the next message. Called under
+ * rcu_read_lock().
+ */
+int
+ip_set_hash_list(const struct ip_set_hash *h, struct sk_buff *skb,
+		 struct netlink_callback *cb,
+		 int (*fill)(struct sk_buff *skb, const void *key))
+{
+	const struct ip_set_hash_table *t = rcu_dereference(h->table);
+	struct nlattr *atd, *nested;
+	struct hlist_node *n;
+	void *incomplete;
+	u32 first = cb->args[2];
+
+	atd = ipset_nest_start(skb, IPSET_ATTR_ADT);
+	if (!atd)
+		return -EMSGSIZE;
+	for (; cb->args[2] < ip_set_hash_size(t->htable_bits); cb->args[2]++) {
+		incomplete = skb_tail_pointer(skb);
+		hash_for_each_rcu(n, &t->bucket[cb->args[2]]) {
+			struct ip_set_hash_elem *e = hash_elem(n, t->idx);
+
+			nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
+			if (!nested)
+				goto nla_put_failure;
+			if (fill(skb, e->key))
+				goto nla_put_failure;
+			ipset_nest_end(skb, nested);
+		}
+	}
+	ipset_nest_end(skb, atd);
+	/* Set listing finished */
+	cb->args[2] = 0;
+	return 0;
+
+nla_put_failure:
+	nlmsg_trim(skb, incomplete);
+	ipset_nest_end(skb, atd);
+	if (unlikely(cb->args[2] == first)) {
+		pr_warning("ipset: cannot list set, too large bucket\n");
+		cb->args[2] = 0;
+		return -EMSGSIZE;
+	}
+	return 1;
+}
+EXPORT_SYMBOL_GPL(ip_set_hash_list);
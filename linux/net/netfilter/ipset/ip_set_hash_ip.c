@@ -0,0 +1,310 @@
+/* Copyright (C) 2003-2011 Jozsef Kadlecsik <kadlec@blackhole.kfki.hu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* Kernel module implementing an IP set type: the hash:ip type */
+
+#include <linux/module.h>
+#include <linux/ip.h>
+#include <linux/skbuff.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/netlink.h>
+#include <net/netlink.h>
+
+#include <linux/netfilter.h>
+#include <linux/netfilter/ipset/ip_set.h>
+#include <linux/netfilter/ipset/ip_set_hash.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Jozsef Kadlecsik <kadlec@blackhole.kfki.hu>");
+MODULE_DESCRIPTION("hash:ip type of IP sets");
+MODULE_ALIAS("ip_set_hash:ip");
+
+/* Member elements */
+struct hash_ip4_elem {
+	__be32 ip;
+};
+
+/* The hash:ip set */
+struct hash_ip {
+	struct ip_set_hash hash;	/* generic hash, must be first */
+	u8 netmask;			/* netmask value for subnets to store */
+};
+
+static int
+hash_ip4_adt(struct hash_ip *h, const struct hash_ip4_elem *e,
+	     enum ipset_adt adt)
+{
+	switch (adt) {
+	case IPSET_TEST:
+		return ip_set_hash_test(&h->hash, e);
+	case IPSET_ADD:
+		return ip_set_hash_add(&h->hash, e);
+	case IPSET_DEL:
+		return ip_set_hash_del(&h->hash, e);
+	default:
+		return -EINVAL;
+	}
+}
+
+static int
+hash_ip4_kadt(struct ip_set *set, const struct sk_buff *skb,
+	      enum ipset_adt adt, u8 pf, u8 dim, u8 flags)
+{
+	struct hash_ip *h = set->data;
+	struct hash_ip4_elem e;
+
+	e.ip = ip4addr(skb, flags & IPSET_DIM_ONE_SRC) &
+	       ip_set_netmask(h->netmask);
+	if (e.ip == 0)
+		return -EINVAL;
+
+	return hash_ip4_adt(h, &e, adt);
+}
+
+static int
+hash_ip4_uadt(struct ip_set *set, struct nlattr *tb[],
+	      enum ipset_adt adt, u32 flags)
+{
+	struct hash_ip *h = set->data;
+	struct hash_ip4_elem e;
+	u32 ip, ip_to, hosts;
+	int ret = 0;
+
+	if (unlikely(!tb[IPSET_ATTR_IP]))
+		return -IPSET_ERR_PROTOCOL;
+	if (tb[IPSET_ATTR_TIMEOUT])
+		return -IPSET_ERR_TIMEOUT;
+
+	ret = ip_set_get_hostipaddr4(tb[IPSET_ATTR_IP], &ip);
+	if (ret)
+		return ret;
+	ip &= ip_set_hostmask(h->netmask);
+
+	if (adt == IPSET_TEST) {
+		e.ip = htonl(ip);
+		if (e.ip == 0)
+			return -IPSET_ERR_HASH_ELEM;
+		return hash_ip4_adt(h, &e, adt);
+	}
+
+	if (tb[IPSET_ATTR_IP_TO]) {
+		ret = ip_set_get_hostipaddr4(tb[IPSET_ATTR_IP_TO], &ip_to);
+		if (ret)
+			return ret;
+		if (ip > ip_to)
+			swap(ip, ip_to);
+	} else if (tb[IPSET_ATTR_CIDR]) {
+		u8 cidr = nla_get_u8(tb[IPSET_ATTR_CIDR]);
+
+		if (!cidr || cidr > 32)
+			return -IPSET_ERR_INVALID_CIDR;
+		ip &= ip_set_hostmask(cidr);
+		ip_to = ip | ~ip_set_hostmask(cidr);
+	} else
+		ip_to = ip;
+
+	hosts = h->netmask == 32 ? 1 : 2 << (32 - h->netmask - 1);
+
+	for (;;) {
+		e.ip = htonl(ip);
+		if (e.ip == 0)
+			return -IPSET_ERR_HASH_ELEM;
+		ret = hash_ip4_adt(h, &e, adt);
+		if (ret && !ip_set_eexist(ret, flags))
+			return ret;
+		else
+			ret = 0;
+		/* Don't wrap around at 255.255.255.255 */
+		if (ip_to - ip < hosts)
+			break;
+		ip += hosts;
+	}
+	return ret;
+}
+
+static int
+hash_ip4_resize(struct ip_set *set)
+{
+	struct hash_ip *h = set->data;
+
+	return ip_set_hash_resize(&h->hash);
+}
+
+static void
+hash_ip4_destroy(struct ip_set *set)
+{
+	struct hash_ip *h = set->data;
+
+	ip_set_hash_destroy(&h->hash);
+	kfree(h);
+	set->data = NULL;
+}
+
+static void
+hash_ip4_flush(struct ip_set *set)
+{
+	struct hash_ip *h = set->data;
+
+	ip_set_hash_flush(&h->hash);
+}
+
+static int
+hash_ip4_head(struct ip_set *set, struct sk_buff *skb)
+{
+	const struct hash_ip *h = set->data;
+	struct nlattr *nested;
+
+	nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
+	if (!nested)
+		goto nla_put_failure;
+	if (ip_set_hash_head(&h->hash, skb))
+		goto nla_put_failure;
+	NLA_PUT_NET32(skb, IPSET_ATTR_REFERENCES, htonl(set->ref - 1));
+	if (h->netmask != 32)
+		NLA_PUT_U8(skb, IPSET_ATTR_NETMASK, h->netmask);
+	ipset_nest_end(skb, nested);
+
+	return 0;
+nla_put_failure:
+	return -EMSGSIZE;
+}
+
+static int
+hash_ip4_fill(struct sk_buff *skb, const void *key)
+{
+	const struct hash_ip4_elem *e = key;
+
+	NLA_PUT_IPADDR4(skb, IPSET_ATTR_IP, e->ip);
+	return 0;
+
+nla_put_failure:
+	return -EMSGSIZE;
+}
+
+static int
+hash_ip4_list(const struct ip_set *set, struct sk_buff *skb,
+	      struct netlink_callback *cb)
+{
+	const struct hash_ip *h = set->data;
+
+	return ip_set_hash_list(&h->hash, skb, cb, hash_ip4_fill);
+}
+
+static bool
+hash_ip4_same_set(const struct ip_set *a, const struct ip_set *b)
+{
+	const struct hash_ip *x = a->data;
+	const struct hash_ip *y = b->data;
+
+	return x->hash.maxelem == y->hash.maxelem &&
+	       x->netmask == y->netmask;
+}
+
+static const struct ip_set_type_variant hash_ip4_variant = {
+	.kadt	= hash_ip4_kadt,
+	.uadt	= hash_ip4_uadt,
+	.resize	= hash_ip4_resize,
+	.destroy = hash_ip4_destroy,
+	.flush	= hash_ip4_flush,
+	.head	= hash_ip4_head,
+	.list	= hash_ip4_list,
+	.same_set = hash_ip4_same_set,
+};
+
+static int
+hash_ip_create(struct ip_set *set, struct nlattr *tb[], u32 flags)
+{
+	u32 hashsize = IPSET_DEFAULT_HASHSIZE, maxelem = IPSET_DEFAULT_MAXELEM;
+	u8 netmask = 32;
+	struct hash_ip *h;
+	int ret;
+
+	if (set->family != NFPROTO_IPV4)
+		return -IPSET_ERR_INVALID_FAMILY;
+
+	/* The chained table grows on its own, probes and resize
+	 * steps do not apply to it.
+	 */
+	if (unlikely(!ip_set_optattr_netorder(tb, IPSET_ATTR_HASHSIZE) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_MAXELEM) ||
+		     tb[IPSET_ATTR_PROBES] || tb[IPSET_ATTR_RESIZE]))
+		return -IPSET_ERR_PROTOCOL;
+	if (tb[IPSET_ATTR_TIMEOUT])
+		return -IPSET_ERR_TIMEOUT;
+
+	if (tb[IPSET_ATTR_HASHSIZE])
+		hashsize = ip_set_get_h32(tb[IPSET_ATTR_HASHSIZE]);
+
+	if (tb[IPSET_ATTR_MAXELEM])
+		maxelem = ip_set_get_h32(tb[IPSET_ATTR_MAXELEM]);
+
+	if (tb[IPSET_ATTR_NETMASK]) {
+		netmask = nla_get_u8(tb[IPSET_ATTR_NETMASK]);
+
+		if (netmask > 32 || netmask == 0)
+			return -IPSET_ERR_INVALID_NETMASK;
+	}
+
+	h = kzalloc(sizeof(*h), GFP_KERNEL);
+	if (!h)
+		return -ENOMEM;
+
+	ret = ip_set_hash_init(&h->hash, hashsize, maxelem,
+			       sizeof(struct hash_ip4_elem));
+	if (ret) {
+		kfree(h);
+		return ret;
+	}
+	h->netmask = netmask;
+
+	set->data = h;
+	set->variant = &hash_ip4_variant;
+
+	return 0;
+}
+
+static struct ip_set_type hash_ip_type __read_mostly = {
+	.name		= "hash:ip",
+	.protocol	= IPSET_PROTOCOL,
+	.features	= IPSET_TYPE_IP,
+	.dimension	= IPSET_DIM_ONE,
+	.family		= NFPROTO_IPV4,
+	.revision	= 0,
+	.create		= hash_ip_create,
+	.create_policy	= {
+		[IPSET_ATTR_HASHSIZE]	= { .type = NLA_U32 },
+		[IPSET_ATTR_MAXELEM]	= { .type = NLA_U32 },
+		[IPSET_ATTR_PROBES]	= { .type = NLA_U8 },
+		[IPSET_ATTR_RESIZE]	= { .type = NLA_U8  },
+		[IPSET_ATTR_TIMEOUT]	= { .type = NLA_U32 },
+		[IPSET_ATTR_NETMASK]	= { .type = NLA_U8  },
+	},
+	.adt_policy	= {
+		[IPSET_ATTR_IP]		= { .type = NLA_NESTED },
+		[IPSET_ATTR_IP_TO]	= { .type = NLA_NESTED },
+		[IPSET_ATTR_CIDR]	= { .type = NLA_U8 },
+		[IPSET_ATTR_TIMEOUT]	= { .type = NLA_U32 },
+		[IPSET_ATTR_LINENO]	= { .type = NLA_U32 },
+	},
+	.me		= THIS_MODULE,
+};
+
+static int __init
+hash_ip_init(void)
+{
+	return ip_set_type_register(&hash_ip_type);
+}
+
+static void __exit
+hash_ip_fini(void)
+{
+	ip_set_type_unregister(&hash_ip_type);
+}
+
+module_init(hash_ip_init);
+module_exit(hash_ip_fini);
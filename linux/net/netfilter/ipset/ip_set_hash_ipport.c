@@ -0,0 +1,334 @@
+/* Copyright (C) 2003-2011 Jozsef Kadlecsik <kadlec@blackhole.kfki.hu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* Kernel module implementing an IP set type: the hash:ip,port type */
+
+#include <linux/module.h>
+#include <linux/ip.h>
+#include <linux/skbuff.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/netlink.h>
+#include <net/netlink.h>
+
+#include <linux/netfilter.h>
+#include <linux/netfilter/ipset/ip_set.h>
+#include <linux/netfilter/ipset/ip_set_hash.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Jozsef Kadlecsik <kadlec@blackhole.kfki.hu>");
+MODULE_DESCRIPTION("hash:ip,port type of IP sets");
+MODULE_ALIAS("ip_set_hash:ip,port");
+
+/* Member elements */
+struct hash_ipport4_elem {
+	__be32 ip;
+	__be16 port;
+	u8 proto;
+	u8 padding;
+};
+
+/* The hash:ip,port set */
+struct hash_ipport {
+	struct ip_set_hash hash;	/* generic hash, must be first */
+};
+
+static inline bool
+with_ports(u8 proto)
+{
+	return proto == IPPROTO_TCP || proto == IPPROTO_UDP ||
+	       proto == IPPROTO_UDPLITE;
+}
+
+static int
+hash_ipport4_adt(struct hash_ipport *h, const struct hash_ipport4_elem *e,
+		 enum ipset_adt adt)
+{
+	switch (adt) {
+	case IPSET_TEST:
+		return ip_set_hash_test(&h->hash, e);
+	case IPSET_ADD:
+		return ip_set_hash_add(&h->hash, e);
+	case IPSET_DEL:
+		return ip_set_hash_del(&h->hash, e);
+	default:
+		return -EINVAL;
+	}
+}
+
+static int
+hash_ipport4_kadt(struct ip_set *set, const struct sk_buff *skb,
+		  enum ipset_adt adt, u8 pf, u8 dim, u8 flags)
+{
+	struct hash_ipport *h = set->data;
+	struct hash_ipport4_elem e = { };
+
+	if (!ip_set_get_ip4_port(skb, flags & IPSET_DIM_TWO_SRC,
+				 &e.port, &e.proto))
+		return -EINVAL;
+
+	e.ip = ip4addr(skb, flags & IPSET_DIM_ONE_SRC);
+
+	return hash_ipport4_adt(h, &e, adt);
+}
+
+static int
+hash_ipport4_uadt(struct ip_set *set, struct nlattr *tb[],
+		  enum ipset_adt adt, u32 flags)
+{
+	struct hash_ipport *h = set->data;
+	struct hash_ipport4_elem e = { };
+	u32 ip, ip_to, p, port, port_to;
+	int ret;
+
+	if (unlikely(!tb[IPSET_ATTR_IP] ||
+		     !ip_set_attr_netorder(tb, IPSET_ATTR_PORT) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_PORT_TO)))
+		return -IPSET_ERR_PROTOCOL;
+	if (tb[IPSET_ATTR_TIMEOUT])
+		return -IPSET_ERR_TIMEOUT;
+
+	ret = ip_set_get_hostipaddr4(tb[IPSET_ATTR_IP], &ip);
+	if (ret)
+		return ret;
+
+	e.port = nla_get_be16(tb[IPSET_ATTR_PORT]);
+
+	if (tb[IPSET_ATTR_PROTO]) {
+		e.proto = nla_get_u8(tb[IPSET_ATTR_PROTO]);
+
+		if (e.proto == 0)
+			return -IPSET_ERR_INVALID_PROTO;
+	} else
+		return -IPSET_ERR_MISSING_PROTO;
+
+	if (!with_ports(e.proto))
+		e.port = 0;
+
+	if (adt == IPSET_TEST ||
+	    !(tb[IPSET_ATTR_IP_TO] || tb[IPSET_ATTR_CIDR] ||
+	      tb[IPSET_ATTR_PORT_TO])) {
+		e.ip = htonl(ip);
+		ret = hash_ipport4_adt(h, &e, adt);
+		return ip_set_eexist(ret, flags) ? 0 : ret;
+	}
+
+	if (tb[IPSET_ATTR_IP_TO]) {
+		ret = ip_set_get_hostipaddr4(tb[IPSET_ATTR_IP_TO], &ip_to);
+		if (ret)
+			return ret;
+		if (ip > ip_to)
+			swap(ip, ip_to);
+	} else if (tb[IPSET_ATTR_CIDR]) {
+		u8 cidr = nla_get_u8(tb[IPSET_ATTR_CIDR]);
+
+		if (!cidr || cidr > 32)
+			return -IPSET_ERR_INVALID_CIDR;
+		ip &= ip_set_hostmask(cidr);
+		ip_to = ip | ~ip_set_hostmask(cidr);
+	} else
+		ip_to = ip;
+
+	port_to = port = ntohs(e.port);
+	if (with_ports(e.proto) && tb[IPSET_ATTR_PORT_TO]) {
+		port_to = ip_set_get_h16(tb[IPSET_ATTR_PORT_TO]);
+		if (port > port_to)
+			swap(port, port_to);
+	}
+
+	for (;;) {
+		e.ip = htonl(ip);
+		for (p = port; p <= port_to; p++) {
+			e.port = htons(p);
+			ret = hash_ipport4_adt(h, &e, adt);
+
+			if (ret && !ip_set_eexist(ret, flags))
+				return ret;
+			else
+				ret = 0;
+		}
+		if (ip == ip_to)
+			break;
+		ip++;
+	}
+	return ret;
+}
+
+static int
+hash_ipport4_resize(struct ip_set *set)
+{
+	struct hash_ipport *h = set->data;
+
+	return ip_set_hash_resize(&h->hash);
+}
+
+static void
+hash_ipport4_destroy(struct ip_set *set)
+{
+	struct hash_ipport *h = set->data;
+
+	ip_set_hash_destroy(&h->hash);
+	kfree(h);
+	set->data = NULL;
+}
+
+static void
+hash_ipport4_flush(struct ip_set *set)
+{
+	struct hash_ipport *h = set->data;
+
+	ip_set_hash_flush(&h->hash);
+}
+
+static int
+hash_ipport4_head(struct ip_set *set, struct sk_buff *skb)
+{
+	const struct hash_ipport *h = set->data;
+	struct nlattr *nested;
+
+	nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
+	if (!nested)
+		goto nla_put_failure;
+	if (ip_set_hash_head(&h->hash, skb))
+		goto nla_put_failure;
+	NLA_PUT_NET32(skb, IPSET_ATTR_REFERENCES, htonl(set->ref - 1));
+	ipset_nest_end(skb, nested);
+
+	return 0;
+nla_put_failure:
+	return -EMSGSIZE;
+}
+
+static int
+hash_ipport4_fill(struct sk_buff *skb, const void *key)
+{
+	const struct hash_ipport4_elem *e = key;
+
+	NLA_PUT_IPADDR4(skb, IPSET_ATTR_IP, e->ip);
+	NLA_PUT_NET16(skb, IPSET_ATTR_PORT, e->port);
+	NLA_PUT_U8(skb, IPSET_ATTR_PROTO, e->proto);
+	return 0;
+
+nla_put_failure:
+	return -EMSGSIZE;
+}
+
+static int
+hash_ipport4_list(const struct ip_set *set, struct sk_buff *skb,
+		  struct netlink_callback *cb)
+{
+	const struct hash_ipport *h = set->data;
+
+	return ip_set_hash_list(&h->hash, skb, cb, hash_ipport4_fill);
+}
+
+static bool
+hash_ipport4_same_set(const struct ip_set *a, const struct ip_set *b)
+{
+	const struct hash_ipport *x = a->data;
+	const struct hash_ipport *y = b->data;
+
+	return x->hash.maxelem == y->hash.maxelem;
+}
+
+static const struct ip_set_type_variant hash_ipport4_variant = {
+	.kadt	= hash_ipport4_kadt,
+	.uadt	= hash_ipport4_uadt,
+	.resize	= hash_ipport4_resize,
+	.destroy = hash_ipport4_destroy,
+	.flush	= hash_ipport4_flush,
+	.head	= hash_ipport4_head,
+	.list	= hash_ipport4_list,
+	.same_set = hash_ipport4_same_set,
+};
+
+static int
+hash_ipport_create(struct ip_set *set, struct nlattr *tb[], u32 flags)
+{
+	u32 hashsize = IPSET_DEFAULT_HASHSIZE, maxelem = IPSET_DEFAULT_MAXELEM;
+	struct hash_ipport *h;
+	int ret;
+
+	if (set->family != NFPROTO_IPV4)
+		return -IPSET_ERR_INVALID_FAMILY;
+
+	/* The chained table grows on its own, probes and resize
+	 * steps do not apply to it.
+	 */
+	if (unlikely(!ip_set_optattr_netorder(tb, IPSET_ATTR_HASHSIZE) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_MAXELEM) ||
+		     tb[IPSET_ATTR_PROBES] || tb[IPSET_ATTR_RESIZE]))
+		return -IPSET_ERR_PROTOCOL;
+	if (tb[IPSET_ATTR_TIMEOUT])
+		return -IPSET_ERR_TIMEOUT;
+
+	if (tb[IPSET_ATTR_HASHSIZE])
+		hashsize = ip_set_get_h32(tb[IPSET_ATTR_HASHSIZE]);
+
+	if (tb[IPSET_ATTR_MAXELEM])
+		maxelem = ip_set_get_h32(tb[IPSET_ATTR_MAXELEM]);
+
+	h = kzalloc(sizeof(*h), GFP_KERNEL);
+	if (!h)
+		return -ENOMEM;
+
+	ret = ip_set_hash_init(&h->hash, hashsize, maxelem,
+			       sizeof(struct hash_ipport4_elem));
+	if (ret) {
+		kfree(h);
+		return ret;
+	}
+
+	set->data = h;
+	set->variant = &hash_ipport4_variant;
+
+	return 0;
+}
+
+static struct ip_set_type hash_ipport_type __read_mostly = {
+	.name		= "hash:ip,port",
+	.protocol	= IPSET_PROTOCOL,
+	.features	= IPSET_TYPE_IP | IPSET_TYPE_PORT,
+	.dimension	= IPSET_DIM_TWO,
+	.family		= NFPROTO_IPV4,
+	.revision	= 0,
+	.create		= hash_ipport_create,
+	.create_policy	= {
+		[IPSET_ATTR_HASHSIZE]	= { .type = NLA_U32 },
+		[IPSET_ATTR_MAXELEM]	= { .type = NLA_U32 },
+		[IPSET_ATTR_PROBES]	= { .type = NLA_U8 },
+		[IPSET_ATTR_RESIZE]	= { .type = NLA_U8  },
+		[IPSET_ATTR_PROTO]	= { .type = NLA_U8 },
+		[IPSET_ATTR_TIMEOUT]	= { .type = NLA_U32 },
+	},
+	.adt_policy	= {
+		[IPSET_ATTR_IP]		= { .type = NLA_NESTED },
+		[IPSET_ATTR_IP_TO]	= { .type = NLA_NESTED },
+		[IPSET_ATTR_CIDR]	= { .type = NLA_U8 },
+		[IPSET_ATTR_PORT]	= { .type = NLA_U16 },
+		[IPSET_ATTR_PORT_TO]	= { .type = NLA_U16 },
+		[IPSET_ATTR_PROTO]	= { .type = NLA_U8 },
+		[IPSET_ATTR_TIMEOUT]	= { .type = NLA_U32 },
+		[IPSET_ATTR_LINENO]	= { .type = NLA_U32 },
+	},
+	.me		= THIS_MODULE,
+};
+
+static int __init
+hash_ipport_init(void)
+{
+	return ip_set_type_register(&hash_ipport_type);
+}
+
+static void __exit
+hash_ipport_fini(void)
+{
+	ip_set_type_unregister(&hash_ipport_type);
+}
+
+module_init(hash_ipport_init);
+module_exit(hash_ipport_fini);
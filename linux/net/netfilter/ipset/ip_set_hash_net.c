@@ -0,0 +1,325 @@
+/* Copyright (C) 2003-2011 Jozsef Kadlecsik <kadlec@blackhole.kfki.hu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* Kernel module implementing an IP set type: the hash:net type */
+
+#include <linux/module.h>
+#include <linux/ip.h>
+#include <linux/skbuff.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/netlink.h>
+#include <net/netlink.h>
+
+#include <linux/netfilter.h>
+#include <linux/netfilter/ipset/ip_set.h>
+#include <linux/netfilter/ipset/ip_set_hash.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Jozsef Kadlecsik <kadlec@blackhole.kfki.hu>");
+MODULE_DESCRIPTION("hash:net type of IP sets");
+MODULE_ALIAS("ip_set_hash:net");
+
+#define HOST_MASK	32
+
+/* Member elements: the network address, masked, and its prefix length */
+struct hash_net4_elem {
+	__be32 ip;
+	u8 cidr;
+	u8 padding[3];
+};
+
+/* The hash:net set. Networks of different sizes hash to different
+ * buckets, so a packet is looked up once for every prefix length
+ * present in the set, from the most specific one.
+ */
+struct hash_net {
+	struct ip_set_hash hash;	/* generic hash, must be first */
+	atomic_t nets[HOST_MASK + 1];	/* elements per prefix length */
+};
+
+static inline void
+hash_net4_elem_init(struct hash_net4_elem *e, __be32 ip, u8 cidr)
+{
+	e->ip = ip & ip_set_netmask(cidr);
+	e->cidr = cidr;
+	memset(e->padding, 0, sizeof(e->padding));
+}
+
+/* Caller holds rcu_read_lock() */
+static int
+hash_net4_test_cidrs(struct hash_net *h, __be32 ip)
+{
+	struct hash_net4_elem e;
+	int cidr;
+
+	for (cidr = HOST_MASK; cidr > 0; cidr--) {
+		if (!atomic_read(&h->nets[cidr]))
+			continue;
+		hash_net4_elem_init(&e, ip, cidr);
+		if (ip_set_hash_test(&h->hash, &e))
+			return 1;
+	}
+	return 0;
+}
+
+static int
+hash_net4_adt(struct hash_net *h, const struct hash_net4_elem *e,
+	      enum ipset_adt adt)
+{
+	int ret;
+
+	switch (adt) {
+	case IPSET_TEST:
+		if (e->cidr == HOST_MASK)
+			return hash_net4_test_cidrs(h, e->ip);
+		return ip_set_hash_test(&h->hash, e);
+	case IPSET_ADD:
+		/* Count the prefix before the element becomes visible */
+		spin_lock_bh(&h->hash.lock);
+		atomic_inc(&h->nets[e->cidr]);
+		ret = __ip_set_hash_add(&h->hash, e);
+		if (ret)
+			atomic_dec(&h->nets[e->cidr]);
+		spin_unlock_bh(&h->hash.lock);
+		return ret;
+	case IPSET_DEL:
+		spin_lock_bh(&h->hash.lock);
+		ret = __ip_set_hash_del(&h->hash, e);
+		if (!ret)
+			atomic_dec(&h->nets[e->cidr]);
+		spin_unlock_bh(&h->hash.lock);
+		return ret;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int
+hash_net4_kadt(struct ip_set *set, const struct sk_buff *skb,
+	       enum ipset_adt adt, u8 pf, u8 dim, u8 flags)
+{
+	struct hash_net *h = set->data;
+	struct hash_net4_elem e;
+
+	/* Packets can be added/deleted as host entries only */
+	hash_net4_elem_init(&e, ip4addr(skb, flags & IPSET_DIM_ONE_SRC),
+			    HOST_MASK);
+	if (e.ip == 0)
+		return -EINVAL;
+
+	return hash_net4_adt(h, &e, adt);
+}
+
+static int
+hash_net4_uadt(struct ip_set *set, struct nlattr *tb[],
+	       enum ipset_adt adt, u32 flags)
+{
+	struct hash_net *h = set->data;
+	struct hash_net4_elem e;
+	u8 cidr = HOST_MASK;
+	__be32 ip;
+	int ret;
+
+	if (unlikely(!tb[IPSET_ATTR_IP]))
+		return -IPSET_ERR_PROTOCOL;
+	if (tb[IPSET_ATTR_TIMEOUT])
+		return -IPSET_ERR_TIMEOUT;
+
+	ret = ip_set_get_ipaddr4(tb[IPSET_ATTR_IP], &ip);
+	if (ret)
+		return ret;
+
+	if (tb[IPSET_ATTR_CIDR]) {
+		cidr = nla_get_u8(tb[IPSET_ATTR_CIDR]);
+		if (!cidr || cidr > HOST_MASK)
+			return -IPSET_ERR_INVALID_CIDR;
+	}
+
+	hash_net4_elem_init(&e, ip, cidr);
+	if (e.ip == 0)
+		return -IPSET_ERR_HASH_ELEM;
+
+	ret = hash_net4_adt(h, &e, adt);
+
+	return ip_set_eexist(ret, flags) ? 0 : ret;
+}
+
+static int
+hash_net4_resize(struct ip_set *set)
+{
+	struct hash_net *h = set->data;
+
+	return ip_set_hash_resize(&h->hash);
+}
+
+static void
+hash_net4_destroy(struct ip_set *set)
+{
+	struct hash_net *h = set->data;
+
+	ip_set_hash_destroy(&h->hash);
+	kfree(h);
+	set->data = NULL;
+}
+
+static void
+hash_net4_flush(struct ip_set *set)
+{
+	struct hash_net *h = set->data;
+	int i;
+
+	/* Adds and deletes update nets[] under the same lock */
+	spin_lock_bh(&h->hash.lock);
+	__ip_set_hash_flush(&h->hash);
+	for (i = 0; i <= HOST_MASK; i++)
+		atomic_set(&h->nets[i], 0);
+	spin_unlock_bh(&h->hash.lock);
+}
+
+static int
+hash_net4_head(struct ip_set *set, struct sk_buff *skb)
+{
+	const struct hash_net *h = set->data;
+	struct nlattr *nested;
+
+	nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
+	if (!nested)
+		goto nla_put_failure;
+	if (ip_set_hash_head(&h->hash, skb))
+		goto nla_put_failure;
+	NLA_PUT_NET32(skb, IPSET_ATTR_REFERENCES, htonl(set->ref - 1));
+	ipset_nest_end(skb, nested);
+
+	return 0;
+nla_put_failure:
+	return -EMSGSIZE;
+}
+
+static int
+hash_net4_fill(struct sk_buff *skb, const void *key)
+{
+	const struct hash_net4_elem *e = key;
+
+	NLA_PUT_IPADDR4(skb, IPSET_ATTR_IP, e->ip);
+	NLA_PUT_U8(skb, IPSET_ATTR_CIDR, e->cidr);
+	return 0;
+
+nla_put_failure:
+	return -EMSGSIZE;
+}
+
+static int
+hash_net4_list(const struct ip_set *set, struct sk_buff *skb,
+	       struct netlink_callback *cb)
+{
+	const struct hash_net *h = set->data;
+
+	return ip_set_hash_list(&h->hash, skb, cb, hash_net4_fill);
+}
+
+static bool
+hash_net4_same_set(const struct ip_set *a, const struct ip_set *b)
+{
+	const struct hash_net *x = a->data;
+	const struct hash_net *y = b->data;
+
+	return x->hash.maxelem == y->hash.maxelem;
+}
+
+static const struct ip_set_type_variant hash_net4_variant = {
+	.kadt	= hash_net4_kadt,
+	.uadt	= hash_net4_uadt,
+	.resize	= hash_net4_resize,
+	.destroy = hash_net4_destroy,
+	.flush	= hash_net4_flush,
+	.head	= hash_net4_head,
+	.list	= hash_net4_list,
+	.same_set = hash_net4_same_set,
+};
+
+static int
+hash_net_create(struct ip_set *set, struct nlattr *tb[], u32 flags)
+{
+	u32 hashsize = IPSET_DEFAULT_HASHSIZE, maxelem = IPSET_DEFAULT_MAXELEM;
+	struct hash_net *h;
+	int ret;
+
+	if (set->family != NFPROTO_IPV4)
+		return -IPSET_ERR_INVALID_FAMILY;
+
+	/* The chained table grows on its own, probes and resize
+	 * steps do not apply to it.
+	 */
+	if (unlikely(!ip_set_optattr_netorder(tb, IPSET_ATTR_HASHSIZE) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_MAXELEM) ||
+		     tb[IPSET_ATTR_PROBES] || tb[IPSET_ATTR_RESIZE]))
+		return -IPSET_ERR_PROTOCOL;
+	if (tb[IPSET_ATTR_TIMEOUT])
+		return -IPSET_ERR_TIMEOUT;
+
+	if (tb[IPSET_ATTR_HASHSIZE])
+		hashsize = ip_set_get_h32(tb[IPSET_ATTR_HASHSIZE]);
+
+	if (tb[IPSET_ATTR_MAXELEM])
+		maxelem = ip_set_get_h32(tb[IPSET_ATTR_MAXELEM]);
+
+	h = kzalloc(sizeof(*h), GFP_KERNEL);
+	if (!h)
+		return -ENOMEM;
+
+	ret = ip_set_hash_init(&h->hash, hashsize, maxelem,
+			       sizeof(struct hash_net4_elem));
+	if (ret) {
+		kfree(h);
+		return ret;
+	}
+
+	set->data = h;
+	set->variant = &hash_net4_variant;
+
+	return 0;
+}
+
+static struct ip_set_type hash_net_type __read_mostly = {
+	.name		= "hash:net",
+	.protocol	= IPSET_PROTOCOL,
+	.features	= IPSET_TYPE_IP,
+	.dimension	= IPSET_DIM_ONE,
+	.family		= NFPROTO_IPV4,
+	.revision	= 0,
+	.create		= hash_net_create,
+	.create_policy	= {
+		[IPSET_ATTR_HASHSIZE]	= { .type = NLA_U32 },
+		[IPSET_ATTR_MAXELEM]	= { .type = NLA_U32 },
+		[IPSET_ATTR_PROBES]	= { .type = NLA_U8 },
+		[IPSET_ATTR_RESIZE]	= { .type = NLA_U8  },
+		[IPSET_ATTR_TIMEOUT]	= { .type = NLA_U32 },
+	},
+	.adt_policy	= {
+		[IPSET_ATTR_IP]		= { .type = NLA_NESTED },
+		[IPSET_ATTR_CIDR]	= { .type = NLA_U8 },
+		[IPSET_ATTR_TIMEOUT]	= { .type = NLA_U32 },
+		[IPSET_ATTR_LINENO]	= { .type = NLA_U32 },
+	},
+	.me		= THIS_MODULE,
+};
+
+static int __init
+hash_net_init(void)
+{
+	return ip_set_type_register(&hash_net_type);
+}
+
+static void __exit
+hash_net_fini(void)
+{
+	ip_set_type_unregister(&hash_net_type);
+}
+
+module_init(hash_net_init);
+module_exit(hash_net_fini);
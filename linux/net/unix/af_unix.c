@@ -114,6 +114,7 @@
 #include <linux/mount.h>
 #include <net/checksum.h>
 #include <linux/security.h>
+#include <linux/splice.h>
 
 static struct hlist_head unix_socket_table[UNIX_HASH_SIZE + 1];
 static DEFINE_SPINLOCK(unix_table_lock);
@@ -349,6 +350,12 @@ static void unix_sock_destructor(struct sock *sk)
 
 	skb_queue_purge(&sk->sk_receive_queue);
 
+	/* Left over from copying linear data in splice_read */
+	if (sk->sk_sndmsg_page) {
+		__free_page(sk->sk_sndmsg_page);
+		sk->sk_sndmsg_page = NULL;
+	}
+
 	WARN_ON(atomic_read(&sk->sk_wmem_alloc));
 	WARN_ON(!sk_unhashed(sk));
 	WARN_ON(sk->sk_socket);
@@ -493,6 +500,11 @@ static int unix_ioctl(struct socket *, unsigned int, unsigned long);
 static int unix_shutdown(struct socket *, int);
 static int unix_stream_sendmsg(struct kiocb *, struct socket *,
 			       struct msghdr *, size_t);
+static ssize_t unix_stream_sendpage(struct socket *, struct page *, int offset,
+				    size_t size, int flags);
+static ssize_t unix_stream_splice_read(struct socket *, loff_t *ppos,
+				       struct pipe_inode_info *, size_t size,
+				       unsigned int flags);
 static int unix_stream_recvmsg(struct kiocb *, struct socket *,
 			       struct msghdr *, size_t, int);
 static int unix_dgram_sendmsg(struct kiocb *, struct socket *,
@@ -522,7 +534,8 @@ static const struct proto_ops unix_stream_ops = {
 	.sendmsg =	unix_stream_sendmsg,
 	.recvmsg =	unix_stream_recvmsg,
 	.mmap =		sock_no_mmap,
-	.sendpage =	sock_no_sendpage,
+	.sendpage =	unix_stream_sendpage,
+	.splice_read =	unix_stream_splice_read,
 };
 
 static const struct proto_ops unix_dgram_ops = {
@@ -1611,6 +1624,102 @@ out_err:
 	return sent ? : err;
 }
 
+static int unix_skb_append_page(struct sk_buff *skb, struct page *page,
+				int offset, size_t size)
+{
+	int i = skb_shinfo(skb)->nr_frags;
+
+	if (skb_can_coalesce(skb, i, page, offset)) {
+		skb_shinfo(skb)->frags[i - 1].size += size;
+	} else if (i < MAX_SKB_FRAGS) {
+		get_page(page);
+		skb_fill_page_desc(skb, i, page, offset, size);
+	} else {
+		return -EMSGSIZE;
+	}
+
+	skb->len += size;
+	skb->data_len += size;
+	skb->truesize += size;
+	return 0;
+}
+
+/*
+ * Queue a page reference on the peer without copying it. The page is
+ * appended to the last skb in the receive queue when that one came from
+ * us with the same credentials and carries no descriptors, so a stream
+ * of small sendpage calls does not turn into a stream of skbs.
+ */
+static ssize_t unix_stream_sendpage(struct socket *socket, struct page *page,
+				    int offset, size_t size, int flags)
+{
+	struct sock *sk = socket->sk;
+	struct sock *other;
+	struct sk_buff *skb, *newskb = NULL;
+	struct ucred creds;
+	int err;
+
+	if (flags & MSG_OOB)
+		return -EOPNOTSUPP;
+
+	other = unix_peer(sk);
+	if (!other)
+		return -ENOTCONN;
+
+	creds.pid = task_tgid_vnr(current);
+	creds.uid = current_uid();
+	creds.gid = current_gid();
+
+	if (false) {
+alloc_skb:
+		spin_unlock(&other->sk_receive_queue.lock);
+		unix_state_unlock(other);
+		newskb = sock_alloc_send_pskb(sk, 0, 0, flags & MSG_DONTWAIT,
+					      &err);
+		if (!newskb)
+			return err;
+		memcpy(UNIXCREDS(newskb), &creds, sizeof(creds));
+	}
+
+	if (sk->sk_shutdown & SEND_SHUTDOWN)
+		goto pipe_err;
+
+	unix_state_lock(other);
+	if (sock_flag(other, SOCK_DEAD) ||
+	    (other->sk_shutdown & RCV_SHUTDOWN)) {
+		unix_state_unlock(other);
+		goto pipe_err;
+	}
+
+	spin_lock(&other->sk_receive_queue.lock);
+	skb = skb_peek_tail(&other->sk_receive_queue);
+	if (skb && skb->sk == sk && !UNIXCB(skb).fp &&
+	    !memcmp(UNIXCREDS(skb), &creds, sizeof(creds)) &&
+	    !unix_skb_append_page(skb, page, offset, size)) {
+		if (newskb) {
+			kfree_skb(newskb);
+			newskb = NULL;
+		}
+	} else {
+		if (!newskb)
+			goto alloc_skb;
+		unix_skb_append_page(newskb, page, offset, size);
+		__skb_queue_tail(&other->sk_receive_queue, newskb);
+	}
+	atomic_add(size, &sk->sk_wmem_alloc);
+	spin_unlock(&other->sk_receive_queue.lock);
+	unix_state_unlock(other);
+
+	other->sk_data_ready(other, size);
+	return size;
+
+pipe_err:
+	kfree_skb(newskb);
+	if (!(flags & MSG_NOSIGNAL))
+		send_sig(SIGPIPE, current, 0);
+	return -EPIPE;
+}
+
 static int unix_seqpacket_sendmsg(struct kiocb *kiocb, struct socket *sock,
 				  struct msghdr *msg, size_t len)
 {
@@ -1758,15 +1867,31 @@ static long unix_stream_data_wait(struct sock *sk, long timeo)
 
 
 
-static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
-			       struct msghdr *msg, size_t size,
-			       int flags)
+static unsigned int unix_skb_len(const struct sk_buff *skb)
 {
-	struct sock_iocb *siocb = kiocb_to_siocb(iocb);
-	struct scm_cookie tmp_scm;
+	return skb->len - UNIXCB(skb).consumed;
+}
+
+struct unix_stream_read_state {
+	int (*recv_actor)(struct sk_buff *, int,
+			  struct unix_stream_read_state *);
+	struct socket *socket;
+	struct msghdr *msg;
+	struct pipe_inode_info *pipe;
+	size_t size;
+	int flags;
+	unsigned int splice_flags;
+};
+
+static int unix_stream_read_generic(struct unix_stream_read_state *state,
+				    struct scm_cookie *scm)
+{
+	struct socket *sock = state->socket;
 	struct sock *sk = sock->sk;
 	struct unix_sock *u = unix_sk(sk);
-	struct sockaddr_un *sunaddr = msg->msg_name;
+	struct sockaddr_un *sunaddr = state->msg ? state->msg->msg_name : NULL;
+	int flags = state->flags;
+	size_t size = state->size;
 	int copied = 0;
 	int check_creds = 0;
 	int target;
@@ -1784,17 +1909,10 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 	target = sock_rcvlowat(sk, flags&MSG_WAITALL, size);
 	timeo = sock_rcvtimeo(sk, flags&MSG_DONTWAIT);
 
-	msg->msg_namelen = 0;
-
 	/* Lock the socket to prevent queue disordering
 	 * while sleeps in memcpy_tomsg
 	 */
 
-	if (!siocb->scm) {
-		siocb->scm = &tmp_scm;
-		memset(&tmp_scm, 0, sizeof(tmp_scm));
-	}
-
 	mutex_lock(&u->readlock);
 
 	do {
@@ -1839,28 +1957,29 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 
 		if (check_creds) {
 			/* Never glue messages from different writers */
-			if (memcmp(UNIXCREDS(skb), &siocb->scm->creds,
-				   sizeof(siocb->scm->creds)) != 0) {
+			if (memcmp(UNIXCREDS(skb), &scm->creds,
+				   sizeof(scm->creds)) != 0) {
 				skb_queue_head(&sk->sk_receive_queue, skb);
 				break;
 			}
 		} else {
 			/* Copy credentials */
-			siocb->scm->creds = *UNIXCREDS(skb);
+			scm->creds = *UNIXCREDS(skb);
 			check_creds = 1;
 		}
 
 		/* Copy address just once */
 		if (sunaddr) {
-			unix_copy_addr(msg, skb->sk);
+			unix_copy_addr(state->msg, skb->sk);
 			sunaddr = NULL;
 		}
 
-		chunk = min_t(unsigned int, skb->len, size);
-		if (memcpy_toiovec(msg->msg_iov, skb->data, chunk)) {
+		chunk = min_t(unsigned int, unix_skb_len(skb), size);
+		chunk = state->recv_actor(skb, chunk, state);
+		if (chunk < 0) {
 			skb_queue_head(&sk->sk_receive_queue, skb);
 			if (copied == 0)
-				copied = -EFAULT;
+				copied = chunk;
 			break;
 		}
 		copied += chunk;
@@ -1868,26 +1987,26 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 
 		/* Mark read part of skb as used */
 		if (!(flags & MSG_PEEK)) {
-			skb_pull(skb, chunk);
+			UNIXCB(skb).consumed += chunk;
 
 			if (UNIXCB(skb).fp)
-				unix_detach_fds(siocb->scm, skb);
+				unix_detach_fds(scm, skb);
 
 			/* put the skb back if we didn't use it up.. */
-			if (skb->len) {
+			if (unix_skb_len(skb)) {
 				skb_queue_head(&sk->sk_receive_queue, skb);
 				break;
 			}
 
 			kfree_skb(skb);
 
-			if (siocb->scm->fp)
+			if (scm->fp)
 				break;
 		} else {
 			/* It is questionable, see note in unix_dgram_recvmsg.
 			 */
 			if (UNIXCB(skb).fp)
-				siocb->scm->fp = scm_fp_dup(UNIXCB(skb).fp);
+				scm->fp = scm_fp_dup(UNIXCB(skb).fp);
 
 			/* put message back and return */
 			skb_queue_head(&sk->sk_receive_queue, skb);
@@ -1896,11 +2015,94 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 	} while (size);
 
 	mutex_unlock(&u->readlock);
-	scm_recv(sock, msg, siocb->scm, flags);
+	if (state->msg)
+		scm_recv(sock, state->msg, scm, flags);
+	else
+		scm_destroy(scm);
 out:
 	return copied ? : err;
 }
 
+static int unix_stream_read_actor(struct sk_buff *skb, int chunk,
+				  struct unix_stream_read_state *state)
+{
+	int ret;
+
+	ret = skb_copy_datagram_iovec(skb, UNIXCB(skb).consumed,
+				      state->msg->msg_iov, chunk);
+	return ret ? -EFAULT : chunk;
+}
+
+static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
+			       struct msghdr *msg, size_t size,
+			       int flags)
+{
+	struct sock_iocb *siocb = kiocb_to_siocb(iocb);
+	struct scm_cookie tmp_scm;
+	struct unix_stream_read_state state = {
+		.recv_actor = unix_stream_read_actor,
+		.socket = sock,
+		.msg = msg,
+		.size = size,
+		.flags = flags
+	};
+
+	msg->msg_namelen = 0;
+
+	if (!siocb->scm) {
+		siocb->scm = &tmp_scm;
+		memset(&tmp_scm, 0, sizeof(tmp_scm));
+	}
+
+	return unix_stream_read_generic(&state, siocb->scm);
+}
+
+static ssize_t unix_stream_splice_cb(struct sock *sk,
+				     struct pipe_inode_info *pipe,
+				     struct splice_pipe_desc *spd)
+{
+	/* Only u->readlock is held here, which no pipe lock holder takes. */
+	return splice_to_pipe(pipe, spd);
+}
+
+static int unix_stream_splice_actor(struct sk_buff *skb, int chunk,
+				    struct unix_stream_read_state *state)
+{
+	return skb_splice_bits(skb, state->socket->sk, UNIXCB(skb).consumed,
+			       state->pipe, chunk, state->splice_flags,
+			       unix_stream_splice_cb);
+}
+
+/*
+ * Move data from the receive queue into a pipe. Pages that came in
+ * through sendpage are passed on by reference, only data written with
+ * sendmsg is copied once. File descriptors cannot travel through a
+ * pipe and are dropped, as are the credentials.
+ */
+static ssize_t unix_stream_splice_read(struct socket *sock, loff_t *ppos,
+				       struct pipe_inode_info *pipe,
+				       size_t size, unsigned int flags)
+{
+	struct scm_cookie scm;
+	struct unix_stream_read_state state = {
+		.recv_actor = unix_stream_splice_actor,
+		.socket = sock,
+		.pipe = pipe,
+		.size = size,
+		.splice_flags = flags,
+	};
+
+	if (unlikely(*ppos))
+		return -ESPIPE;
+
+	if (sock->file->f_flags & O_NONBLOCK ||
+	    flags & SPLICE_F_NONBLOCK)
+		state.flags = MSG_DONTWAIT;
+
+	memset(&scm, 0, sizeof(scm));
+	return unix_stream_read_generic(&state, &scm);
+}
+
 static int unix_shutdown(struct socket *sock, int mode)
 {
 	struct sock *sk = sock->sk;
@@ -1967,7 +2169,7 @@ static int unix_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg)
 			if (sk->sk_type == SOCK_STREAM ||
 			    sk->sk_type == SOCK_SEQPACKET) {
 				skb_queue_walk(&sk->sk_receive_queue, skb)
-					amount += skb->len;
+					amount += unix_skb_len(skb);
 			} else {
 				skb = skb_peek(&sk->sk_receive_queue);
 				if (skb)